@@ -7,6 +7,10 @@ set -e
 
 SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
 APPIMAGE_SCRIPTS_DIR="${SCRIPT_DIR}/appimage/scripts"
+# SkSL warm-up set bundled into release builds; see record-shaders.
+SKSL_BUNDLE="${SCRIPT_DIR}/linux/shaders/bizsync.sksl.json"
+# Profile-guided optimized build of the native code; set by --pgo.
+RELEASE_PGO=false
 
 # Colors for output
 GREEN='\033[0;32m'
@@ -78,12 +82,56 @@ show_system_info() {
     echo ""
 }
 
+# Function to record the SkSL warm-up set from a scripted profile run
+record_shaders() {
+    local target="${1:-integration_test/shader_warmup_test.dart}"
+    local driver="test_driver/integration_test.dart"
+
+    for file in "$target" "$driver"; do
+        if [ ! -f "$file" ]; then
+            log_error "Missing $file"
+            log_info "The target should open invoices, inventory and reports the way users do"
+            return 1
+        fi
+    done
+
+    mkdir -p "$(dirname "$SKSL_BUNDLE")"
+    log_build "Recording shaders with $target..."
+    flutter drive --profile -d linux --cache-sksl --purge-persistent-cache \
+        --driver "$driver" --target "$target" \
+        --write-sksl-on-exit "$SKSL_BUNDLE"
+    log_build "SkSL warm-up set written to $SKSL_BUNDLE"
+    log_info "Commit it so release AppImages bundle it"
+}
+
 # Function to perform full build
 full_build() {
     local sign_appimage="${1:-true}"
     
     log_build "Starting full AppImage build process..."
     
+    # The inner build scripts pass this to flutter build --bundle-sksl-path
+    if [ -f "$SKSL_BUNDLE" ]; then
+        log_build "Bundling SkSL warm-up set: $SKSL_BUNDLE"
+        export BIZSYNC_SKSL_BUNDLE="$SKSL_BUNDLE"
+    else
+        log_warn "No SkSL warm-up set; run '$0 record-shaders' to record one"
+    fi
+    
+    # Train and build the Release-PGO bundle first; the inner build scripts
+    # keep its flags because flutter build reads BIZSYNC_PGO from the
+    # environment
+    if [ "$RELEASE_PGO" = true ]; then
+        local sksl_args=()
+        if [ -f "$SKSL_BUNDLE" ]; then
+            sksl_args=(--bundle-sksl-path "$SKSL_BUNDLE")
+        fi
+        log_build "Building Release-PGO bundle..."
+        "${SCRIPT_DIR}/build-release-pgo.sh" "${sksl_args[@]}"
+        export BIZSYNC_PGO=use
+        export BIZSYNC_PGO_DIR="${BIZSYNC_PGO_DIR:-${XDG_CACHE_HOME:-$HOME/.cache}/bizsync/pgo}"
+    fi
+    
     # Check dependencies first
     log_build "Step 1/6: Checking dependencies..."
     "${APPIMAGE_SCRIPTS_DIR}/build-appimage.sh" --deps-only
@@ -228,6 +276,7 @@ COMMANDS:
     quick-build     Quick build for testing
     sign-only       Sign existing AppImage
     verify          Verify existing AppImage
+    record-shaders  Record the SkSL warm-up set bundled into builds
     clean           Clean build artifacts
     setup-dev       Setup development environment
     version         Show version information
@@ -238,13 +287,19 @@ OPTIONS:
     --clean         Clean previous builds
     --verbose       Enable verbose output
     --dev           Development mode
+    --sksl FILE     SkSL warm-up set to bundle or record
+                    (default: linux/shaders/bizsync.sksl.json)
+    --pgo           Release-PGO build: train the native code on the
+                    benchmark scenarios and rebuild it with the profile
 
 EXAMPLES:
     $0                           # Full production build
     $0 build --clean             # Clean build
+    $0 build --pgo               # Profile-guided optimized build
     $0 dev-build                 # Development build
     $0 sign-only BizSync.AppImage # Sign specific file
     $0 verify BizSync.AppImage   # Verify specific file
+    $0 record-shaders            # Record with integration_test/shader_warmup_test.dart
 
 SCRIPTS:
     appimage/scripts/build-appimage.sh     - Main build script
@@ -304,6 +359,14 @@ main() {
                 skip_signing=true
                 shift
                 ;;
+            --sksl)
+                SKSL_BUNDLE="$(realpath -m "$2")"
+                shift 2
+                ;;
+            --pgo)
+                RELEASE_PGO=true
+                shift
+                ;;
             *)
                 # Unknown option, might be file for sign-only/verify
                 break
@@ -367,6 +430,9 @@ main() {
         "setup-dev")
             setup_dev_environment
             ;;
+        "record-shaders")
+            record_shaders "$1"
+            ;;
         "version")
             "${APPIMAGE_SCRIPTS_DIR}/version-manager.sh" info
             ;;
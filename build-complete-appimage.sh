@@ -20,6 +20,8 @@ APPDIR="${APPIMAGE_DIR}/AppDir"
 BUILD_DIR="${APPIMAGE_DIR}/build"
 FLUTTER_BUILD_DIR="${PROJECT_ROOT}/build/linux/x64/release/bundle"
 SCRIPTS_DIR="${APPIMAGE_DIR}/scripts"
+# Profile-guided optimized build of the native code; set by --pgo
+RELEASE_PGO=false
 
 # Colors for output
 GREEN='\033[0;32m'
@@ -147,8 +149,23 @@ build_flutter_app() {
     # Get Flutter dependencies
     flutter pub get
     
-    # Build the application
-    flutter build linux --release --verbose
+    # Bundle the SkSL warm-up set recorded by build-appimage.sh record-shaders
+    local sksl_bundle="${BIZSYNC_SKSL_BUNDLE:-${PROJECT_ROOT}/linux/shaders/bizsync.sksl.json}"
+    local sksl_args=()
+    if [ -f "$sksl_bundle" ]; then
+        log_info "Bundling SkSL warm-up set: $sksl_bundle"
+        sksl_args=(--bundle-sksl-path "$sksl_bundle")
+    fi
+    
+    # Build the application; Release-PGO trains and rebuilds it
+    if [ "$RELEASE_PGO" = true ]; then
+        log_info "Building Release-PGO bundle"
+        "${PROJECT_ROOT}/build-release-pgo.sh" --verbose "${sksl_args[@]}"
+    else
+        # Keeps the optimized flags if build-appimage.sh --pgo already built
+        # with BIZSYNC_PGO=use exported
+        flutter build linux --release --verbose "${sksl_args[@]}"
+    fi
     
     # Verify build success
     if [ ! -d "${FLUTTER_BUILD_DIR}" ]; then
@@ -525,12 +542,17 @@ main() {
                 skip_tests=true
                 shift
                 ;;
+            --pgo)
+                RELEASE_PGO=true
+                shift
+                ;;
             --help)
                 echo "Usage: $0 [options]"
                 echo ""
                 echo "Options:"
                 echo "  --clean       Clean previous builds"
                 echo "  --skip-tests  Skip AppImage testing"
+                echo "  --pgo         Release-PGO build (see build-release-pgo.sh)"
                 echo "  --help        Show this help"
                 echo ""
                 exit 0
@@ -0,0 +1,163 @@
+#!/bin/bash
+
+# BizSync Release-PGO Build Script
+# Builds the Linux release bundle in three stages:
+#   1. an instrumented build (BIZSYNC_PGO=generate),
+#   2. a training run of the benchmark suite against it: the macro scenarios
+#      on the bizsync_datagen datasets, then the engine microbenchmarks; the
+#      runner, libbizsync_native.so and bizsync_bench must each write a profile,
+#   3. an optimized rebuild from the merged profile (BIZSYNC_PGO=use).
+# The optimized bundle is left in build/linux/x64/release/bundle, where
+# `flutter build linux --release` puts it. See "Release-PGO" in
+# linux/CMakeLists.txt for the compiler and linker flags.
+#
+# Needs clang, lld, llvm-profdata and Google Benchmark (libbenchmark-dev).
+# Without a display the scenarios run under xvfb-run.
+#
+# Usage: ./build-release-pgo.sh [flutter build linux options...]
+#
+# Environment:
+#   BIZSYNC_PGO_DIR  profiles (default: ~/.cache/bizsync/pgo)
+#   PGO_RUNS         launches per dataset (default: 2)
+#   PGO_DURATION     seconds per launch (default: 15)
+
+set -e
+
+PROJECT_ROOT="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+RELEASE_BUILD_DIR="${PROJECT_ROOT}/build/linux/x64/release"
+FLUTTER_BUILD_DIR="${RELEASE_BUILD_DIR}/bundle"
+# Outside build/, which flutter clean removes.
+export BIZSYNC_PGO_DIR="${BIZSYNC_PGO_DIR:-${XDG_CACHE_HOME:-$HOME/.cache}/bizsync/pgo}"
+DATASETS_DIR="${BIZSYNC_PGO_DIR}/datasets"
+PGO_RUNS="${PGO_RUNS:-2}"
+PGO_DURATION="${PGO_DURATION:-15}"
+
+# Colors for output
+GREEN='\033[0;32m'
+BLUE='\033[0;34m'
+RED='\033[0;31m'
+NC='\033[0m'
+
+log_info() {
+    echo -e "${GREEN}[INFO]${NC} $1"
+}
+
+log_build() {
+    echo -e "${BLUE}[PGO]${NC} $1"
+}
+
+log_error() {
+    echo -e "${RED}[ERROR]${NC} $1"
+}
+
+# Function to locate llvm-profdata matching the compiler
+find_profdata() {
+    local profdata="${LLVM_PROFDATA:-$(${CXX:-clang++} -print-prog-name=llvm-profdata 2>/dev/null)}"
+    if ! command -v "$profdata" >/dev/null 2>&1; then
+        profdata="llvm-profdata"
+    fi
+    if ! command -v "$profdata" >/dev/null 2>&1; then
+        log_error "llvm-profdata not found; set LLVM_PROFDATA"
+        return 1
+    fi
+    echo "$profdata"
+}
+
+# Function to run a command with a display
+with_display() {
+    if [ -n "$DISPLAY" ] || [ -n "$WAYLAND_DISPLAY" ]; then
+        "$@"
+    elif command -v xvfb-run >/dev/null 2>&1; then
+        xvfb-run -a -s "-screen 0 1920x1080x24" "$@"
+    else
+        log_error "No display for the training run; install xvfb-run"
+        return 1
+    fi
+}
+
+# Function to build the instrumented bundle and benchmark tools
+build_instrumented() {
+    log_build "Stage 1/3: Instrumented build..."
+    rm -rf "${BIZSYNC_PGO_DIR}"
+    mkdir -p "${BIZSYNC_PGO_DIR}"
+
+    BIZSYNC_PGO=generate flutter build linux --release "$@"
+    cmake --build "${RELEASE_BUILD_DIR}" --target bizsync_bench
+}
+
+# Function to run the training scenarios
+train() {
+    log_build "Stage 2/3: Training run..."
+    # Datagen links the instrumented library; its bulk inserts are not a
+    # scenario, so their counters are discarded.
+    LLVM_PROFILE_FILE=/dev/null \
+        "${RELEASE_BUILD_DIR}/datagen/bizsync_datagen" --suite "${DATASETS_DIR}"
+
+    with_display "${RELEASE_BUILD_DIR}/bench/bizsync_bench" macro \
+        --bundle "${FLUTTER_BUILD_DIR}" --datasets "${DATASETS_DIR}" \
+        --runs "${PGO_RUNS}" --duration "${PGO_DURATION}" \
+        --out "${BIZSYNC_PGO_DIR}/macro.json"
+    "${RELEASE_BUILD_DIR}/bench/bizsync_bench" \
+        --benchmark_out="${BIZSYNC_PGO_DIR}/micro.json" \
+        --benchmark_out_format=json >/dev/null
+
+    # The datasets are large and not needed by the optimized build.
+    rm -rf "${DATASETS_DIR}"
+
+    local profdata
+    profdata="$(find_profdata)"
+    shopt -s nullglob
+    local profiles=("${BIZSYNC_PGO_DIR}"/*.profraw)
+    shopt -u nullglob
+    if [ ${#profiles[@]} -eq 0 ]; then
+        log_error "The training run wrote no profiles to ${BIZSYNC_PGO_DIR}"
+        return 1
+    fi
+    "$profdata" merge -o "${BIZSYNC_PGO_DIR}/bizsync.profdata" "${profiles[@]}"
+    rm -f "${profiles[@]}"
+    log_info "Merged ${#profiles[@]} profiles into ${BIZSYNC_PGO_DIR}/bizsync.profdata"
+    check_profile "$profdata"
+}
+
+# Function to check that every instrumented binary wrote a profile. The raw
+# files are named by module signature, so look for one function from each.
+check_profile() {
+    local functions
+    functions="$("$1" show --all-functions "${BIZSYNC_PGO_DIR}/bizsync.profdata")"
+    local binary
+    for binary in "bizsync:my_application_activate" \
+                  "libbizsync_native.so:bizsync_db_open" \
+                  "bizsync_bench:macro_harness_main"; do
+        if ! grep -q "${binary#*:}" <<<"$functions"; then
+            log_error "The training run wrote no profile for ${binary%%:*}"
+            return 1
+        fi
+    done
+}
+
+# Function to rebuild with the profile
+build_optimized() {
+    log_build "Stage 3/3: Optimized build..."
+    BIZSYNC_PGO=use flutter build linux --release "$@"
+
+    if [ ! -f "${FLUTTER_BUILD_DIR}/bizsync" ]; then
+        log_error "Optimized build failed - executable not found"
+        return 1
+    fi
+    log_info "Release-PGO bundle: ${FLUTTER_BUILD_DIR}"
+    log_info "Training reports: ${BIZSYNC_PGO_DIR}/macro.json, micro.json"
+}
+
+main() {
+    cd "${PROJECT_ROOT}"
+    if [ ! -f "pubspec.yaml" ]; then
+        log_error "pubspec.yaml not found in ${PROJECT_ROOT}"
+        exit 1
+    fi
+
+    build_instrumented "$@"
+    train
+    build_optimized "$@"
+}
+
+main "$@"
@@ -0,0 +1,20 @@
+#include <benchmark/benchmark.h>
+#include <string.h>
+
+#include "macro_harness.h"
+
+// `bizsync_bench macro ...` runs the launch harness; anything else goes to
+// Google Benchmark, e.g. --benchmark_filter=Csv --benchmark_out=micro.json
+// --benchmark_out_format=json.
+int main(int argc, char** argv) {
+  if (argc > 1 && strcmp(argv[1], "macro") == 0) {
+    return macro_harness_main(argc - 2, argv + 2);
+  }
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 2;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
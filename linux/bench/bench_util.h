@@ -0,0 +1,36 @@
+#ifndef BIZSYNC_BENCH_BENCH_UTIL_H_
+#define BIZSYNC_BENCH_BENCH_UTIL_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "temp_dir.h"
+
+namespace bizsync {
+
+// Deterministic xorshift64* numbers, so every run measures the same data.
+class BenchRandom {
+ public:
+  explicit BenchRandom(uint64_t seed) : state_(seed != 0 ? seed : 1) {}
+
+  uint64_t Next() {
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    return state_ * 0x2545f4914f6cdd1dULL;
+  }
+
+  // Uniform in [0, bound).
+  uint64_t Below(uint64_t bound) { return Next() % bound; }
+
+ private:
+  uint64_t state_;
+};
+
+}  // namespace bizsync
+
+#endif  // BIZSYNC_BENCH_BENCH_UTIL_H_
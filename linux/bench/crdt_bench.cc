@@ -0,0 +1,78 @@
+#include <benchmark/benchmark.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <future>
+
+#include "bench_util.h"
+#include "crdt.h"
+
+static const char* kFields[] = {"name", "email", "phone", "total_cents"};
+static const int64_t kLocalNode = 1;
+static const int64_t kRemoteNode = 2;
+
+// An operation log of |operations| field writes by |node| over |rows|
+// customers, every fourth one a tag added to a set.
+static void fill_log(bizsync::PackedRowWriter* log, int64_t operations,
+                     int64_t rows, int64_t node, uint64_t seed) {
+  bizsync::BenchRandom random(seed);
+  uint64_t hlc = static_cast<uint64_t>(1700000000000ULL) << 16;
+  char text[32];
+  for (int64_t i = 0; i < operations; i++) {
+    hlc += 1 + random.Below(1 << 16);
+    bool tag = i % 4 == 3;
+    log->AppendInt64(tag ? BIZSYNC_CRDT_ADD : BIZSYNC_CRDT_SET);
+    log->AppendText("customers", 9);
+    int length = snprintf(text, sizeof(text), "c%llu",
+                          static_cast<unsigned long long>(random.Below(rows)));
+    log->AppendText(text, length);
+    const char* field = tag ? "tags" : kFields[random.Below(4)];
+    log->AppendText(field, strlen(field));
+    log->AppendInt64(static_cast<int64_t>(hlc));
+    log->AppendInt64(node);
+    length = snprintf(text, sizeof(text), "value-%llu",
+                      static_cast<unsigned long long>(random.Below(100)));
+    log->AppendText(text, length);
+    log->EndRow();
+  }
+}
+
+static void merge_done_cb(void* user_data, int32_t status) {
+  static_cast<std::promise<int32_t>*>(user_data)->set_value(status);
+}
+
+// Merges two logs of range(0) operations each, written by two devices
+// editing the same customers while offline.
+static void BM_CrdtMerge(benchmark::State& state) {
+  int64_t operations = state.range(0);
+  int64_t rows = operations / 8 + 1;
+  bizsync::PackedRowWriter local(7);
+  bizsync::PackedRowWriter remote(7);
+  fill_log(&local, operations, rows, kLocalNode, 1);
+  fill_log(&remote, operations, rows, kRemoteNode, 2);
+
+  int64_t changes = 0;
+  for (auto _ : state) {
+    std::promise<int32_t> done;
+    BizsyncCrdtMerge* merge = nullptr;
+    if (bizsync_crdt_merge_start(local.data(), local.size(), remote.data(),
+                                 remote.size(), merge_done_cb, &done,
+                                 &merge) != BIZSYNC_OK) {
+      state.SkipWithError(bizsync_last_error());
+      break;
+    }
+    BizsyncCrdtResult result;
+    if (done.get_future().get() != BIZSYNC_OK ||
+        bizsync_crdt_merge_get_result(merge, &result) != BIZSYNC_OK) {
+      state.SkipWithError(bizsync_last_error());
+      bizsync_crdt_merge_free(merge);
+      break;
+    }
+    changes = result.change_count;
+    bizsync_crdt_merge_free(merge);
+  }
+  state.SetItemsProcessed(state.iterations() * operations * 2);
+  state.counters["changes"] = static_cast<double>(changes);
+}
+BENCHMARK(BM_CrdtMerge)->Arg(1000)->Arg(100000)->Arg(1000000)
+    ->Unit(benchmark::kMillisecond)->UseRealTime();
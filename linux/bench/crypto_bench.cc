@@ -0,0 +1,96 @@
+#include <benchmark/benchmark.h>
+#include <string.h>
+
+#include <vector>
+
+#include "crypto.h"
+
+static const uint8_t kKey[BIZSYNC_AEAD_KEY_SIZE] = {1, 2, 3, 4, 5, 6, 7, 8};
+static const uint8_t kSalt[16] = {9, 8, 7, 6, 5, 4, 3, 2};
+static const char* kPassword = "correct horse battery staple";
+
+// Seals range(1) bytes with algorithm range(0), as a field or a backup
+// chunk would be.
+static void BM_AeadSeal(benchmark::State& state) {
+  int32_t algorithm = static_cast<int32_t>(state.range(0));
+  size_t length = static_cast<size_t>(state.range(1));
+  std::vector<uint8_t> data(length, 0x5a);
+  std::vector<uint8_t> sealed(length + BIZSYNC_AEAD_OVERHEAD);
+  for (auto _ : state) {
+    if (bizsync_aead_seal(algorithm, kKey, nullptr, 0, data.data(), length,
+                          sealed.data()) != BIZSYNC_OK) {
+      state.SkipWithError(bizsync_last_error());
+      break;
+    }
+    benchmark::DoNotOptimize(sealed.data());
+  }
+  state.SetBytesProcessed(state.iterations() * length);
+  state.SetLabel(algorithm == BIZSYNC_AEAD_AES_256_GCM ? "aes-256-gcm"
+                                                       : "chacha20-poly1305");
+}
+BENCHMARK(BM_AeadSeal)
+    ->ArgsProduct({{BIZSYNC_AEAD_AES_256_GCM, BIZSYNC_AEAD_CHACHA20_POLY1305},
+                   {64, 4096, 1 << 20}});
+
+static void BM_AeadOpen(benchmark::State& state) {
+  int32_t algorithm = static_cast<int32_t>(state.range(0));
+  size_t length = static_cast<size_t>(state.range(1));
+  std::vector<uint8_t> data(length, 0x5a);
+  std::vector<uint8_t> sealed(length + BIZSYNC_AEAD_OVERHEAD);
+  if (bizsync_aead_seal(algorithm, kKey, nullptr, 0, data.data(), length,
+                        sealed.data()) != BIZSYNC_OK) {
+    state.SkipWithError(bizsync_last_error());
+    return;
+  }
+  for (auto _ : state) {
+    if (bizsync_aead_open(algorithm, kKey, nullptr, 0, sealed.data(),
+                          sealed.size(), data.data()) != BIZSYNC_OK) {
+      state.SkipWithError(bizsync_last_error());
+      break;
+    }
+    benchmark::DoNotOptimize(data.data());
+  }
+  state.SetBytesProcessed(state.iterations() * length);
+}
+BENCHMARK(BM_AeadOpen)
+    ->ArgsProduct({{BIZSYNC_AEAD_AES_256_GCM, BIZSYNC_AEAD_CHACHA20_POLY1305},
+                   {64, 4096, 1 << 20}});
+
+static void BM_Sha256(benchmark::State& state) {
+  std::vector<uint8_t> data(static_cast<size_t>(state.range(0)), 0xa5);
+  uint8_t digest[BIZSYNC_SHA256_SIZE];
+  for (auto _ : state) {
+    bizsync_sha256(data.data(), data.size(), digest);
+    benchmark::DoNotOptimize(digest);
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_Sha256)->Arg(4096)->Arg(1 << 20);
+
+static void BM_Pbkdf2Sha256(benchmark::State& state) {
+  uint8_t key[BIZSYNC_AEAD_KEY_SIZE];
+  for (auto _ : state) {
+    if (bizsync_pbkdf2_sha256(reinterpret_cast<const uint8_t*>(kPassword),
+                              strlen(kPassword), kSalt, sizeof(kSalt),
+                              static_cast<uint32_t>(state.range(0)), key,
+                              sizeof(key)) != BIZSYNC_OK) {
+      state.SkipWithError(bizsync_last_error());
+      break;
+    }
+  }
+}
+BENCHMARK(BM_Pbkdf2Sha256)->Arg(600000)->Unit(benchmark::kMillisecond);
+
+// The default Argon2id cost, which sets how long unlocking a backup takes.
+static void BM_Argon2id(benchmark::State& state) {
+  uint8_t key[BIZSYNC_AEAD_KEY_SIZE];
+  for (auto _ : state) {
+    if (bizsync_argon2id(reinterpret_cast<const uint8_t*>(kPassword),
+                         strlen(kPassword), kSalt, sizeof(kSalt), nullptr, key,
+                         sizeof(key)) != BIZSYNC_OK) {
+      state.SkipWithError(bizsync_last_error());
+      break;
+    }
+  }
+}
+BENCHMARK(BM_Argon2id)->Unit(benchmark::kMillisecond)->UseRealTime();
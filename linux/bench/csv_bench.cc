@@ -0,0 +1,104 @@
+#include <benchmark/benchmark.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include <atomic>
+
+#include "bench_util.h"
+#include "csv_import.h"
+
+static const char* kSchema =
+    "CREATE TABLE customers (uen TEXT, name TEXT, address TEXT,"
+    " credit_limit_cents INTEGER, gst_rate REAL)";
+static const char* kInsert =
+    "INSERT INTO customers (uen, name, address, credit_limit_cents, gst_rate)"
+    " VALUES (?, ?, ?, ?, ?)";
+static const int32_t kColumnTypes[] = {
+    BIZSYNC_VALUE_TEXT, BIZSYNC_VALUE_TEXT, BIZSYNC_VALUE_TEXT,
+    BIZSYNC_VALUE_INT64, BIZSYNC_VALUE_FLOAT64,
+};
+
+// Writes a header and |rows| customer records, a tenth of them with quoted
+// addresses that contain the delimiter.
+static bool write_csv(const std::string& path, int64_t rows) {
+  FILE* file = fopen(path.c_str(), "w");
+  if (file == nullptr) {
+    return false;
+  }
+  bizsync::BenchRandom random(7);
+  fprintf(file, "uen,name,address,credit_limit_cents,gst_rate\n");
+  for (int64_t i = 0; i < rows; i++) {
+    fprintf(file, "2019%05lldK,Trading Company %lld Pte Ltd,",
+            static_cast<long long>(i), static_cast<long long>(i));
+    if (random.Below(10) == 0) {
+      fprintf(file, "\"%llu Ubi Avenue 1, #05-%02llu\",",
+              static_cast<unsigned long long>(random.Below(1000)),
+              static_cast<unsigned long long>(random.Below(40)));
+    } else {
+      fprintf(file, "%llu Jurong West Street 42,",
+              static_cast<unsigned long long>(random.Below(1000)));
+    }
+    fprintf(file, "%llu,0.09\n",
+            static_cast<unsigned long long>(random.Below(10000000)));
+  }
+  return fclose(file) == 0;
+}
+
+static void import_done_cb(void* user_data, int32_t status,
+                           int64_t rows_imported, int64_t rows_rejected) {
+  if (status != BIZSYNC_IMPORT_RUNNING) {
+    static_cast<std::atomic<int32_t>*>(user_data)->store(status);
+  }
+}
+
+// Imports a CSV file of range(0) records end to end: mmap, parallel SIMD
+// scan, field conversion and batched inserts in one transaction.
+static void BM_CsvImport(benchmark::State& state) {
+  bizsync::TempDir dir("bizsync-bench-csv");
+  std::string csv = dir.Join("customers.csv");
+  struct stat info;
+  if (!write_csv(csv, state.range(0)) || stat(csv.c_str(), &info) != 0) {
+    state.SkipWithError("cannot write the CSV file");
+    return;
+  }
+
+  BizsyncDb* db = nullptr;
+  if (bizsync_db_open(dir.Join("bench.db").c_str(), nullptr, &db) !=
+          BIZSYNC_OK ||
+      bizsync_db_execute(db, kSchema) != BIZSYNC_OK) {
+    state.SkipWithError(bizsync_last_error());
+    bizsync_db_close(db);
+    return;
+  }
+
+  BizsyncImportOptions options = {};
+  options.flags = BIZSYNC_IMPORT_HEADER;
+  options.column_types = kColumnTypes;
+  options.column_count = 5;
+  options.callback = import_done_cb;
+  std::atomic<int32_t> status{BIZSYNC_OK};
+  options.user_data = &status;
+  for (auto _ : state) {
+    BizsyncImport* job = nullptr;
+    if (bizsync_import_csv_start(db, csv.c_str(), kInsert, &options, &job) !=
+        BIZSYNC_OK) {
+      state.SkipWithError(bizsync_last_error());
+      break;
+    }
+    // Waits for the import to finish.
+    bizsync_import_free(job);
+    if (status.load() != BIZSYNC_OK) {
+      state.SkipWithError("the import failed");
+      break;
+    }
+
+    state.PauseTiming();
+    bizsync_db_execute(db, "DELETE FROM customers");
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.SetBytesProcessed(state.iterations() * info.st_size);
+  bizsync_db_close(db);
+}
+BENCHMARK(BM_CsvImport)->Arg(10000)->Arg(100000)->Arg(1000000)
+    ->Unit(benchmark::kMillisecond)->UseRealTime();
@@ -0,0 +1,115 @@
+#include <benchmark/benchmark.h>
+#include <string.h>
+
+#include "bench_util.h"
+#include "gst_rollup.h"
+
+static const char* kSchema =
+    "CREATE TABLE lines (id INTEGER PRIMARY KEY, issued_at INTEGER,"
+    " code TEXT, net_cents INTEGER, tax_cents INTEGER)";
+static const char* kInsert =
+    "INSERT INTO lines (issued_at, code, net_cents, tax_cents)"
+    " VALUES (?, ?, ?, ?)";
+static const char* kCodes[] = {"SR", "SR", "SR", "SR", "ZR", "ESN33", "TX"};
+// 2024-01-01 00:00 Singapore time.
+static const int64_t kHistoryStart = 1704038400;
+
+// Appends |rows| lines spread over two years in issue order.
+static void fill_lines(bizsync::PackedRowWriter* batch, int64_t rows,
+                       bizsync::BenchRandom* random) {
+  for (int64_t i = 0; i < rows; i++) {
+    const char* code = kCodes[random->Below(7)];
+    int64_t net = 100 + random->Below(1000000);
+    batch->AppendInt64(kHistoryStart + i * (2 * 365 * 86400 / rows));
+    batch->AppendText(code, static_cast<uint32_t>(strlen(code)));
+    batch->AppendInt64(net);
+    batch->AppendInt64(code[0] == 'S' || code[0] == 'T' ? net * 9 / 100 : 0);
+    batch->EndRow();
+  }
+}
+
+// A database of range(0) lines registered as a GST source.
+class GstFixture {
+ public:
+  explicit GstFixture(benchmark::State& state) : dir_("bizsync-bench-gst") {
+    bizsync::BenchRandom random(5);
+    bizsync::PackedRowWriter batch(4);
+    fill_lines(&batch, state.range(0), &random);
+    BizsyncGstSource source = {};
+    source.source = 1;
+    source.table = "lines";
+    source.code_column = "code";
+    source.net_column = "net_cents";
+    source.tax_column = "tax_cents";
+    source.time_column = "issued_at";
+    if (bizsync_db_open(dir_.Join("bench.db").c_str(), nullptr, &db_) !=
+            BIZSYNC_OK ||
+        bizsync_db_execute(db_, kSchema) != BIZSYNC_OK ||
+        bizsync_db_batch(db_, kInsert, batch.data(), batch.size(), nullptr) !=
+            BIZSYNC_OK ||
+        bizsync_gst_open(db_, &gst_) != BIZSYNC_OK ||
+        bizsync_gst_add_source(gst_, &source) != BIZSYNC_OK) {
+      state.SkipWithError(bizsync_last_error());
+    }
+  }
+
+  ~GstFixture() {
+    bizsync_gst_close(gst_);
+    bizsync_db_close(db_);
+  }
+
+  BizsyncDb* db() const { return db_; }
+  BizsyncGst* gst() const { return gst_; }
+
+ private:
+  bizsync::TempDir dir_;
+  BizsyncDb* db_ = nullptr;
+  BizsyncGst* gst_ = nullptr;
+};
+
+// Recomputes every rollup from range(0) lines on the worker pool.
+static void BM_GstRebuild(benchmark::State& state) {
+  GstFixture fixture(state);
+  for (auto _ : state) {
+    if (bizsync_gst_rebuild(fixture.gst(), 0) != BIZSYNC_OK) {
+      state.SkipWithError(bizsync_last_error());
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_GstRebuild)->Arg(100000)->Arg(1000000)
+    ->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// A quarterly F5 from the rollups, whatever the history size.
+static void BM_GstReturn(benchmark::State& state) {
+  GstFixture fixture(state);
+  BizsyncGstReturn result;
+  for (auto _ : state) {
+    if (bizsync_gst_return(fixture.gst(), 202501, 202503, &result) !=
+        BIZSYNC_OK) {
+      state.SkipWithError(bizsync_last_error());
+      break;
+    }
+    benchmark::DoNotOptimize(result);
+  }
+}
+BENCHMARK(BM_GstReturn)->Arg(1000000)->Unit(benchmark::kMicrosecond);
+
+// Batched inserts with the rollup triggers installed; compare with
+// BM_SqliteBatchInsert for their cost per row.
+static void BM_GstTriggeredInsert(benchmark::State& state) {
+  GstFixture fixture(state);
+  bizsync::BenchRandom random(6);
+  bizsync::PackedRowWriter batch(4);
+  fill_lines(&batch, 2048, &random);
+  for (auto _ : state) {
+    if (bizsync_db_batch(fixture.db(), kInsert, batch.data(), batch.size(),
+                         nullptr) != BIZSYNC_OK) {
+      state.SkipWithError(bizsync_last_error());
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * 2048);
+}
+BENCHMARK(BM_GstTriggeredInsert)->Arg(10000);
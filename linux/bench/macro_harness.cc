@@ -0,0 +1,336 @@
+#include "macro_harness.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "bench_util.h"
+
+static const char* kDatasets[] = {"invoices-10k", "invoices-100k",
+                                  "invoices-1m"};
+static const double kStartupTimeoutMs = 60000;
+static const double kShutdownTimeoutMs = 10000;
+static const useconds_t kPollIntervalUs = 10000;
+
+struct HarnessOptions {
+  std::string bundle = "bundle";
+  std::string datasets = "datasets";
+  int runs = 5;
+  int duration = 10;
+  std::string out;
+};
+
+struct RunResult {
+  int exit_status = -1;
+  // Negative if the first frame never arrived.
+  double first_frame_ms = -1;
+  std::string startup_trace;
+  std::string frame_stats;
+};
+
+static double now_ms() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+static bool file_exists(const std::string& path) {
+  struct stat info;
+  return stat(path.c_str(), &info) == 0;
+}
+
+static std::string read_file(const std::string& path) {
+  std::string contents;
+  FILE* file = fopen(path.c_str(), "r");
+  if (file == nullptr) {
+    return contents;
+  }
+  char buffer[65536];
+  size_t length;
+  while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    contents.append(buffer, length);
+  }
+  fclose(file);
+  return contents;
+}
+
+static bool write_file(const std::string& path, const std::string& contents) {
+  FILE* file = fopen(path.c_str(), "w");
+  if (file == nullptr) {
+    return false;
+  }
+  bool ok = fwrite(contents.data(), 1, contents.size(), file) ==
+            contents.size();
+  return fclose(file) == 0 && ok;
+}
+
+static bool copy_file(const std::string& from, const std::string& to) {
+  int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in < 0) {
+    return false;
+  }
+  int out = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (out < 0) {
+    close(in);
+    return false;
+  }
+  static char buffer[1 << 20];
+  bool ok = true;
+  ssize_t length;
+  while ((length = read(in, buffer, sizeof(buffer))) > 0) {
+    if (write(out, buffer, length) != length) {
+      ok = false;
+      break;
+    }
+  }
+  ok = ok && length == 0;
+  close(in);
+  return close(out) == 0 && ok;
+}
+
+static std::string json_string(const std::string& value) {
+  std::string out = "\"";
+  for (char c : value) {
+    switch (c) {
+      case '"':
+        out += "\\\"";
+        break;
+      case '\\':
+        out += "\\\\";
+        break;
+      case '\n':
+        out += "\\n";
+        break;
+      case '\t':
+        out += "\\t";
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char escaped[8];
+          snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+          out += escaped;
+        } else {
+          out += c;
+        }
+    }
+  }
+  return out + "\"";
+}
+
+// The dumps are already JSON; a missing or empty one becomes null.
+static std::string json_document(const std::string& contents) {
+  return contents.find_first_not_of(" \t\r\n") == std::string::npos
+             ? "null"
+             : contents;
+}
+
+// Polls |pid| until it exits or |deadline| passes. Returns true and sets
+// |status| if it exited.
+static bool wait_until(pid_t pid, double deadline, int* status) {
+  while (now_ms() < deadline) {
+    pid_t done = waitpid(pid, status, WNOHANG);
+    if (done == pid || (done < 0 && errno == ECHILD)) {
+      return true;
+    }
+    usleep(kPollIntervalUs);
+  }
+  return false;
+}
+
+static int exit_code(int status) {
+  if (WIFEXITED(status)) {
+    return WEXITSTATUS(status);
+  }
+  return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : -1;
+}
+
+// One launch of the bundle with a fresh home directory holding |dataset|.
+static bool run_once(const HarnessOptions& options, const std::string& dataset,
+                     const std::string& cache, RunResult* result) {
+  bizsync::TempDir home("bizsync-macro-home");
+  std::string documents = home.Join("Documents");
+  std::string config = home.Join(".config");
+  if (home.path().empty() || mkdir(documents.c_str(), 0755) != 0 ||
+      mkdir(config.c_str(), 0755) != 0 ||
+      !write_file(config + "/user-dirs.dirs",
+                  "XDG_DOCUMENTS_DIR=\"$HOME/Documents\"\n") ||
+      !copy_file(dataset, documents + "/bizsync.db")) {
+    fprintf(stderr, "bizsync_bench: cannot prepare a home for %s: %s\n",
+            dataset.c_str(), strerror(errno));
+    return false;
+  }
+
+  std::string binary = options.bundle + "/bizsync";
+  std::string trace = home.Join("startup-trace.json");
+  std::string frames = home.Join("frame-stats.json");
+  std::string trace_arg = "--trace-startup=" + trace;
+  std::string frames_arg = "--frame-stats=" + frames;
+  // X11 looks for its cookie under $HOME unless told otherwise.
+  const char* user_home = getenv("HOME");
+  std::string xauthority =
+      getenv("XAUTHORITY") != nullptr
+          ? getenv("XAUTHORITY")
+          : std::string(user_home != nullptr ? user_home : "") +
+                "/.Xauthority";
+
+  double start = now_ms();
+  pid_t pid = fork();
+  if (pid < 0) {
+    fprintf(stderr, "bizsync_bench: fork failed: %s\n", strerror(errno));
+    return false;
+  }
+  if (pid == 0) {
+    setenv("XAUTHORITY", xauthority.c_str(), 1);
+    setenv("HOME", home.path().c_str(), 1);
+    setenv("XDG_CONFIG_HOME", config.c_str(), 1);
+    setenv("XDG_DATA_HOME", home.Join(".local/share").c_str(), 1);
+    setenv("XDG_CACHE_HOME", cache.c_str(), 1);
+    execl(binary.c_str(), binary.c_str(), trace_arg.c_str(),
+          frames_arg.c_str(), static_cast<char*>(nullptr));
+    _exit(127);
+  }
+
+  // The runner writes the startup trace on the first frame.
+  int status = 0;
+  bool exited = false;
+  while (!exited && now_ms() - start < kStartupTimeoutMs) {
+    if (file_exists(trace)) {
+      result->first_frame_ms = now_ms() - start;
+      break;
+    }
+    exited = wait_until(pid, now_ms() + kPollIntervalUs / 1000.0, &status);
+  }
+
+  if (!exited && result->first_frame_ms >= 0) {
+    exited = wait_until(pid, now_ms() + options.duration * 1000.0, &status);
+  }
+  if (!exited) {
+    // SIGTERM goes through GApplication, which writes the frame stats.
+    kill(pid, SIGTERM);
+    if (!wait_until(pid, now_ms() + kShutdownTimeoutMs, &status)) {
+      // Nothing is written after SIGKILL, including an instrumented build's
+      // profile.
+      fprintf(stderr, "bizsync_bench: %s ignored SIGTERM; killing it\n",
+              binary.c_str());
+      kill(pid, SIGKILL);
+      waitpid(pid, &status, 0);
+    }
+  }
+  result->exit_status = exit_code(status);
+  result->startup_trace = read_file(trace);
+  result->frame_stats = read_file(frames);
+  return true;
+}
+
+static bool parse_options(int argc, char** argv, HarnessOptions* options) {
+  for (int i = 0; i < argc; i++) {
+    std::string name = argv[i];
+    if (i + 1 >= argc) {
+      fprintf(stderr, "bizsync_bench: %s needs a value\n", name.c_str());
+      return false;
+    }
+    const char* value = argv[++i];
+    if (name == "--bundle") {
+      options->bundle = value;
+    } else if (name == "--datasets") {
+      options->datasets = value;
+    } else if (name == "--runs") {
+      options->runs = atoi(value);
+    } else if (name == "--duration") {
+      options->duration = atoi(value);
+    } else if (name == "--out") {
+      options->out = value;
+    } else {
+      fprintf(stderr, "bizsync_bench: unknown option %s\n", name.c_str());
+      return false;
+    }
+  }
+  if (options->runs < 1 || options->duration < 0) {
+    fprintf(stderr, "bizsync_bench: --runs must be positive and --duration"
+                    " not negative\n");
+    return false;
+  }
+  return true;
+}
+
+int macro_harness_main(int argc, char** argv) {
+  HarnessOptions options;
+  if (!parse_options(argc, argv, &options)) {
+    return 2;
+  }
+  if (access((options.bundle + "/bizsync").c_str(), X_OK) != 0) {
+    fprintf(stderr, "bizsync_bench: no bizsync executable in %s\n",
+            options.bundle.c_str());
+    return 2;
+  }
+
+  bool ok = true;
+  std::string report = "{\"bundle\": " + json_string(options.bundle) +
+                       ", \"scenarios\": [";
+  bool first_scenario = true;
+  for (const char* name : kDatasets) {
+    std::string dataset = options.datasets + "/" + name + ".db";
+    if (!file_exists(dataset)) {
+      fprintf(stderr, "bizsync_bench: skipping %s, no %s\n", name,
+              dataset.c_str());
+      continue;
+    }
+    bizsync::TempDir cache("bizsync-macro-cache");
+    report += first_scenario ? "\n" : ",\n";
+    first_scenario = false;
+    report += "  {\"name\": " + json_string(name) +
+              ", \"dataset\": " + json_string(dataset) + ", \"runs\": [";
+    bool first_run = true;
+    for (int run = 0; run < options.runs; run++) {
+      RunResult result;
+      if (!run_once(options, dataset, cache.path(), &result)) {
+        ok = false;
+        continue;
+      }
+      if (result.first_frame_ms < 0) {
+        fprintf(stderr, "bizsync_bench: %s run %d never drew a frame\n", name,
+                run);
+        ok = false;
+      }
+      char first_frame[32];
+      snprintf(first_frame, sizeof(first_frame), "%.1f",
+               result.first_frame_ms);
+      report += first_run ? "\n" : ",\n";
+      first_run = false;
+      report += "    {\"run\": " + std::to_string(run) + ", \"cache\": " +
+                (run == 0 ? "\"cold\"" : "\"warm\"") +
+                ", \"exit_status\": " + std::to_string(result.exit_status) +
+                ", \"first_frame_wall_ms\": " +
+                (result.first_frame_ms < 0 ? "null" : first_frame) +
+                ",\n     \"startup_trace\": " +
+                json_document(result.startup_trace) +
+                ",\n     \"frame_stats\": " +
+                json_document(result.frame_stats) + "}";
+    }
+    report += "]}";
+  }
+  report += "\n]}\n";
+  if (first_scenario) {
+    fprintf(stderr, "bizsync_bench: no datasets in %s\n",
+            options.datasets.c_str());
+    ok = false;
+  }
+
+  if (options.out.empty()) {
+    fputs(report.c_str(), stdout);
+  } else if (!write_file(options.out, report)) {
+    fprintf(stderr, "bizsync_bench: cannot write %s: %s\n",
+            options.out.c_str(), strerror(errno));
+    return 1;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,29 @@
+#ifndef BIZSYNC_BENCH_MACRO_HARNESS_H_
+#define BIZSYNC_BENCH_MACRO_HARNESS_H_
+
+// Launches the installed bundle against the synthetic invoice datasets and
+// collects the runner's own startup trace (--trace-startup) and frame
+// statistics (--frame-stats) from every run into one JSON report:
+//
+//   {"bundle": "...", "scenarios": [{"name": "invoices-10k", "dataset": "...",
+//     "runs": [{"run": 0, "cache": "cold", "exit_status": 0,
+//               "first_frame_wall_ms": 812.4, "startup_trace": {...},
+//               "frame_stats": {...}}]}]}
+//
+// Each run gets a fresh $HOME whose documents directory holds a copy of the
+// dataset as bizsync.db. The shader and engine caches under $XDG_CACHE_HOME
+// are shared within a scenario, so run 0 starts cold and the rest warm.
+//
+// Options:
+//   --bundle DIR     the `flutter build linux` bundle (default: bundle)
+//   --datasets DIR   invoices-10k.db, invoices-100k.db and invoices-1m.db,
+//                    as written by `bizsync_datagen --suite DIR`; missing
+//                    files are skipped (default: datasets)
+//   --runs N         launches per dataset (default: 5)
+//   --duration S     seconds to keep each instance running (default: 10)
+//   --out FILE       report destination (default: stdout)
+//
+// Returns the process exit status.
+int macro_harness_main(int argc, char** argv);
+
+#endif  // BIZSYNC_BENCH_MACRO_HARNESS_H_
@@ -0,0 +1,125 @@
+#include <benchmark/benchmark.h>
+#include <flutter_linux/flutter_linux.h>
+#include <stdio.h>
+
+#include "bench_util.h"
+#include "packed_rows.h"
+#include "runner/invoice_renderer.h"
+
+// Invoice columns: number, customer, amount due in dollars, expiry.
+static const uint32_t kInvoiceColumns = 4;
+// Line columns: invoice row, description, quantity, amount.
+static const uint32_t kLineColumns = 4;
+static const int64_t kLinesPerInvoice = 12;
+
+static FlValue* text_element(double x, double y, double size,
+                             const gchar* text, gint64 column) {
+  FlValue* element = fl_value_new_map();
+  fl_value_set_string_take(element, "type", fl_value_new_string("text"));
+  fl_value_set_string_take(element, "x", fl_value_new_float(x));
+  fl_value_set_string_take(element, "y", fl_value_new_float(y));
+  fl_value_set_string_take(element, "size", fl_value_new_float(size));
+  fl_value_set_string_take(element, "text", fl_value_new_string(text));
+  fl_value_set_string_take(element, "column", fl_value_new_int(column));
+  return element;
+}
+
+static FlValue* table_column(double x, double width, const gchar* align,
+                             gint64 column) {
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "x", fl_value_new_float(x));
+  fl_value_set_string_take(value, "width", fl_value_new_float(width));
+  fl_value_set_string_take(value, "align", fl_value_new_string(align));
+  fl_value_set_string_take(value, "column", fl_value_new_int(column));
+  return value;
+}
+
+// A typical tax invoice: header text, a PayNow code and a line item table.
+static FlValue* invoice_template() {
+  FlValue* elements = fl_value_new_list();
+  fl_value_append_take(elements,
+                       text_element(40, 60, 18, "TAX INVOICE ", 0));
+  fl_value_append_take(elements, text_element(40, 90, 10, "Bill to: ", 1));
+  fl_value_append_take(elements, text_element(40, 760, 12, "Total S$", 2));
+
+  FlValue* paynow = fl_value_new_map();
+  fl_value_set_string_take(paynow, "type", fl_value_new_string("paynow"));
+  fl_value_set_string_take(paynow, "x", fl_value_new_float(440));
+  fl_value_set_string_take(paynow, "y", fl_value_new_float(40));
+  fl_value_set_string_take(paynow, "width", fl_value_new_float(110));
+  fl_value_set_string_take(paynow, "proxyType", fl_value_new_string("uen"));
+  fl_value_set_string_take(paynow, "proxy", fl_value_new_string("201912345K"));
+  fl_value_set_string_take(paynow, "merchantName",
+                           fl_value_new_string("BizSync Trading Pte Ltd"));
+  fl_value_set_string_take(paynow, "amountColumn", fl_value_new_int(2));
+  fl_value_set_string_take(paynow, "referenceColumn", fl_value_new_int(0));
+  fl_value_set_string_take(paynow, "expiryColumn", fl_value_new_int(3));
+  fl_value_append_take(elements, paynow);
+
+  FlValue* columns = fl_value_new_list();
+  fl_value_append_take(columns, table_column(40, 300, "left", 1));
+  fl_value_append_take(columns, table_column(350, 60, "right", 2));
+  fl_value_append_take(columns, table_column(420, 130, "right", 3));
+  FlValue* table = fl_value_new_map();
+  fl_value_set_string_take(table, "type", fl_value_new_string("table"));
+  fl_value_set_string_take(table, "y", fl_value_new_float(180));
+  fl_value_set_string_take(table, "bottom", fl_value_new_float(740));
+  fl_value_set_string_take(table, "continuedY", fl_value_new_float(60));
+  fl_value_set_string_take(table, "columns", columns);
+  fl_value_append_take(elements, table);
+
+  FlValue* layout = fl_value_new_map();
+  fl_value_set_string_take(layout, "elements", elements);
+  return layout;
+}
+
+static FlValue* packed_value(const bizsync::PackedRowWriter& rows) {
+  return fl_value_new_uint8_list(rows.data(), rows.size());
+}
+
+// Renders range(0) invoices to PDF files on one thread, the work each
+// scheduler worker does per invoice in a batch run.
+static void BM_PdfRender(benchmark::State& state) {
+  bizsync::TempDir dir("bizsync-bench-pdf");
+  int64_t count = state.range(0);
+  bizsync::BenchRandom random(11);
+  bizsync::PackedRowWriter invoices(kInvoiceColumns);
+  bizsync::PackedRowWriter lines(kLineColumns);
+  char text[64];
+  for (int64_t i = 0; i < count; i++) {
+    int length = snprintf(text, sizeof(text), "INV-%08lld",
+                          static_cast<long long>(i));
+    invoices.AppendText(text, length);
+    length = snprintf(text, sizeof(text), "Customer %llu Pte Ltd",
+                      static_cast<unsigned long long>(random.Below(5000)));
+    invoices.AppendText(text, length);
+    invoices.AppendFloat64(100 + random.Below(100000) / 100.0);
+    invoices.AppendText("20301231", 8);
+    invoices.EndRow();
+    for (int64_t j = 0; j < kLinesPerInvoice; j++) {
+      lines.AppendInt64(i);
+      length = snprintf(text, sizeof(text), "Item %lld, standard-rated",
+                        static_cast<long long>(j));
+      lines.AppendText(text, length);
+      lines.AppendInt64(1 + random.Below(20));
+      lines.AppendFloat64(random.Below(50000) / 100.0);
+      lines.EndRow();
+    }
+  }
+
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "template", invoice_template());
+  fl_value_set_string_take(args, "invoices", packed_value(invoices));
+  fl_value_set_string_take(args, "lines", packed_value(lines));
+  fl_value_set_string_take(args, "outputDirectory",
+                           fl_value_new_string(dir.path().c_str()));
+  for (auto _ : state) {
+    g_autoptr(GError) error = nullptr;
+    if (!invoice_renderer_render_sync(args, &error)) {
+      state.SkipWithError(error->message);
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_PdfRender)->Arg(1)->Arg(50)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,92 @@
+#include <benchmark/benchmark.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include "qr_code.h"
+
+// Builds the PayNow payload for an invoice numbered |invoice|.
+static size_t paynow_payload(int64_t invoice, char* out) {
+  char reference[32];
+  snprintf(reference, sizeof(reference), "INV-%08lld",
+           static_cast<long long>(invoice));
+  BizsyncPayNowRequest request = {};
+  request.proxy_type = BIZSYNC_PAYNOW_UEN;
+  request.proxy = "201912345K";
+  request.merchant_name = "BizSync Trading Pte Ltd";
+  request.reference = reference;
+  request.expiry = "20301231";
+  request.amount_cents = 10900 + invoice % 1000;
+  size_t length = 0;
+  bizsync_paynow_payload(&request, out, &length);
+  return length;
+}
+
+static void BM_PayNowPayload(benchmark::State& state) {
+  char payload[BIZSYNC_PAYNOW_PAYLOAD_MAX];
+  int64_t invoice = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(paynow_payload(invoice++, payload));
+  }
+}
+BENCHMARK(BM_PayNowPayload);
+
+// Encodes a new payload every iteration, so every lookup misses the cache.
+static void BM_QrEncodeMiss(benchmark::State& state) {
+  char payload[BIZSYNC_PAYNOW_PAYLOAD_MAX];
+  int64_t invoice = 0;
+  for (auto _ : state) {
+    size_t length = paynow_payload(invoice++, payload);
+    BizsyncQrCode* code = nullptr;
+    if (bizsync_qr_encode(reinterpret_cast<const uint8_t*>(payload), length,
+                          BIZSYNC_QR_ECC_MEDIUM, &code) != BIZSYNC_OK) {
+      state.SkipWithError(bizsync_last_error());
+      break;
+    }
+    bizsync_qr_code_free(code);
+  }
+}
+BENCHMARK(BM_QrEncodeMiss);
+
+// Encodes one payload over and over, as a batch run with the same payment
+// details does.
+static void BM_QrEncodeHit(benchmark::State& state) {
+  char payload[BIZSYNC_PAYNOW_PAYLOAD_MAX];
+  size_t length = paynow_payload(0, payload);
+  for (auto _ : state) {
+    BizsyncQrCode* code = nullptr;
+    if (bizsync_qr_encode(reinterpret_cast<const uint8_t*>(payload), length,
+                          BIZSYNC_QR_ECC_MEDIUM, &code) != BIZSYNC_OK) {
+      state.SkipWithError(bizsync_last_error());
+      break;
+    }
+    bizsync_qr_code_free(code);
+  }
+}
+BENCHMARK(BM_QrEncodeHit);
+
+// Rasterizes a symbol at range(0) pixels per module.
+static void BM_QrRasterize(benchmark::State& state) {
+  char payload[BIZSYNC_PAYNOW_PAYLOAD_MAX];
+  size_t length = paynow_payload(0, payload);
+  BizsyncQrCode* code = nullptr;
+  if (bizsync_qr_encode(reinterpret_cast<const uint8_t*>(payload), length,
+                        BIZSYNC_QR_ECC_MEDIUM, &code) != BIZSYNC_OK) {
+    state.SkipWithError(bizsync_last_error());
+    return;
+  }
+  int32_t module_pixels = static_cast<int32_t>(state.range(0));
+  size_t side = static_cast<size_t>(code->size + 2 * BIZSYNC_QR_QUIET_ZONE) *
+                module_pixels;
+  std::vector<uint8_t> bitmap(side * side);
+  for (auto _ : state) {
+    if (bizsync_qr_rasterize(code, module_pixels, BIZSYNC_QR_QUIET_ZONE,
+                             bitmap.data(), side) != BIZSYNC_OK) {
+      state.SkipWithError(bizsync_last_error());
+      break;
+    }
+    benchmark::DoNotOptimize(bitmap.data());
+  }
+  bizsync_qr_code_free(code);
+}
+BENCHMARK(BM_QrRasterize)->Arg(4)->Arg(16);
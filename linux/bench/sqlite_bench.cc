@@ -0,0 +1,67 @@
+#include <benchmark/benchmark.h>
+#include <stdio.h>
+
+#include "bench_util.h"
+#include "packed_rows.h"
+#include "sqlite_engine.h"
+
+static const char* kSchema =
+    "CREATE TABLE invoices (id INTEGER PRIMARY KEY, number TEXT NOT NULL,"
+    " customer TEXT NOT NULL, total_cents INTEGER NOT NULL,"
+    " gst_cents INTEGER NOT NULL, issued_at INTEGER NOT NULL)";
+static const char* kInsert =
+    "INSERT INTO invoices (number, customer, total_cents, gst_cents,"
+    " issued_at) VALUES (?, ?, ?, ?, ?)";
+
+// One packed batch of |rows| invoices, numbered from |first|.
+static void fill_invoices(bizsync::PackedRowWriter* batch, int64_t first,
+                          int64_t rows, bizsync::BenchRandom* random) {
+  char text[32];
+  for (int64_t i = first; i < first + rows; i++) {
+    int length = snprintf(text, sizeof(text), "INV-%08lld",
+                          static_cast<long long>(i));
+    batch->AppendText(text, length);
+    length = snprintf(text, sizeof(text), "CUST-%05llu",
+                      static_cast<unsigned long long>(random->Below(5000)));
+    batch->AppendText(text, length);
+    int64_t total = 1000 + random->Below(500000);
+    batch->AppendInt64(total);
+    batch->AppendInt64(total * 9 / 109);
+    batch->AppendInt64(1700000000 + i * 60);
+    batch->EndRow();
+  }
+}
+
+// Inserts batches of range(0) invoices through the writer connection's
+// cached statement, one transaction per batch, each into an empty table so
+// the time does not depend on the iteration count.
+static void BM_SqliteBatchInsert(benchmark::State& state) {
+  bizsync::TempDir dir("bizsync-bench-sqlite");
+  BizsyncDb* db = nullptr;
+  if (bizsync_db_open(dir.Join("bench.db").c_str(), nullptr, &db) !=
+          BIZSYNC_OK ||
+      bizsync_db_execute(db, kSchema) != BIZSYNC_OK) {
+    state.SkipWithError(bizsync_last_error());
+    bizsync_db_close(db);
+    return;
+  }
+
+  bizsync::BenchRandom random(42);
+  bizsync::PackedRowWriter batch(5);
+  fill_invoices(&batch, 0, state.range(0), &random);
+  for (auto _ : state) {
+    state.PauseTiming();
+    bizsync_db_execute(db, "DELETE FROM invoices");
+    state.ResumeTiming();
+    int64_t changes = 0;
+    if (bizsync_db_batch(db, kInsert, batch.data(), batch.size(), &changes) !=
+        BIZSYNC_OK) {
+      state.SkipWithError(bizsync_last_error());
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  bizsync_db_close(db);
+}
+BENCHMARK(BM_SqliteBatchInsert)->Arg(100)->Arg(2048)->Arg(10000)
+    ->Unit(benchmark::kMillisecond);
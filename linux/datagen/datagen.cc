@@ -0,0 +1,802 @@
+// bizsync_datagen: writes a synthetic Singapore SME database for load tests
+// and benchmarks. The same seed and scale always give the same rows, so
+// results from different machines and releases are comparable, and no
+// customer data ever needs to leave a customer's machine.
+//
+//   bizsync_datagen --invoices 100000 --seed 7 --out invoices-100k.db
+//   bizsync_datagen --suite datasets
+//
+// --suite writes the invoices-10k, -100k and -1m databases that
+// `bizsync_bench macro` expects. Every table is written through
+// bizsync_db_batch() in chunks, and the next chunk is generated while the
+// current one is inserted.
+//
+// Tables: customers (businesses with UENs, individuals with NRICs),
+// products, invoices with invoice_lines (standard-rated lines at the GST
+// rate in force on the issue date: 9% from 2024), stock_movements and
+// payments. Customers and products are drawn with a long tail, so a few
+// accounts carry most of the revenue. Each customer has a payment habit, so
+// most invoices are paid on time, some late or in part, and a few never.
+// With --crdt, customer fields are also written to crdt_ops as device
+// --node, for sync tests; generate two databases with different seeds and
+// nodes to get two diverging replicas.
+//
+// UENs follow ACRA's formats, but their check letters are random. NRICs
+// carry valid check letters and are synthetic.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "crdt.h"
+#include "packed_rows.h"
+#include "sqlite_engine.h"
+
+static const char* kSchema =
+    "CREATE TABLE dataset_info (key TEXT PRIMARY KEY, value);"
+    "CREATE TABLE customers (id INTEGER PRIMARY KEY, kind TEXT NOT NULL,"
+    " uen TEXT, nric TEXT, name TEXT NOT NULL, email TEXT, phone TEXT,"
+    " address TEXT, postal_code TEXT, gst_registered INTEGER NOT NULL,"
+    " credit_limit_cents INTEGER NOT NULL,"
+    " payment_terms_days INTEGER NOT NULL, created_at INTEGER NOT NULL);"
+    "CREATE TABLE products (id INTEGER PRIMARY KEY, sku TEXT NOT NULL,"
+    " name TEXT NOT NULL, unit_price_cents INTEGER NOT NULL,"
+    " gst_code TEXT NOT NULL);"
+    "CREATE TABLE invoices (id INTEGER PRIMARY KEY, number TEXT NOT NULL,"
+    " customer_id INTEGER NOT NULL, issued_at INTEGER NOT NULL,"
+    " due_at INTEGER NOT NULL, status TEXT NOT NULL,"
+    " subtotal_cents INTEGER NOT NULL, gst_cents INTEGER NOT NULL,"
+    " total_cents INTEGER NOT NULL, paid_cents INTEGER NOT NULL);"
+    "CREATE TABLE invoice_lines (id INTEGER PRIMARY KEY,"
+    " invoice_id INTEGER NOT NULL, product_id INTEGER NOT NULL,"
+    " quantity INTEGER NOT NULL, unit_price_cents INTEGER NOT NULL,"
+    " discount_percent INTEGER NOT NULL, amount_cents INTEGER NOT NULL,"
+    " gst_code TEXT NOT NULL, gst_rate_bp INTEGER NOT NULL,"
+    " gst_cents INTEGER NOT NULL);"
+    "CREATE TABLE stock_movements (id INTEGER PRIMARY KEY,"
+    " product_id INTEGER NOT NULL, invoice_id INTEGER, kind TEXT NOT NULL,"
+    " quantity INTEGER NOT NULL, moved_at INTEGER NOT NULL);"
+    "CREATE TABLE payments (id INTEGER PRIMARY KEY,"
+    " invoice_id INTEGER NOT NULL, amount_cents INTEGER NOT NULL,"
+    " method TEXT NOT NULL, paid_at INTEGER NOT NULL);"
+    "CREATE TABLE crdt_ops (kind INTEGER, collection TEXT, key TEXT,"
+    " field TEXT, hlc INTEGER, node INTEGER, value);";
+
+// Built after loading, which is faster than maintaining them per row.
+static const char* kIndexes =
+    "CREATE INDEX invoices_customer ON invoices (customer_id);"
+    "CREATE INDEX invoices_issued ON invoices (issued_at);"
+    "CREATE INDEX invoice_lines_invoice ON invoice_lines (invoice_id);"
+    "CREATE INDEX stock_movements_product"
+    " ON stock_movements (product_id, moved_at);"
+    "CREATE INDEX payments_invoice ON payments (invoice_id);"
+    "ANALYZE;";
+
+static const char* kInsertCustomer =
+    "INSERT INTO customers (id, kind, uen, nric, name, email, phone, address,"
+    " postal_code, gst_registered, credit_limit_cents, payment_terms_days,"
+    " created_at) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+static const uint32_t kCustomerColumns = 13;
+static const char* kInsertProduct =
+    "INSERT INTO products (id, sku, name, unit_price_cents, gst_code)"
+    " VALUES (?, ?, ?, ?, ?)";
+static const uint32_t kProductColumns = 5;
+static const char* kInsertInvoice =
+    "INSERT INTO invoices (id, number, customer_id, issued_at, due_at, status,"
+    " subtotal_cents, gst_cents, total_cents, paid_cents)"
+    " VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+static const uint32_t kInvoiceColumns = 10;
+static const char* kInsertLine =
+    "INSERT INTO invoice_lines (invoice_id, product_id, quantity,"
+    " unit_price_cents, discount_percent, amount_cents, gst_code,"
+    " gst_rate_bp, gst_cents) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)";
+static const uint32_t kLineColumns = 9;
+static const char* kInsertMovement =
+    "INSERT INTO stock_movements (product_id, invoice_id, kind, quantity,"
+    " moved_at) VALUES (?, ?, ?, ?, ?)";
+static const uint32_t kMovementColumns = 5;
+static const char* kInsertPayment =
+    "INSERT INTO payments (invoice_id, amount_cents, method, paid_at)"
+    " VALUES (?, ?, ?, ?)";
+static const uint32_t kPaymentColumns = 4;
+static const char* kInsertOp =
+    "INSERT INTO crdt_ops (kind, collection, key, field, hlc, node, value)"
+    " VALUES (?, ?, ?, ?, ?, ?, ?)";
+static const uint32_t kOpColumns = 7;
+static const char* kInsertInfo =
+    "INSERT INTO dataset_info (key, value) VALUES (?, ?)";
+
+// Invoices per generated chunk; each table's share is one batch.
+static const int64_t kChunkInvoices = 4096;
+static const int64_t kDay = 86400;
+// The history ends at 2026-01-01 00:00 UTC.
+static const int64_t kHistoryEnd = 1767225600;
+// GST went from 7% to 8% on 2023-01-01 and to 9% on 2024-01-01.
+static const int64_t kGst8From = 1672531200;
+static const int64_t kGst9From = 1704067200;
+
+static const char* kCompanyWords[] = {
+    "Lion",    "Merlion", "Orchid",  "Harbour",  "Straits", "Jurong",
+    "Tampines", "Kallang", "Changi", "Bukit",    "Marina",  "Raffles",
+    "Temasek", "Sentosa", "Pioneer", "Eastern",  "Golden",  "Evergreen",
+    "Sunrise", "Keppel",
+};
+static const char* kTradeWords[] = {
+    "Trading", "Engineering", "Logistics", "Foods",   "Supplies", "Electronics",
+    "Builders", "Consulting", "Marine",    "Textiles", "Print",   "Motors",
+    "Hardware", "Florist",    "Bakery",    "Tech",
+};
+static const char* kSurnames[] = {
+    "Tan",  "Lim",  "Lee",  "Ng",    "Ong",   "Wong",   "Goh",
+    "Chua", "Chan", "Koh",  "Teo",   "Ang",   "Yeo",    "Tay",
+    "Ho",   "Kumar", "Singh", "Rahman", "Ismail", "Pillai",
+};
+static const char* kGivenNames[] = {
+    "Wei Ling", "Jun Jie", "Siew Mei", "Kai Wen", "Hui Min", "Ahmad",
+    "Nurul",    "Priya",   "Ravi",     "Mei Ling", "Zhi Hao", "Farah",
+    "Arjun",    "Xin Yi",  "Daniel",   "Rachel",
+};
+static const char* kStreets[] = {
+    "Ang Mo Kio Avenue 3", "Bedok North Street 1", "Jurong West Street 42",
+    "Tampines Street 81",  "Ubi Avenue 1",         "Woodlands Drive 14",
+    "Toa Payoh Lorong 4",  "Yishun Ring Road",     "Clementi Avenue 2",
+    "Serangoon Central",   "Kallang Bahru",        "Pasir Ris Drive 6",
+};
+static const char* kProductAdjectives[] = {
+    "Premium", "Standard", "Industrial", "Compact", "Heavy-duty", "Organic",
+    "Wireless", "Stainless", "Recycled", "Deluxe",
+};
+static const char* kProductNouns[] = {
+    "A4 Paper Ream", "Toner Cartridge", "Office Chair", "LED Panel",
+    "Coffee Beans 1kg", "Safety Helmet", "Cable Tray", "Hand Sanitiser",
+    "Packing Tape", "Laptop Stand", "Water Dispenser", "Shelving Unit",
+    "Servicing Visit", "Installation", "Cleaning Service",
+};
+static const char* kPaymentMethods[] = {"paynow", "giro", "bank_transfer",
+                                        "cheque", "cash"};
+static const int kPaymentMethodWeights[] = {45, 25, 15, 10, 5};
+static const int kTermsDays[] = {0, 14, 30, 30, 30, 60};
+
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+
+// SplitMix64, which is fast and gives good streams from small seeds.
+class Random {
+ public:
+  explicit Random(uint64_t seed) : state_(seed) {}
+
+  uint64_t Next() {
+    uint64_t z = (state_ += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  // Uniform in [0, bound).
+  int64_t Below(int64_t bound) {
+    return static_cast<int64_t>(Next() % static_cast<uint64_t>(bound));
+  }
+
+  bool Percent(int percent) { return Below(100) < percent; }
+
+  // In [0, bound) with density falling as 1/x, so low values dominate: with
+  // 10,000 customers the busiest fifth gets over 80% of the picks.
+  int64_t LongTail(int64_t bound) {
+    double unit = (Next() >> 11) * (1.0 / 9007199254740992.0);
+    int64_t value =
+        static_cast<int64_t>(std::exp(unit * std::log(bound + 1.0))) - 1;
+    return std::min(std::max<int64_t>(value, 0), bound - 1);
+  }
+
+  template <typename T, size_t N>
+  T Pick(T (&values)[N]) {
+    return values[Below(N)];
+  }
+
+ private:
+  uint64_t state_;
+};
+
+struct Options {
+  int64_t invoices = 10000;
+  uint64_t seed = 1;
+  int64_t years = 2;
+  int64_t node = 1;
+  bool crdt = false;
+  std::string out;
+  std::string suite;
+};
+
+enum Habit { kPrompt, kSlow, kPoor };
+
+struct Customer {
+  int64_t terms_days;
+  Habit habit;
+};
+
+struct Product {
+  int64_t price_cents;
+  // IRAS code: standard-rated (SR), zero-rated (ZR) or exempt (ESN33).
+  const char* gst_code;
+  int64_t on_hand;
+};
+
+// One chunk of invoices with their lines, stock movements and payments.
+struct Chunk {
+  Chunk()
+      : invoices(kInvoiceColumns),
+        lines(kLineColumns),
+        movements(kMovementColumns),
+        payments(kPaymentColumns) {}
+
+  bizsync::PackedRowWriter invoices;
+  bizsync::PackedRowWriter lines;
+  bizsync::PackedRowWriter movements;
+  bizsync::PackedRowWriter payments;
+};
+
+struct Generator {
+  explicit Generator(const Options& options)
+      : random(options.seed),
+        start(kHistoryEnd - options.years * 365 * kDay),
+        invoice_count(options.invoices) {}
+
+  Random random;
+  int64_t start;
+  int64_t invoice_count;
+  std::vector<Customer> customers;
+  std::vector<Product> products;
+};
+
+static void append_text(bizsync::PackedRowWriter* rows,
+                        const std::string& text) {
+  rows->AppendText(text.data(), static_cast<uint32_t>(text.size()));
+}
+
+static std::string format(const char* pattern, ...)
+    __attribute__((format(printf, 1, 2)));
+
+static std::string format(const char* pattern, ...) {
+  char text[256];
+  va_list args;
+  va_start(args, pattern);
+  vsnprintf(text, sizeof(text), pattern, args);
+  va_end(args);
+  return text;
+}
+
+static std::string lower_alnum(const std::string& text) {
+  std::string out;
+  for (char c : text) {
+    if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) {
+      out += c;
+    } else if (c >= 'A' && c <= 'Z') {
+      out += static_cast<char>(c - 'A' + 'a');
+    }
+  }
+  return out;
+}
+
+// GST in basis points on |when| for standard-rated supplies.
+static int64_t gst_rate_bp(int64_t when) {
+  return when >= kGst9From ? 900 : when >= kGst8From ? 800 : 700;
+}
+
+// Rounds half up, as IRAS allows for per-line GST.
+static int64_t percent_of(int64_t cents, int64_t basis_points) {
+  return (cents * basis_points + 5000) / 10000;
+}
+
+// An NRIC with its check letter: weights 2,7,6,5,4,3,2 over the digits,
+// plus 4 for the T series.
+static std::string nric(Random* random) {
+  static const int kWeights[] = {2, 7, 6, 5, 4, 3, 2};
+  char prefix = random->Percent(60) ? 'S' : 'T';
+  char digits[8];
+  int sum = prefix == 'T' ? 4 : 0;
+  for (int i = 0; i < 7; i++) {
+    int digit = static_cast<int>(random->Below(10));
+    digits[i] = static_cast<char>('0' + digit);
+    sum += digit * kWeights[i];
+  }
+  digits[7] = '\0';
+  return format("%c%s%c", prefix, digits, "JZIHGFEDCBA"[sum % 11]);
+}
+
+static char check_letter(Random* random) {
+  return static_cast<char>('A' + random->Below(26));
+}
+
+static void write_customer(Generator* gen, int64_t id,
+                           bizsync::PackedRowWriter* rows,
+                           bizsync::PackedRowWriter* ops,
+                           const Options& options) {
+  Random* random = &gen->random;
+  bool business = random->Percent(75);
+  std::string name;
+  std::string email;
+  std::string phone;
+  if (business) {
+    std::string company = std::string(random->Pick(kCompanyWords)) + " " +
+                          random->Pick(kTradeWords);
+    int64_t form = random->Below(10);
+    std::string uen;
+    if (form < 7) {
+      name = company + " Pte Ltd";
+      uen = format("%04lld%05lld%c",
+                   static_cast<long long>(1975 + random->Below(50)),
+                   static_cast<long long>(random->Below(100000)),
+                   check_letter(random));
+    } else if (form < 9) {
+      name = company + " Enterprise";
+      uen = format("%08lld%c", static_cast<long long>(random->Below(100000000)),
+                   check_letter(random));
+    } else {
+      name = company + " LLP";
+      uen = format("T%02lldLL%04lld%c",
+                   static_cast<long long>(8 + random->Below(18)),
+                   static_cast<long long>(random->Below(10000)),
+                   check_letter(random));
+    }
+    email = format("accounts@%s.example.sg", lower_alnum(company).c_str());
+    phone = format("+65 6%03lld %04lld",
+                   static_cast<long long>(random->Below(1000)),
+                   static_cast<long long>(random->Below(10000)));
+    rows->AppendInt64(id);
+    rows->AppendText("business", 8);
+    append_text(rows, uen);
+    rows->AppendNull();
+  } else {
+    std::string surname = random->Pick(kSurnames);
+    std::string given = random->Pick(kGivenNames);
+    name = surname + " " + given;
+    email = format("%s.%s%lld@example.sg", lower_alnum(given).c_str(),
+                   lower_alnum(surname).c_str(),
+                   static_cast<long long>(id % 1000));
+    phone = format("+65 %c%03lld %04lld", random->Percent(70) ? '9' : '8',
+                   static_cast<long long>(random->Below(1000)),
+                   static_cast<long long>(random->Below(10000)));
+    rows->AppendInt64(id);
+    rows->AppendText("individual", 10);
+    rows->AppendNull();
+    append_text(rows, nric(random));
+  }
+  std::string address =
+      format("Blk %lld %s #%02lld-%02lld",
+             static_cast<long long>(1 + random->Below(999)),
+             random->Pick(kStreets),
+             static_cast<long long>(1 + random->Below(25)),
+             static_cast<long long>(1 + random->Below(40)));
+  std::string postal_code = format(
+      "%06lld", static_cast<long long>(10000 + random->Below(820000)));
+  int64_t terms = business ? random->Pick(kTermsDays) : 0;
+  int64_t created_at = gen->start - random->Below(365 * kDay);
+  append_text(rows, name);
+  append_text(rows, email);
+  append_text(rows, phone);
+  append_text(rows, address);
+  append_text(rows, postal_code);
+  rows->AppendInt64(business && random->Percent(60) ? 1 : 0);
+  rows->AppendInt64(business ? (1 + random->Below(100)) * 100000 : 0);
+  rows->AppendInt64(terms);
+  rows->AppendInt64(created_at);
+  rows->EndRow();
+
+  int64_t habit = random->Below(100);
+  gen->customers.push_back(
+      {terms, habit < 60 ? kPrompt : habit < 85 ? kSlow : kPoor});
+
+  if (ops == nullptr) {
+    return;
+  }
+  std::string key = std::to_string(id);
+  uint64_t hlc = static_cast<uint64_t>(created_at) * 1000 << 16;
+  const std::string* fields[] = {&name, &email, &phone, &address};
+  const char* field_names[] = {"name", "email", "phone", "address"};
+  for (size_t i = 0; i < ARRAY_SIZE(fields); i++) {
+    ops->AppendInt64(BIZSYNC_CRDT_SET);
+    ops->AppendText("customers", 9);
+    append_text(ops, key);
+    ops->AppendText(field_names[i], static_cast<uint32_t>(
+                                        strlen(field_names[i])));
+    ops->AppendInt64(static_cast<int64_t>(hlc + i));
+    ops->AppendInt64(options.node);
+    append_text(ops, *fields[i]);
+    ops->EndRow();
+  }
+  ops->AppendInt64(BIZSYNC_CRDT_ADD);
+  ops->AppendText("customers", 9);
+  append_text(ops, key);
+  ops->AppendText("tags", 4);
+  ops->AppendInt64(static_cast<int64_t>(hlc + ARRAY_SIZE(fields)));
+  ops->AppendInt64(options.node);
+  append_text(ops, business ? "wholesale" : "retail");
+  ops->EndRow();
+}
+
+static void write_product(Generator* gen, int64_t id,
+                          bizsync::PackedRowWriter* rows) {
+  Random* random = &gen->random;
+  std::string name = std::string(random->Pick(kProductAdjectives)) + " " +
+                     random->Pick(kProductNouns);
+  // $2 to $5,000, most of them cheap.
+  int64_t price = 200 + random->LongTail(500000);
+  int64_t code = random->Below(100);
+  const char* gst_code = code < 85 ? "SR" : code < 95 ? "ZR" : "ESN33";
+  rows->AppendInt64(id);
+  append_text(rows, format("SKU-%06lld", static_cast<long long>(id)));
+  append_text(rows, name);
+  rows->AppendInt64(price);
+  rows->AppendText(gst_code, static_cast<uint32_t>(strlen(gst_code)));
+  rows->EndRow();
+  gen->products.push_back({price, gst_code, 0});
+}
+
+static void write_movement(bizsync::PackedRowWriter* rows, int64_t product,
+                           int64_t invoice, const char* kind, int64_t quantity,
+                           int64_t when) {
+  rows->AppendInt64(product);
+  if (invoice > 0) {
+    rows->AppendInt64(invoice);
+  } else {
+    rows->AppendNull();
+  }
+  rows->AppendText(kind, static_cast<uint32_t>(strlen(kind)));
+  rows->AppendInt64(quantity);
+  rows->AppendInt64(when);
+  rows->EndRow();
+}
+
+static const char* payment_method(Random* random) {
+  int64_t pick = random->Below(100);
+  for (size_t i = 0; i < ARRAY_SIZE(kPaymentMethods); i++) {
+    pick -= kPaymentMethodWeights[i];
+    if (pick < 0) {
+      return kPaymentMethods[i];
+    }
+  }
+  return kPaymentMethods[0];
+}
+
+static void write_payment(bizsync::PackedRowWriter* rows, int64_t invoice,
+                          int64_t cents, const char* method, int64_t when) {
+  rows->AppendInt64(invoice);
+  rows->AppendInt64(cents);
+  rows->AppendText(method, static_cast<uint32_t>(strlen(method)));
+  rows->AppendInt64(when);
+  rows->EndRow();
+}
+
+// Pays |total| the way the customer's habit suggests and returns the amount
+// received before the end of the history.
+static int64_t write_payments(Generator* gen, Chunk* chunk, int64_t invoice,
+                              const Customer& customer, int64_t total,
+                              int64_t issued_at) {
+  Random* random = &gen->random;
+  int64_t roll = random->Below(100);
+  int64_t paid = 0;
+  int64_t delay_days = 0;
+  switch (customer.habit) {
+    case kPrompt:
+      paid = roll < 92 ? total : roll < 97 ? total / 2 : 0;
+      delay_days = random->Below(customer.terms_days + 1);
+      break;
+    case kSlow:
+      paid = roll < 75   ? total
+             : roll < 90 ? total * (30 + random->Below(41)) / 100
+                         : 0;
+      delay_days = customer.terms_days + random->Below(46);
+      break;
+    case kPoor:
+      paid = roll < 40   ? total
+             : roll < 65 ? total * (10 + random->Below(51)) / 100
+                         : 0;
+      delay_days = customer.terms_days + 15 + random->Below(106);
+      break;
+  }
+  int64_t paid_at = issued_at + delay_days * kDay + random->Below(kDay);
+  if (paid == 0 || paid_at >= kHistoryEnd) {
+    return 0;
+  }
+  const char* method = payment_method(random);
+  if (paid == total && total > 100000 && random->Percent(15)) {
+    // Larger bills are sometimes settled in two instalments.
+    int64_t first = total / 2;
+    int64_t second_at = paid_at + (14 + random->Below(30)) * kDay;
+    write_payment(&chunk->payments, invoice, first, method, paid_at);
+    if (second_at >= kHistoryEnd) {
+      return first;
+    }
+    write_payment(&chunk->payments, invoice, total - first, method, second_at);
+    return total;
+  }
+  write_payment(&chunk->payments, invoice, paid, method, paid_at);
+  return paid;
+}
+
+static void write_invoice(Generator* gen, Chunk* chunk, int64_t id) {
+  Random* random = &gen->random;
+  int64_t span = kHistoryEnd - gen->start;
+  // Issue dates rise with the invoice number, with some jitter.
+  int64_t issued_at = gen->start + span * (id - 1) / gen->invoice_count +
+                      random->Below(6 * 3600);
+  int64_t customer_id =
+      1 + random->LongTail(static_cast<int64_t>(gen->customers.size()));
+  const Customer& customer = gen->customers[customer_id - 1];
+  int64_t due_at = issued_at + customer.terms_days * kDay;
+
+  int64_t line_count = 1 + random->Below(3);
+  if (random->Percent(25)) {
+    line_count += random->Below(6);
+  }
+  int64_t subtotal = 0;
+  int64_t gst = 0;
+  for (int64_t i = 0; i < line_count; i++) {
+    int64_t product_id =
+        1 + random->LongTail(static_cast<int64_t>(gen->products.size()));
+    Product& product = gen->products[product_id - 1];
+    int64_t quantity = 1 + random->Below(10);
+    if (random->Percent(5)) {
+      quantity *= 10;
+    }
+    int64_t discount = random->Percent(10) ? 5 + 5 * random->Below(2) : 0;
+    int64_t amount = product.price_cents * quantity;
+    amount -= percent_of(amount, discount * 100);
+    int64_t rate = strcmp(product.gst_code, "SR") == 0
+                       ? gst_rate_bp(issued_at)
+                       : 0;
+    int64_t line_gst = percent_of(amount, rate);
+    subtotal += amount;
+    gst += line_gst;
+
+    chunk->lines.AppendInt64(id);
+    chunk->lines.AppendInt64(product_id);
+    chunk->lines.AppendInt64(quantity);
+    chunk->lines.AppendInt64(product.price_cents);
+    chunk->lines.AppendInt64(discount);
+    chunk->lines.AppendInt64(amount);
+    chunk->lines.AppendText(product.gst_code,
+                            static_cast<uint32_t>(strlen(product.gst_code)));
+    chunk->lines.AppendInt64(rate);
+    chunk->lines.AppendInt64(line_gst);
+    chunk->lines.EndRow();
+
+    if (product.on_hand < quantity) {
+      int64_t restock = quantity + 50 + random->Below(200);
+      write_movement(&chunk->movements, product_id, 0, "purchase", restock,
+                     issued_at - kDay - random->Below(kDay));
+      product.on_hand += restock;
+    }
+    write_movement(&chunk->movements, product_id, id, "sale", -quantity,
+                   issued_at);
+    product.on_hand -= quantity;
+  }
+
+  int64_t total = subtotal + gst;
+  int64_t paid = write_payments(gen, chunk, id, customer, total, issued_at);
+  const char* status = paid >= total          ? "paid"
+                       : paid > 0             ? "partial"
+                       : due_at < kHistoryEnd ? "overdue"
+                                              : "sent";
+  chunk->invoices.AppendInt64(id);
+  append_text(&chunk->invoices,
+              format("INV-%07lld", static_cast<long long>(id)));
+  chunk->invoices.AppendInt64(customer_id);
+  chunk->invoices.AppendInt64(issued_at);
+  chunk->invoices.AppendInt64(due_at);
+  chunk->invoices.AppendText(status, static_cast<uint32_t>(strlen(status)));
+  chunk->invoices.AppendInt64(subtotal);
+  chunk->invoices.AppendInt64(gst);
+  chunk->invoices.AppendInt64(total);
+  chunk->invoices.AppendInt64(paid);
+  chunk->invoices.EndRow();
+}
+
+static std::unique_ptr<Chunk> generate_chunk(Generator* gen, int64_t first,
+                                             int64_t count) {
+  std::unique_ptr<Chunk> chunk(new Chunk());
+  for (int64_t id = first; id < first + count; id++) {
+    write_invoice(gen, chunk.get(), id);
+  }
+  return chunk;
+}
+
+static bool insert(BizsyncDb* db, const char* sql,
+                   const bizsync::PackedRowWriter& rows, int64_t* total) {
+  if (rows.row_count() == 0) {
+    return true;
+  }
+  int64_t changes = 0;
+  if (bizsync_db_batch(db, sql, rows.data(), rows.size(), &changes) !=
+      BIZSYNC_OK) {
+    fprintf(stderr, "bizsync_datagen: %s\n", bizsync_last_error());
+    return false;
+  }
+  *total += changes;
+  return true;
+}
+
+static double now_seconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static bool generate(const Options& options, const std::string& path) {
+  // Start from an empty file so the output depends only on the options.
+  for (const char* suffix : {"", "-wal", "-shm"}) {
+    unlink((path + suffix).c_str());
+  }
+  BizsyncDb* db = nullptr;
+  if (bizsync_db_open(path.c_str(), nullptr, &db) != BIZSYNC_OK ||
+      bizsync_db_execute(db, "PRAGMA synchronous = OFF") != BIZSYNC_OK ||
+      bizsync_db_execute(db, kSchema) != BIZSYNC_OK) {
+    fprintf(stderr, "bizsync_datagen: %s: %s\n", path.c_str(),
+            bizsync_last_error());
+    bizsync_db_close(db);
+    return false;
+  }
+
+  double started = now_seconds();
+  Generator gen(options);
+  int64_t rows = 0;
+  bool ok = true;
+
+  int64_t customer_count = std::max<int64_t>(50, options.invoices / 20);
+  bizsync::PackedRowWriter customers(kCustomerColumns);
+  std::unique_ptr<bizsync::PackedRowWriter> ops;
+  if (options.crdt) {
+    ops.reset(new bizsync::PackedRowWriter(kOpColumns));
+  }
+  for (int64_t id = 1; ok && id <= customer_count; id++) {
+    write_customer(&gen, id, &customers, ops.get(), options);
+    if (customers.row_count() == kChunkInvoices || id == customer_count) {
+      ok = insert(db, kInsertCustomer, customers, &rows) &&
+           (ops == nullptr || insert(db, kInsertOp, *ops, &rows));
+      customers.Clear();
+      if (ops != nullptr) {
+        ops->Clear();
+      }
+    }
+  }
+
+  int64_t product_count =
+      std::min<int64_t>(20000, std::max<int64_t>(100, options.invoices / 50));
+  bizsync::PackedRowWriter products(kProductColumns);
+  bizsync::PackedRowWriter opening(kMovementColumns);
+  for (int64_t id = 1; ok && id <= product_count; id++) {
+    write_product(&gen, id, &products);
+    Product& product = gen.products.back();
+    product.on_hand = 20 + gen.random.Below(200);
+    write_movement(&opening, id, 0, "opening", product.on_hand, gen.start);
+  }
+  ok = ok && insert(db, kInsertProduct, products, &rows) &&
+       insert(db, kInsertMovement, opening, &rows);
+
+  // Generates chunk n + 1 while chunk n is inserted. Chunks are generated
+  // strictly in order, so the rows do not depend on timing.
+  std::future<std::unique_ptr<Chunk>> next;
+  if (ok) {
+    next = std::async(std::launch::async, generate_chunk, &gen, 1,
+                      std::min(kChunkInvoices, options.invoices));
+  }
+  for (int64_t first = 1; ok && first <= options.invoices;
+       first += kChunkInvoices) {
+    std::unique_ptr<Chunk> chunk = next.get();
+    int64_t following = first + kChunkInvoices;
+    if (following <= options.invoices) {
+      next = std::async(
+          std::launch::async, generate_chunk, &gen, following,
+          std::min(kChunkInvoices, options.invoices - following + 1));
+    }
+    ok = insert(db, kInsertInvoice, chunk->invoices, &rows) &&
+         insert(db, kInsertLine, chunk->lines, &rows) &&
+         insert(db, kInsertMovement, chunk->movements, &rows) &&
+         insert(db, kInsertPayment, chunk->payments, &rows);
+  }
+  if (next.valid()) {
+    next.wait();
+  }
+
+  bizsync::PackedRowWriter info(2);
+  const std::pair<const char*, int64_t> values[] = {
+      {"seed", static_cast<int64_t>(options.seed)},
+      {"invoices", options.invoices},
+      {"customers", customer_count},
+      {"products", product_count},
+      {"years", options.years},
+      {"node", options.node},
+  };
+  for (const auto& value : values) {
+    info.AppendText(value.first, static_cast<uint32_t>(strlen(value.first)));
+    info.AppendInt64(value.second);
+    info.EndRow();
+  }
+  ok = ok && insert(db, kInsertInfo, info, &rows);
+
+  // Fold the WAL back in, so the .db file alone can be copied.
+  if (ok && (bizsync_db_execute(db, kIndexes) != BIZSYNC_OK ||
+             bizsync_db_execute(db, "PRAGMA wal_checkpoint(TRUNCATE)") !=
+                 BIZSYNC_OK)) {
+    fprintf(stderr, "bizsync_datagen: %s\n", bizsync_last_error());
+    ok = false;
+  }
+  bizsync_db_close(db);
+  if (ok) {
+    fprintf(stderr, "bizsync_datagen: %s: %lld rows in %.1f s\n",
+            path.c_str(), static_cast<long long>(rows),
+            now_seconds() - started);
+  }
+  return ok;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: bizsync_datagen [--invoices N] [--seed S] [--years Y]\n"
+          "                       [--node N] [--crdt] --out FILE\n"
+          "       bizsync_datagen [--seed S] --suite DIR\n");
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    std::string name = argv[i];
+    if (name == "--crdt") {
+      options.crdt = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      usage();
+      return 2;
+    }
+    const char* value = argv[++i];
+    if (name == "--invoices") {
+      options.invoices = strtoll(value, nullptr, 10);
+    } else if (name == "--seed") {
+      options.seed = strtoull(value, nullptr, 10);
+    } else if (name == "--years") {
+      options.years = strtoll(value, nullptr, 10);
+    } else if (name == "--node") {
+      options.node = strtoll(value, nullptr, 10);
+    } else if (name == "--out") {
+      options.out = value;
+    } else if (name == "--suite") {
+      options.suite = value;
+    } else {
+      usage();
+      return 2;
+    }
+  }
+  if (options.out.empty() == options.suite.empty() || options.invoices < 1 ||
+      options.years < 1) {
+    usage();
+    return 2;
+  }
+
+  if (!options.out.empty()) {
+    return generate(options, options.out) ? 0 : 1;
+  }
+  mkdir(options.suite.c_str(), 0755);
+  const std::pair<const char*, int64_t> suite[] = {
+      {"invoices-10k.db", 10000},
+      {"invoices-100k.db", 100000},
+      {"invoices-1m.db", 1000000},
+  };
+  for (const auto& entry : suite) {
+    options.invoices = entry.second;
+    if (!generate(options, options.suite + "/" + entry.first)) {
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,956 @@
+#include "backup.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "compression.h"
+#include "crypto.h"
+#include "output_file.h"
+#include "task_scheduler.h"
+
+static const int32_t kDefaultCompressionLevel = 3;
+static const size_t kBufferSize = 1024 * 1024;
+
+// Pages copied per sqlite3_backup_step(), between cancellation checks.
+static const int kSnapshotStepPages = 4096;
+
+// Progress is reported at most once per this many database bytes.
+static const int64_t kProgressBytes = 16 * 1024 * 1024;
+
+// FastCDC: no cut before the minimum, a strict mask up to the normal size
+// and a loose one after it, so chunk sizes cluster around 64 KiB. These
+// and the gear table decide where chunks are cut; changing them stops new
+// backups from sharing chunks with old ones.
+static const size_t kMinChunkSize = 16 * 1024;
+static const size_t kNormalChunkSize = 64 * 1024;
+static const size_t kMaxChunkSize = 256 * 1024;
+static const uint64_t kStrictMask = ~0ull << (64 - 18);
+static const uint64_t kLooseMask = ~0ull << (64 - 14);
+
+static const char kHeaderMagic[8] = {'B', 'Z', 'S', 'Y', 'N', 'C', 'B', 'K'};
+static const char kTrailerMagic[8] = {'B', 'Z', 'S', 'Y', 'N', 'C', 'M', 'F'};
+static const uint32_t kFormatVersion = 1;
+static const size_t kHeaderSize = 64;
+static const size_t kTrailerSize = 32;
+static const size_t kIdSize = 16;
+static const size_t kFrameOverhead = BIZSYNC_AEAD_OVERHEAD;
+static const size_t kHashSize = 32;
+static const size_t kManifestHeaderSize = 24;
+static const size_t kEntrySize = 64;
+
+namespace bizsync {
+
+// Where one chunk of the database is stored.
+struct ChunkEntry {
+  // 0 for the backup holding the manifest, otherwise 1 + the index of the
+  // base backup's id in the manifest.
+  uint32_t file;
+  uint32_t codec;
+  // Authenticated with the frame, together with its backup's id.
+  uint64_t sequence;
+  // Offset of the frame in its backup.
+  uint64_t offset;
+  uint32_t stored_length;
+  uint32_t raw_length;
+  uint8_t hash[kHashSize];
+};
+
+struct Manifest {
+  uint64_t database_size = 0;
+  std::vector<std::string> base_ids;
+  std::vector<ChunkEntry> entries;
+};
+
+}  // namespace bizsync
+
+struct BizsyncBackup {
+  BizsyncDb* db;
+  bool restore;
+  std::string path;
+  // Restores only; empty to verify.
+  std::string db_path;
+  std::vector<std::string> base_paths;
+  uint8_t key[BIZSYNC_BACKUP_KEY_SIZE];
+  BizsyncBackupOptions options;
+
+  std::atomic<bool> cancelled{false};
+  bizsync::CancelOnStop cancel_on_stop{&cancelled};
+  std::atomic<int64_t> bytes_done{0};
+  int64_t bytes_total = 0;
+  int64_t reported = 0;
+
+  int status = BIZSYNC_OK;
+  std::string error;
+  BizsyncBackupResult result = {};
+  // Backups run at background priority, restores as interactive work.
+  std::unique_ptr<bizsync::TaskGroup> task;
+};
+
+namespace bizsync {
+
+static void put_u32(uint8_t* out, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    out[i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+static void put_u64(uint8_t* out, uint64_t value) {
+  for (int i = 0; i < 8; i++) {
+    out[i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+static uint32_t get_u32(const uint8_t* in) {
+  uint32_t value = 0;
+  for (int i = 3; i >= 0; i--) {
+    value = value << 8 | in[i];
+  }
+  return value;
+}
+
+static uint64_t get_u64(const uint8_t* in) {
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; i--) {
+    value = value << 8 | in[i];
+  }
+  return value;
+}
+
+static std::string hex_id(const std::string& id) {
+  static const char kDigits[] = "0123456789abcdef";
+  std::string text;
+  for (unsigned char c : id) {
+    text += kDigits[c >> 4];
+    text += kDigits[c & 15];
+  }
+  return text;
+}
+
+// Random values indexed by byte, from a fixed splitmix64 sequence.
+static const uint64_t* gear_table() {
+  static const std::vector<uint64_t> table = [] {
+    std::vector<uint64_t> values(256);
+    uint64_t state = 0x6a09e667f3bcc908ull;
+    for (uint64_t& value : values) {
+      state += 0x9e3779b97f4a7c15ull;
+      uint64_t z = state;
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+      value = z ^ (z >> 31);
+    }
+    return values;
+  }();
+  return table.data();
+}
+
+// Returns the length of the chunk starting at |data|.
+static size_t next_cut(const uint8_t* data, size_t length) {
+  if (length <= kMinChunkSize) {
+    return length;
+  }
+  const uint64_t* gear = gear_table();
+  size_t normal = std::min(kNormalChunkSize, length);
+  size_t end = std::min(kMaxChunkSize, length);
+  uint64_t hash = 0;
+  size_t i = kMinChunkSize;
+  for (; i < normal; i++) {
+    hash = (hash << 1) + gear[data[i]];
+    if ((hash & kStrictMask) == 0) {
+      return i + 1;
+    }
+  }
+  for (; i < end; i++) {
+    hash = (hash << 1) + gear[data[i]];
+    if ((hash & kLooseMask) == 0) {
+      return i + 1;
+    }
+  }
+  return end;
+}
+
+// Seals |data| as a frame of nonce, ciphertext and tag.
+static int seal_frame(Aead* aead, const uint8_t* aad, size_t aad_length,
+                      const void* data, size_t length, std::string* frame) {
+  frame->resize(length + kFrameOverhead);
+  return aead->Seal(aad, aad_length, static_cast<const uint8_t*>(data), length,
+                    reinterpret_cast<uint8_t*>(&(*frame)[0]));
+}
+
+// A whole file mapped read-only.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  ~MappedFile() {
+    if (data_ != nullptr) {
+      munmap(data_, size_);
+    }
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  }
+
+  int Open(const std::string& path) {
+    fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd_ < 0 || fstat(fd_, &st) != 0) {
+      return SetError(BIZSYNC_ERROR_IO, "%s: %s", path.c_str(),
+                      strerror(errno));
+    }
+    size_ = st.st_size;
+    if (size_ > 0) {
+      data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+      if (data_ == MAP_FAILED) {
+        data_ = nullptr;
+        return SetError(BIZSYNC_ERROR_IO, "%s: %s", path.c_str(),
+                        strerror(errno));
+      }
+    }
+    return BIZSYNC_OK;
+  }
+
+  void Advise(int advice) {
+    if (data_ != nullptr) {
+      madvise(data_, size_, advice);
+    }
+  }
+
+  const uint8_t* data() const { return static_cast<const uint8_t*>(data_); }
+  size_t size() const { return size_; }
+
+ private:
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  int fd_ = -1;
+  void* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// A mapped backup with its manifest opened.
+struct BackupFile {
+  std::string path;
+  std::string id;
+  MappedFile file;
+  Manifest manifest;
+};
+
+static void frame_aad(const std::string& id, uint64_t sequence,
+                      uint8_t* aad) {
+  memcpy(aad, id.data(), kIdSize);
+  put_u64(aad + kIdSize, sequence);
+}
+
+static void encode_manifest(const Manifest& manifest,
+                            std::vector<uint8_t>* out) {
+  out->assign(kManifestHeaderSize + manifest.base_ids.size() * kIdSize +
+                  manifest.entries.size() * kEntrySize,
+              0);
+  uint8_t* cursor = out->data();
+  put_u32(cursor, kFormatVersion);
+  put_u32(cursor + 4, manifest.base_ids.size());
+  put_u64(cursor + 8, manifest.database_size);
+  put_u64(cursor + 16, manifest.entries.size());
+  cursor += kManifestHeaderSize;
+  for (const std::string& id : manifest.base_ids) {
+    memcpy(cursor, id.data(), kIdSize);
+    cursor += kIdSize;
+  }
+  for (const ChunkEntry& entry : manifest.entries) {
+    put_u32(cursor, entry.file);
+    put_u32(cursor + 4, entry.codec);
+    put_u64(cursor + 8, entry.sequence);
+    put_u64(cursor + 16, entry.offset);
+    put_u32(cursor + 24, entry.stored_length);
+    put_u32(cursor + 28, entry.raw_length);
+    memcpy(cursor + 32, entry.hash, kHashSize);
+    cursor += kEntrySize;
+  }
+}
+
+static int decode_manifest(const uint8_t* data, size_t length,
+                           Manifest* manifest) {
+  if (length < kManifestHeaderSize || get_u32(data) != kFormatVersion) {
+    return SetError(BIZSYNC_ERROR_FORMAT, "unsupported manifest");
+  }
+  uint64_t base_count = get_u32(data + 4);
+  uint64_t entry_count = get_u64(data + 16);
+  if (entry_count > length / kEntrySize ||
+      length != kManifestHeaderSize + base_count * kIdSize +
+                    entry_count * kEntrySize) {
+    return SetError(BIZSYNC_ERROR_FORMAT, "manifest size mismatch");
+  }
+  manifest->database_size = get_u64(data + 8);
+  const uint8_t* cursor = data + kManifestHeaderSize;
+  manifest->base_ids.clear();
+  for (uint64_t i = 0; i < base_count; i++) {
+    manifest->base_ids.emplace_back(reinterpret_cast<const char*>(cursor),
+                                    kIdSize);
+    cursor += kIdSize;
+  }
+  manifest->entries.resize(entry_count);
+  uint64_t total = 0;
+  for (ChunkEntry& entry : manifest->entries) {
+    entry.file = get_u32(cursor);
+    entry.codec = get_u32(cursor + 4);
+    entry.sequence = get_u64(cursor + 8);
+    entry.offset = get_u64(cursor + 16);
+    entry.stored_length = get_u32(cursor + 24);
+    entry.raw_length = get_u32(cursor + 28);
+    memcpy(entry.hash, cursor + 32, kHashSize);
+    cursor += kEntrySize;
+    if (entry.file > base_count || entry.raw_length > kMaxChunkSize) {
+      return SetError(BIZSYNC_ERROR_FORMAT, "corrupt manifest entry");
+    }
+    total += entry.raw_length;
+  }
+  if (total != manifest->database_size) {
+    return SetError(BIZSYNC_ERROR_FORMAT, "manifest does not add up");
+  }
+  return BIZSYNC_OK;
+}
+
+static int read_backup(const std::string& path, const uint8_t* key,
+                       BackupFile* backup) {
+  backup->path = path;
+  int status = backup->file.Open(path);
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+  const uint8_t* data = backup->file.data();
+  size_t size = backup->file.size();
+  if (size < kHeaderSize + kTrailerSize ||
+      memcmp(data, kHeaderMagic, sizeof(kHeaderMagic)) != 0 ||
+      memcmp(data + size - sizeof(kTrailerMagic), kTrailerMagic,
+             sizeof(kTrailerMagic)) != 0) {
+    return SetError(BIZSYNC_ERROR_FORMAT, "%s is not a complete backup",
+                    path.c_str());
+  }
+  if (get_u32(data + 8) != kFormatVersion) {
+    return SetError(BIZSYNC_ERROR_UNSUPPORTED, "%s: backup version %u",
+                    path.c_str(), get_u32(data + 8));
+  }
+  backup->id.assign(reinterpret_cast<const char*>(data + 16), kIdSize);
+
+  const uint8_t* trailer = data + size - kTrailerSize;
+  uint64_t offset = get_u64(trailer);
+  uint64_t length = get_u64(trailer + 8);
+  // Both values come from the file; compare without sums or differences
+  // that could wrap.
+  if (offset < kHeaderSize || offset > size - kTrailerSize ||
+      length < kFrameOverhead || length != size - kTrailerSize - offset) {
+    return SetError(BIZSYNC_ERROR_FORMAT, "%s: corrupt trailer",
+                    path.c_str());
+  }
+  std::vector<uint8_t> plain(length - kFrameOverhead);
+  Aead aead(BIZSYNC_AEAD_AES_256_GCM, key);
+  status = aead.Open(data, kHeaderSize, data + offset, length, plain.data());
+  if (status == BIZSYNC_OK) {
+    status = decode_manifest(plain.data(), plain.size(), &backup->manifest);
+  }
+  if (status != BIZSYNC_OK) {
+    return SetError(status, "%s: %s", path.c_str(), bizsync_last_error());
+  }
+
+  // Frames must lie between the header and the manifest.
+  for (const ChunkEntry& entry : backup->manifest.entries) {
+    if (entry.file == 0 &&
+        (entry.offset < kHeaderSize || entry.offset > offset ||
+         entry.stored_length + kFrameOverhead > offset - entry.offset)) {
+      return SetError(BIZSYNC_ERROR_FORMAT, "%s: chunk outside the file",
+                      path.c_str());
+    }
+  }
+  return BIZSYNC_OK;
+}
+
+// Work shared by the workers of one job; worker failures are kept for the
+// job's own task to report.
+class Workers {
+ public:
+  explicit Workers(BizsyncBackup* job) : job_(job) {}
+
+  bool running() const { return status_ == BIZSYNC_OK && !job_->cancelled; }
+
+  void Fail(int status) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (status_ == BIZSYNC_OK) {
+      status_ = status;
+      error_ = bizsync_last_error();
+    }
+  }
+
+  // Runs |work| on the configured number of workers, this one included,
+  // and returns the first failure.
+  template <typename Work>
+  int Run(const Work& work) {
+    RunParallel(job_->restore ? BIZSYNC_TASK_INTERACTIVE
+                              : BIZSYNC_TASK_BACKGROUND,
+                job_->options.worker_count,
+                [&](size_t copy) { work(copy == 0); });
+    if (status_ != BIZSYNC_OK) {
+      return SetError(status_, "%s", error_.c_str());
+    }
+    if (job_->cancelled) {
+      return SetError(BIZSYNC_ERROR_CANCELLED, "cancelled");
+    }
+    return BIZSYNC_OK;
+  }
+
+  // Counts |bytes| as done; the job's own task also reports progress.
+  void Progress(int64_t bytes, bool job_thread) {
+    int64_t done = job_->bytes_done += bytes;
+    if (job_thread && job_->options.callback != nullptr &&
+        done - job_->reported >= kProgressBytes) {
+      job_->reported = done;
+      job_->options.callback(job_->options.user_data, BIZSYNC_BACKUP_RUNNING,
+                             done, job_->bytes_total);
+    }
+  }
+
+ private:
+  BizsyncBackup* job_;
+  std::mutex mutex_;
+  std::atomic<int> status_{BIZSYNC_OK};
+  std::string error_;
+};
+
+static int exec(sqlite3* handle, const char* sql, const char* context) {
+  if (sqlite3_exec(handle, sql, nullptr, nullptr, nullptr) != SQLITE_OK) {
+    return SetSqliteError(handle, context);
+  }
+  return BIZSYNC_OK;
+}
+
+// Copies the database into |snapshot_path| at one point in time. A read
+// transaction on the reader keeps every step on the same snapshot while
+// the writer carries on.
+static int take_snapshot(BizsyncBackup* job,
+                         const std::string& snapshot_path) {
+  unlink(snapshot_path.c_str());
+  sqlite3* target = nullptr;
+  if (sqlite3_open_v2(snapshot_path.c_str(), &target,
+                      SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+                      nullptr) != SQLITE_OK) {
+    int status = SetSqliteError(target, snapshot_path.c_str());
+    sqlite3_close(target);
+    return status;
+  }
+  // The copy is thrown away if anything fails, so it needs no journal.
+  int status = exec(target, "PRAGMA journal_mode=OFF; PRAGMA synchronous=OFF",
+                    "snapshot");
+
+  ConnectionLease lease = AcquireReader(job->db);
+  sqlite3* source = lease.handle();
+  if (status == BIZSYNC_OK) {
+    status = exec(source, "BEGIN; SELECT count(*) FROM sqlite_schema",
+                  "snapshot");
+  }
+  if (status == BIZSYNC_OK) {
+    sqlite3_backup* backup =
+        sqlite3_backup_init(target, "main", source, "main");
+    if (backup == nullptr) {
+      status = SetSqliteError(target, "snapshot");
+    } else {
+      int rc = SQLITE_OK;
+      while (!job->cancelled) {
+        rc = sqlite3_backup_step(backup, kSnapshotStepPages);
+        if (rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+          sqlite3_sleep(10);
+        } else if (rc != SQLITE_OK) {
+          break;
+        }
+      }
+      sqlite3_backup_finish(backup);
+      if (job->cancelled) {
+        status = SetError(BIZSYNC_ERROR_CANCELLED, "cancelled");
+      } else if (rc != SQLITE_DONE) {
+        status = SetError(BIZSYNC_ERROR_SQLITE, "snapshot: %s",
+                          sqlite3_errstr(rc));
+      }
+    }
+  }
+  if (!sqlite3_get_autocommit(source)) {
+    sqlite3_exec(source, "COMMIT", nullptr, nullptr, nullptr);
+  }
+  if (sqlite3_close(target) != SQLITE_OK && status == BIZSYNC_OK) {
+    status = SetError(BIZSYNC_ERROR_SQLITE, "cannot close snapshot");
+  }
+  if (status != BIZSYNC_OK) {
+    unlink(snapshot_path.c_str());
+  }
+  return status;
+}
+
+static int run_backup(BizsyncBackup* job) {
+  // Chunks the bases already hold, by hash, with |file| as 1 + an index
+  // into |candidate_ids|.
+  std::vector<std::string> candidate_ids;
+  std::unordered_map<std::string, ChunkEntry> known;
+  for (const std::string& base_path : job->base_paths) {
+    BackupFile base;
+    int status = read_backup(base_path, job->key, &base);
+    if (status != BIZSYNC_OK) {
+      return status;
+    }
+    size_t first = candidate_ids.size();
+    candidate_ids.push_back(base.id);
+    candidate_ids.insert(candidate_ids.end(), base.manifest.base_ids.begin(),
+                         base.manifest.base_ids.end());
+    for (ChunkEntry entry : base.manifest.entries) {
+      entry.file += first + 1;
+      known.emplace(std::string(reinterpret_cast<const char*>(entry.hash),
+                                kHashSize),
+                    entry);
+    }
+  }
+
+  std::string snapshot_path = job->path + ".snapshot";
+  int status = take_snapshot(job, snapshot_path);
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+  MappedFile snapshot;
+  status = snapshot.Open(snapshot_path);
+  unlink(snapshot_path.c_str());
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+  snapshot.Advise(MADV_SEQUENTIAL);
+  job->bytes_total = snapshot.size();
+
+  uint8_t header[kHeaderSize] = {};
+  memcpy(header, kHeaderMagic, sizeof(kHeaderMagic));
+  put_u32(header + 8, kFormatVersion);
+  if (RAND_bytes(header + 16, kIdSize) != 1) {
+    return SetError(BIZSYNC_ERROR_UNSUPPORTED, "no random source");
+  }
+  std::string id(reinterpret_cast<const char*>(header + 16), kIdSize);
+
+  OutputFile out;
+  status = out.Open(job->path, kBufferSize,
+                    job->options.flags & BIZSYNC_BACKUP_DIRECT_IO);
+  if (status == BIZSYNC_OK) {
+    status = out.Write(header, sizeof(header));
+  }
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+
+  // Everything below is guarded by |mutex|: the cut position, the entries
+  // and the output. Hashing, compression and encryption run outside it.
+  std::mutex mutex;
+  size_t cursor = 0;
+  Manifest manifest;
+  manifest.database_size = snapshot.size();
+  std::vector<int64_t> base_index(candidate_ids.size(), -1);
+  int64_t reused = 0;
+
+  Workers workers(job);
+  status = workers.Run([&](bool job_thread) {
+    Compressor compressor(job->options.compression_level);
+    Aead aead(BIZSYNC_AEAD_AES_256_GCM, job->key);
+    std::string compressed;
+    std::string frame;
+    while (workers.running()) {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (cursor >= snapshot.size()) {
+        break;
+      }
+      const uint8_t* chunk = snapshot.data() + cursor;
+      size_t length = next_cut(chunk, snapshot.size() - cursor);
+      cursor += length;
+      uint64_t sequence = manifest.entries.size();
+      manifest.entries.emplace_back();
+      lock.unlock();
+
+      ChunkEntry entry = {};
+      entry.raw_length = length;
+      Sha256(chunk, length, entry.hash);
+      std::string hash(reinterpret_cast<const char*>(entry.hash), kHashSize);
+
+      lock.lock();
+      auto found = known.find(hash);
+      if (found != known.end()) {
+        entry = found->second;
+        if (entry.file != 0) {
+          size_t candidate = entry.file - 1;
+          if (base_index[candidate] < 0) {
+            base_index[candidate] = manifest.base_ids.size();
+            manifest.base_ids.push_back(candidate_ids[candidate]);
+          }
+          entry.file = base_index[candidate] + 1;
+          reused++;
+        }
+        manifest.entries[sequence] = entry;
+        lock.unlock();
+        workers.Progress(length, job_thread);
+        continue;
+      }
+      lock.unlock();
+
+      // Chunks that barely compress, such as stored attachments, are kept
+      // as they are.
+      int result = compressor.Compress(chunk, length, &compressed);
+      const void* payload = chunk;
+      entry.codec = kCodecNone;
+      entry.stored_length = length;
+      if (result == BIZSYNC_OK &&
+          compressed.size() < length - length / 16) {
+        payload = compressed.data();
+        entry.codec = compressor.codec();
+        entry.stored_length = compressed.size();
+      }
+      entry.sequence = sequence;
+      uint8_t aad[kIdSize + 8];
+      frame_aad(id, sequence, aad);
+      result = seal_frame(&aead, aad, sizeof(aad), payload,
+                          entry.stored_length, &frame);
+      if (result != BIZSYNC_OK) {
+        workers.Fail(result);
+        break;
+      }
+
+      lock.lock();
+      entry.offset = out.bytes_written();
+      result = out.Write(frame.data(), frame.size());
+      if (result != BIZSYNC_OK) {
+        lock.unlock();
+        workers.Fail(result);
+        break;
+      }
+      manifest.entries[sequence] = entry;
+      known.emplace(hash, entry);
+      lock.unlock();
+      workers.Progress(length, job_thread);
+    }
+  });
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+
+  std::vector<uint8_t> plain;
+  encode_manifest(manifest, &plain);
+  std::string frame;
+  Aead aead(BIZSYNC_AEAD_AES_256_GCM, job->key);
+  status = seal_frame(&aead, header, sizeof(header), plain.data(),
+                      plain.size(), &frame);
+  uint8_t trailer[kTrailerSize] = {};
+  put_u64(trailer, out.bytes_written());
+  put_u64(trailer + 8, frame.size());
+  memcpy(trailer + kTrailerSize - sizeof(kTrailerMagic), kTrailerMagic,
+         sizeof(kTrailerMagic));
+  if (status == BIZSYNC_OK) {
+    status = out.Write(frame.data(), frame.size());
+  }
+  if (status == BIZSYNC_OK) {
+    status = out.Write(trailer, sizeof(trailer));
+  }
+  if (status == BIZSYNC_OK) {
+    status = out.Commit();
+  }
+
+  job->result.database_bytes = manifest.database_size;
+  job->result.stored_bytes = out.bytes_written();
+  job->result.chunk_count = manifest.entries.size();
+  job->result.reused_chunks = reused;
+  return status;
+}
+
+static int write_all(int fd, const uint8_t* data, size_t length,
+                     uint64_t offset) {
+  while (length > 0) {
+    ssize_t written = pwrite(fd, data, length, offset);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return SetError(BIZSYNC_ERROR_IO, "restore: %s",
+                      written < 0 ? strerror(errno) : "short write");
+    }
+    data += written;
+    length -= written;
+    offset += written;
+  }
+  return BIZSYNC_OK;
+}
+
+static int run_restore(BizsyncBackup* job) {
+  BackupFile backup;
+  int status = read_backup(job->path, job->key, &backup);
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+  backup.file.Advise(MADV_SEQUENTIAL);
+
+  // The file behind each manifest file index. Bases may be listed in any
+  // order, and ones this backup does not need are ignored.
+  std::vector<std::unique_ptr<BackupFile>> bases;
+  for (const std::string& base_path : job->base_paths) {
+    bases.emplace_back(new BackupFile());
+    status = read_backup(base_path, job->key, bases.back().get());
+    if (status != BIZSYNC_OK) {
+      return status;
+    }
+  }
+  std::vector<const BackupFile*> files = {&backup};
+  for (const std::string& base_id : backup.manifest.base_ids) {
+    auto match = std::find_if(
+        bases.begin(), bases.end(),
+        [&](const std::unique_ptr<BackupFile>& base) {
+          return base->id == base_id;
+        });
+    if (match == bases.end()) {
+      return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                      "%s needs base backup %s, which is not in base_paths",
+                      job->path.c_str(), hex_id(base_id).c_str());
+    }
+    files.push_back(match->get());
+  }
+
+  const std::vector<ChunkEntry>& entries = backup.manifest.entries;
+  std::vector<uint64_t> offsets(entries.size());
+  uint64_t total = 0;
+  for (size_t i = 0; i < entries.size(); i++) {
+    offsets[i] = total;
+    total += entries[i].raw_length;
+    // read_backup() only checked the frames each file stores itself.
+    const BackupFile* file = files[entries[i].file];
+    if (entries[i].offset < kHeaderSize ||
+        entries[i].offset > file->file.size() - kTrailerSize ||
+        entries[i].stored_length + kFrameOverhead >
+            file->file.size() - kTrailerSize - entries[i].offset) {
+      return SetError(BIZSYNC_ERROR_FORMAT, "%s: chunk %zu outside %s",
+                      job->path.c_str(), i, file->path.c_str());
+    }
+  }
+  job->bytes_total = total;
+
+  std::string partial_path;
+  int fd = -1;
+  if (!job->db_path.empty()) {
+    partial_path = job->db_path + ".partial";
+    fd = open(partial_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+              0644);
+    if (fd < 0 || ftruncate(fd, total) != 0) {
+      status = SetError(BIZSYNC_ERROR_IO, "%s: %s", partial_path.c_str(),
+                        strerror(errno));
+      if (fd >= 0) {
+        close(fd);
+        unlink(partial_path.c_str());
+      }
+      return status;
+    }
+  }
+
+  std::atomic<size_t> next{0};
+  std::atomic<int64_t> stored{0};
+  Workers workers(job);
+  status = workers.Run([&](bool job_thread) {
+    Aead aead(BIZSYNC_AEAD_AES_256_GCM, job->key);
+    std::vector<uint8_t> sealed;
+    std::vector<uint8_t> raw;
+    uint8_t hash[kHashSize];
+    while (workers.running()) {
+      size_t i = next++;
+      if (i >= entries.size()) {
+        break;
+      }
+      const ChunkEntry& entry = entries[i];
+      const BackupFile* file = files[entry.file];
+      uint8_t aad[kIdSize + 8];
+      frame_aad(file->id, entry.sequence, aad);
+      sealed.resize(entry.stored_length);
+      raw.resize(entry.raw_length);
+      size_t frame_length = entry.stored_length + kFrameOverhead;
+      int result = aead.Open(aad, sizeof(aad),
+                             file->file.data() + entry.offset, frame_length,
+                             sealed.data());
+      if (result == BIZSYNC_OK) {
+        result = Decompress(static_cast<CompressionCodec>(entry.codec),
+                            sealed.data(), sealed.size(), raw.data(),
+                            raw.size());
+      }
+      if (result == BIZSYNC_OK) {
+        Sha256(raw.data(), raw.size(), hash);
+        if (memcmp(hash, entry.hash, kHashSize) != 0) {
+          result = SetError(BIZSYNC_ERROR_FORMAT, "checksum mismatch");
+        }
+      }
+      if (result == BIZSYNC_OK && fd >= 0) {
+        result = write_all(fd, raw.data(), raw.size(), offsets[i]);
+      }
+      if (result != BIZSYNC_OK) {
+        SetError(result, "%s: chunk %zu: %s", file->path.c_str(), i,
+                 bizsync_last_error());
+        workers.Fail(result);
+        break;
+      }
+      stored += frame_length;
+      workers.Progress(entry.raw_length, job_thread);
+    }
+  });
+
+  if (fd >= 0) {
+    if (status == BIZSYNC_OK && fdatasync(fd) != 0) {
+      status = SetError(BIZSYNC_ERROR_IO, "%s: %s", partial_path.c_str(),
+                        strerror(errno));
+    }
+    close(fd);
+    if (status == BIZSYNC_OK) {
+      // A leftover log would be replayed onto the restored pages.
+      unlink((job->db_path + "-wal").c_str());
+      unlink((job->db_path + "-shm").c_str());
+      if (rename(partial_path.c_str(), job->db_path.c_str()) != 0) {
+        status = SetError(BIZSYNC_ERROR_IO, "%s: %s", job->db_path.c_str(),
+                          strerror(errno));
+      }
+    }
+    if (status != BIZSYNC_OK) {
+      unlink(partial_path.c_str());
+    }
+  }
+
+  job->result.database_bytes = total;
+  job->result.stored_bytes = stored;
+  job->result.chunk_count = entries.size();
+  job->result.reused_chunks = entries.size() -
+      std::count_if(entries.begin(), entries.end(),
+                    [](const ChunkEntry& entry) { return entry.file == 0; });
+  return status;
+}
+
+static void backup_task_main(BizsyncBackup* job) {
+  job->status = job->restore ? run_restore(job) : run_backup(job);
+  if (job->status != BIZSYNC_OK) {
+    job->error = bizsync_last_error();
+  }
+  if (job->options.callback != nullptr) {
+    job->options.callback(job->options.user_data, job->status,
+                          job->bytes_done, job->bytes_total);
+  }
+}
+
+static int start_job(BizsyncBackup* job, const char* path,
+                     const BizsyncBackupOptions* options,
+                     BizsyncBackup** out_job) {
+  if (options == nullptr || options->key == nullptr) {
+    delete job;
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "a key is required");
+  }
+  job->path = path;
+  job->options = *options;
+  memcpy(job->key, options->key, sizeof(job->key));
+  job->options.key = nullptr;
+  for (int32_t i = 0; i < options->base_count; i++) {
+    if (options->base_paths == nullptr || options->base_paths[i] == nullptr) {
+      delete job;
+      return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                      "base_paths has fewer than %d entries",
+                      options->base_count);
+    }
+    job->base_paths.push_back(options->base_paths[i]);
+  }
+  job->options.base_paths = nullptr;
+  if (job->options.worker_count <= 0) {
+    job->options.worker_count = SchedulerWorkerCount();
+  }
+  if (job->options.compression_level <= 0) {
+    job->options.compression_level = kDefaultCompressionLevel;
+  }
+
+  job->task.reset(new TaskGroup(job->restore ? BIZSYNC_TASK_INTERACTIVE
+                                              : BIZSYNC_TASK_BACKGROUND));
+  int status = job->task->Post([job] { backup_task_main(job); });
+  if (status != BIZSYNC_OK) {
+    OPENSSL_cleanse(job->key, sizeof(job->key));
+    delete job;
+    return status;
+  }
+  *out_job = job;
+  return BIZSYNC_OK;
+}
+
+}  // namespace bizsync
+
+int bizsync_backup_start(BizsyncDb* db, const char* path,
+                         const BizsyncBackupOptions* options,
+                         BizsyncBackup** out_backup) {
+  using namespace bizsync;
+
+  if (db == nullptr || path == nullptr || out_backup == nullptr) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "db, path and out_backup required");
+  }
+  *out_backup = nullptr;
+
+  BizsyncBackup* job = new BizsyncBackup();
+  job->db = db;
+  job->restore = false;
+  return start_job(job, path, options, out_backup);
+}
+
+int bizsync_restore_start(const char* path, const char* db_path,
+                          const BizsyncBackupOptions* options,
+                          BizsyncBackup** out_restore) {
+  using namespace bizsync;
+
+  if (path == nullptr || out_restore == nullptr) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "path and out_restore required");
+  }
+  *out_restore = nullptr;
+
+  BizsyncBackup* job = new BizsyncBackup();
+  job->db = nullptr;
+  job->restore = true;
+  if (db_path != nullptr) {
+    job->db_path = db_path;
+  }
+  return start_job(job, path, options, out_restore);
+}
+
+void bizsync_backup_cancel(BizsyncBackup* job) {
+  if (job != nullptr) {
+    job->cancelled = true;
+  }
+}
+
+int bizsync_backup_get_result(BizsyncBackup* job,
+                              BizsyncBackupResult* out_result) {
+  using namespace bizsync;
+
+  if (job == nullptr || out_result == nullptr) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "job and out_result required");
+  }
+  *out_result = job->result;
+  if (job->status != BIZSYNC_OK) {
+    return SetError(job->status, "%s", job->error.c_str());
+  }
+  return BIZSYNC_OK;
+}
+
+void bizsync_backup_free(BizsyncBackup* job) {
+  if (job == nullptr) {
+    return;
+  }
+  if (job->task != nullptr) {
+    job->task->Wait();
+  }
+  OPENSSL_cleanse(job->key, sizeof(job->key));
+  delete job;
+}
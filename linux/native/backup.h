@@ -0,0 +1,152 @@
+#ifndef BIZSYNC_NATIVE_BACKUP_H_
+#define BIZSYNC_NATIVE_BACKUP_H_
+
+#include "sqlite_engine.h"
+
+// Encrypted database backups. A backup takes a consistent snapshot with
+// SQLite's online backup API, while other connections keep writing. The
+// snapshot is split into content-defined chunks of about 64 KiB. Chunks are
+// hashed, compressed and sealed with AES-256-GCM on every core, then
+// appended to the backup file as they finish. Memory use stays at a few
+// chunks per worker, whatever the database size.
+//
+// Chunk boundaries follow the content, so rows inserted in one place only
+// change the chunks around them. A backup given earlier backups as bases
+// stores only chunks they do not already hold and refers to the rest.
+// Restoring it then needs those files too.
+//
+// Restore decrypts, decompresses and checks each chunk against its SHA-256
+// in parallel, writing chunks at their offsets in the new database file.
+// The file replaces the destination only once every chunk has been
+// verified.
+//
+// Layout, little-endian: a 64-byte header with a magic, a version and a
+// random backup id. The header is followed by chunk frames (nonce,
+// ciphertext, tag) and then the sealed manifest, which lists every chunk in
+// database order. A 32-byte trailer locates the manifest. Chunk frames are
+// authenticated with the backup id and their sequence number, and the
+// manifest with the header.
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct BizsyncBackup BizsyncBackup;
+
+// Size of the AES-256 key every backup is sealed with.
+#define BIZSYNC_BACKUP_KEY_SIZE 32
+
+typedef enum {
+  // Write the backup with O_DIRECT, as for exports.
+  BIZSYNC_BACKUP_DIRECT_IO = 1 << 0,
+} BizsyncBackupFlags;
+
+// Status passed to the callback while the job is still running.
+#define BIZSYNC_BACKUP_RUNNING 1
+
+// Called on the job's worker as database bytes are processed, with
+// BIZSYNC_BACKUP_RUNNING, and exactly once at the end with the final
+// #BizsyncStatus. Use NativeCallable.listener from Dart.
+typedef void (*BizsyncBackupCallback)(void* user_data, int32_t status,
+                                      int64_t bytes_done, int64_t bytes_total);
+
+// Zero fields select the default noted beside them.
+typedef struct {
+  // BIZSYNC_BACKUP_KEY_SIZE bytes, required. Every backup a backup refers to
+  // must use the same key.
+  const uint8_t* key;
+  // Earlier backups. A new backup refers to their chunks rather than
+  // storing them again. A restore needs every backup the one it reads
+  // refers to. None.
+  const char* const* base_paths;
+  int32_t base_count;             // Entries in |base_paths|.
+  int32_t worker_count;           // one per scheduler worker
+  int32_t compression_level;      // 3
+  int32_t flags;                  // BizsyncBackupFlags, none
+  BizsyncBackupCallback callback;  // none
+  void* user_data;
+} BizsyncBackupOptions;
+
+typedef struct {
+  // Size of the snapshot or of the restored database.
+  int64_t database_bytes;
+  // Bytes written to the backup, or read from the backups for a restore.
+  int64_t stored_bytes;
+  int64_t chunk_count;
+  // Chunks referenced in base backups instead of being stored again.
+  int64_t reused_chunks;
+} BizsyncBackupResult;
+
+/**
+ * bizsync_backup_start:
+ * @db: a #BizsyncDb that outlives the backup.
+ * @path: destination file, replaced when the backup succeeds.
+ * @options: settings including the key.
+ * @out_backup: (out): location for the running backup.
+ *
+ * Copies the arguments and starts the backup as background work on the
+ * shared scheduler, so its file I/O runs at idle priority. The snapshot
+ * is staged in "<path>.snapshot" next to @path and removed as soon as it
+ * has been mapped, so that filesystem needs room for another copy of the
+ * database.
+ *
+ * Returns: %BIZSYNC_OK or a negative #BizsyncStatus.
+ */
+BIZSYNC_EXPORT int bizsync_backup_start(BizsyncDb* db, const char* path,
+                                        const BizsyncBackupOptions* options,
+                                        BizsyncBackup** out_backup);
+
+/**
+ * bizsync_restore_start:
+ * @path: a backup written by bizsync_backup_start().
+ * @db_path: (allow-none): database file to replace, or %NULL to only
+ * verify the backup.
+ * @options: settings including the key and the base backups @path refers
+ * to.
+ * @out_restore: (out): location for the running restore.
+ *
+ * Copies the arguments and starts restoring on the shared scheduler. Close
+ * every connection to @db_path first; its -wal and -shm files are removed
+ * when the restored file is moved into place.
+ *
+ * Returns: %BIZSYNC_OK or a negative #BizsyncStatus.
+ */
+BIZSYNC_EXPORT int bizsync_restore_start(const char* path,
+                                         const char* db_path,
+                                         const BizsyncBackupOptions* options,
+                                         BizsyncBackup** out_restore);
+
+/**
+ * bizsync_backup_cancel:
+ * @job: a #BizsyncBackup.
+ *
+ * Asks @job to stop; its callback then reports %BIZSYNC_ERROR_CANCELLED
+ * unless it had already finished. Nothing is left at the destination.
+ */
+BIZSYNC_EXPORT void bizsync_backup_cancel(BizsyncBackup* job);
+
+/**
+ * bizsync_backup_get_result:
+ * @job: a finished #BizsyncBackup.
+ * @out_result: (out): sizes and chunk counts.
+ *
+ * Only valid after the final callback.
+ *
+ * Returns: the job's #BizsyncStatus. On failure bizsync_last_error()
+ * describes it.
+ */
+BIZSYNC_EXPORT int bizsync_backup_get_result(BizsyncBackup* job,
+                                             BizsyncBackupResult* out_result);
+
+/**
+ * bizsync_backup_free:
+ * @job: (allow-none): a #BizsyncBackup.
+ *
+ * Waits for the job to finish and releases @job.
+ */
+BIZSYNC_EXPORT void bizsync_backup_free(BizsyncBackup* job);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // BIZSYNC_NATIVE_BACKUP_H_
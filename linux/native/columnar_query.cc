@@ -0,0 +1,209 @@
+#include "columnar_query.h"
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace bizsync {
+
+// Storage behind one BizsyncColumn while rows are appended.
+struct ColumnData {
+  std::string name;
+  // BIZSYNC_VALUE_NULL until the first non-NULL value fixes the type.
+  BizsyncValueType type = BIZSYNC_VALUE_NULL;
+  std::vector<uint8_t> nulls;
+  std::vector<int64_t> ints;
+  std::vector<double> floats;
+  std::vector<uint32_t> offsets;
+  std::vector<uint8_t> bytes;
+};
+
+struct ColumnarResult {
+  BizsyncColumnarResult header;
+  std::vector<BizsyncColumn> columns;
+  std::vector<ColumnData> data;
+};
+
+// Fixes the type of |column| at |type|, converting the placeholders already
+// stored for |rows| leading NULLs.
+static void set_column_type(ColumnData* column, BizsyncValueType type,
+                            size_t rows) {
+  column->type = type;
+  switch (type) {
+    case BIZSYNC_VALUE_FLOAT64:
+      column->floats.assign(rows, 0.0);
+      column->ints = std::vector<int64_t>();
+      break;
+    case BIZSYNC_VALUE_TEXT:
+    case BIZSYNC_VALUE_BLOB:
+      column->offsets.assign(rows + 1, 0);
+      column->ints = std::vector<int64_t>();
+      break;
+    default:
+      break;
+  }
+}
+
+// Appends row |row| of |statement|'s column |index| to |column|.
+static int append_value(ColumnData* column, sqlite3_stmt* statement, int index,
+                        size_t row) {
+  int sqlite_type = sqlite3_column_type(statement, index);
+  bool is_null = sqlite_type == SQLITE_NULL;
+  column->nulls.push_back(is_null ? 1 : 0);
+
+  if (column->type == BIZSYNC_VALUE_NULL && !is_null) {
+    switch (sqlite_type) {
+      case SQLITE_INTEGER:
+        column->type = BIZSYNC_VALUE_INT64;
+        break;
+      case SQLITE_FLOAT:
+        set_column_type(column, BIZSYNC_VALUE_FLOAT64, row);
+        break;
+      case SQLITE_TEXT:
+        set_column_type(column, BIZSYNC_VALUE_TEXT, row);
+        break;
+      default:
+        set_column_type(column, BIZSYNC_VALUE_BLOB, row);
+        break;
+    }
+  } else if (column->type == BIZSYNC_VALUE_INT64 &&
+             sqlite_type == SQLITE_FLOAT) {
+    column->floats.assign(column->ints.begin(), column->ints.end());
+    column->ints = std::vector<int64_t>();
+    column->type = BIZSYNC_VALUE_FLOAT64;
+  }
+
+  switch (column->type) {
+    case BIZSYNC_VALUE_NULL:
+    case BIZSYNC_VALUE_INT64:
+      column->ints.push_back(is_null ? 0
+                                     : sqlite3_column_int64(statement, index));
+      break;
+    case BIZSYNC_VALUE_FLOAT64:
+      column->floats.push_back(
+          is_null ? 0.0 : sqlite3_column_double(statement, index));
+      break;
+    case BIZSYNC_VALUE_TEXT:
+    case BIZSYNC_VALUE_BLOB: {
+      if (!is_null) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(
+            column->type == BIZSYNC_VALUE_TEXT
+                ? sqlite3_column_text(statement, index)
+                : sqlite3_column_blob(statement, index));
+        int length = sqlite3_column_bytes(statement, index);
+        if (column->bytes.size() + length > UINT32_MAX) {
+          return SetError(BIZSYNC_ERROR_UNSUPPORTED,
+                          "column %s exceeds 4 GiB of text",
+                          column->name.c_str());
+        }
+        if (bytes != nullptr) {
+          column->bytes.insert(column->bytes.end(), bytes, bytes + length);
+        }
+      }
+      column->offsets.push_back(static_cast<uint32_t>(column->bytes.size()));
+      break;
+    }
+  }
+  return BIZSYNC_OK;
+}
+
+// Points the C view of each column at its finished storage.
+static void publish(ColumnarResult* result, size_t rows) {
+  result->columns.resize(result->data.size());
+  for (size_t i = 0; i < result->data.size(); i++) {
+    ColumnData& data = result->data[i];
+    BizsyncColumn& column = result->columns[i];
+    if (data.type == BIZSYNC_VALUE_NULL) {
+      data.type = BIZSYNC_VALUE_INT64;
+    }
+    column = {};
+    column.name = data.name.c_str();
+    column.type = data.type;
+    column.nulls = data.nulls.data();
+    switch (data.type) {
+      case BIZSYNC_VALUE_FLOAT64:
+        column.values = data.floats.data();
+        break;
+      case BIZSYNC_VALUE_TEXT:
+      case BIZSYNC_VALUE_BLOB:
+        column.offsets = data.offsets.data();
+        column.bytes = data.bytes.data();
+        column.bytes_length = data.bytes.size();
+        break;
+      default:
+        column.values = data.ints.data();
+        break;
+    }
+  }
+
+  result->header.row_count = static_cast<int64_t>(rows);
+  result->header.column_count = static_cast<int32_t>(result->columns.size());
+  result->header.columns = result->columns.data();
+  result->header.internal = result;
+}
+
+}  // namespace bizsync
+
+int bizsync_db_query_columns(BizsyncDb* db, const char* sql,
+                             const uint8_t* params, size_t params_length,
+                             BizsyncColumnarResult** out_result) {
+  using namespace bizsync;
+
+  if (db == nullptr || sql == nullptr || out_result == nullptr) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "db, sql and out_result required");
+  }
+  *out_result = nullptr;
+
+  ConnectionLease lease = AcquireReader(db);
+  sqlite3_stmt* statement = nullptr;
+  int status = lease.Prepare(sql, &statement);
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+
+  status = lease.BindParameters(statement, params, params_length);
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+
+  std::unique_ptr<ColumnarResult> result(new ColumnarResult());
+  int column_count = sqlite3_column_count(statement);
+  result->data.resize(column_count);
+  for (int i = 0; i < column_count; i++) {
+    const char* name = sqlite3_column_name(statement, i);
+    result->data[i].name = name != nullptr ? name : "";
+  }
+
+  size_t rows = 0;
+  int step = SQLITE_DONE;
+  while (status == BIZSYNC_OK &&
+         (step = sqlite3_step(statement)) == SQLITE_ROW) {
+    for (int i = 0; status == BIZSYNC_OK && i < column_count; i++) {
+      status = append_value(&result->data[i], statement, i, rows);
+    }
+    rows++;
+  }
+  if (status == BIZSYNC_OK && step != SQLITE_DONE) {
+    status = SetSqliteError(lease.handle(), "step");
+  }
+
+  // Parameters may point into the caller's buffer.
+  sqlite3_reset(statement);
+  sqlite3_clear_bindings(statement);
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+
+  publish(result.get(), rows);
+  *out_result = &result.release()->header;
+  return BIZSYNC_OK;
+}
+
+void bizsync_columnar_result_free(BizsyncColumnarResult* result) {
+  if (result == nullptr) {
+    return;
+  }
+  delete static_cast<bizsync::ColumnarResult*>(result->internal);
+}
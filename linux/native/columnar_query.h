@@ -0,0 +1,75 @@
+#ifndef BIZSYNC_NATIVE_COLUMNAR_QUERY_H_
+#define BIZSYNC_NATIVE_COLUMNAR_QUERY_H_
+
+#include "sqlite_engine.h"
+
+// Runs a SELECT on a reader connection and returns the result as contiguous
+// typed columns instead of per-row maps. Dart wraps each array with
+// Pointer.asTypedList() (Int64List, Float64List, Uint32List, Uint8List) and
+// attaches bizsync_columnar_result_free as a NativeFinalizer to the object
+// holding the views, so no per-row Dart objects are created.
+//
+// A column's type is that of its first non-NULL value. An INT64 column that
+// later meets a REAL is promoted to FLOAT64; other mismatches use SQLite's
+// own conversion to the column type.
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  const char* name;
+  // BIZSYNC_VALUE_INT64, BIZSYNC_VALUE_FLOAT64, BIZSYNC_VALUE_TEXT or
+  // BIZSYNC_VALUE_BLOB. Columns that are NULL in every row are INT64.
+  int32_t type;
+  int32_t reserved;
+  // row_count bytes, 1 where the value is NULL.
+  const uint8_t* nulls;
+  // row_count int64_t or double values; 0 for NULL rows. NULL for TEXT and
+  // BLOB columns.
+  const void* values;
+  // TEXT and BLOB only: row_count + 1 offsets into |bytes|; row i spans
+  // [offsets[i], offsets[i + 1]). Strings are not NUL-terminated.
+  const uint32_t* offsets;
+  const uint8_t* bytes;
+  uint64_t bytes_length;
+} BizsyncColumn;
+
+typedef struct {
+  int64_t row_count;
+  int32_t column_count;
+  int32_t reserved;
+  const BizsyncColumn* columns;
+  void* internal;
+} BizsyncColumnarResult;
+
+/**
+ * bizsync_db_query_columns:
+ * @db: a #BizsyncDb.
+ * @sql: a single SELECT statement.
+ * @params: (allow-none): packed row buffer holding one row of parameters, or
+ * %NULL if @sql takes none.
+ * @params_length: size of @params in bytes.
+ * @out_result: (out): location for the result, free with
+ * bizsync_columnar_result_free().
+ *
+ * Returns: %BIZSYNC_OK or a negative #BizsyncStatus.
+ */
+BIZSYNC_EXPORT int bizsync_db_query_columns(BizsyncDb* db, const char* sql,
+                                            const uint8_t* params,
+                                            size_t params_length,
+                                            BizsyncColumnarResult** out_result);
+
+/**
+ * bizsync_columnar_result_free:
+ * @result: (allow-none): a #BizsyncColumnarResult.
+ *
+ * Releases @result and every array it points to. Suitable as a
+ * NativeFinalizer callback.
+ */
+BIZSYNC_EXPORT void bizsync_columnar_result_free(BizsyncColumnarResult* result);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // BIZSYNC_NATIVE_COLUMNAR_QUERY_H_
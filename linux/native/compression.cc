@@ -0,0 +1,112 @@
+#include "compression.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "native_status.h"
+
+namespace bizsync {
+
+Compressor::Compressor(int level) : level_(level) {
+#ifdef BIZSYNC_HAVE_ZSTD
+  context_ = ZSTD_createCCtx();
+#else
+  memset(&stream_, 0, sizeof(stream_));
+  ready_ = deflateInit(&stream_, std::min(level_, 9)) == Z_OK;
+#endif
+}
+
+Compressor::~Compressor() {
+#ifdef BIZSYNC_HAVE_ZSTD
+  ZSTD_freeCCtx(context_);
+#else
+  if (ready_) {
+    deflateEnd(&stream_);
+  }
+#endif
+}
+
+CompressionCodec Compressor::codec() const {
+#ifdef BIZSYNC_HAVE_ZSTD
+  return kCodecZstd;
+#else
+  return kCodecDeflate;
+#endif
+}
+
+const char* Compressor::encoding() const {
+#ifdef BIZSYNC_HAVE_ZSTD
+  return "zstd";
+#else
+  return "deflate";
+#endif
+}
+
+int Compressor::Compress(const void* data, size_t length,
+                         std::string* output) {
+#ifdef BIZSYNC_HAVE_ZSTD
+  if (context_ == nullptr) {
+    return SetError(BIZSYNC_ERROR_UNSUPPORTED, "zstd context unavailable");
+  }
+  output->resize(ZSTD_compressBound(length));
+  size_t size = ZSTD_compressCCtx(context_, &(*output)[0], output->size(),
+                                  data, length, level_);
+  if (ZSTD_isError(size)) {
+    return SetError(BIZSYNC_ERROR_FORMAT, "zstd: %s", ZSTD_getErrorName(size));
+  }
+  output->resize(size);
+  return BIZSYNC_OK;
+#else
+  if (!ready_ || deflateReset(&stream_) != Z_OK) {
+    return SetError(BIZSYNC_ERROR_UNSUPPORTED, "deflate unavailable");
+  }
+  output->resize(deflateBound(&stream_, length));
+  stream_.next_in = static_cast<Bytef*>(const_cast<void*>(data));
+  stream_.avail_in = length;
+  stream_.next_out = reinterpret_cast<Bytef*>(&(*output)[0]);
+  stream_.avail_out = output->size();
+  if (deflate(&stream_, Z_FINISH) != Z_STREAM_END) {
+    return SetError(BIZSYNC_ERROR_FORMAT, "deflate failed");
+  }
+  output->resize(stream_.total_out);
+  return BIZSYNC_OK;
+#endif
+}
+
+int Decompress(CompressionCodec codec, const void* data, size_t length,
+               void* output, size_t raw_length) {
+  switch (codec) {
+    case kCodecNone:
+      if (length != raw_length) {
+        return SetError(BIZSYNC_ERROR_FORMAT, "stored size mismatch");
+      }
+      memcpy(output, data, length);
+      return BIZSYNC_OK;
+    case kCodecDeflate: {
+      uLongf size = raw_length;
+      if (uncompress(static_cast<Bytef*>(output), &size,
+                     static_cast<const Bytef*>(data), length) != Z_OK ||
+          size != raw_length) {
+        return SetError(BIZSYNC_ERROR_FORMAT, "corrupt deflate data");
+      }
+      return BIZSYNC_OK;
+    }
+    case kCodecZstd: {
+#ifdef BIZSYNC_HAVE_ZSTD
+      size_t size = ZSTD_decompress(output, raw_length, data, length);
+      if (ZSTD_isError(size) || size != raw_length) {
+        return SetError(BIZSYNC_ERROR_FORMAT, "corrupt zstd data");
+      }
+      return BIZSYNC_OK;
+#else
+      return SetError(BIZSYNC_ERROR_UNSUPPORTED,
+                      "this build cannot read zstd data");
+#endif
+    }
+  }
+  return SetError(BIZSYNC_ERROR_FORMAT, "unknown compression codec %d",
+                  static_cast<int>(codec));
+}
+
+}  // namespace bizsync
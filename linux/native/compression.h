@@ -0,0 +1,59 @@
+#ifndef BIZSYNC_NATIVE_COMPRESSION_H_
+#define BIZSYNC_NATIVE_COMPRESSION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zlib.h>
+#ifdef BIZSYNC_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <string>
+
+namespace bizsync {
+
+// Identifies a compressed format in stored data. The values are persisted.
+enum CompressionCodec {
+  kCodecNone = 0,
+  kCodecDeflate = 1,
+  kCodecZstd = 2,
+};
+
+// zstd, or zlib's deflate where the build has no libzstd. One context is
+// reused for every call, so keep one per thread.
+class Compressor {
+ public:
+  explicit Compressor(int level);
+  ~Compressor();
+
+  CompressionCodec codec() const;
+
+  // The HTTP Content-Encoding of Compress()'s output.
+  const char* encoding() const;
+
+  int Compress(const void* data, size_t length, std::string* output);
+  int Compress(const std::string& input, std::string* output) {
+    return Compress(input.data(), input.size(), output);
+  }
+
+ private:
+  Compressor(const Compressor&) = delete;
+  Compressor& operator=(const Compressor&) = delete;
+
+  int level_;
+#ifdef BIZSYNC_HAVE_ZSTD
+  ZSTD_CCtx* context_;
+#else
+  z_stream stream_;
+  bool ready_;
+#endif
+};
+
+// Decompresses |length| bytes written by a Compressor with |codec| into
+// exactly |raw_length| bytes at |output|. kCodecNone copies.
+int Decompress(CompressionCodec codec, const void* data, size_t length,
+               void* output, size_t raw_length);
+
+}  // namespace bizsync
+
+#endif  // BIZSYNC_NATIVE_COMPRESSION_H_
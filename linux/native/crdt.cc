@@ -0,0 +1,519 @@
+#include "crdt.h"
+
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "task_scheduler.h"
+
+static const uint32_t kLogColumns = 7;
+static const int kCounterBits = 16;
+static const uint64_t kMaxDriftMs = 60 * 1000;
+
+struct BizsyncCrdtMerge {
+  std::vector<uint8_t> local;
+  std::vector<uint8_t> remote;
+  BizsyncCrdtCallback callback;
+  void* user_data;
+  bizsync::TaskGroup task{BIZSYNC_TASK_INTERACTIVE};
+
+  int status = BIZSYNC_OK;
+  std::string error;
+  bizsync::PackedRowWriter changes{kLogColumns};
+  BizsyncCrdtResult result = {};
+};
+
+namespace bizsync {
+
+static uint64_t wall_clock_ms() {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return static_cast<uint64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+// FNV-1a, folded into |seed| so composite keys hash field by field.
+static uint64_t hash_bytes(const uint8_t* data, size_t length, uint64_t seed) {
+  uint64_t hash = seed ^ 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ data[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+// Bytes inside one of the merge's copies of the logs, compared by content.
+struct Slice {
+  const uint8_t* data;
+  uint32_t length;
+
+  bool operator==(const Slice& other) const {
+    return length == other.length && memcmp(data, other.data, length) == 0;
+  }
+};
+
+struct RowKey {
+  Slice collection;
+  Slice key;
+
+  bool operator==(const RowKey& other) const {
+    return collection == other.collection && key == other.key;
+  }
+};
+
+struct FieldKey {
+  uint32_t row;
+  Slice field;
+
+  bool operator==(const FieldKey& other) const {
+    return row == other.row && field == other.field;
+  }
+};
+
+// A set element is its type plus its integer bits or its bytes.
+struct ElementKey {
+  uint8_t type;
+  uint64_t bits;
+  Slice bytes;
+
+  bool operator==(const ElementKey& other) const {
+    return type == other.type && bits == other.bits && bytes == other.bytes;
+  }
+};
+
+struct KeyHash {
+  uint64_t operator()(const RowKey& key) const {
+    return hash_bytes(key.key.data, key.key.length,
+                      hash_bytes(key.collection.data, key.collection.length,
+                                 0));
+  }
+  uint64_t operator()(const FieldKey& key) const {
+    return hash_bytes(key.field.data, key.field.length, key.row);
+  }
+  uint64_t operator()(const ElementKey& key) const {
+    return hash_bytes(key.bytes.data, key.bytes.length,
+                      key.bits * 31 + key.type);
+  }
+};
+
+// Assigns dense ids to distinct keys in first-seen order. Open addressing
+// over flat arrays: a node-based map costs an allocation per lookup, which
+// dominated merges of large logs.
+template <typename Key>
+class Interner {
+ public:
+  uint32_t Intern(const Key& key) {
+    if ((keys_.size() + 1) * 2 > slots_.size()) {
+      Grow();
+    }
+    uint64_t hash = Mix(KeyHash()(key));
+    uint32_t tag = static_cast<uint32_t>(hash >> 32);
+    size_t mask = slots_.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+      Slot& slot = slots_[i];
+      if (slot.id == 0) {
+        keys_.push_back(key);
+        hashes_.push_back(hash);
+        slot.id = keys_.size();
+        slot.tag = tag;
+        return slot.id - 1;
+      }
+      if (slot.tag == tag && keys_[slot.id - 1] == key) {
+        return slot.id - 1;
+      }
+    }
+  }
+
+  const Key& operator[](uint32_t id) const { return keys_[id]; }
+
+ private:
+  // Part of the hash is kept beside the id so most mismatches are rejected
+  // without touching |keys_|.
+  struct Slot {
+    uint32_t id;  // Key id + 1, or 0 when empty.
+    uint32_t tag;
+  };
+
+  // FNV's low bits mix poorly; the table indexes by them.
+  static uint64_t Mix(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    return hash;
+  }
+
+  void Grow() {
+    slots_.assign(std::max<size_t>(64, slots_.size() * 2), Slot{0, 0});
+    size_t mask = slots_.size() - 1;
+    for (size_t id = 0; id < keys_.size(); id++) {
+      size_t i = hashes_[id] & mask;
+      while (slots_[i].id != 0) {
+        i = (i + 1) & mask;
+      }
+      slots_[i] = Slot{static_cast<uint32_t>(id + 1),
+                       static_cast<uint32_t>(hashes_[id] >> 32)};
+    }
+  }
+
+  std::vector<Slot> slots_;
+  std::vector<Key> keys_;
+  std::vector<uint64_t> hashes_;  // Only read when growing.
+};
+
+// One operation reduced to integers. Strings are interned to dense ids
+// first, so sorting compares small fixed-size records instead of chasing
+// string pointers.
+struct Operation {
+  uint32_t row;
+  uint32_t field;
+  uint32_t element;  // 0 for SET; ADD and REMOVE elements count from 1.
+  uint8_t kind;
+  uint8_t remote;
+  uint64_t hlc;
+  uint64_t node;
+  uint32_t value;  // Index into MergeState::values_.
+};
+
+static bool operation_less(const Operation& a, const Operation& b) {
+  return std::tie(a.row, a.field, a.element, a.hlc, a.node, a.kind,
+                  a.remote) < std::tie(b.row, b.field, b.element, b.hlc,
+                                       b.node, b.kind, b.remote);
+}
+
+static bool same_stamp(const Operation& a, const Operation& b) {
+  return a.hlc == b.hlc && a.node == b.node;
+}
+
+static Slice slice_of(const PackedValue& value) {
+  return {value.bytes, value.length};
+}
+
+class MergeState {
+ public:
+  // Decodes |log| and appends its operations. Empty buffers are empty logs.
+  int AddLog(const std::vector<uint8_t>& log, bool remote, uint64_t* max_hlc) {
+    if (log.empty()) {
+      return BIZSYNC_OK;
+    }
+    PackedRowReader reader(log.data(), log.size());
+    if (!reader.ok()) {
+      return SetError(BIZSYNC_ERROR_FORMAT, "operation log is truncated");
+    }
+    if (reader.row_count() > 0 && reader.column_count() != kLogColumns) {
+      return SetError(BIZSYNC_ERROR_FORMAT,
+                      "operation log has %u columns, expected %u",
+                      reader.column_count(), kLogColumns);
+    }
+    operations_.reserve(operations_.size() + reader.row_count());
+    values_.reserve(values_.size() + reader.row_count());
+
+    PackedValue v[kLogColumns];
+    for (uint32_t i = 0; i < reader.row_count(); i++) {
+      for (uint32_t column = 0; column < kLogColumns; column++) {
+        if (!reader.Next(&v[column])) {
+          return SetError(BIZSYNC_ERROR_FORMAT,
+                          "operation %u is truncated", i + 1);
+        }
+      }
+      if (v[0].type != BIZSYNC_VALUE_INT64 || v[0].int64_value < 0 ||
+          v[0].int64_value > BIZSYNC_CRDT_REMOVE ||
+          v[1].type != BIZSYNC_VALUE_TEXT || v[2].type != BIZSYNC_VALUE_TEXT ||
+          v[3].type != BIZSYNC_VALUE_TEXT || v[4].type != BIZSYNC_VALUE_INT64 ||
+          v[5].type != BIZSYNC_VALUE_INT64) {
+        return SetError(BIZSYNC_ERROR_FORMAT,
+                        "operation %u has the wrong column types", i + 1);
+      }
+
+      Operation operation;
+      operation.kind = static_cast<uint8_t>(v[0].int64_value);
+      operation.row = rows_.Intern(RowKey{slice_of(v[1]), slice_of(v[2])});
+      operation.field =
+          fields_.Intern(FieldKey{operation.row, slice_of(v[3])});
+      operation.element = 0;
+      if (operation.kind != BIZSYNC_CRDT_SET) {
+        uint64_t bits = 0;
+        if (v[6].type == BIZSYNC_VALUE_INT64) {
+          bits = static_cast<uint64_t>(v[6].int64_value);
+        } else if (v[6].type == BIZSYNC_VALUE_FLOAT64) {
+          memcpy(&bits, &v[6].float64_value, sizeof(bits));
+        }
+        ElementKey key{static_cast<uint8_t>(v[6].type), bits, slice_of(v[6])};
+        operation.element = elements_.Intern(key) + 1;
+      }
+      operation.remote = remote;
+      operation.hlc = static_cast<uint64_t>(v[4].int64_value);
+      operation.node = static_cast<uint64_t>(v[5].int64_value);
+      operation.value = values_.size();
+      values_.push_back(v[6]);
+      operations_.push_back(operation);
+
+      if (remote) {
+        *max_hlc = std::max(*max_hlc, operation.hlc);
+      }
+    }
+    return BIZSYNC_OK;
+  }
+
+  size_t operation_count() const { return operations_.size(); }
+
+  // Settles every register and set element and appends those whose merged
+  // state differs from the local one to |changes|.
+  void Merge(PackedRowWriter* changes, int64_t* changed_rows) {
+    std::sort(operations_.begin(), operations_.end(), operation_less);
+
+    uint32_t last_row = UINT32_MAX;
+    size_t begin = 0;
+    while (begin < operations_.size()) {
+      const Operation& first = operations_[begin];
+      size_t end = begin + 1;
+      while (end < operations_.size() && operations_[end].row == first.row &&
+             operations_[end].field == first.field &&
+             operations_[end].element == first.element) {
+        end++;
+      }
+
+      bool changed = first.element == 0 ? MergeRegister(begin, end, changes)
+                                        : MergeElement(begin, end, changes);
+      if (changed && first.row != last_row) {
+        last_row = first.row;
+        (*changed_rows)++;
+      }
+      begin = end;
+    }
+  }
+
+ private:
+  // Last writer wins: the highest (hlc, node) in the group. Only a remote
+  // winner newer than every local write is a change.
+  bool MergeRegister(size_t begin, size_t end, PackedRowWriter* changes) {
+    const Operation& winner = operations_[end - 1];
+    const Operation* local = nullptr;
+    for (size_t i = begin; i < end; i++) {
+      if (!operations_[i].remote) {
+        local = &operations_[i];
+      }
+    }
+    // The log order puts a local copy of the same operation first, so an
+    // operation both sides have is never reported.
+    if (!winner.remote || (local != nullptr && same_stamp(*local, winner))) {
+      return false;
+    }
+    Emit(changes, BIZSYNC_CRDT_SET, winner);
+    return true;
+  }
+
+  // Observed-remove: an element is present while some ADD tag, identified
+  // by its (hlc, node), has no REMOVE naming it. Concurrent adds therefore
+  // survive a remove that did not see them.
+  bool MergeElement(size_t begin, size_t end, PackedRowWriter* changes) {
+    bool local_present = false;
+    bool merged_present = false;
+    const Operation* newest_add = nullptr;
+    const Operation* local_add = nullptr;
+
+    size_t i = begin;
+    while (i < end) {
+      bool added_locally = false;
+      bool removed_locally = false;
+      bool added = false;
+      bool removed = false;
+      const Operation* add = nullptr;
+      size_t tag_end = i;
+      while (tag_end < end &&
+             same_stamp(operations_[tag_end], operations_[i])) {
+        const Operation& operation = operations_[tag_end];
+        bool is_add = operation.kind == BIZSYNC_CRDT_ADD;
+        if (is_add) {
+          add = &operation;
+        }
+        added = added || is_add;
+        removed = removed || !is_add;
+        if (!operation.remote) {
+          added_locally = added_locally || is_add;
+          removed_locally = removed_locally || !is_add;
+        }
+        tag_end++;
+      }
+      if (added_locally && !removed_locally) {
+        local_present = true;
+        local_add = add;
+      }
+      if (added && !removed) {
+        merged_present = true;
+        newest_add = add;
+      }
+      i = tag_end;
+    }
+
+    if (merged_present == local_present) {
+      return false;
+    }
+    Emit(changes, merged_present ? BIZSYNC_CRDT_ADD : BIZSYNC_CRDT_REMOVE,
+         merged_present ? *newest_add : *local_add);
+    return true;
+  }
+
+  void Emit(PackedRowWriter* changes, BizsyncCrdtKind kind,
+            const Operation& operation) {
+    const RowKey& row = rows_[operation.row];
+    const Slice& field = fields_[operation.field].field;
+    changes->AppendInt64(kind);
+    changes->AppendText(reinterpret_cast<const char*>(row.collection.data),
+                        row.collection.length);
+    changes->AppendText(reinterpret_cast<const char*>(row.key.data),
+                        row.key.length);
+    changes->AppendText(reinterpret_cast<const char*>(field.data),
+                        field.length);
+    changes->AppendInt64(static_cast<int64_t>(operation.hlc));
+    changes->AppendInt64(static_cast<int64_t>(operation.node));
+
+    const PackedValue& value = values_[operation.value];
+    switch (value.type) {
+      case BIZSYNC_VALUE_INT64:
+        changes->AppendInt64(value.int64_value);
+        break;
+      case BIZSYNC_VALUE_FLOAT64:
+        changes->AppendFloat64(value.float64_value);
+        break;
+      case BIZSYNC_VALUE_TEXT:
+        changes->AppendText(reinterpret_cast<const char*>(value.bytes),
+                            value.length);
+        break;
+      case BIZSYNC_VALUE_BLOB:
+        changes->AppendBlob(value.bytes, value.length);
+        break;
+      default:
+        changes->AppendNull();
+        break;
+    }
+    changes->EndRow();
+  }
+
+  std::vector<Operation> operations_;
+  std::vector<PackedValue> values_;
+  Interner<RowKey> rows_;
+  Interner<FieldKey> fields_;
+  Interner<ElementKey> elements_;
+};
+
+static int run_merge(BizsyncCrdtMerge* merge) {
+  MergeState state;
+  int status = state.AddLog(merge->local, false, &merge->result.max_hlc);
+  if (status == BIZSYNC_OK) {
+    status = state.AddLog(merge->remote, true, &merge->result.max_hlc);
+  }
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+  state.Merge(&merge->changes, &merge->result.changed_rows);
+  merge->result.operations_merged = state.operation_count();
+  merge->result.change_count = merge->changes.row_count();
+  return BIZSYNC_OK;
+}
+
+static void merge_task_main(BizsyncCrdtMerge* merge) {
+  merge->status = run_merge(merge);
+  if (merge->status != BIZSYNC_OK) {
+    merge->error = bizsync_last_error();
+  }
+  // The change set holds copies of everything it needs.
+  std::vector<uint8_t>().swap(merge->local);
+  std::vector<uint8_t>().swap(merge->remote);
+
+  if (merge->callback != nullptr) {
+    merge->callback(merge->user_data, merge->status);
+  }
+}
+
+}  // namespace bizsync
+
+uint64_t bizsync_hlc_now(BizsyncHlc* clock) {
+  if (clock == nullptr) {
+    return 0;
+  }
+  // A stalled or rewound wall clock keeps counting from the last timestamp;
+  // a counter overflow simply carries into the millisecond bits.
+  uint64_t wall = bizsync::wall_clock_ms() << kCounterBits;
+  clock->last = wall > clock->last ? wall : clock->last + 1;
+  return clock->last;
+}
+
+int bizsync_hlc_receive(BizsyncHlc* clock, uint64_t remote,
+                        uint64_t* out_hlc) {
+  using namespace bizsync;
+
+  if (clock == nullptr) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "clock required");
+  }
+  uint64_t wall_ms = wall_clock_ms();
+  uint64_t remote_ms = remote >> kCounterBits;
+  if (remote_ms > wall_ms + kMaxDriftMs) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "remote clock is %llu ms ahead",
+                    static_cast<unsigned long long>(remote_ms - wall_ms));
+  }
+  clock->last = std::max(clock->last, remote);
+  uint64_t now = bizsync_hlc_now(clock);
+  if (out_hlc != nullptr) {
+    *out_hlc = now;
+  }
+  return BIZSYNC_OK;
+}
+
+int bizsync_crdt_merge_start(const uint8_t* local, size_t local_length,
+                             const uint8_t* remote, size_t remote_length,
+                             BizsyncCrdtCallback callback, void* user_data,
+                             BizsyncCrdtMerge** out_merge) {
+  using namespace bizsync;
+
+  if ((local == nullptr && local_length > 0) ||
+      (remote == nullptr && remote_length > 0) || out_merge == nullptr) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "logs and out_merge required");
+  }
+  *out_merge = nullptr;
+
+  BizsyncCrdtMerge* merge = new BizsyncCrdtMerge();
+  if (local_length > 0) {
+    merge->local.assign(local, local + local_length);
+  }
+  if (remote_length > 0) {
+    merge->remote.assign(remote, remote + remote_length);
+  }
+  merge->callback = callback;
+  merge->user_data = user_data;
+  int status = merge->task.Post([merge] { merge_task_main(merge); });
+  if (status != BIZSYNC_OK) {
+    delete merge;
+    return status;
+  }
+  *out_merge = merge;
+  return BIZSYNC_OK;
+}
+
+int bizsync_crdt_merge_get_result(BizsyncCrdtMerge* merge,
+                                  BizsyncCrdtResult* out_result) {
+  using namespace bizsync;
+
+  if (merge == nullptr || out_result == nullptr) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "merge and out_result required");
+  }
+  if (merge->status != BIZSYNC_OK) {
+    return SetError(merge->status, "%s", merge->error.c_str());
+  }
+  *out_result = merge->result;
+  out_result->changes = merge->changes.data();
+  out_result->changes_length = merge->changes.size();
+  return BIZSYNC_OK;
+}
+
+void bizsync_crdt_merge_free(BizsyncCrdtMerge* merge) {
+  if (merge == nullptr) {
+    return;
+  }
+  merge->task.Wait();
+  delete merge;
+}
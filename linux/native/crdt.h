@@ -0,0 +1,143 @@
+#ifndef BIZSYNC_NATIVE_CRDT_H_
+#define BIZSYNC_NATIVE_CRDT_H_
+
+#include "native_status.h"
+#include "packed_rows.h"
+
+// The conflict-free core of offline sync. Every change is an operation
+// stamped with a hybrid logical clock (HLC) and the id of the device that
+// made it. Fields are last-writer-wins registers. Multi-valued fields such as
+// tags are observed-remove sets.
+//
+// A merge takes the local operation log and one received from a peer. It
+// sorts both into one array grouped by row and field, so one linear pass
+// settles every conflict. The cost is O(n log n) in the operation count, with
+// no calls back into Dart while it runs. The result lists only the fields and
+// set elements whose merged value differs from the local one, which is what
+// Dart must write to its tables.
+//
+// Operation logs are packed row buffers (see packed_rows.h) with these seven
+// columns:
+//
+//   0 kind        INT64  a #BizsyncCrdtKind
+//   1 collection  TEXT   table name
+//   2 key         TEXT   row id
+//   3 field       TEXT   column name, or set name for ADD and REMOVE
+//   4 hlc         INT64  the operation's timestamp; for REMOVE, that of the
+//                        ADD being removed
+//   5 node        INT64  device id; for REMOVE, that of the ADD being removed
+//   6 value       any    the new value for SET, the element for ADD and
+//                        REMOVE
+//
+// The change set uses the same columns. Its SET rows carry the winning
+// write, ADD rows an element that became present and REMOVE rows one that
+// disappeared.
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  BIZSYNC_CRDT_SET = 0,
+  BIZSYNC_CRDT_ADD = 1,
+  BIZSYNC_CRDT_REMOVE = 2,
+} BizsyncCrdtKind;
+
+// A hybrid logical clock: milliseconds since the Unix epoch in the upper 48
+// bits and a counter in the lower 16. Timestamps order like wall time, but
+// they stay unique and increasing when the wall clock stalls or goes
+// backwards. One clock per device; not thread-safe.
+typedef struct {
+  uint64_t last;
+} BizsyncHlc;
+
+/**
+ * bizsync_hlc_now:
+ * @clock: the device clock, zero-initialized on first use.
+ *
+ * Returns: a timestamp after every one @clock has issued or received.
+ */
+BIZSYNC_EXPORT uint64_t bizsync_hlc_now(BizsyncHlc* clock);
+
+/**
+ * bizsync_hlc_receive:
+ * @clock: the device clock.
+ * @remote: the latest timestamp seen from a peer, such as
+ * #BizsyncCrdtResult.max_hlc.
+ * @out_hlc: (out) (allow-none): a timestamp after both.
+ *
+ * Advances @clock past @remote so local writes made afterwards win over
+ * what was received. A peer more than a minute ahead of this machine's wall
+ * clock is refused, so one bad clock cannot drag every device into the
+ * future.
+ *
+ * Returns: %BIZSYNC_OK or %BIZSYNC_ERROR_INVALID_ARGUMENT.
+ */
+BIZSYNC_EXPORT int bizsync_hlc_receive(BizsyncHlc* clock, uint64_t remote,
+                                       uint64_t* out_hlc);
+
+typedef struct BizsyncCrdtMerge BizsyncCrdtMerge;
+
+// Called once on the merge's worker when it finishes, with its
+// #BizsyncStatus. Use NativeCallable.listener from Dart.
+typedef void (*BizsyncCrdtCallback)(void* user_data, int32_t status);
+
+typedef struct {
+  // Packed change set in the operation log layout, owned by the merge.
+  const uint8_t* changes;
+  size_t changes_length;
+  int64_t change_count;
+  // Distinct (collection, key) rows among the changes.
+  int64_t changed_rows;
+  int64_t operations_merged;
+  // Latest timestamp in the remote log, for bizsync_hlc_receive().
+  uint64_t max_hlc;
+} BizsyncCrdtResult;
+
+/**
+ * bizsync_crdt_merge_start:
+ * @local: packed local operation log.
+ * @local_length: size of @local in bytes.
+ * @remote: packed operation log received from a peer.
+ * @remote_length: size of @remote in bytes.
+ * @callback: (allow-none): completion callback.
+ * @user_data: passed to @callback.
+ * @out_merge: (out): location for the running merge.
+ *
+ * Copies both logs and merges them on the shared scheduler. The logs may
+ * overlap; operations present in both are recognised by their timestamp
+ * and device.
+ *
+ * Returns: %BIZSYNC_OK or a negative #BizsyncStatus.
+ */
+BIZSYNC_EXPORT int bizsync_crdt_merge_start(const uint8_t* local,
+                                            size_t local_length,
+                                            const uint8_t* remote,
+                                            size_t remote_length,
+                                            BizsyncCrdtCallback callback,
+                                            void* user_data,
+                                            BizsyncCrdtMerge** out_merge);
+
+/**
+ * bizsync_crdt_merge_get_result:
+ * @merge: a #BizsyncCrdtMerge whose callback has run.
+ * @out_result: (out): the change set, valid until bizsync_crdt_merge_free().
+ *
+ * Returns: the merge's #BizsyncStatus. On failure bizsync_last_error()
+ * describes it on the calling thread.
+ */
+BIZSYNC_EXPORT int bizsync_crdt_merge_get_result(BizsyncCrdtMerge* merge,
+                                                 BizsyncCrdtResult* out_result);
+
+/**
+ * bizsync_crdt_merge_free:
+ * @merge: (allow-none): a #BizsyncCrdtMerge.
+ *
+ * Waits for the merge to finish and releases it with its change set.
+ */
+BIZSYNC_EXPORT void bizsync_crdt_merge_free(BizsyncCrdtMerge* merge);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // BIZSYNC_NATIVE_CRDT_H_
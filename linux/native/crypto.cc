@@ -0,0 +1,870 @@
+#include "crypto.h"
+
+#include <limits.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "packed_rows.h"
+#include "task_scheduler.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define BIZSYNC_CRYPTO_X86 1
+#elif defined(__aarch64__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
+namespace bizsync {
+
+static const size_t kNonceSize = BIZSYNC_AEAD_NONCE_SIZE;
+static const size_t kTagSize = BIZSYNC_AEAD_TAG_SIZE;
+static const size_t kOverhead = BIZSYNC_AEAD_OVERHEAD;
+
+static int32_t cpu_features() {
+  int32_t features = 0;
+#ifdef BIZSYNC_CRYPTO_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul")) {
+    features |= BIZSYNC_CPU_AES;
+  }
+  unsigned int eax, ebx, ecx, edx;
+  if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_SHA)) {
+    features |= BIZSYNC_CPU_SHA;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    features |= BIZSYNC_CPU_AVX2;
+  }
+  if (__builtin_cpu_supports("avx512f")) {
+    features |= BIZSYNC_CPU_AVX512;
+  }
+#elif defined(__aarch64__)
+  unsigned long hwcap = getauxval(AT_HWCAP);
+  if ((hwcap & HWCAP_AES) && (hwcap & HWCAP_PMULL)) {
+    features |= BIZSYNC_CPU_AES;
+  }
+  if (hwcap & HWCAP_SHA2) {
+    features |= BIZSYNC_CPU_SHA;
+  }
+#endif
+  return features;
+}
+
+static const EVP_CIPHER* aead_cipher(int32_t algorithm) {
+  switch (algorithm) {
+    case BIZSYNC_AEAD_AES_256_GCM:
+      return EVP_aes_256_gcm();
+    case BIZSYNC_AEAD_CHACHA20_POLY1305:
+      return EVP_chacha20_poly1305();
+  }
+  return nullptr;
+}
+
+Aead::Aead(int32_t algorithm, const uint8_t* key) {
+  const EVP_CIPHER* cipher = aead_cipher(algorithm);
+  if (cipher == nullptr || key == nullptr) {
+    return;
+  }
+  // Both contexts expand the key now; each value then only sets its nonce.
+  seal_ = EVP_CIPHER_CTX_new();
+  open_ = EVP_CIPHER_CTX_new();
+  if (seal_ != nullptr && open_ != nullptr &&
+      EVP_EncryptInit_ex(seal_, cipher, nullptr, key, nullptr) == 1 &&
+      EVP_DecryptInit_ex(open_, cipher, nullptr, key, nullptr) == 1) {
+    cipher_ = cipher;
+  }
+}
+
+Aead::~Aead() {
+  EVP_CIPHER_CTX_free(seal_);
+  EVP_CIPHER_CTX_free(open_);
+}
+
+int Aead::Seal(const uint8_t* aad, size_t aad_length, const uint8_t* data,
+               size_t length, uint8_t* out) {
+  if (!ok()) {
+    return SetError(BIZSYNC_ERROR_UNSUPPORTED, "cipher unavailable");
+  }
+  if (length > INT_MAX || aad_length > INT_MAX) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "value too large");
+  }
+  uint8_t* nonce = out;
+  uint8_t* ciphertext = out + kNonceSize;
+  int count = 0;
+  if (RAND_bytes(nonce, kNonceSize) != 1 ||
+      EVP_EncryptInit_ex(seal_, nullptr, nullptr, nullptr, nonce) != 1 ||
+      (aad_length > 0 &&
+       EVP_EncryptUpdate(seal_, nullptr, &count, aad, aad_length) != 1) ||
+      (length > 0 &&
+       EVP_EncryptUpdate(seal_, ciphertext, &count, data, length) != 1) ||
+      EVP_EncryptFinal_ex(seal_, ciphertext + length, &count) != 1 ||
+      EVP_CIPHER_CTX_ctrl(seal_, EVP_CTRL_AEAD_GET_TAG, kTagSize,
+                          ciphertext + length) != 1) {
+    return SetError(BIZSYNC_ERROR_UNSUPPORTED, "encryption failed");
+  }
+  return BIZSYNC_OK;
+}
+
+int Aead::Open(const uint8_t* aad, size_t aad_length, const uint8_t* sealed,
+               size_t length, uint8_t* out) {
+  if (!ok()) {
+    return SetError(BIZSYNC_ERROR_UNSUPPORTED, "cipher unavailable");
+  }
+  if (length < kOverhead) {
+    return SetError(BIZSYNC_ERROR_FORMAT, "truncated value");
+  }
+  if (length > INT_MAX || aad_length > INT_MAX) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "value too large");
+  }
+  size_t plain_length = length - kOverhead;
+  const uint8_t* ciphertext = sealed + kNonceSize;
+  int count = 0;
+  if (EVP_DecryptInit_ex(open_, nullptr, nullptr, nullptr, sealed) != 1 ||
+      (aad_length > 0 &&
+       EVP_DecryptUpdate(open_, nullptr, &count, aad, aad_length) != 1) ||
+      (plain_length > 0 && EVP_DecryptUpdate(open_, out, &count, ciphertext,
+                                             plain_length) != 1) ||
+      EVP_CIPHER_CTX_ctrl(open_, EVP_CTRL_AEAD_SET_TAG, kTagSize,
+                          const_cast<uint8_t*>(ciphertext + plain_length)) !=
+          1 ||
+      EVP_DecryptFinal_ex(open_, out + plain_length, &count) != 1) {
+    // The plaintext is written before the tag is checked; wipe it.
+    OPENSSL_cleanse(out, plain_length);
+    return SetError(BIZSYNC_ERROR_FORMAT,
+                    "authentication failed: wrong key or damaged data");
+  }
+  return BIZSYNC_OK;
+}
+
+void Sha256(const void* data, size_t length, uint8_t* out) {
+  EVP_Digest(data, length, out, nullptr, EVP_sha256(), nullptr);
+}
+
+// BLAKE2b as specified by RFC 7693, unkeyed, which Argon2 hashes its
+// inputs and outputs with.
+class Blake2b {
+ public:
+  explicit Blake2b(size_t out_length) : out_length_(out_length) {
+    memcpy(h_, kIv, sizeof(h_));
+    h_[0] ^= 0x01010000 ^ out_length;
+  }
+
+  void Update(const void* data, size_t length) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    while (length > 0) {
+      // The last block is compressed in Final(), so only compress full
+      // blocks once more input follows.
+      if (buffered_ == kBlockSize) {
+        counter_ += kBlockSize;
+        Compress(false);
+        buffered_ = 0;
+      }
+      size_t take = std::min(length, kBlockSize - buffered_);
+      memcpy(buffer_ + buffered_, bytes, take);
+      buffered_ += take;
+      bytes += take;
+      length -= take;
+    }
+  }
+
+  void UpdateUint32(uint32_t value) {
+    uint8_t bytes[4] = {uint8_t(value), uint8_t(value >> 8),
+                        uint8_t(value >> 16), uint8_t(value >> 24)};
+    Update(bytes, sizeof(bytes));
+  }
+
+  void Final(uint8_t* out) {
+    counter_ += buffered_;
+    memset(buffer_ + buffered_, 0, kBlockSize - buffered_);
+    Compress(true);
+    uint8_t digest[64];
+    for (int i = 0; i < 8; i++) {
+      for (int j = 0; j < 8; j++) {
+        digest[i * 8 + j] = uint8_t(h_[i] >> (8 * j));
+      }
+    }
+    memcpy(out, digest, out_length_);
+    OPENSSL_cleanse(digest, sizeof(digest));
+    OPENSSL_cleanse(buffer_, sizeof(buffer_));
+  }
+
+ private:
+  static const size_t kBlockSize = 128;
+  static const uint64_t kIv[8];
+  static const uint8_t kSigma[12][16];
+
+  static uint64_t Rotr(uint64_t x, int n) { return (x >> n) | (x << (64 - n)); }
+
+  void Compress(bool last) {
+    uint64_t m[16];
+    for (int i = 0; i < 16; i++) {
+      m[i] = 0;
+      for (int j = 0; j < 8; j++) {
+        m[i] |= uint64_t{buffer_[i * 8 + j]} << (8 * j);
+      }
+    }
+    uint64_t v[16];
+    memcpy(v, h_, sizeof(h_));
+    memcpy(v + 8, kIv, sizeof(kIv));
+    v[12] ^= counter_;
+    if (last) {
+      v[14] = ~v[14];
+    }
+    for (int round = 0; round < 12; round++) {
+      const uint8_t* s = kSigma[round];
+      Mix(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+      Mix(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+      Mix(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+      Mix(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+      Mix(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+      Mix(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+      Mix(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+      Mix(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+    }
+    for (int i = 0; i < 8; i++) {
+      h_[i] ^= v[i] ^ v[i + 8];
+    }
+  }
+
+  static void Mix(uint64_t* v, int a, int b, int c, int d, uint64_t x,
+                  uint64_t y) {
+    v[a] += v[b] + x;
+    v[d] = Rotr(v[d] ^ v[a], 32);
+    v[c] += v[d];
+    v[b] = Rotr(v[b] ^ v[c], 24);
+    v[a] += v[b] + y;
+    v[d] = Rotr(v[d] ^ v[a], 16);
+    v[c] += v[d];
+    v[b] = Rotr(v[b] ^ v[c], 63);
+  }
+
+  uint64_t h_[8];
+  uint8_t buffer_[kBlockSize] = {};
+  size_t buffered_ = 0;
+  // Inputs here stay far below 2^64 bytes, so the high word is always zero.
+  uint64_t counter_ = 0;
+  size_t out_length_;
+};
+
+const uint64_t Blake2b::kIv[8] = {
+    0x6a09e667f3bcc908, 0xbb67ae8584caa73b, 0x3c6ef372fe94f82b,
+    0xa54ff53a5f1d36f1, 0x510e527fade682d1, 0x9b05688c2b3e6c1f,
+    0x1f83d9abfb41bd6b, 0x5be0cd19137e2179};
+
+const uint8_t Blake2b::kSigma[12][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+    {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+    {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+    {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0},
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+};
+
+void Blake2bDigest(const void* data, size_t length, uint8_t* out,
+                   size_t out_length) {
+  Blake2b hash(out_length);
+  hash.Update(data, length);
+  hash.Final(out);
+}
+
+// Argon2's variable-length hash H' from RFC 9106 section 3.3, over the
+// concatenation of |first| and |second|.
+static void blake2b_long(uint8_t* out, size_t out_length, const void* first,
+                         size_t first_length, const void* second,
+                         size_t second_length) {
+  Blake2b hash(std::min<size_t>(out_length, 64));
+  hash.UpdateUint32(out_length);
+  hash.Update(first, first_length);
+  hash.Update(second, second_length);
+  if (out_length <= 64) {
+    hash.Final(out);
+    return;
+  }
+  uint8_t v[64];
+  hash.Final(v);
+  memcpy(out, v, 32);
+  out += 32;
+  out_length -= 32;
+  while (out_length > 64) {
+    Blake2b next(64);
+    next.Update(v, 64);
+    next.Final(v);
+    memcpy(out, v, 32);
+    out += 32;
+    out_length -= 32;
+  }
+  Blake2b last(out_length);
+  last.Update(v, 64);
+  last.Final(out);
+  OPENSSL_cleanse(v, sizeof(v));
+}
+
+static const int kArgon2Version = 0x13;
+static const int kArgon2idType = 2;
+static const int kSyncPoints = 4;
+static const size_t kBlockWords = 128;
+
+struct Argon2Block {
+  uint64_t v[kBlockWords];
+};
+
+// Computes |next| = G(|prev|, |ref|), XORed into the old |next| when
+// |with_xor| is set, as on passes after the first.
+typedef void (*FillBlockFunction)(const Argon2Block* prev,
+                                  const Argon2Block* ref, Argon2Block* next,
+                                  bool with_xor);
+
+static inline uint64_t blamka(uint64_t x, uint64_t y) {
+  return x + y + 2 * (x & 0xffffffff) * (y & 0xffffffff);
+}
+
+static inline uint64_t rotr64(uint64_t x, int n) {
+  return (x >> n) | (x << (64 - n));
+}
+
+static inline void blamka_g(uint64_t& a, uint64_t& b, uint64_t& c,
+                            uint64_t& d) {
+  a = blamka(a, b);
+  d = rotr64(d ^ a, 32);
+  c = blamka(c, d);
+  b = rotr64(b ^ c, 24);
+  a = blamka(a, b);
+  d = rotr64(d ^ a, 16);
+  c = blamka(c, d);
+  b = rotr64(b ^ c, 63);
+}
+
+// The BLAKE2b round without message words, over 16 words at the given
+// indices of |v|.
+static inline void blamka_round(uint64_t* v, const size_t* i) {
+  blamka_g(v[i[0]], v[i[4]], v[i[8]], v[i[12]]);
+  blamka_g(v[i[1]], v[i[5]], v[i[9]], v[i[13]]);
+  blamka_g(v[i[2]], v[i[6]], v[i[10]], v[i[14]]);
+  blamka_g(v[i[3]], v[i[7]], v[i[11]], v[i[15]]);
+  blamka_g(v[i[0]], v[i[5]], v[i[10]], v[i[15]]);
+  blamka_g(v[i[1]], v[i[6]], v[i[11]], v[i[12]]);
+  blamka_g(v[i[2]], v[i[7]], v[i[8]], v[i[13]]);
+  blamka_g(v[i[3]], v[i[4]], v[i[9]], v[i[14]]);
+}
+
+static void fill_block_scalar(const Argon2Block* prev, const Argon2Block* ref,
+                              Argon2Block* next, bool with_xor) {
+  Argon2Block r;
+  Argon2Block saved;
+  for (size_t i = 0; i < kBlockWords; i++) {
+    r.v[i] = prev->v[i] ^ ref->v[i];
+    saved.v[i] = with_xor ? r.v[i] ^ next->v[i] : r.v[i];
+  }
+  // The block is an 8x8 matrix of 16-byte registers: rounds over each row,
+  // then over each column.
+  for (size_t row = 0; row < 8; row++) {
+    size_t i[16];
+    for (size_t k = 0; k < 16; k++) {
+      i[k] = row * 16 + k;
+    }
+    blamka_round(r.v, i);
+  }
+  for (size_t column = 0; column < 8; column++) {
+    size_t i[16];
+    for (size_t k = 0; k < 16; k++) {
+      i[k] = column * 2 + (k / 2) * 16 + (k % 2);
+    }
+    blamka_round(r.v, i);
+  }
+  for (size_t i = 0; i < kBlockWords; i++) {
+    next->v[i] = saved.v[i] ^ r.v[i];
+  }
+}
+
+#ifdef BIZSYNC_CRYPTO_X86
+__attribute__((target("avx2"))) static inline __m256i blamka_avx2(__m256i x,
+                                                                  __m256i y) {
+  __m256i product = _mm256_mul_epu32(x, y);
+  return _mm256_add_epi64(_mm256_add_epi64(x, y),
+                          _mm256_add_epi64(product, product));
+}
+
+__attribute__((target("avx2"))) static inline __m256i rotr_avx2(__m256i x,
+                                                                int n) {
+  return _mm256_or_si256(_mm256_srli_epi64(x, n), _mm256_slli_epi64(x, 64 - n));
+}
+
+// Four G functions at once, one per 64-bit lane.
+__attribute__((target("avx2"))) static inline void blamka_g_avx2(__m256i& a,
+                                                                 __m256i& b,
+                                                                 __m256i& c,
+                                                                 __m256i& d) {
+  a = blamka_avx2(a, b);
+  d = _mm256_shuffle_epi32(_mm256_xor_si256(d, a), _MM_SHUFFLE(2, 3, 0, 1));
+  c = blamka_avx2(c, d);
+  b = rotr_avx2(_mm256_xor_si256(b, c), 24);
+  a = blamka_avx2(a, b);
+  d = rotr_avx2(_mm256_xor_si256(d, a), 16);
+  c = blamka_avx2(c, d);
+  b = rotr_avx2(_mm256_xor_si256(b, c), 63);
+}
+
+// A full round over rows a, b, c and d of a 4x4 word matrix: columns, then
+// diagonals by rotating rows b, c and d into place and back.
+__attribute__((target("avx2"))) static inline void blamka_round_avx2(
+    __m256i& a,
+    __m256i& b,
+    __m256i& c,
+    __m256i& d) {
+  blamka_g_avx2(a, b, c, d);
+  b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(0, 3, 2, 1));
+  c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(1, 0, 3, 2));
+  d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(2, 1, 0, 3));
+  blamka_g_avx2(a, b, c, d);
+  b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(2, 1, 0, 3));
+  c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(1, 0, 3, 2));
+  d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(0, 3, 2, 1));
+}
+
+__attribute__((target("avx2"))) static inline __m256i load_pair_avx2(
+    const uint64_t* low,
+    const uint64_t* high) {
+  return _mm256_inserti128_si256(
+      _mm256_castsi128_si256(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(low))),
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(high)), 1);
+}
+
+__attribute__((target("avx2"))) static inline void store_pair_avx2(
+    __m256i value,
+    uint64_t* low,
+    uint64_t* high) {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(low),
+                   _mm256_castsi256_si128(value));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(high),
+                   _mm256_extracti128_si256(value, 1));
+}
+
+__attribute__((target("avx2"))) static void fill_block_avx2(
+    const Argon2Block* prev,
+    const Argon2Block* ref,
+    Argon2Block* next,
+    bool with_xor) {
+  Argon2Block r;
+  Argon2Block saved;
+  for (size_t i = 0; i < kBlockWords; i += 4) {
+    __m256i x = _mm256_xor_si256(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(prev->v + i)),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ref->v + i)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(r.v + i), x);
+    if (with_xor) {
+      x = _mm256_xor_si256(
+          x, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(next->v + i)));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(saved.v + i), x);
+  }
+  for (size_t row = 0; row < 8; row++) {
+    __m256i* words = reinterpret_cast<__m256i*>(r.v + row * 16);
+    __m256i a = _mm256_loadu_si256(words);
+    __m256i b = _mm256_loadu_si256(words + 1);
+    __m256i c = _mm256_loadu_si256(words + 2);
+    __m256i d = _mm256_loadu_si256(words + 3);
+    blamka_round_avx2(a, b, c, d);
+    _mm256_storeu_si256(words, a);
+    _mm256_storeu_si256(words + 1, b);
+    _mm256_storeu_si256(words + 2, c);
+    _mm256_storeu_si256(words + 3, d);
+  }
+  // A column's words are pairs 16 apart, so each register joins two pairs.
+  for (size_t column = 0; column < 8; column++) {
+    uint64_t* words = r.v + column * 2;
+    __m256i a = load_pair_avx2(words, words + 16);
+    __m256i b = load_pair_avx2(words + 32, words + 48);
+    __m256i c = load_pair_avx2(words + 64, words + 80);
+    __m256i d = load_pair_avx2(words + 96, words + 112);
+    blamka_round_avx2(a, b, c, d);
+    store_pair_avx2(a, words, words + 16);
+    store_pair_avx2(b, words + 32, words + 48);
+    store_pair_avx2(c, words + 64, words + 80);
+    store_pair_avx2(d, words + 96, words + 112);
+  }
+  for (size_t i = 0; i < kBlockWords; i += 4) {
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(next->v + i),
+        _mm256_xor_si256(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(saved.v + i)),
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(r.v + i))));
+  }
+}
+#endif
+
+static std::atomic<bool> avx2_enabled{true};
+
+static FillBlockFunction select_fill_block() {
+#ifdef BIZSYNC_CRYPTO_X86
+  __builtin_cpu_init();
+  if (avx2_enabled.load(std::memory_order_relaxed) &&
+      __builtin_cpu_supports("avx2")) {
+    return fill_block_avx2;
+  }
+#endif
+  return fill_block_scalar;
+}
+
+bool SetArgon2idAvx2Enabled(bool enabled) {
+  avx2_enabled.store(enabled, std::memory_order_relaxed);
+  return select_fill_block() != fill_block_scalar;
+}
+
+// The memory matrix of one Argon2id computation, filled by RFC 9106
+// section 3.4: lanes are filled in parallel, one slice at a time.
+class Argon2Matrix {
+ public:
+  Argon2Matrix(Argon2Block* memory, uint32_t lanes, uint32_t lane_length,
+               uint32_t passes)
+      : memory_(memory),
+        lanes_(lanes),
+        lane_length_(lane_length),
+        segment_length_(lane_length / kSyncPoints),
+        passes_(passes),
+        fill_block_(select_fill_block()) {}
+
+  void FillSegment(uint32_t pass, uint32_t lane, uint32_t slice) {
+    // Argon2id picks reference blocks independently of the data during the
+    // first half of the first pass, against side channels, and from the
+    // data afterwards, against tradeoff attacks.
+    bool independent = pass == 0 && slice < kSyncPoints / 2;
+    Argon2Block zero = {};
+    Argon2Block input = {};
+    Argon2Block addresses = {};
+    if (independent) {
+      input.v[0] = pass;
+      input.v[1] = lane;
+      input.v[2] = slice;
+      input.v[3] = uint64_t{lanes_} * lane_length_;
+      input.v[4] = passes_;
+      input.v[5] = kArgon2idType;
+    }
+    uint32_t start = 0;
+    if (pass == 0 && slice == 0) {
+      // The first two blocks of each lane come from H0.
+      start = 2;
+      if (independent) {
+        NextAddresses(&zero, &input, &addresses);
+      }
+    }
+    uint32_t offset = lane * lane_length_ + slice * segment_length_ + start;
+    uint32_t previous =
+        offset % lane_length_ == 0 ? offset + lane_length_ - 1 : offset - 1;
+    for (uint32_t index = start; index < segment_length_;
+         index++, offset++, previous++) {
+      if (offset % lane_length_ == 1) {
+        previous = offset - 1;
+      }
+      uint64_t random;
+      if (independent) {
+        if (index % kBlockWords == 0) {
+          NextAddresses(&zero, &input, &addresses);
+        }
+        random = addresses.v[index % kBlockWords];
+      } else {
+        random = memory_[previous].v[0];
+      }
+      uint32_t ref_lane = (pass == 0 && slice == 0)
+                              ? lane
+                              : static_cast<uint32_t>((random >> 32) % lanes_);
+      uint32_t ref_index = ReferenceIndex(pass, slice, index,
+                                          static_cast<uint32_t>(random),
+                                          ref_lane == lane);
+      fill_block_(&memory_[previous],
+                  &memory_[uint64_t{ref_lane} * lane_length_ + ref_index],
+                  &memory_[offset], pass != 0);
+    }
+    OPENSSL_cleanse(&addresses, sizeof(addresses));
+  }
+
+ private:
+  void NextAddresses(const Argon2Block* zero, Argon2Block* input,
+                     Argon2Block* addresses) {
+    input->v[6]++;
+    fill_block_(zero, input, addresses, false);
+    fill_block_(zero, addresses, addresses, false);
+  }
+
+  uint32_t ReferenceIndex(uint32_t pass, uint32_t slice, uint32_t index,
+                          uint32_t random, bool same_lane) {
+    // Blocks that may be referenced: everything finished in this lane, or
+    // only completed segments of other lanes, minus the previous block.
+    uint32_t area;
+    if (pass == 0) {
+      if (slice == 0) {
+        area = index - 1;
+      } else if (same_lane) {
+        area = slice * segment_length_ + index - 1;
+      } else {
+        area = slice * segment_length_ - (index == 0 ? 1 : 0);
+      }
+    } else if (same_lane) {
+      area = lane_length_ - segment_length_ + index - 1;
+    } else {
+      area = lane_length_ - segment_length_ - (index == 0 ? 1 : 0);
+    }
+    uint64_t relative = uint64_t{random} * random >> 32;
+    relative = area - 1 - (uint64_t{area} * relative >> 32);
+    uint32_t start_position = pass != 0 && slice != kSyncPoints - 1
+                                  ? (slice + 1) * segment_length_
+                                  : 0;
+    return static_cast<uint32_t>((start_position + relative) % lane_length_);
+  }
+
+  Argon2Block* memory_;
+  uint32_t lanes_;
+  uint32_t lane_length_;
+  uint32_t segment_length_;
+  uint32_t passes_;
+  FillBlockFunction fill_block_;
+};
+
+int Argon2id(const uint8_t* password, size_t password_length,
+             const uint8_t* salt, size_t salt_length, const uint8_t* secret,
+             size_t secret_length, const uint8_t* associated_data,
+             size_t associated_data_length,
+             const BizsyncArgon2Options* options, uint8_t* out,
+             size_t out_length) {
+  BizsyncArgon2Options defaults = {};
+  if (options == nullptr) {
+    options = &defaults;
+  }
+  uint32_t passes = options->iterations > 0 ? options->iterations : 3;
+  uint32_t lanes = options->parallelism > 0 ? options->parallelism : 4;
+  uint32_t memory_kib = options->memory_kib > 0 ? options->memory_kib : 65536;
+  if (out == nullptr || out_length < 4 || out_length > UINT32_MAX ||
+      (password == nullptr && password_length > 0) ||
+      password_length > UINT32_MAX || salt == nullptr || salt_length < 8 ||
+      salt_length > UINT32_MAX || secret_length > UINT32_MAX ||
+      associated_data_length > UINT32_MAX || options->iterations < 0 ||
+      options->parallelism < 0 || options->memory_kib < 0 ||
+      lanes > 0xffffff || memory_kib < 8 * lanes) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "invalid Argon2id parameters");
+  }
+
+  uint8_t h0[64 + 8];
+  Blake2b hash(64);
+  hash.UpdateUint32(lanes);
+  hash.UpdateUint32(out_length);
+  hash.UpdateUint32(memory_kib);
+  hash.UpdateUint32(passes);
+  hash.UpdateUint32(kArgon2Version);
+  hash.UpdateUint32(kArgon2idType);
+  hash.UpdateUint32(password_length);
+  hash.Update(password, password_length);
+  hash.UpdateUint32(salt_length);
+  hash.Update(salt, salt_length);
+  hash.UpdateUint32(secret_length);
+  hash.Update(secret, secret_length);
+  hash.UpdateUint32(associated_data_length);
+  hash.Update(associated_data, associated_data_length);
+  hash.Final(h0);
+
+  // Memory is rounded down to a whole number of segments in every lane.
+  uint32_t lane_length = memory_kib / (kSyncPoints * lanes) * kSyncPoints;
+  size_t block_count = size_t{lanes} * lane_length;
+  size_t memory_size = block_count * sizeof(Argon2Block);
+  void* mapping = mmap(nullptr, memory_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED) {
+    OPENSSL_cleanse(h0, sizeof(h0));
+    return SetError(BIZSYNC_ERROR_IO, "cannot allocate %u KiB for Argon2id",
+                    memory_kib);
+  }
+  Argon2Block* memory = static_cast<Argon2Block*>(mapping);
+
+  for (uint32_t lane = 0; lane < lanes; lane++) {
+    for (uint32_t i = 0; i < 2; i++) {
+      uint8_t suffix[8] = {uint8_t(i),         0, 0, 0,
+                           uint8_t(lane),      uint8_t(lane >> 8),
+                           uint8_t(lane >> 16), uint8_t(lane >> 24)};
+      uint8_t block[sizeof(Argon2Block)];
+      blake2b_long(block, sizeof(block), h0, 64, suffix, sizeof(suffix));
+      Argon2Block* target = &memory[size_t{lane} * lane_length + i];
+      for (size_t word = 0; word < kBlockWords; word++) {
+        uint64_t value = 0;
+        for (int j = 0; j < 8; j++) {
+          value |= uint64_t{block[word * 8 + j]} << (8 * j);
+        }
+        target->v[word] = value;
+      }
+      OPENSSL_cleanse(block, sizeof(block));
+    }
+  }
+  OPENSSL_cleanse(h0, sizeof(h0));
+
+  // Lanes only read other lanes' finished slices, so each slice is filled on
+  // up to one scheduler worker per lane and finished before the next.
+  Argon2Matrix matrix(memory, lanes, lane_length, passes);
+  uint32_t copies = std::min<uint32_t>(
+      lanes, static_cast<uint32_t>(SchedulerWorkerCount()));
+  for (uint32_t pass = 0; pass < passes; pass++) {
+    for (uint32_t slice = 0; slice < kSyncPoints; slice++) {
+      RunParallel(BIZSYNC_TASK_INTERACTIVE, copies, [&](size_t first) {
+        for (uint32_t lane = first; lane < lanes; lane += copies) {
+          matrix.FillSegment(pass, lane, slice);
+        }
+      });
+    }
+  }
+
+  Argon2Block final_block = memory[lane_length - 1];
+  for (uint32_t lane = 1; lane < lanes; lane++) {
+    const Argon2Block& last = memory[size_t{lane} * lane_length + lane_length - 1];
+    for (size_t word = 0; word < kBlockWords; word++) {
+      final_block.v[word] ^= last.v[word];
+    }
+  }
+  uint8_t bytes[sizeof(Argon2Block)];
+  for (size_t word = 0; word < kBlockWords; word++) {
+    for (int j = 0; j < 8; j++) {
+      bytes[word * 8 + j] = uint8_t(final_block.v[word] >> (8 * j));
+    }
+  }
+  blake2b_long(out, out_length, bytes, sizeof(bytes), nullptr, 0);
+  OPENSSL_cleanse(bytes, sizeof(bytes));
+  OPENSSL_cleanse(&final_block, sizeof(final_block));
+  OPENSSL_cleanse(memory, memory_size);
+  munmap(mapping, memory_size);
+  return BIZSYNC_OK;
+}
+
+}  // namespace bizsync
+
+using bizsync::SetError;
+
+int32_t bizsync_crypto_get_cpu_features(void) {
+  static const int32_t features = bizsync::cpu_features();
+  return features;
+}
+
+int32_t bizsync_aead_preferred(void) {
+  return (bizsync_crypto_get_cpu_features() & BIZSYNC_CPU_AES)
+             ? BIZSYNC_AEAD_AES_256_GCM
+             : BIZSYNC_AEAD_CHACHA20_POLY1305;
+}
+
+int bizsync_aead_seal(int32_t algorithm, const uint8_t* key,
+                      const uint8_t* aad, size_t aad_length,
+                      const uint8_t* data, size_t length, uint8_t* out) {
+  if (key == nullptr || out == nullptr || (data == nullptr && length > 0) ||
+      (aad == nullptr && aad_length > 0)) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "missing argument");
+  }
+  bizsync::Aead aead(algorithm, key);
+  return aead.Seal(aad, aad_length, data, length, out);
+}
+
+int bizsync_aead_open(int32_t algorithm, const uint8_t* key,
+                      const uint8_t* aad, size_t aad_length,
+                      const uint8_t* sealed, size_t length, uint8_t* out) {
+  if (key == nullptr || sealed == nullptr ||
+      (out == nullptr && length > BIZSYNC_AEAD_OVERHEAD) ||
+      (aad == nullptr && aad_length > 0)) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "missing argument");
+  }
+  bizsync::Aead aead(algorithm, key);
+  return aead.Open(aad, aad_length, sealed, length, out);
+}
+
+int bizsync_aead_open_batch(int32_t algorithm, const uint8_t* key,
+                            const uint8_t* aad, size_t aad_length,
+                            const uint8_t* packed, size_t length, uint8_t* out,
+                            size_t* out_length, int64_t* out_failures) {
+  if (key == nullptr || packed == nullptr || out == nullptr ||
+      out_length == nullptr || (aad == nullptr && aad_length > 0)) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "missing argument");
+  }
+  bizsync::Aead aead(algorithm, key);
+  if (!aead.ok()) {
+    return SetError(BIZSYNC_ERROR_UNSUPPORTED, "cipher unavailable");
+  }
+  bizsync::PackedRowReader reader(packed, length);
+  if (!reader.ok()) {
+    return SetError(BIZSYNC_ERROR_FORMAT, "truncated packed rows");
+  }
+  // Every plaintext is shorter than its sealed value, so the result never
+  // outgrows the input and is written straight into |out|.
+  uint64_t count = uint64_t{reader.row_count()} * reader.column_count();
+  memcpy(out, packed, bizsync::kPackedHeaderSize);
+  uint8_t* cursor = out + bizsync::kPackedHeaderSize;
+  int64_t failures = 0;
+  for (uint64_t i = 0; i < count; i++) {
+    bizsync::PackedValue value;
+    if (!reader.Next(&value)) {
+      return SetError(BIZSYNC_ERROR_FORMAT, "malformed packed rows");
+    }
+    if (value.type == BIZSYNC_VALUE_NULL) {
+      *cursor++ = BIZSYNC_VALUE_NULL;
+      continue;
+    }
+    if (value.type != BIZSYNC_VALUE_BLOB && value.type != BIZSYNC_VALUE_TEXT) {
+      return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                      "value %llu is not sealed",
+                      static_cast<unsigned long long>(i));
+    }
+    uint32_t plain_length = value.length - BIZSYNC_AEAD_OVERHEAD;
+    if (value.length < BIZSYNC_AEAD_OVERHEAD ||
+        aead.Open(aad, aad_length, value.bytes, value.length, cursor + 5) !=
+            BIZSYNC_OK) {
+      *cursor++ = BIZSYNC_VALUE_NULL;
+      failures++;
+      continue;
+    }
+    cursor[0] = BIZSYNC_VALUE_BLOB;
+    memcpy(cursor + 1, &plain_length, 4);
+    cursor += 5 + plain_length;
+  }
+  *out_length = cursor - out;
+  if (out_failures != nullptr) {
+    *out_failures = failures;
+  }
+  return BIZSYNC_OK;
+}
+
+void bizsync_sha256(const uint8_t* data, size_t length, uint8_t* out) {
+  bizsync::Sha256(data, length, out);
+}
+
+int bizsync_pbkdf2_sha256(const uint8_t* password, size_t password_length,
+                          const uint8_t* salt, size_t salt_length,
+                          uint32_t iterations, uint8_t* out,
+                          size_t out_length) {
+  if (out == nullptr || (password == nullptr && password_length > 0) ||
+      (salt == nullptr && salt_length > 0) || iterations < 1 ||
+      iterations > INT_MAX || password_length > INT_MAX ||
+      salt_length > INT_MAX || out_length > INT_MAX) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "invalid PBKDF2 parameters");
+  }
+  if (PKCS5_PBKDF2_HMAC(reinterpret_cast<const char*>(password),
+                        password_length, salt, salt_length, iterations,
+                        EVP_sha256(), out_length, out) != 1) {
+    return SetError(BIZSYNC_ERROR_UNSUPPORTED, "PBKDF2 failed");
+  }
+  return BIZSYNC_OK;
+}
+
+int bizsync_argon2id(const uint8_t* password, size_t password_length,
+                     const uint8_t* salt, size_t salt_length,
+                     const BizsyncArgon2Options* options, uint8_t* out,
+                     size_t out_length) {
+  return bizsync::Argon2id(password, password_length, salt, salt_length,
+                           nullptr, 0, nullptr, 0, options, out, out_length);
+}
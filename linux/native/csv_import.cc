@@ -0,0 +1,852 @@
+#include "csv_import.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <locale.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "csv_scan.h"
+#include "task_scheduler.h"
+
+static const int32_t kDefaultBatchRows = 2048;
+
+// Chunks are small enough that a slow one near the end does not leave the
+// other workers idle for long, and large enough that finding the first
+// record boundary in each is negligible.
+static const size_t kChunksPerWorker = 4;
+static const size_t kMinChunkSize = 1024 * 1024;
+
+// What one chunk contributed, combined in file order once every worker is
+// done so record numbers refer to the whole file.
+struct CsvChunkResult {
+  int64_t records = 0;
+  int64_t rejected = 0;
+  int64_t first_rejected = -1;  // 0-based within the chunk.
+  std::string rejection;
+};
+
+namespace bizsync {
+class BatchQueue;
+}
+
+struct BizsyncImport {
+  BizsyncDb* db;
+  std::string path;
+  std::string sql;
+  BizsyncImportOptions options;
+  std::vector<int32_t> column_types;
+
+  std::atomic<bool> cancelled{false};
+  bizsync::CancelOnStop cancel_on_stop{&cancelled};
+  bizsync::TaskGroup task{BIZSYNC_TASK_INTERACTIVE};
+
+  // Set up by the import task and read-only while workers run.
+  const char* data = nullptr;
+  size_t size = 0;
+  bizsync::CsvCharacters characters;
+  bizsync::StructuralMaskFunction scan = nullptr;
+  std::vector<size_t> chunk_starts;  // One past the last chunk holds |size|.
+  std::vector<uint8_t> chunk_in_quotes;
+  locale_t c_locale = static_cast<locale_t>(0);
+
+  std::vector<CsvChunkResult> chunks;
+  std::atomic<size_t> next_chunk{0};
+  std::atomic<int64_t> rows_rejected{0};  // For progress callbacks.
+  std::unique_ptr<bizsync::BatchQueue> queue;
+
+  BizsyncImportResult result = {};
+};
+
+namespace bizsync {
+
+// Full batches waiting for the inserter, and emptied ones waiting for a
+// worker. At most |limit| batches exist, so parsing cannot run more than a
+// few batches ahead of SQLite however large the file is.
+class BatchQueue {
+ public:
+  BatchQueue(uint32_t column_count, size_t limit, size_t producers)
+      : column_count_(column_count), limit_(limit), producers_(producers) {}
+
+  // Returns an empty batch, blocking while all of them are in use, or
+  // nullptr once the import is aborted.
+  PackedRowWriter* Acquire() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto available = [this] {
+      return aborted_ || !free_.empty() || batches_.size() < limit_;
+    };
+    if (!available()) {
+      ScopedBlockingWait blocking;
+      changed_.wait(lock, available);
+    }
+    if (aborted_) {
+      return nullptr;
+    }
+    if (!free_.empty()) {
+      PackedRowWriter* batch = free_.back();
+      free_.pop_back();
+      return batch;
+    }
+    batches_.emplace_back(new PackedRowWriter(column_count_));
+    return batches_.back().get();
+  }
+
+  void Push(PackedRowWriter* batch) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ready_.push_back(batch);
+    changed_.notify_all();
+  }
+
+  void Recycle(PackedRowWriter* batch) {
+    batch->Clear();
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(batch);
+    changed_.notify_all();
+  }
+
+  void ProducerDone() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    producers_--;
+    changed_.notify_all();
+  }
+
+  // Returns the next full batch, or nullptr once every producer is done and
+  // nothing is left, or the import was aborted.
+  PackedRowWriter* Pop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto available = [this] {
+      return aborted_ || !ready_.empty() || producers_ == 0;
+    };
+    if (!available()) {
+      ScopedBlockingWait blocking;
+      changed_.wait(lock, available);
+    }
+    if (aborted_ || ready_.empty()) {
+      return nullptr;
+    }
+    PackedRowWriter* batch = ready_.front();
+    ready_.pop_front();
+    return batch;
+  }
+
+  void Abort() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    aborted_ = true;
+    changed_.notify_all();
+  }
+
+ private:
+  const uint32_t column_count_;
+  const size_t limit_;
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::vector<std::unique_ptr<PackedRowWriter>> batches_;
+  std::vector<PackedRowWriter*> free_;
+  std::deque<PackedRowWriter*> ready_;
+  size_t producers_;
+  bool aborted_ = false;
+};
+
+// Returns the structural mask of the 64 bytes at |position|, padding with
+// zero bytes past the end of the file. |characters| never include NUL.
+static uint64_t block_mask(const BizsyncImport* job, size_t position,
+                           const CsvCharacters& characters) {
+  if (position + 64 <= job->size) {
+    return job->scan(job->data + position, characters);
+  }
+  char tail[64] = {};
+  memcpy(tail, job->data + position, job->size - position);
+  return job->scan(tail, characters);
+}
+
+static uint64_t count_quotes(const BizsyncImport* job, size_t start,
+                             size_t end) {
+  const CsvCharacters quotes = {job->characters.quote, job->characters.quote,
+                                job->characters.quote};
+  uint64_t count = 0;
+  for (size_t position = start; position < end; position += 64) {
+    uint64_t mask = block_mask(job, position, quotes);
+    if (end - position < 64) {
+      mask &= (uint64_t{1} << (end - position)) - 1;
+    }
+    count += __builtin_popcountll(mask);
+  }
+  return count;
+}
+
+static bool valid_utf8(const char* text, size_t length) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(text);
+  size_t i = 0;
+  while (i < length) {
+    // Skip ASCII eight bytes at a time; most business data is mostly ASCII.
+    if (i + 8 <= length) {
+      uint64_t word;
+      memcpy(&word, bytes + i, sizeof(word));
+      if ((word & 0x8080808080808080ull) == 0) {
+        i += 8;
+        continue;
+      }
+    }
+    unsigned char c = bytes[i];
+    if (c < 0x80) {
+      i++;
+      continue;
+    }
+    size_t extra;
+    uint32_t code_point;
+    if ((c & 0xe0) == 0xc0) {
+      extra = 1;
+      code_point = c & 0x1f;
+    } else if ((c & 0xf0) == 0xe0) {
+      extra = 2;
+      code_point = c & 0x0f;
+    } else if ((c & 0xf8) == 0xf0) {
+      extra = 3;
+      code_point = c & 0x07;
+    } else {
+      return false;
+    }
+    if (length - i <= extra) {
+      return false;
+    }
+    for (size_t k = 1; k <= extra; k++) {
+      if ((bytes[i + k] & 0xc0) != 0x80) {
+        return false;
+      }
+      code_point = (code_point << 6) | (bytes[i + k] & 0x3f);
+    }
+    // Reject overlong forms, surrogates and values past U+10FFFF.
+    static const uint32_t kMinimum[] = {0, 0x80, 0x800, 0x10000};
+    if (code_point < kMinimum[extra] || code_point > 0x10ffff ||
+        (code_point >= 0xd800 && code_point <= 0xdfff)) {
+      return false;
+    }
+    i += extra + 1;
+  }
+  return true;
+}
+
+static bool parse_int64(const char* text, size_t length, int64_t* value) {
+  size_t i = 0;
+  bool negative = false;
+  if (i < length && (text[i] == '-' || text[i] == '+')) {
+    negative = text[i] == '-';
+    i++;
+  }
+  if (i == length) {
+    return false;
+  }
+  // Accumulate negatively so INT64_MIN parses without overflow.
+  int64_t result = 0;
+  for (; i < length; i++) {
+    if (text[i] < '0' || text[i] > '9') {
+      return false;
+    }
+    if (__builtin_mul_overflow(result, 10, &result) ||
+        __builtin_sub_overflow(result, text[i] - '0', &result)) {
+      return false;
+    }
+  }
+  if (!negative && __builtin_mul_overflow(result, -1, &result)) {
+    return false;
+  }
+  *value = result;
+  return true;
+}
+
+// Parses the records of one chunk into packed batches.
+class ChunkParser {
+ public:
+  explicit ChunkParser(BizsyncImport* job) : job_(job) {}
+
+  // Parses every record starting in chunk |index|, swapping |*batch| for an
+  // empty one each time it fills. Returns false if the import was aborted,
+  // in which case |*batch| is null.
+  bool ParseChunk(size_t index, PackedRowWriter** batch) {
+    const size_t end = job_->chunk_starts[index + 1];
+    const size_t batch_rows = job_->options.batch_rows;
+    bool skip_header =
+        index == 0 && (job_->options.flags & BIZSYNC_IMPORT_HEADER);
+    CsvChunkResult& result = job_->chunks[index];
+
+    size_t start = FirstRecordStart(index);
+    while (start < end) {
+      if (job_->cancelled) {
+        return true;
+      }
+      start = ParseRecord(start);
+      if (IsBlankLine()) {
+        continue;
+      }
+      if (skip_header) {
+        skip_header = false;
+        continue;
+      }
+
+      int64_t record = result.records++;
+      if (!AppendRecord(*batch)) {
+        (*batch)->DiscardRow();
+        job_->rows_rejected++;
+        if (result.rejected++ == 0) {
+          result.first_rejected = record;
+          result.rejection = rejection_;
+        }
+        continue;
+      }
+      (*batch)->EndRow();
+      if ((*batch)->row_count() >= batch_rows) {
+        job_->queue->Push(*batch);
+        *batch = job_->queue->Acquire();
+        if (*batch == nullptr) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+ private:
+  struct Field {
+    size_t begin;
+    size_t end;  // The delimiter, newline or end of file.
+    bool quoted;
+    bool escaped;  // Holds "" pairs to collapse.
+  };
+
+  // Chunks are cut at arbitrary bytes; a chunk's first record is the one
+  // after the first newline outside quotes, found from the quote parity the
+  // first pass computed.
+  size_t FirstRecordStart(size_t index) const {
+    size_t start = job_->chunk_starts[index];
+    if (index == 0) {
+      return start;
+    }
+    bool in_quotes = job_->chunk_in_quotes[index];
+    if (!in_quotes && job_->data[start - 1] == job_->characters.newline) {
+      return start;
+    }
+    for (size_t i = start; i < job_->size; i++) {
+      char c = job_->data[i];
+      if (c == job_->characters.quote) {
+        in_quotes = !in_quotes;
+      } else if (c == job_->characters.newline && !in_quotes) {
+        return i + 1;
+      }
+    }
+    return job_->size;
+  }
+
+  // Splits the record at |start| into |fields_| and returns where the next
+  // one starts. Every quote toggles quoting, even inside an unquoted field,
+  // so this agrees with the parity FirstRecordStart() relies on.
+  size_t ParseRecord(size_t start) {
+    const CsvCharacters& characters = job_->characters;
+    const char* data = job_->data;
+    const size_t size = job_->size;
+
+    fields_.clear();
+    size_t field_start = start;
+    bool in_quotes = false;
+    bool quoted = false;
+    bool escaped = false;
+    size_t skip_until = start;
+    for (size_t block = start; block < size; block += 64) {
+      uint64_t mask = block_mask(job_, block, characters);
+      while (mask != 0) {
+        size_t at = block + __builtin_ctzll(mask);
+        mask &= mask - 1;
+        if (at < skip_until) {
+          continue;
+        }
+        char c = data[at];
+        if (c == characters.quote) {
+          if (!in_quotes) {
+            in_quotes = true;
+            quoted = quoted || at == field_start;
+          } else if (at + 1 < size && data[at + 1] == characters.quote) {
+            escaped = true;
+            skip_until = at + 2;
+          } else {
+            in_quotes = false;
+          }
+          continue;
+        }
+        if (in_quotes) {
+          continue;
+        }
+        fields_.push_back({field_start, at, quoted, escaped});
+        field_start = at + 1;
+        quoted = false;
+        escaped = false;
+        if (c == characters.newline) {
+          return at + 1;
+        }
+      }
+    }
+    fields_.push_back({field_start, size, quoted, escaped});
+    return size;
+  }
+
+  bool IsBlankLine() const {
+    if (fields_.size() != 1 || fields_[0].quoted) {
+      return false;
+    }
+    size_t length = fields_[0].end - fields_[0].begin;
+    return length == 0 ||
+           (length == 1 && job_->data[fields_[0].begin] == '\r');
+  }
+
+  // Returns the unquoted text of |field|, without a CRLF's carriage return.
+  void FieldText(const Field& field, const char** text, size_t* length) {
+    const char* data = job_->data;
+    const char quote = job_->characters.quote;
+    size_t begin = field.begin;
+    size_t end = field.end;
+    if (end > begin && data[end - 1] == '\r') {
+      end--;
+    }
+    if (field.quoted) {
+      // Anything between the closing quote and the delimiter is dropped. An
+      // unterminated quote runs to the end of the file.
+      size_t close = end;
+      while (close > begin + 1 && data[close - 1] != quote) {
+        close--;
+      }
+      begin++;
+      if (close > begin) {
+        end = close - 1;
+      }
+    }
+    if (!field.escaped) {
+      *text = data + begin;
+      *length = end - begin;
+      return;
+    }
+    scratch_.clear();
+    for (size_t i = begin; i < end; i++) {
+      scratch_.push_back(data[i]);
+      if (data[i] == quote && i + 1 < end && data[i + 1] == quote) {
+        i++;
+      }
+    }
+    *text = scratch_.data();
+    *length = scratch_.size();
+  }
+
+  bool Reject(const char* format, size_t column) {
+    char message[sizeof(BizsyncImportResult::first_rejection)];
+    snprintf(message, sizeof(message), format, column + 1);
+    rejection_ = message;
+    return false;
+  }
+
+  // Converts |fields_| and appends them to |batch| as one row. On failure
+  // the caller discards the partial row.
+  bool AppendRecord(PackedRowWriter* batch) {
+    const std::vector<int32_t>& types = job_->column_types;
+    if (fields_.size() != types.size()) {
+      char message[sizeof(BizsyncImportResult::first_rejection)];
+      snprintf(message, sizeof(message), "expected %zu fields, found %zu",
+               types.size(), fields_.size());
+      rejection_ = message;
+      return false;
+    }
+
+    for (size_t column = 0; column < types.size(); column++) {
+      const char* text;
+      size_t length;
+      FieldText(fields_[column], &text, &length);
+
+      switch (types[column]) {
+        case BIZSYNC_VALUE_INT64:
+        case BIZSYNC_VALUE_FLOAT64: {
+          while (length > 0 && (*text == ' ' || *text == '\t')) {
+            text++;
+            length--;
+          }
+          while (length > 0 &&
+                 (text[length - 1] == ' ' || text[length - 1] == '\t')) {
+            length--;
+          }
+          if (length == 0) {
+            batch->AppendNull();
+            break;
+          }
+          if (types[column] == BIZSYNC_VALUE_INT64) {
+            int64_t value;
+            if (!parse_int64(text, length, &value)) {
+              return Reject("column %zu is not an integer", column);
+            }
+            batch->AppendInt64(value);
+            break;
+          }
+          // strtod needs a terminator; the field may end at the mapping's
+          // last byte.
+          number_.assign(text, length);
+          char* parsed_end = nullptr;
+          double value = strtod(number_.c_str(), &parsed_end);
+          if (parsed_end != number_.c_str() + number_.size() ||
+              !isfinite(value)) {
+            return Reject("column %zu is not a number", column);
+          }
+          batch->AppendFloat64(value);
+          break;
+        }
+        case BIZSYNC_VALUE_BLOB:
+          batch->AppendBlob(text, length);
+          break;
+        default:
+          if (!valid_utf8(text, length)) {
+            return Reject("column %zu is not valid UTF-8", column);
+          }
+          batch->AppendText(text, length);
+          break;
+      }
+    }
+    return true;
+  }
+
+  BizsyncImport* job_;
+  std::vector<Field> fields_;
+  std::string scratch_;
+  std::string number_;
+  std::string rejection_;
+};
+
+static void parse_worker_main(BizsyncImport* job) {
+  // strtod honours the thread's locale; the desktop one may use a decimal
+  // comma.
+  locale_t previous = static_cast<locale_t>(0);
+  if (job->c_locale != static_cast<locale_t>(0)) {
+    previous = uselocale(job->c_locale);
+  }
+
+  ChunkParser parser(job);
+  PackedRowWriter* batch = job->queue->Acquire();
+  while (batch != nullptr && !job->cancelled) {
+    size_t index = job->next_chunk++;
+    if (index >= job->chunks.size() || !parser.ParseChunk(index, &batch)) {
+      break;
+    }
+  }
+  if (batch != nullptr) {
+    if (batch->row_count() > 0 && !job->cancelled) {
+      job->queue->Push(batch);
+    } else {
+      job->queue->Recycle(batch);
+    }
+  }
+  job->queue->ProducerDone();
+
+  if (previous != static_cast<locale_t>(0)) {
+    uselocale(previous);
+  }
+}
+
+// Maps the import file read-only for the duration of the import.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  ~MappedFile() {
+    if (data_ != nullptr) {
+      munmap(data_, size_);
+    }
+  }
+
+  int Open(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return SetError(BIZSYNC_ERROR_IO, "cannot open %s: %s", path.c_str(),
+                      strerror(errno));
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+      int error = errno;
+      close(fd);
+      return SetError(BIZSYNC_ERROR_IO, "cannot stat %s: %s", path.c_str(),
+                      strerror(error));
+    }
+    size_ = static_cast<size_t>(info.st_size);
+    if (size_ > 0) {
+      void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED) {
+        int error = errno;
+        close(fd);
+        return SetError(BIZSYNC_ERROR_IO, "cannot map %s: %s", path.c_str(),
+                        strerror(error));
+      }
+      data_ = data;
+      // Each worker reads its chunk front to back. Advice values are not
+      // flags, so each needs its own call.
+      madvise(data_, size_, MADV_SEQUENTIAL);
+      madvise(data_, size_, MADV_WILLNEED);
+    }
+    close(fd);
+    return BIZSYNC_OK;
+  }
+
+  const char* data() const { return static_cast<const char*>(data_); }
+  size_t size() const { return size_; }
+
+ private:
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  void* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Cuts the mapping into chunks and works out, from the parity of the quotes
+// before each one, whether it starts inside a quoted field.
+static void split_chunks(BizsyncImport* job, size_t worker_count) {
+  size_t begin = 0;
+  // Excel writes a UTF-8 byte order mark.
+  if (job->size >= 3 && memcmp(job->data, "\xef\xbb\xbf", 3) == 0) {
+    begin = 3;
+  }
+  size_t chunk_size = std::max(
+      kMinChunkSize, (job->size - begin) / (worker_count * kChunksPerWorker));
+  job->chunk_starts.clear();
+  for (size_t start = begin; start < job->size; start += chunk_size) {
+    job->chunk_starts.push_back(start);
+  }
+  size_t chunk_count = job->chunk_starts.size();
+  job->chunk_starts.push_back(job->size);
+  job->chunks.assign(chunk_count, CsvChunkResult());
+
+  std::vector<uint64_t> quotes(chunk_count);
+  std::atomic<size_t> next{0};
+  auto count = [&](size_t) {
+    for (size_t i = next++; i < chunk_count; i = next++) {
+      quotes[i] = count_quotes(job, job->chunk_starts[i],
+                               job->chunk_starts[i + 1]);
+    }
+  };
+  RunParallel(BIZSYNC_TASK_INTERACTIVE, std::min(worker_count, chunk_count),
+              count);
+
+  job->chunk_in_quotes.assign(chunk_count, 0);
+  uint64_t total = 0;
+  for (size_t i = 0; i < chunk_count; i++) {
+    job->chunk_in_quotes[i] = total & 1;
+    total += quotes[i];
+  }
+}
+
+static int run_import(BizsyncImport* job) {
+  MappedFile file;
+  int status = file.Open(job->path);
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+  job->data = file.data();
+  job->size = file.size();
+
+  ConnectionLease lease = AcquireWriter(job->db);
+  sqlite3_stmt* statement = nullptr;
+  status = lease.Prepare(job->sql.c_str(), &statement);
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+  size_t parameter_count = sqlite3_bind_parameter_count(statement);
+  if (job->column_types.empty()) {
+    job->column_types.assign(parameter_count, BIZSYNC_VALUE_TEXT);
+  }
+  if (parameter_count == 0 || parameter_count != job->column_types.size()) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "statement has %zu parameters for %zu column types",
+                    parameter_count, job->column_types.size());
+  }
+
+  size_t worker_count = job->options.worker_count;
+  split_chunks(job, worker_count);
+  if (job->chunks.empty()) {
+    return BIZSYNC_OK;
+  }
+  worker_count = std::min(worker_count, job->chunks.size());
+
+  if (sqlite3_exec(lease.handle(), "BEGIN IMMEDIATE", nullptr, nullptr,
+                   nullptr) != SQLITE_OK) {
+    return SetSqliteError(lease.handle(), "begin import");
+  }
+
+  // Two batches per worker keeps everyone busy while the inserter works
+  // through one.
+  job->queue.reset(new BatchQueue(job->column_types.size(),
+                                  worker_count * 2 + 1, worker_count));
+  // The parsers run as scheduler tasks while this one inserts; the
+  // queue's waits let spare threads step in for either side.
+  TaskGroup parsers(BIZSYNC_TASK_INTERACTIVE);
+  for (size_t i = 0; i < worker_count; i++) {
+    parsers.Post([job] { parse_worker_main(job); });
+  }
+
+  while (PackedRowWriter* batch = job->queue->Pop()) {
+    if (job->cancelled) {
+      job->queue->Recycle(batch);
+      break;
+    }
+    PackedRowReader reader(reinterpret_cast<const uint8_t*>(batch->data()),
+                           batch->size());
+    status = lease.ExecuteRows(job->sql.c_str(), &reader,
+                               &job->result.rows_imported);
+    job->queue->Recycle(batch);
+    if (status != BIZSYNC_OK) {
+      break;
+    }
+    if (job->options.callback != nullptr) {
+      job->options.callback(job->options.user_data, BIZSYNC_IMPORT_RUNNING,
+                            job->result.rows_imported, job->rows_rejected);
+    }
+  }
+  job->queue->Abort();
+  parsers.Wait();
+  job->queue.reset();
+
+  if (status == BIZSYNC_OK && job->cancelled) {
+    status = SetError(BIZSYNC_ERROR_CANCELLED, "import cancelled");
+  }
+  if (status == BIZSYNC_OK &&
+      sqlite3_exec(lease.handle(), "COMMIT", nullptr, nullptr, nullptr) !=
+          SQLITE_OK) {
+    status = SetSqliteError(lease.handle(), "commit import");
+  }
+  if (status != BIZSYNC_OK) {
+    sqlite3_exec(lease.handle(), "ROLLBACK", nullptr, nullptr, nullptr);
+    job->result.rows_imported = 0;
+  }
+
+  int64_t records_before = 0;
+  for (const CsvChunkResult& chunk : job->chunks) {
+    if (chunk.first_rejected >= 0 && job->result.first_rejected_record == 0) {
+      job->result.first_rejected_record =
+          records_before + chunk.first_rejected + 1;
+      snprintf(job->result.first_rejection,
+               sizeof(job->result.first_rejection), "%s",
+               chunk.rejection.c_str());
+    }
+    records_before += chunk.records;
+    job->result.rows_rejected += chunk.rejected;
+  }
+  return status;
+}
+
+static void import_task_main(BizsyncImport* job) {
+  int status = run_import(job);
+  job->data = nullptr;
+  job->size = 0;
+  if (job->c_locale != static_cast<locale_t>(0)) {
+    freelocale(job->c_locale);
+    job->c_locale = static_cast<locale_t>(0);
+  }
+
+  if (job->options.callback != nullptr) {
+    job->options.callback(job->options.user_data, status,
+                          job->result.rows_imported,
+                          job->result.rows_rejected);
+  }
+}
+
+}  // namespace bizsync
+
+int bizsync_import_csv_start(BizsyncDb* db, const char* path, const char* sql,
+                             const BizsyncImportOptions* options,
+                             BizsyncImport** out_import) {
+  using namespace bizsync;
+
+  if (db == nullptr || path == nullptr || sql == nullptr ||
+      out_import == nullptr) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "db, path, sql and out_import required");
+  }
+  *out_import = nullptr;
+
+  BizsyncImportOptions settings =
+      options != nullptr ? *options : BizsyncImportOptions{};
+  if (settings.delimiter == 0) {
+    settings.delimiter = ',';
+  }
+  if (settings.delimiter < 1 || settings.delimiter > 127 ||
+      settings.delimiter == '"' || settings.delimiter == '\n' ||
+      settings.delimiter == '\r') {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "unusable delimiter %d",
+                    settings.delimiter);
+  }
+  if (settings.batch_rows <= 0) {
+    settings.batch_rows = kDefaultBatchRows;
+  }
+  if (settings.worker_count <= 0) {
+    settings.worker_count = SchedulerWorkerCount();
+  }
+
+  BizsyncImport* job = new BizsyncImport();
+  if (settings.column_types != nullptr && settings.column_count > 0) {
+    for (int32_t i = 0; i < settings.column_count; i++) {
+      int32_t type = settings.column_types[i];
+      if (type < BIZSYNC_VALUE_INT64 || type > BIZSYNC_VALUE_BLOB) {
+        delete job;
+        return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                        "unknown type %d for column %d", type, i + 1);
+      }
+      job->column_types.push_back(type);
+    }
+  }
+  settings.column_types = nullptr;
+  job->db = db;
+  job->path = path;
+  job->sql = sql;
+  job->options = settings;
+  job->characters = {static_cast<char>(settings.delimiter), '"', '\n'};
+  job->scan = SelectStructuralMask(&job->result.scanner);
+  job->c_locale = newlocale(LC_ALL_MASK, "C", static_cast<locale_t>(0));
+
+  int status = job->task.Post([job] { import_task_main(job); });
+  if (status != BIZSYNC_OK) {
+    if (job->c_locale != static_cast<locale_t>(0)) {
+      freelocale(job->c_locale);
+    }
+    delete job;
+    return status;
+  }
+  *out_import = job;
+  return BIZSYNC_OK;
+}
+
+void bizsync_import_cancel(BizsyncImport* job) {
+  if (job != nullptr) {
+    job->cancelled = true;
+  }
+}
+
+void bizsync_import_get_result(BizsyncImport* job,
+                               BizsyncImportResult* out_result) {
+  if (job != nullptr && out_result != nullptr) {
+    *out_result = job->result;
+  }
+}
+
+void bizsync_import_free(BizsyncImport* job) {
+  if (job == nullptr) {
+    return;
+  }
+  job->task.Wait();
+  if (job->c_locale != static_cast<locale_t>(0)) {
+    freelocale(job->c_locale);
+  }
+  delete job;
+}
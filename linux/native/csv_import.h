@@ -0,0 +1,112 @@
+#ifndef BIZSYNC_NATIVE_CSV_IMPORT_H_
+#define BIZSYNC_NATIVE_CSV_IMPORT_H_
+
+#include "sqlite_engine.h"
+
+// Imports an RFC 4180 CSV file into SQLite on a pool of worker threads. The
+// file is mmapped and cut into chunks; a first parallel pass counts quotes so
+// each worker can find the first record boundary in its chunk, then workers
+// scan their chunks with SIMD, validate and convert each field to the
+// requested column type and hand packed row batches to a single inserter.
+// The whole import is one transaction: it either lands completely or, on
+// error or cancellation, not at all. Rows that fail validation are skipped
+// and counted rather than failing the import.
+//
+// Batches from different chunks are inserted as they complete, so rowid
+// order does not follow file order.
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct BizsyncImport BizsyncImport;
+
+typedef enum {
+  // The first record holds column names and is skipped.
+  BIZSYNC_IMPORT_HEADER = 1 << 0,
+} BizsyncImportFlags;
+
+// Status passed to the callback while the import is still running.
+#define BIZSYNC_IMPORT_RUNNING 1
+
+// Called on a scheduler worker after each inserted batch with
+// BIZSYNC_IMPORT_RUNNING, and exactly once at the end with the final
+// #BizsyncStatus. Use NativeCallable.listener from Dart.
+typedef void (*BizsyncImportCallback)(void* user_data, int32_t status,
+                                      int64_t rows_imported,
+                                      int64_t rows_rejected);
+
+// Zero fields select the default noted beside them.
+typedef struct {
+  int32_t delimiter;     // ','
+  int32_t flags;         // BizsyncImportFlags, none
+  int32_t batch_rows;    // 2048 rows per insert batch
+  int32_t worker_count;  // one per scheduler worker
+  // One BizsyncValueType per statement parameter: INT64 and FLOAT64 fields
+  // must parse completely, TEXT must be valid UTF-8, BLOB is taken as is.
+  // Empty numeric fields bind NULL. NULL means TEXT for every column.
+  const int32_t* column_types;
+  int32_t column_count;  // Entries in |column_types|.
+  BizsyncImportCallback callback;  // none
+  void* user_data;
+} BizsyncImportOptions;
+
+typedef struct {
+  int64_t rows_imported;
+  int64_t rows_rejected;
+  // 1-based record number of the first rejected row, not counting the
+  // header, or 0 if none was rejected.
+  int64_t first_rejected_record;
+  char first_rejection[128];
+  // SIMD implementation used for scanning: "avx2", "sse4.2" or "scalar".
+  const char* scanner;
+} BizsyncImportResult;
+
+/**
+ * bizsync_import_csv_start:
+ * @db: a #BizsyncDb that outlives the import.
+ * @path: CSV file to read.
+ * @sql: INSERT statement with one parameter per CSV column.
+ * @options: (allow-none): import settings, or %NULL for the defaults.
+ * @out_import: (out): location for the running import.
+ *
+ * Copies the arguments and starts importing on the shared scheduler.
+ *
+ * Returns: %BIZSYNC_OK or a negative #BizsyncStatus.
+ */
+BIZSYNC_EXPORT int bizsync_import_csv_start(BizsyncDb* db, const char* path,
+                                            const char* sql,
+                                            const BizsyncImportOptions* options,
+                                            BizsyncImport** out_import);
+
+/**
+ * bizsync_import_cancel:
+ * @job: a #BizsyncImport.
+ *
+ * Asks @job to stop and roll back; its callback then reports
+ * %BIZSYNC_ERROR_CANCELLED unless it had already finished.
+ */
+BIZSYNC_EXPORT void bizsync_import_cancel(BizsyncImport* job);
+
+/**
+ * bizsync_import_get_result:
+ * @job: a finished #BizsyncImport.
+ * @out_result: (out): counters and the first rejection.
+ *
+ * Only valid after the final callback.
+ */
+BIZSYNC_EXPORT void bizsync_import_get_result(BizsyncImport* job,
+                                              BizsyncImportResult* out_result);
+
+/**
+ * bizsync_import_free:
+ * @job: (allow-none): a #BizsyncImport.
+ *
+ * Waits for the import to finish and releases @job.
+ */
+BIZSYNC_EXPORT void bizsync_import_free(BizsyncImport* job);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // BIZSYNC_NATIVE_CSV_IMPORT_H_
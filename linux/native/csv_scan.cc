@@ -0,0 +1,84 @@
+#include "csv_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BIZSYNC_CSV_SCAN_X86 1
+#endif
+
+namespace bizsync {
+
+static uint64_t structural_mask_scalar(const char* block,
+                                       const CsvCharacters& characters) {
+  uint64_t mask = 0;
+  for (int i = 0; i < 64; i++) {
+    char c = block[i];
+    if (c == characters.delimiter || c == characters.quote ||
+        c == characters.newline) {
+      mask |= uint64_t{1} << i;
+    }
+  }
+  return mask;
+}
+
+#ifdef BIZSYNC_CSV_SCAN_X86
+__attribute__((target("avx2"))) static uint64_t structural_mask_avx2(
+    const char* block,
+    const CsvCharacters& characters) {
+  const __m256i delimiter = _mm256_set1_epi8(characters.delimiter);
+  const __m256i quote = _mm256_set1_epi8(characters.quote);
+  const __m256i newline = _mm256_set1_epi8(characters.newline);
+
+  uint64_t mask = 0;
+  for (int half = 0; half < 2; half++) {
+    __m256i bytes = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(block + half * 32));
+    __m256i matches = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(bytes, delimiter),
+                        _mm256_cmpeq_epi8(bytes, quote)),
+        _mm256_cmpeq_epi8(bytes, newline));
+    mask |= static_cast<uint64_t>(static_cast<uint32_t>(
+                _mm256_movemask_epi8(matches)))
+            << (half * 32);
+  }
+  return mask;
+}
+
+// PCMPESTRM compares 16 bytes against a set of up to 16 characters at once.
+__attribute__((target("sse4.2"))) static uint64_t structural_mask_sse42(
+    const char* block,
+    const CsvCharacters& characters) {
+  const __m128i set = _mm_setr_epi8(characters.delimiter, characters.quote,
+                                    characters.newline, 0, 0, 0, 0, 0, 0, 0,
+                                    0, 0, 0, 0, 0, 0);
+  uint64_t mask = 0;
+  for (int quarter = 0; quarter < 4; quarter++) {
+    __m128i bytes = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(block + quarter * 16));
+    __m128i matches = _mm_cmpestrm(
+        set, 3, bytes, 16,
+        _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK);
+    mask |= static_cast<uint64_t>(
+                static_cast<uint16_t>(_mm_cvtsi128_si32(matches)))
+            << (quarter * 16);
+  }
+  return mask;
+}
+#endif
+
+StructuralMaskFunction SelectStructuralMask(const char** name) {
+#ifdef BIZSYNC_CSV_SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    *name = "avx2";
+    return structural_mask_avx2;
+  }
+  if (__builtin_cpu_supports("sse4.2")) {
+    *name = "sse4.2";
+    return structural_mask_sse42;
+  }
+#endif
+  *name = "scalar";
+  return structural_mask_scalar;
+}
+
+}  // namespace bizsync
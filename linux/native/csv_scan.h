@@ -0,0 +1,26 @@
+#ifndef BIZSYNC_NATIVE_CSV_SCAN_H_
+#define BIZSYNC_NATIVE_CSV_SCAN_H_
+
+#include <stdint.h>
+
+namespace bizsync {
+
+// The characters that end or open a CSV field.
+struct CsvCharacters {
+  char delimiter;
+  char quote;
+  char newline;
+};
+
+// Returns a mask with bit i set when block[i] is one of |characters|. Reads
+// exactly 64 bytes from |block|.
+using StructuralMaskFunction = uint64_t (*)(const char* block,
+                                            const CsvCharacters& characters);
+
+// Picks the widest implementation the CPU supports: AVX2, then SSE4.2, then
+// a portable scalar loop. |name| receives a label for logging.
+StructuralMaskFunction SelectStructuralMask(const char** name);
+
+}  // namespace bizsync
+
+#endif  // BIZSYNC_NATIVE_CSV_SCAN_H_
@@ -0,0 +1,752 @@
+#include "gst_rollup.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "task_scheduler.h"
+
+static const int32_t kMaxSource = 255;
+// Rowids per slice of a rebuild scan; slices are handed out to workers as
+// they finish, so a few large invoices do not hold up the rest.
+static const int64_t kSliceRowids = 65536;
+// Rows fetched before their periods are computed and summed.
+static const size_t kBlockRows = 1024;
+// Singapore time, which has no daylight saving.
+static const int64_t kUtcOffsetSeconds = 8 * 3600;
+static const int64_t kNullTime = INT64_MIN;
+
+namespace bizsync {
+
+struct GstSource {
+  int32_t id = 0;
+  int32_t time_unit = BIZSYNC_GST_TIME_SECONDS;
+  std::string table;
+  std::string code;
+  std::string net;
+  std::string tax;
+  std::string time;
+  std::string parent;
+  std::string parent_key;
+  std::string link;
+};
+
+struct GstTotals {
+  int64_t net = 0;
+  int64_t tax = 0;
+  int64_t lines = 0;
+};
+
+}  // namespace bizsync
+
+struct BizsyncGst {
+  BizsyncDb* db;
+  // Registered sources by id. Only used while holding the writer.
+  std::map<int32_t, bizsync::GstSource> sources;
+};
+
+namespace bizsync {
+
+enum GstCodeKind {
+  kStandardRated,
+  kZeroRated,
+  kExempt,
+  // Purchases whose GST is claimed in box 7.
+  kClaimablePurchase,
+  // Purchases in box 5 that carry no claimable GST.
+  kOtherPurchase,
+};
+
+static const struct {
+  const char* code;
+  GstCodeKind kind;
+} kGstCodes[] = {
+    {"SR", kStandardRated},         {"DS", kStandardRated},
+    {"SRRC", kStandardRated},       {"SROVR", kStandardRated},
+    {"ZR", kZeroRated},             {"ES33", kExempt},
+    {"ESN33", kExempt},             {"TX", kClaimablePurchase},
+    {"TX-E33", kClaimablePurchase}, {"TX-N33", kClaimablePurchase},
+    {"TX-RE", kClaimablePurchase},  {"IM", kClaimablePurchase},
+    {"IGDS", kClaimablePurchase},   {"ME", kOtherPurchase},
+    {"ZP", kOtherPurchase},
+};
+
+static int execute(ConnectionLease* lease, const char* sql) {
+  if (sqlite3_exec(lease->handle(), sql, nullptr, nullptr, nullptr) !=
+      SQLITE_OK) {
+    return SetSqliteError(lease->handle(), "gst");
+  }
+  return BIZSYNC_OK;
+}
+
+// |name| as a quoted SQL identifier.
+static std::string ident(const std::string& name) {
+  char* quoted = sqlite3_mprintf("\"%w\"", name.c_str());
+  std::string result = quoted;
+  sqlite3_free(quoted);
+  return result;
+}
+
+// The settings stored in gst_sources, one per line, to notice changes.
+static std::string config_text(const GstSource& source) {
+  return std::to_string(source.time_unit) + "\n" + source.table + "\n" +
+         source.code + "\n" + source.net + "\n" + source.tax + "\n" +
+         source.time + "\n" + source.parent + "\n" + source.parent_key +
+         "\n" + source.link;
+}
+
+static bool parse_config(int32_t id, const std::string& text,
+                         GstSource* source) {
+  std::vector<std::string> fields;
+  size_t start = 0;
+  for (;;) {
+    size_t end = text.find('\n', start);
+    fields.push_back(text.substr(start, end - start));
+    if (end == std::string::npos) {
+      break;
+    }
+    start = end + 1;
+  }
+  if (fields.size() != 9) {
+    return false;
+  }
+  source->id = id;
+  source->time_unit = atoi(fields[0].c_str());
+  source->table = fields[1];
+  source->code = fields[2];
+  source->net = fields[3];
+  source->tax = fields[4];
+  source->time = fields[5];
+  source->parent = fields[6];
+  source->parent_key = fields[7];
+  source->link = fields[8];
+  return true;
+}
+
+// SQL for the yyyymm period of Unix time |time|, matching period_of().
+static std::string period_sql(const GstSource& source,
+                              const std::string& time) {
+  std::string seconds = source.time_unit == BIZSYNC_GST_TIME_MILLISECONDS
+                            ? "(" + time + ") / 1000"
+                            : time;
+  return "coalesce(CAST(strftime('%Y%m', " + seconds + " + " +
+         std::to_string(kUtcOffsetSeconds) +
+         ", 'unixepoch') AS INTEGER), 0)";
+}
+
+// The supply time of the line |row| ("new" or "old") in a trigger.
+static std::string row_time_sql(const GstSource& source,
+                                const std::string& row) {
+  if (source.parent.empty()) {
+    return row + "." + ident(source.time);
+  }
+  return "(SELECT " + ident(source.time) + " FROM " + ident(source.parent) +
+         " WHERE " + ident(source.parent_key) + " = " + row + "." +
+         ident(source.link) + ")";
+}
+
+static const char kUpsertTail[] =
+    " ON CONFLICT(source, period, code) DO UPDATE SET"
+    " net_cents = net_cents + excluded.net_cents,"
+    " tax_cents = tax_cents + excluded.tax_cents,"
+    " lines = lines + excluded.lines;";
+
+// Adds (|sign| "") or removes (|sign| "-") the line |row| in a trigger.
+static std::string row_upsert_sql(const GstSource& source,
+                                  const std::string& row,
+                                  const std::string& sign) {
+  return "INSERT INTO gst_rollups VALUES(" + std::to_string(source.id) + ", " +
+         period_sql(source, row_time_sql(source, row)) +
+         ", coalesce(CAST(" + row + "." + ident(source.code) +
+         " AS TEXT), ''), " + sign + "CAST(coalesce(" + row + "." +
+         ident(source.net) + ", 0) AS INTEGER), " + sign +
+         "CAST(coalesce(" + row + "." + ident(source.tax) +
+         ", 0) AS INTEGER), " + sign + "1)" + kUpsertTail;
+}
+
+// Adds (|sign| "") or removes (|sign| "-") every line of the invoice |row|
+// of the parent table, dated |time|, in a trigger.
+static std::string parent_upsert_sql(const GstSource& source,
+                                     const std::string& row,
+                                     const std::string& time,
+                                     const std::string& sign) {
+  return "INSERT INTO gst_rollups SELECT " + std::to_string(source.id) +
+         ", " + period_sql(source, time) +
+         ", coalesce(CAST(l." + ident(source.code) + " AS TEXT), '') AS c, " +
+         sign + "sum(CAST(coalesce(l." + ident(source.net) +
+         ", 0) AS INTEGER)), " + sign + "sum(CAST(coalesce(l." +
+         ident(source.tax) + ", 0) AS INTEGER)), " + sign + "count(*) FROM " +
+         ident(source.table) + " AS l WHERE l." + ident(source.link) + " = " +
+         row + "." + ident(source.parent_key) + " GROUP BY c" + kUpsertTail;
+}
+
+// Moves the lines of the invoice |row| from the month of |from| to the
+// month of |to|. Lines without an invoice count as undated, as in a
+// rebuild.
+static std::string parent_move_sql(const GstSource& source,
+                                   const std::string& row,
+                                   const std::string& from,
+                                   const std::string& to) {
+  return parent_upsert_sql(source, row, from, "-") +
+         parent_upsert_sql(source, row, to, "");
+}
+
+static std::string trigger_name(const GstSource& source, const char* event) {
+  return "gst_" + std::to_string(source.id) + "_" + event;
+}
+
+static std::string triggers_sql(const GstSource& source) {
+  std::string table = ident(source.table);
+  std::string columns = ident(source.code) + ", " + ident(source.net) + ", " +
+                        ident(source.tax) + ", " +
+                        ident(source.parent.empty() ? source.time
+                                                    : source.link);
+  std::string sql =
+      "CREATE TRIGGER " + trigger_name(source, "insert") +
+      " AFTER INSERT ON " + table + " BEGIN " +
+      row_upsert_sql(source, "new", "") + " END;" + "CREATE TRIGGER " +
+      trigger_name(source, "delete") + " AFTER DELETE ON " + table +
+      " BEGIN " + row_upsert_sql(source, "old", "-") + " END;" +
+      "CREATE TRIGGER " + trigger_name(source, "update") + " AFTER UPDATE OF " +
+      columns + " ON " + table + " BEGIN " +
+      row_upsert_sql(source, "old", "-") + row_upsert_sql(source, "new", "") +
+      " END;";
+  if (!source.parent.empty()) {
+    // Re-dating an invoice moves its lines to the new month. Inserting,
+    // deleting or re-keying one dates or undates the lines linked to it.
+    std::string parent = ident(source.parent);
+    std::string time = ident(source.time);
+    std::string key = ident(source.parent_key);
+    std::string old_time = "old." + time;
+    std::string new_time = "new." + time;
+    sql += "CREATE TRIGGER " + trigger_name(source, "parent") +
+           " AFTER UPDATE OF " + time + ", " + key + " ON " + parent +
+           " WHEN old." + time + " IS NOT new." + time + " OR old." + key +
+           " IS NOT new." + key + " BEGIN " +
+           parent_move_sql(source, "old", old_time, "NULL") +
+           parent_move_sql(source, "new", "NULL", new_time) + " END;" +
+           "CREATE TRIGGER " + trigger_name(source, "parent_insert") +
+           " AFTER INSERT ON " + parent + " BEGIN " +
+           parent_move_sql(source, "new", "NULL", new_time) + " END;" +
+           "CREATE TRIGGER " + trigger_name(source, "parent_delete") +
+           " AFTER DELETE ON " + parent + " BEGIN " +
+           parent_move_sql(source, "old", old_time, "NULL") + " END;";
+  }
+  return sql;
+}
+
+static std::string drop_triggers_sql(const GstSource& source) {
+  std::string sql;
+  for (const char* event : {"insert", "update", "delete", "parent",
+                            "parent_insert", "parent_delete"}) {
+    sql += "DROP TRIGGER IF EXISTS " + trigger_name(source, event) + ";";
+  }
+  return sql;
+}
+
+// The rebuild scan of one slice of rowids, bound as ?1 and ?2.
+static std::string scan_sql(const GstSource& source) {
+  if (source.parent.empty()) {
+    return "SELECT " + ident(source.time) + ", " + ident(source.code) + ", " +
+           ident(source.net) + ", " + ident(source.tax) + " FROM " +
+           ident(source.table) + " WHERE rowid BETWEEN ?1 AND ?2";
+  }
+  return "SELECT p." + ident(source.time) + ", l." + ident(source.code) +
+         ", l." + ident(source.net) + ", l." + ident(source.tax) + " FROM " +
+         ident(source.table) + " AS l LEFT JOIN " + ident(source.parent) +
+         " AS p ON p." + ident(source.parent_key) + " = l." +
+         ident(source.link) + " WHERE l.rowid BETWEEN ?1 AND ?2";
+}
+
+// The yyyymm month of Unix time |time| in Singapore, as SQLite's strftime()
+// computes it, or 0 for kNullTime and dates SQLite cannot represent. Plain
+// integer arithmetic (days to civil date, after Howard Hinnant), so the
+// per-block loop has no calls and vectorizes.
+static int32_t period_of(int64_t time, int32_t time_unit) {
+  if (time == kNullTime) {
+    return 0;
+  }
+  int64_t seconds =
+      (time_unit == BIZSYNC_GST_TIME_MILLISECONDS ? time / 1000 : time) +
+      kUtcOffsetSeconds;
+  int64_t days = (seconds >= 0 ? seconds : seconds - 86399) / 86400;
+  int64_t z = days + 719468;
+  int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+  int64_t doe = z - era * 146097;
+  int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  int64_t mp = (5 * doy + 2) / 153;
+  int64_t month = mp < 10 ? mp + 3 : mp - 9;
+  int64_t year = yoe + era * 400 + (month <= 2 ? 1 : 0);
+  if (year < 0 || year > 9999) {
+    return 0;
+  }
+  return static_cast<int32_t>(year * 100 + month);
+}
+
+// One worker's share of a rebuild, keyed by period << 16 | code index.
+struct GstScan {
+  std::vector<std::string> codes;
+  std::unordered_map<uint64_t, GstTotals> totals;
+
+  uint16_t Intern(const char* code, int length) {
+    for (size_t i = codes.size(); i > 0; i--) {
+      const std::string& known = codes[i - 1];
+      if (known.size() == static_cast<size_t>(length) &&
+          memcmp(known.data(), code, length) == 0) {
+        return static_cast<uint16_t>(i - 1);
+      }
+    }
+    codes.emplace_back(code, length);
+    return static_cast<uint16_t>(codes.size() - 1);
+  }
+
+  // Sums one block. Lines of an invoice, and invoices of a day, sit next to
+  // each other, so runs of one key are summed in registers before touching
+  // the map.
+  void Add(const int64_t* times, const uint16_t* code_indexes,
+           const int64_t* nets, const int64_t* taxes, size_t count,
+           int32_t time_unit) {
+    int32_t periods[kBlockRows];
+    for (size_t i = 0; i < count; i++) {
+      periods[i] = period_of(times[i], time_unit);
+    }
+    size_t i = 0;
+    while (i < count) {
+      uint64_t key = static_cast<uint64_t>(periods[i]) << 16 | code_indexes[i];
+      GstTotals run;
+      for (; i < count && (static_cast<uint64_t>(periods[i]) << 16 |
+                           code_indexes[i]) == key;
+           i++) {
+        run.net += nets[i];
+        run.tax += taxes[i];
+        run.lines++;
+      }
+      GstTotals& total = totals[key];
+      total.net += run.net;
+      total.tax += run.tax;
+      total.lines += run.lines;
+    }
+  }
+};
+
+static int scan_slice(ConnectionLease* lease, sqlite3_stmt* statement,
+                      int64_t first, int64_t last, int32_t time_unit,
+                      GstScan* scan) {
+  sqlite3_bind_int64(statement, 1, first);
+  sqlite3_bind_int64(statement, 2, last);
+  int64_t times[kBlockRows];
+  uint16_t codes[kBlockRows];
+  int64_t nets[kBlockRows];
+  int64_t taxes[kBlockRows];
+  size_t count = 0;
+  int step;
+  while ((step = sqlite3_step(statement)) == SQLITE_ROW) {
+    times[count] = sqlite3_column_type(statement, 0) == SQLITE_NULL
+                       ? kNullTime
+                       : sqlite3_column_int64(statement, 0);
+    const char* code =
+        reinterpret_cast<const char*>(sqlite3_column_text(statement, 1));
+    codes[count] = scan->Intern(code != nullptr ? code : "",
+                                sqlite3_column_bytes(statement, 1));
+    nets[count] = sqlite3_column_int64(statement, 2);
+    taxes[count] = sqlite3_column_int64(statement, 3);
+    if (++count == kBlockRows) {
+      scan->Add(times, codes, nets, taxes, count, time_unit);
+      count = 0;
+    }
+  }
+  scan->Add(times, codes, nets, taxes, count, time_unit);
+  sqlite3_reset(statement);
+  if (step != SQLITE_DONE) {
+    return SetSqliteError(lease->handle(), "gst scan");
+  }
+  return BIZSYNC_OK;
+}
+
+// Recomputes the rollups of |source| inside the writer's open transaction.
+// The writer holds the database's write lock throughout, so every reader
+// sees the same snapshot.
+static int rebuild_source(BizsyncGst* gst, ConnectionLease* writer,
+                          const GstSource& source) {
+  sqlite3_stmt* statement = nullptr;
+  std::string range = "SELECT min(rowid), max(rowid) FROM " +
+                      ident(source.table);
+  if (sqlite3_prepare_v2(writer->handle(), range.c_str(), -1, &statement,
+                         nullptr) != SQLITE_OK) {
+    return SetSqliteError(writer->handle(), "gst range");
+  }
+  bool empty = sqlite3_step(statement) != SQLITE_ROW ||
+               sqlite3_column_type(statement, 0) == SQLITE_NULL;
+  int64_t min_rowid = empty ? 0 : sqlite3_column_int64(statement, 0);
+  int64_t max_rowid = empty ? -1 : sqlite3_column_int64(statement, 1);
+  sqlite3_finalize(statement);
+
+  std::string delete_sql =
+      "DELETE FROM gst_rollups WHERE source = " + std::to_string(source.id);
+  int status = execute(writer, delete_sql.c_str());
+  if (status != BIZSYNC_OK || empty) {
+    return status;
+  }
+
+  int64_t slices = (max_rowid - min_rowid) / kSliceRowids + 1;
+  size_t copies = static_cast<size_t>(
+      std::min<int64_t>({SchedulerWorkerCount(), ReaderCount(gst->db),
+                         slices}));
+  std::string sql = scan_sql(source);
+  std::vector<GstScan> scans(copies);
+  std::atomic<int64_t> next{0};
+  std::mutex error_mutex;
+  int error_status = BIZSYNC_OK;
+  std::string error;
+  RunParallel(BIZSYNC_TASK_INTERACTIVE, copies, [&](size_t copy) {
+    ConnectionLease lease = [&] {
+      ScopedBlockingWait blocking;
+      return AcquireReader(gst->db);
+    }();
+    sqlite3_stmt* scan = nullptr;
+    int copy_status = lease.Prepare(sql.c_str(), &scan);
+    for (int64_t slice = next++; copy_status == BIZSYNC_OK && slice < slices;
+         slice = next++) {
+      int64_t first = min_rowid + slice * kSliceRowids;
+      copy_status = scan_slice(&lease, scan, first, first + kSliceRowids - 1,
+                               source.time_unit, &scans[copy]);
+    }
+    if (copy_status != BIZSYNC_OK) {
+      // Stop the other copies at their next slice.
+      next = slices;
+      std::lock_guard<std::mutex> lock(error_mutex);
+      error_status = copy_status;
+      error = bizsync_last_error();
+    }
+  });
+  if (error_status != BIZSYNC_OK) {
+    return SetError(error_status, "%s", error.c_str());
+  }
+
+  std::map<std::pair<int32_t, std::string>, GstTotals> merged;
+  for (const GstScan& scan : scans) {
+    for (const auto& entry : scan.totals) {
+      GstTotals& total = merged[{static_cast<int32_t>(entry.first >> 16),
+                                 scan.codes[entry.first & 0xffff]}];
+      total.net += entry.second.net;
+      total.tax += entry.second.tax;
+      total.lines += entry.second.lines;
+    }
+  }
+  status = writer->Prepare(
+      "INSERT INTO gst_rollups VALUES(?1, ?2, ?3, ?4, ?5, ?6)", &statement);
+  for (auto it = merged.begin(); status == BIZSYNC_OK && it != merged.end();
+       ++it) {
+    sqlite3_bind_int(statement, 1, source.id);
+    sqlite3_bind_int(statement, 2, it->first.first);
+    sqlite3_bind_text(statement, 3, it->first.second.data(),
+                      static_cast<int>(it->first.second.size()),
+                      SQLITE_STATIC);
+    sqlite3_bind_int64(statement, 4, it->second.net);
+    sqlite3_bind_int64(statement, 5, it->second.tax);
+    sqlite3_bind_int64(statement, 6, it->second.lines);
+    if (sqlite3_step(statement) != SQLITE_DONE) {
+      status = SetSqliteError(writer->handle(), "gst rollup");
+    }
+    sqlite3_reset(statement);
+  }
+  return status;
+}
+
+static int load_sources(BizsyncGst* gst, ConnectionLease* lease) {
+  sqlite3_stmt* statement = nullptr;
+  int status =
+      lease->Prepare("SELECT source, config FROM gst_sources", &statement);
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+  int step;
+  while ((step = sqlite3_step(statement)) == SQLITE_ROW) {
+    GstSource source;
+    const char* config =
+        reinterpret_cast<const char*>(sqlite3_column_text(statement, 1));
+    if (config != nullptr &&
+        parse_config(sqlite3_column_int(statement, 0), config, &source)) {
+      gst->sources[source.id] = source;
+    }
+  }
+  sqlite3_reset(statement);
+  if (step != SQLITE_DONE) {
+    return SetSqliteError(lease->handle(), "gst sources");
+  }
+  return BIZSYNC_OK;
+}
+
+static bool has_column(ConnectionLease* lease, const std::string& table,
+                       const std::string& column) {
+  return sqlite3_table_column_metadata(lease->handle(), "main", table.c_str(),
+                                       column.c_str(), nullptr, nullptr,
+                                       nullptr, nullptr, nullptr) == SQLITE_OK;
+}
+
+static bool valid_name(const char* name) {
+  return name != nullptr && *name != '\0' && strchr(name, '\n') == nullptr;
+}
+
+}  // namespace bizsync
+
+int bizsync_gst_open(BizsyncDb* db, BizsyncGst** out_gst) {
+  using namespace bizsync;
+
+  if (db == nullptr || out_gst == nullptr) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "db and out_gst required");
+  }
+  *out_gst = nullptr;
+
+  std::unique_ptr<BizsyncGst> gst(new BizsyncGst());
+  gst->db = db;
+  ConnectionLease lease = AcquireWriter(db);
+  int status = execute(
+      &lease,
+      "CREATE TABLE IF NOT EXISTS gst_rollups("
+      "  source INTEGER NOT NULL, period INTEGER NOT NULL,"
+      "  code TEXT NOT NULL, net_cents INTEGER NOT NULL,"
+      "  tax_cents INTEGER NOT NULL, lines INTEGER NOT NULL,"
+      "  PRIMARY KEY(source, period, code)) WITHOUT ROWID;"
+      "CREATE TABLE IF NOT EXISTS gst_sources("
+      "  source INTEGER PRIMARY KEY, config TEXT NOT NULL)");
+  if (status == BIZSYNC_OK) {
+    status = load_sources(gst.get(), &lease);
+  }
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+  *out_gst = gst.release();
+  return BIZSYNC_OK;
+}
+
+int bizsync_gst_add_source(BizsyncGst* gst, const BizsyncGstSource* source) {
+  using namespace bizsync;
+
+  if (gst == nullptr || source == nullptr || !valid_name(source->table) ||
+      !valid_name(source->code_column) || !valid_name(source->net_column) ||
+      !valid_name(source->tax_column) || !valid_name(source->time_column)) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "gst, table and code, net, tax and time columns required");
+  }
+  if (source->source < 1 || source->source > kMaxSource) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "source %d outside 1 to %d", source->source, kMaxSource);
+  }
+  if (source->time_unit != BIZSYNC_GST_TIME_SECONDS &&
+      source->time_unit != BIZSYNC_GST_TIME_MILLISECONDS) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "bad time unit %d",
+                    source->time_unit);
+  }
+  bool parent = source->parent_table != nullptr;
+  if (parent && (!valid_name(source->parent_table) ||
+                 !valid_name(source->parent_key) ||
+                 !valid_name(source->link_column))) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "parent_table needs parent_key and link_column");
+  }
+
+  GstSource config;
+  config.id = source->source;
+  config.time_unit = source->time_unit;
+  config.table = source->table;
+  config.code = source->code_column;
+  config.net = source->net_column;
+  config.tax = source->tax_column;
+  config.time = source->time_column;
+  if (parent) {
+    config.parent = source->parent_table;
+    config.parent_key = source->parent_key;
+    config.link = source->link_column;
+  }
+  std::string text = config_text(config);
+
+  ConnectionLease lease = AcquireWriter(gst->db);
+  // Unknown names in double quotes would otherwise be taken as strings.
+  if (!has_column(&lease, config.table, "rowid")) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "%s is not a rowid table",
+                    config.table.c_str());
+  }
+  for (const std::string* column :
+       {&config.code, &config.net, &config.tax,
+        parent ? &config.link : &config.time}) {
+    if (!has_column(&lease, config.table, *column)) {
+      return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "%s has no column %s",
+                      config.table.c_str(), column->c_str());
+    }
+  }
+  if (parent && (!has_column(&lease, config.parent, config.parent_key) ||
+                 !has_column(&lease, config.parent, config.time))) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "%s needs columns %s and %s", config.parent.c_str(),
+                    config.parent_key.c_str(), config.time.c_str());
+  }
+  int status = execute(&lease, "BEGIN IMMEDIATE");
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+
+  // Current if unchanged and its triggers still exist; dropping a table
+  // drops them too.
+  std::string check =
+      "SELECT (SELECT count(*) FROM gst_sources WHERE source = ?1 AND"
+      "        config = ?2) +"
+      "       (SELECT count(*) FROM sqlite_schema WHERE type = 'trigger'"
+      "        AND name IN (?3, ?4, ?5, ?6, ?7, ?8))";
+  std::string names[] = {
+      trigger_name(config, "insert"), trigger_name(config, "update"),
+      trigger_name(config, "delete"), trigger_name(config, "parent"),
+      trigger_name(config, "parent_insert"),
+      trigger_name(config, "parent_delete")};
+  bool current = false;
+  sqlite3_stmt* statement = nullptr;
+  if (sqlite3_prepare_v2(lease.handle(), check.c_str(), -1, &statement,
+                         nullptr) == SQLITE_OK) {
+    sqlite3_bind_int(statement, 1, config.id);
+    sqlite3_bind_text(statement, 2, text.c_str(), -1, SQLITE_STATIC);
+    for (int i = 0; i < 6; i++) {
+      sqlite3_bind_text(statement, 3 + i, names[i].c_str(), -1,
+                        SQLITE_STATIC);
+    }
+    current = sqlite3_step(statement) == SQLITE_ROW &&
+              sqlite3_column_int(statement, 0) == (parent ? 7 : 4);
+    sqlite3_finalize(statement);
+  } else {
+    status = SetSqliteError(lease.handle(), "check gst source");
+  }
+
+  if (status == BIZSYNC_OK && !current) {
+    std::string sql = drop_triggers_sql(config) + triggers_sql(config);
+    char* save = sqlite3_mprintf(
+        "INSERT OR REPLACE INTO gst_sources VALUES(%d, %Q)", config.id,
+        text.c_str());
+    sql += save;
+    sqlite3_free(save);
+    status = execute(&lease, sql.c_str());
+    if (status == BIZSYNC_OK) {
+      status = rebuild_source(gst, &lease, config);
+    }
+  }
+
+  if (status == BIZSYNC_OK) {
+    status = execute(&lease, "COMMIT");
+  }
+  if (status != BIZSYNC_OK) {
+    sqlite3_exec(lease.handle(), "ROLLBACK", nullptr, nullptr, nullptr);
+    return status;
+  }
+  gst->sources[config.id] = config;
+  return BIZSYNC_OK;
+}
+
+int bizsync_gst_rebuild(BizsyncGst* gst, int32_t source) {
+  using namespace bizsync;
+
+  if (gst == nullptr) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "gst required");
+  }
+  ConnectionLease lease = AcquireWriter(gst->db);
+  if (source != 0 && gst->sources.count(source) == 0) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "no gst source %d",
+                    source);
+  }
+  int status = execute(&lease, "BEGIN IMMEDIATE");
+  for (auto it = gst->sources.begin();
+       status == BIZSYNC_OK && it != gst->sources.end(); ++it) {
+    if (source == 0 || it->first == source) {
+      status = rebuild_source(gst, &lease, it->second);
+    }
+  }
+  if (status == BIZSYNC_OK) {
+    status = execute(&lease, "COMMIT");
+  }
+  if (status != BIZSYNC_OK) {
+    sqlite3_exec(lease.handle(), "ROLLBACK", nullptr, nullptr, nullptr);
+  }
+  return status;
+}
+
+int bizsync_gst_return(BizsyncGst* gst, int32_t first_period,
+                       int32_t last_period, BizsyncGstReturn* out_return) {
+  using namespace bizsync;
+
+  if (gst == nullptr || out_return == nullptr) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "gst and out_return required");
+  }
+  *out_return = BizsyncGstReturn();
+  ConnectionLease lease = AcquireReader(gst->db);
+  sqlite3_stmt* statement = nullptr;
+  int status = lease.Prepare(
+      "SELECT code, sum(net_cents), sum(tax_cents), sum(lines)"
+      " FROM gst_rollups WHERE period BETWEEN ?1 AND ?2 GROUP BY code",
+      &statement);
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+  sqlite3_bind_int(statement, 1, first_period);
+  sqlite3_bind_int(statement, 2, last_period);
+  int step;
+  while ((step = sqlite3_step(statement)) == SQLITE_ROW) {
+    const char* code =
+        reinterpret_cast<const char*>(sqlite3_column_text(statement, 0));
+    int64_t net = sqlite3_column_int64(statement, 1);
+    int64_t tax = sqlite3_column_int64(statement, 2);
+    int64_t lines = sqlite3_column_int64(statement, 3);
+    const GstCodeKind* kind = nullptr;
+    for (const auto& entry : kGstCodes) {
+      if (code != nullptr && strcmp(code, entry.code) == 0) {
+        kind = &entry.kind;
+        break;
+      }
+    }
+    if (kind == nullptr) {
+      out_return->other_lines += lines;
+      continue;
+    }
+    out_return->lines += lines;
+    switch (*kind) {
+      case kStandardRated:
+        out_return->standard_rated_cents += net;
+        out_return->output_tax_cents += tax;
+        break;
+      case kZeroRated:
+        out_return->zero_rated_cents += net;
+        break;
+      case kExempt:
+        out_return->exempt_cents += net;
+        break;
+      case kClaimablePurchase:
+        out_return->taxable_purchases_cents += net;
+        out_return->input_tax_cents += tax;
+        break;
+      case kOtherPurchase:
+        out_return->taxable_purchases_cents += net;
+        break;
+    }
+  }
+  sqlite3_reset(statement);
+  if (step != SQLITE_DONE) {
+    return SetSqliteError(lease.handle(), "gst return");
+  }
+  out_return->total_supplies_cents = out_return->standard_rated_cents +
+                                     out_return->zero_rated_cents +
+                                     out_return->exempt_cents;
+  out_return->net_gst_cents =
+      out_return->output_tax_cents - out_return->input_tax_cents;
+  return BIZSYNC_OK;
+}
+
+void bizsync_gst_close(BizsyncGst* gst) {
+  delete gst;
+}
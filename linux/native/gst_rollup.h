@@ -0,0 +1,150 @@
+#ifndef BIZSYNC_NATIVE_GST_ROLLUP_H_
+#define BIZSYNC_NATIVE_GST_ROLLUP_H_
+
+#include "sqlite_engine.h"
+
+// GST F5/F7 figures and dashboard totals from materialized rollups instead
+// of scans over the whole invoice history. The gst_rollups table holds one
+// row per source, month and GST code:
+//
+//   gst_rollups(source, period, code, net_cents, tax_cents, lines)
+//
+// |period| is the month as yyyymm in Singapore time (UTC+8), or 0 for rows
+// without a date. Amounts are integer cents.
+//
+// Each line table is registered once with bizsync_gst_add_source(). Triggers
+// on it, and on its parent table when dates live on the invoice, keep the
+// rollups current on every insert, update and delete from any connection.
+// Registering a new or changed source rebuilds its rollups once. The rebuild
+// splits the table's rowid range into slices and aggregates them on every
+// worker at once, each on its own reader connection, then writes the totals
+// in one transaction.
+//
+// A quarter's F5 then reads three months of rollups, and dashboard tiles can
+// query gst_rollups directly, e.g. through bizsync_db_query_columns(). F7
+// corrections are F5 figures for a past period that has since been edited;
+// compare them with the figures filed.
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct BizsyncGst BizsyncGst;
+
+typedef enum {
+  BIZSYNC_GST_TIME_SECONDS = 0,
+  BIZSYNC_GST_TIME_MILLISECONDS = 1,
+} BizsyncGstTimeUnit;
+
+// A table of invoice or bill lines. Column names are plain identifiers.
+typedef struct {
+  // Identifies the source in gst_rollups, 1 to 255.
+  int32_t source;
+  // A #BizsyncGstTimeUnit for |time_column|.
+  int32_t time_unit;
+  // A rowid table.
+  const char* table;
+  // IRAS GST code such as SR, ZR, ES33 or TX; see #BizsyncGstReturn.
+  const char* code_column;
+  // Value excluding GST, and the GST on it, both INTEGER cents.
+  const char* net_column;
+  const char* tax_column;
+  // INTEGER Unix time of the supply. A column of |parent_table| if that is
+  // set, otherwise of |table|.
+  const char* time_column;
+  // (allow-none): the invoice table holding the date, joined on
+  // |table|.|link_column| = |parent_table|.|parent_key|.
+  const char* parent_table;
+  const char* parent_key;
+  const char* link_column;
+} BizsyncGstSource;
+
+// F5 boxes for a range of months, in cents.
+typedef struct {
+  // Box 1: standard-rated supplies (SR, DS, SRRC, SROVR).
+  int64_t standard_rated_cents;
+  // Box 2: zero-rated supplies (ZR).
+  int64_t zero_rated_cents;
+  // Box 3: exempt supplies (ES33, ESN33).
+  int64_t exempt_cents;
+  // Box 4: boxes 1 to 3.
+  int64_t total_supplies_cents;
+  // Box 5: taxable purchases (TX, TX-E33, TX-N33, TX-RE, IM, ME, IGDS,
+  // ZP).
+  int64_t taxable_purchases_cents;
+  // Box 6: GST on box 1 supplies.
+  int64_t output_tax_cents;
+  // Box 7: GST on TX, TX-E33, TX-N33, TX-RE, IM and IGDS purchases, before
+  // any partial exemption apportionment.
+  int64_t input_tax_cents;
+  // Box 8: box 6 minus box 7; negative for a refund.
+  int64_t net_gst_cents;
+  // Lines counted in any box, and lines with other codes (such as OS, EP,
+  // OP or BL), which are left out.
+  int64_t lines;
+  int64_t other_lines;
+} BizsyncGstReturn;
+
+/**
+ * bizsync_gst_open:
+ * @db: a #BizsyncDb.
+ * @out_gst: (out): location for the engine, close with bizsync_gst_close()
+ * before closing @db.
+ *
+ * Creates the rollup tables on @db if missing.
+ *
+ * Returns: %BIZSYNC_OK or a negative #BizsyncStatus.
+ */
+BIZSYNC_EXPORT int bizsync_gst_open(BizsyncDb* db, BizsyncGst** out_gst);
+
+/**
+ * bizsync_gst_add_source:
+ * @gst: a #BizsyncGst.
+ * @source: the line table to roll up.
+ *
+ * Installs the triggers that maintain the rollups of @source. If the source
+ * is new or changed, or its triggers are gone, also rebuilds its rollups,
+ * which takes a full scan. Safe to call on every start.
+ *
+ * Returns: %BIZSYNC_OK or a negative #BizsyncStatus.
+ */
+BIZSYNC_EXPORT int bizsync_gst_add_source(BizsyncGst* gst,
+                                          const BizsyncGstSource* source);
+
+/**
+ * bizsync_gst_rebuild:
+ * @gst: a #BizsyncGst.
+ * @source: a registered source, or 0 for all of them.
+ *
+ * Recomputes rollups from the line tables, for example after writes made
+ * with the triggers dropped. Writes wait until it finishes.
+ *
+ * Returns: %BIZSYNC_OK or a negative #BizsyncStatus.
+ */
+BIZSYNC_EXPORT int bizsync_gst_rebuild(BizsyncGst* gst, int32_t source);
+
+/**
+ * bizsync_gst_return:
+ * @gst: a #BizsyncGst.
+ * @first_period: first month as yyyymm, e.g. 202501.
+ * @last_period: last month, inclusive, e.g. 202503 for the first quarter.
+ * @out_return: (out): the F5 boxes over every source.
+ *
+ * Returns: %BIZSYNC_OK or a negative #BizsyncStatus.
+ */
+BIZSYNC_EXPORT int bizsync_gst_return(BizsyncGst* gst, int32_t first_period,
+                                      int32_t last_period,
+                                      BizsyncGstReturn* out_return);
+
+/**
+ * bizsync_gst_close:
+ * @gst: (allow-none): a #BizsyncGst.
+ *
+ * Releases @gst. The rollups and triggers stay in the database.
+ */
+BIZSYNC_EXPORT void bizsync_gst_close(BizsyncGst* gst);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // BIZSYNC_NATIVE_GST_ROLLUP_H_
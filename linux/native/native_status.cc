@@ -0,0 +1,26 @@
+#include "native_status.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include <string>
+
+static thread_local std::string last_error;
+
+const char* bizsync_last_error(void) {
+  return last_error.c_str();
+}
+
+namespace bizsync {
+
+int SetError(int status, const char* format, ...) {
+  char message[512];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+  last_error = message;
+  return status;
+}
+
+}  // namespace bizsync
@@ -0,0 +1,51 @@
+#ifndef BIZSYNC_NATIVE_STATUS_H_
+#define BIZSYNC_NATIVE_STATUS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// libbizsync_native is loaded from Dart with dart:ffi, so its API is plain C.
+// Symbols are hidden by default; only declarations marked BIZSYNC_EXPORT are
+// visible to DynamicLibrary.lookup().
+#define BIZSYNC_EXPORT __attribute__((visibility("default")))
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Status codes returned by every fallible native call. On failure a
+// description is available from bizsync_last_error() on the same thread.
+typedef enum {
+  BIZSYNC_OK = 0,
+  BIZSYNC_ERROR_INVALID_ARGUMENT = -1,
+  BIZSYNC_ERROR_SQLITE = -2,
+  BIZSYNC_ERROR_IO = -3,
+  BIZSYNC_ERROR_FORMAT = -4,
+  BIZSYNC_ERROR_CANCELLED = -5,
+  BIZSYNC_ERROR_UNSUPPORTED = -6,
+} BizsyncStatus;
+
+/**
+ * bizsync_last_error:
+ *
+ * Returns: (transfer none): a description of the last failure on the calling
+ * thread, or an empty string. Valid until the next native call on that
+ * thread.
+ */
+BIZSYNC_EXPORT const char* bizsync_last_error(void);
+
+#ifdef __cplusplus
+}  // extern "C"
+
+namespace bizsync {
+
+// Records a printf-style message as the calling thread's last error and
+// returns |status|, so failures can be reported with
+// `return SetError(BIZSYNC_ERROR_IO, "...", ...);`.
+int SetError(int status, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+}  // namespace bizsync
+#endif
+
+#endif  // BIZSYNC_NATIVE_STATUS_H_
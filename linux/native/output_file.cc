@@ -0,0 +1,145 @@
+#include "output_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "native_status.h"
+
+namespace bizsync {
+
+static const size_t kDirectIoAlignment = 4096;
+
+OutputFile::~OutputFile() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+  if (!committed_ && !partial_path_.empty()) {
+    unlink(partial_path_.c_str());
+  }
+  free(buffer_);
+}
+
+int OutputFile::Open(const std::string& path, size_t buffer_size,
+                     bool direct_io) {
+  path_ = path;
+  partial_path_ = path + ".partial";
+  capacity_ = (buffer_size + kDirectIoAlignment - 1) / kDirectIoAlignment *
+              kDirectIoAlignment;
+  if (capacity_ == 0 ||
+      posix_memalign(reinterpret_cast<void**>(&buffer_), kDirectIoAlignment,
+                     capacity_) != 0) {
+    buffer_ = nullptr;
+    return SetError(BIZSYNC_ERROR_IO, "cannot allocate %zu byte buffer",
+                    capacity_);
+  }
+
+  int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+  if (direct_io) {
+    fd_ = open(partial_path_.c_str(), flags | O_DIRECT, 0644);
+    direct_io_ = fd_ >= 0;
+  }
+  // tmpfs and some FUSE filesystems reject O_DIRECT with EINVAL.
+  if (fd_ < 0) {
+    fd_ = open(partial_path_.c_str(), flags, 0644);
+  }
+  if (fd_ < 0) {
+    return SetError(BIZSYNC_ERROR_IO, "%s: %s", partial_path_.c_str(),
+                    strerror(errno));
+  }
+  if (!direct_io_) {
+    posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+  return BIZSYNC_OK;
+}
+
+int OutputFile::Write(const void* data, size_t length) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  while (length > 0) {
+    size_t count = capacity_ - used_;
+    if (count > length) {
+      count = length;
+    }
+    memcpy(buffer_ + used_, bytes, count);
+    used_ += count;
+    bytes += count;
+    length -= count;
+    if (used_ == capacity_) {
+      int status = FlushBuffer();
+      if (status != BIZSYNC_OK) {
+        return status;
+      }
+    }
+  }
+  return BIZSYNC_OK;
+}
+
+int OutputFile::FlushBuffer() {
+  size_t written = 0;
+  while (written < used_) {
+    ssize_t result = write(fd_, buffer_ + written, used_ - written);
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {
+      return SetError(BIZSYNC_ERROR_IO, "%s: %s", partial_path_.c_str(),
+                      result < 0 ? strerror(errno) : "short write");
+    }
+    written += result;
+  }
+
+  if (!direct_io_) {
+    // Start writeback of this window, then wait for the previous one and
+    // evict it; its pages are clean by now so the eviction sticks.
+    sync_file_range(fd_, flushed_, used_, SYNC_FILE_RANGE_WRITE);
+    if (previous_length_ > 0) {
+      sync_file_range(fd_, previous_offset_, previous_length_,
+                      SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                          SYNC_FILE_RANGE_WAIT_AFTER);
+      posix_fadvise(fd_, previous_offset_, previous_length_,
+                    POSIX_FADV_DONTNEED);
+    }
+    previous_offset_ = flushed_;
+    previous_length_ = used_;
+  }
+
+  flushed_ += used_;
+  used_ = 0;
+  return BIZSYNC_OK;
+}
+
+int OutputFile::Commit() {
+  // O_DIRECT needs whole blocks, so the tail goes through the page cache.
+  if (direct_io_ && used_ % kDirectIoAlignment != 0) {
+    int flags = fcntl(fd_, F_GETFL);
+    if (flags < 0 || fcntl(fd_, F_SETFL, flags & ~O_DIRECT) != 0) {
+      return SetError(BIZSYNC_ERROR_IO, "%s: %s", partial_path_.c_str(),
+                      strerror(errno));
+    }
+    direct_io_ = false;
+  }
+
+  int status = FlushBuffer();
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+  bool synced = fdatasync(fd_) == 0;
+  int sync_errno = errno;
+  bool closed = close(fd_) == 0;
+  fd_ = -1;
+  if (!synced || !closed) {
+    return SetError(BIZSYNC_ERROR_IO, "%s: %s", partial_path_.c_str(),
+                    strerror(synced ? errno : sync_errno));
+  }
+
+  if (rename(partial_path_.c_str(), path_.c_str()) != 0) {
+    return SetError(BIZSYNC_ERROR_IO, "%s: %s", path_.c_str(),
+                    strerror(errno));
+  }
+  committed_ = true;
+  return BIZSYNC_OK;
+}
+
+}  // namespace bizsync
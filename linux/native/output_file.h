@@ -0,0 +1,56 @@
+#ifndef BIZSYNC_NATIVE_OUTPUT_FILE_H_
+#define BIZSYNC_NATIVE_OUTPUT_FILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+namespace bizsync {
+
+// A write-once file filled sequentially through one fixed-size buffer.
+// Data goes to "<path>.partial" and is renamed over |path| by Commit(); the
+// partial file is removed if the OutputFile is destroyed uncommitted.
+//
+// With buffered I/O each flushed window is pushed to disk and dropped from
+// the page cache one window later, so a long export holds at most two
+// windows of dirty cache. Direct I/O skips the cache altogether.
+class OutputFile {
+ public:
+  OutputFile() = default;
+  ~OutputFile();
+
+  // Creates the partial file. |buffer_size| is rounded up to a multiple of
+  // the 4 KiB direct I/O block size.
+  int Open(const std::string& path, size_t buffer_size, bool direct_io);
+
+  int Write(const void* data, size_t length);
+
+  // Flushes, syncs and renames the file into place.
+  int Commit();
+
+  uint64_t bytes_written() const { return flushed_ + used_; }
+
+ private:
+  OutputFile(const OutputFile&) = delete;
+  OutputFile& operator=(const OutputFile&) = delete;
+
+  int FlushBuffer();
+
+  std::string path_;
+  std::string partial_path_;
+  int fd_ = -1;
+  bool direct_io_ = false;
+  bool committed_ = false;
+  uint8_t* buffer_ = nullptr;
+  size_t capacity_ = 0;
+  size_t used_ = 0;
+  uint64_t flushed_ = 0;
+  // The window written by the previous flush, still under writeback.
+  uint64_t previous_offset_ = 0;
+  uint64_t previous_length_ = 0;
+};
+
+}  // namespace bizsync
+
+#endif  // BIZSYNC_NATIVE_OUTPUT_FILE_H_
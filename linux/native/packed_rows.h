@@ -0,0 +1,222 @@
+#ifndef BIZSYNC_NATIVE_PACKED_ROWS_H_
+#define BIZSYNC_NATIVE_PACKED_ROWS_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <utility>
+
+// Packed row buffers carry a whole batch of rows across the FFI boundary in
+// one allocation. Layout, all integers little endian:
+//
+//   uint32 row_count
+//   uint32 column_count
+//   row_count * column_count values, row-major, each a uint8 type tag
+//   followed by its payload:
+//     BIZSYNC_VALUE_NULL     no payload
+//     BIZSYNC_VALUE_INT64    int64
+//     BIZSYNC_VALUE_FLOAT64  IEEE 754 double
+//     BIZSYNC_VALUE_TEXT     uint32 byte length, then UTF-8 bytes
+//     BIZSYNC_VALUE_BLOB     uint32 byte length, then bytes
+//
+// Dart builds these with a BytesBuilder/ByteData; native producers such as
+// the CSV importer use PackedRowWriter.
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  BIZSYNC_VALUE_NULL = 0,
+  BIZSYNC_VALUE_INT64 = 1,
+  BIZSYNC_VALUE_FLOAT64 = 2,
+  BIZSYNC_VALUE_TEXT = 3,
+  BIZSYNC_VALUE_BLOB = 4,
+} BizsyncValueType;
+
+#ifdef __cplusplus
+}  // extern "C"
+
+namespace bizsync {
+
+static const size_t kPackedHeaderSize = 8;
+
+// One decoded value. |bytes| points into the buffer being read.
+struct PackedValue {
+  BizsyncValueType type = BIZSYNC_VALUE_NULL;
+  int64_t int64_value = 0;
+  double float64_value = 0;
+  const uint8_t* bytes = nullptr;
+  uint32_t length = 0;
+};
+
+// Sequential, bounds-checked reader over a packed row buffer. The buffer must
+// outlive the reader and every PackedValue it returns.
+class PackedRowReader {
+ public:
+  PackedRowReader(const uint8_t* data, size_t length)
+      : end_(data + length), cursor_(data) {
+    if (length >= kPackedHeaderSize) {
+      row_count_ = ReadUint32();
+      column_count_ = ReadUint32();
+    } else {
+      cursor_ = nullptr;
+    }
+  }
+
+  // False if the header was truncated or a value ran past the end.
+  bool ok() const { return cursor_ != nullptr; }
+  uint32_t row_count() const { return row_count_; }
+  uint32_t column_count() const { return column_count_; }
+
+  // Decodes the next value into |value|, resetting the fields its type does
+  // not use, so a reused PackedValue never keeps an earlier row's bytes.
+  // Returns false on malformed input.
+  bool Next(PackedValue* value) {
+    if (cursor_ == nullptr || !Has(1)) {
+      return Fail();
+    }
+    *value = PackedValue();
+    value->type = static_cast<BizsyncValueType>(*cursor_++);
+    switch (value->type) {
+      case BIZSYNC_VALUE_NULL:
+        return true;
+      case BIZSYNC_VALUE_INT64:
+        if (!Has(8)) {
+          return Fail();
+        }
+        memcpy(&value->int64_value, cursor_, 8);
+        cursor_ += 8;
+        return true;
+      case BIZSYNC_VALUE_FLOAT64:
+        if (!Has(8)) {
+          return Fail();
+        }
+        memcpy(&value->float64_value, cursor_, 8);
+        cursor_ += 8;
+        return true;
+      case BIZSYNC_VALUE_TEXT:
+      case BIZSYNC_VALUE_BLOB:
+        if (!Has(4)) {
+          return Fail();
+        }
+        value->length = ReadUint32();
+        if (!Has(value->length)) {
+          return Fail();
+        }
+        value->bytes = cursor_;
+        cursor_ += value->length;
+        return true;
+    }
+    return Fail();
+  }
+
+ private:
+  bool Has(size_t count) const {
+    return static_cast<size_t>(end_ - cursor_) >= count;
+  }
+
+  bool Fail() {
+    cursor_ = nullptr;
+    return false;
+  }
+
+  uint32_t ReadUint32() {
+    uint32_t value;
+    memcpy(&value, cursor_, 4);
+    cursor_ += 4;
+    return value;
+  }
+
+  const uint8_t* end_;
+  const uint8_t* cursor_;
+  uint32_t row_count_ = 0;
+  uint32_t column_count_ = 0;
+};
+
+// Builds a packed row buffer. Call EndRow() after each row's values; the row
+// count in the header is kept current so data() is always a valid buffer.
+class PackedRowWriter {
+ public:
+  explicit PackedRowWriter(uint32_t column_count)
+      : PackedRowWriter(column_count, std::string(), 0) {}
+
+  // Writes after |prefix| bytes left free at the start of |buffer|, reusing
+  // its capacity, so a caller can frame the rows without copying them.
+  PackedRowWriter(uint32_t column_count, std::string buffer, size_t prefix)
+      : buffer_(std::move(buffer)), prefix_(prefix) {
+    buffer_.assign(prefix_ + kPackedHeaderSize, '\0');
+    column_count_ = column_count;
+    row_end_ = buffer_.size();
+    WriteHeader(0, column_count);
+  }
+
+  void AppendNull() { buffer_.push_back(BIZSYNC_VALUE_NULL); }
+
+  void AppendInt64(int64_t value) {
+    buffer_.push_back(BIZSYNC_VALUE_INT64);
+    buffer_.append(reinterpret_cast<const char*>(&value), 8);
+  }
+
+  void AppendFloat64(double value) {
+    buffer_.push_back(BIZSYNC_VALUE_FLOAT64);
+    buffer_.append(reinterpret_cast<const char*>(&value), 8);
+  }
+
+  void AppendText(const char* text, uint32_t length) {
+    AppendBytes(BIZSYNC_VALUE_TEXT, text, length);
+  }
+
+  void AppendBlob(const void* bytes, uint32_t length) {
+    AppendBytes(BIZSYNC_VALUE_BLOB, bytes, length);
+  }
+
+  void EndRow() {
+    WriteHeader(++row_count_, column_count_);
+    row_end_ = buffer_.size();
+  }
+
+  // Drops the values appended since the last EndRow().
+  void DiscardRow() { buffer_.resize(row_end_); }
+
+  // Drops every row, keeping the allocation for reuse.
+  void Clear() {
+    buffer_.resize(prefix_ + kPackedHeaderSize);
+    row_end_ = buffer_.size();
+    row_count_ = 0;
+    WriteHeader(0, column_count_);
+  }
+
+  // Hands over the whole buffer, prefix included; the writer must not be
+  // used afterwards.
+  std::string Release() { return std::move(buffer_); }
+
+  uint32_t row_count() const { return row_count_; }
+  size_t size() const { return buffer_.size() - prefix_; }
+  const uint8_t* data() const {
+    return reinterpret_cast<const uint8_t*>(buffer_.data()) + prefix_;
+  }
+
+ private:
+  void AppendBytes(BizsyncValueType type, const void* bytes, uint32_t length) {
+    buffer_.push_back(static_cast<char>(type));
+    buffer_.append(reinterpret_cast<const char*>(&length), 4);
+    buffer_.append(static_cast<const char*>(bytes), length);
+  }
+
+  void WriteHeader(uint32_t rows, uint32_t columns) {
+    memcpy(&buffer_[prefix_], &rows, 4);
+    memcpy(&buffer_[prefix_ + 4], &columns, 4);
+  }
+
+  std::string buffer_;
+  size_t prefix_ = 0;
+  size_t row_end_ = kPackedHeaderSize;
+  uint32_t row_count_ = 0;
+  uint32_t column_count_ = 0;
+};
+
+}  // namespace bizsync
+#endif
+
+#endif  // BIZSYNC_NATIVE_PACKED_ROWS_H_
@@ -0,0 +1,890 @@
+#include "qr_code.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace bizsync {
+
+// ISO/IEC 18004 table 9, by level and version; index 0 is unused.
+static const int8_t kEccCodewordsPerBlock[4][41] = {
+    {-1, 7,  10, 15, 20, 26, 18, 20, 24, 30, 18, 20, 24, 26,
+     30, 22, 24, 28, 30, 28, 28, 28, 28, 30, 30, 26, 28, 30,
+     30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30},
+    {-1, 10, 16, 26, 18, 24, 16, 18, 22, 22, 26, 30, 22, 22,
+     24, 24, 28, 28, 26, 26, 26, 26, 28, 28, 28, 28, 28, 28,
+     28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28},
+    {-1, 13, 22, 18, 26, 18, 24, 18, 22, 20, 24, 28, 26, 24,
+     20, 30, 24, 28, 28, 26, 30, 28, 30, 30, 30, 30, 28, 30,
+     30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30},
+    {-1, 17, 28, 22, 16, 22, 28, 26, 26, 24, 28, 24, 28, 22,
+     24, 24, 30, 28, 28, 26, 28, 30, 24, 30, 30, 30, 30, 30,
+     30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30},
+};
+
+static const int8_t kErrorCorrectionBlocks[4][41] = {
+    {-1, 1,  1,  1,  1,  1,  2,  2,  2,  2,  4,  4,  4,  4,
+     4,  6,  6,  6,  6,  7,  8,  8,  9,  9,  10, 12, 12, 12,
+     13, 14, 15, 16, 17, 18, 19, 19, 20, 21, 22, 24, 25},
+    {-1, 1,  1,  1,  2,  2,  4,  4,  4,  5,  5,  5,  8,  9,
+     9,  10, 10, 11, 13, 14, 16, 17, 17, 18, 20, 21, 23, 25,
+     26, 28, 29, 31, 33, 35, 37, 38, 40, 43, 45, 47, 49},
+    {-1, 1,  1,  2,  2,  4,  4,  6,  6,  8,  8,  8,  10, 12,
+     16, 12, 17, 16, 18, 21, 20, 23, 23, 25, 27, 29, 34, 34,
+     35, 38, 40, 43, 45, 48, 51, 53, 56, 59, 62, 65, 68},
+    {-1, 1,  1,  2,  4,  4,  4,  5,  6,  8,  8,  11, 11, 16,
+     16, 18, 16, 19, 21, 25, 25, 25, 34, 30, 32, 35, 37, 40,
+     42, 45, 48, 51, 54, 57, 60, 63, 66, 70, 74, 77, 81},
+};
+
+// Level indicators in the format information, in BizsyncQrEcc order.
+static const int kEccFormatBits[4] = {1, 0, 3, 2};
+
+static const char kAlphanumeric[] =
+    "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ $%*+-./:";
+
+enum QrMode {
+  kModeNumeric,
+  kModeAlphanumeric,
+  kModeByte,
+};
+
+static const size_t kCacheCapacity = 256;
+
+struct QrSymbol {
+  std::string payload;
+  int32_t requested_ecc = 0;
+  int32_t version = 0;
+  int32_t ecc = 0;
+  int32_t size = 0;
+  std::vector<uint8_t> modules;
+  std::vector<int32_t> runs;
+};
+
+// Bits appended most significant first.
+class BitBuffer {
+ public:
+  void Append(uint32_t value, int count) {
+    for (int i = count - 1; i >= 0; i--) {
+      bits_.push_back((value >> i) & 1);
+    }
+  }
+
+  size_t size() const { return bits_.size(); }
+
+  std::vector<uint8_t> ToBytes() const {
+    std::vector<uint8_t> bytes(bits_.size() / 8);
+    for (size_t i = 0; i < bytes.size() * 8; i++) {
+      bytes[i / 8] |= bits_[i] << (7 - i % 8);
+    }
+    return bytes;
+  }
+
+ private:
+  std::vector<uint8_t> bits_;
+};
+
+// Data modules available in a version, after every function pattern.
+static int raw_data_modules(int version) {
+  int result = (16 * version + 128) * version + 64;
+  if (version >= 2) {
+    int alignment = version / 7 + 2;
+    result -= (25 * alignment - 10) * alignment - 55;
+    if (version >= 7) {
+      result -= 36;
+    }
+  }
+  return result;
+}
+
+static int data_codewords(int version, int ecc) {
+  return raw_data_modules(version) / 8 -
+         kEccCodewordsPerBlock[ecc][version] *
+             kErrorCorrectionBlocks[ecc][version];
+}
+
+static int count_bits(QrMode mode, int version) {
+  static const int kBits[3][3] = {{10, 12, 14}, {9, 11, 13}, {8, 16, 16}};
+  return kBits[mode][version <= 9 ? 0 : version <= 26 ? 1 : 2];
+}
+
+static QrMode pick_mode(const uint8_t* data, size_t length) {
+  bool numeric = true;
+  bool alphanumeric = true;
+  for (size_t i = 0; i < length; i++) {
+    if (data[i] < '0' || data[i] > '9') {
+      numeric = false;
+    }
+    if (data[i] == 0 || strchr(kAlphanumeric, data[i]) == nullptr) {
+      alphanumeric = false;
+    }
+  }
+  return numeric ? kModeNumeric
+                 : alphanumeric ? kModeAlphanumeric : kModeByte;
+}
+
+static size_t payload_bits(QrMode mode, size_t length) {
+  switch (mode) {
+    case kModeNumeric:
+      return length / 3 * 10 + (length % 3 == 2 ? 7 : length % 3 == 1 ? 4 : 0);
+    case kModeAlphanumeric:
+      return length / 2 * 11 + length % 2 * 6;
+    case kModeByte:
+      break;
+  }
+  return length * 8;
+}
+
+static void append_payload(QrMode mode, const uint8_t* data, size_t length,
+                           BitBuffer* bits) {
+  switch (mode) {
+    case kModeNumeric:
+      for (size_t i = 0; i < length; i += 3) {
+        size_t digits = std::min<size_t>(3, length - i);
+        uint32_t value = 0;
+        for (size_t j = 0; j < digits; j++) {
+          value = value * 10 + (data[i + j] - '0');
+        }
+        bits->Append(value, digits * 3 + 1);
+      }
+      return;
+    case kModeAlphanumeric:
+      for (size_t i = 0; i < length; i += 2) {
+        uint32_t value = strchr(kAlphanumeric, data[i]) - kAlphanumeric;
+        if (i + 1 < length) {
+          value = value * 45 +
+                  (strchr(kAlphanumeric, data[i + 1]) - kAlphanumeric);
+          bits->Append(value, 11);
+        } else {
+          bits->Append(value, 6);
+        }
+      }
+      return;
+    case kModeByte:
+      for (size_t i = 0; i < length; i++) {
+        bits->Append(data[i], 8);
+      }
+      return;
+  }
+}
+
+// Multiplication in GF(2^8) modulo x^8 + x^4 + x^3 + x^2 + 1.
+static uint8_t gf_multiply(uint8_t x, uint8_t y) {
+  int z = 0;
+  for (int i = 7; i >= 0; i--) {
+    z = (z << 1) ^ ((z >> 7) * 0x11d);
+    z ^= ((y >> i) & 1) * x;
+  }
+  return static_cast<uint8_t>(z);
+}
+
+// The Reed-Solomon generator polynomial of |degree|, highest term first,
+// without its leading 1.
+static std::vector<uint8_t> rs_divisor(int degree) {
+  std::vector<uint8_t> result(degree);
+  result[degree - 1] = 1;
+  uint8_t root = 1;
+  for (int i = 0; i < degree; i++) {
+    for (int j = 0; j < degree; j++) {
+      result[j] = gf_multiply(result[j], root);
+      if (j + 1 < degree) {
+        result[j] ^= result[j + 1];
+      }
+    }
+    root = gf_multiply(root, 0x02);
+  }
+  return result;
+}
+
+static void rs_remainder(const uint8_t* data, size_t length,
+                         const std::vector<uint8_t>& divisor, uint8_t* out) {
+  size_t degree = divisor.size();
+  memset(out, 0, degree);
+  for (size_t i = 0; i < length; i++) {
+    uint8_t factor = data[i] ^ out[0];
+    memmove(out, out + 1, degree - 1);
+    out[degree - 1] = 0;
+    for (size_t j = 0; j < degree; j++) {
+      out[j] ^= gf_multiply(divisor[j], factor);
+    }
+  }
+}
+
+// Splits |data| into blocks, appends each block's error correction
+// codewords and interleaves the result as ISO/IEC 18004 section 7.6 lays
+// it out.
+static std::vector<uint8_t> add_error_correction(
+    const std::vector<uint8_t>& data, int version, int ecc) {
+  int block_count = kErrorCorrectionBlocks[ecc][version];
+  int ecc_length = kEccCodewordsPerBlock[ecc][version];
+  int raw_codewords = raw_data_modules(version) / 8;
+  int short_blocks = block_count - raw_codewords % block_count;
+  int short_length = raw_codewords / block_count;
+
+  std::vector<uint8_t> divisor = rs_divisor(ecc_length);
+  std::vector<std::vector<uint8_t>> blocks(block_count);
+  size_t offset = 0;
+  for (int i = 0; i < block_count; i++) {
+    int data_length = short_length - ecc_length + (i < short_blocks ? 0 : 1);
+    std::vector<uint8_t>& block = blocks[i];
+    block.assign(data.begin() + offset, data.begin() + offset + data_length);
+    offset += data_length;
+    // Short blocks get a placeholder so every block has the same layout.
+    if (i < short_blocks) {
+      block.push_back(0);
+    }
+    block.resize(short_length + 1);
+    rs_remainder(block.data(), data_length, divisor,
+                 block.data() + short_length + 1 - ecc_length);
+  }
+
+  std::vector<uint8_t> result;
+  result.reserve(raw_codewords);
+  for (int i = 0; i <= short_length; i++) {
+    for (int j = 0; j < block_count; j++) {
+      if (i != short_length - ecc_length || j >= short_blocks) {
+        result.push_back(blocks[j][i]);
+      }
+    }
+  }
+  return result;
+}
+
+// Builds the module matrix of one symbol.
+class QrMatrix {
+ public:
+  QrMatrix(int version, int ecc)
+      : version_(version),
+        ecc_(ecc),
+        size_(version * 4 + 17),
+        modules_(size_ * size_),
+        function_(size_ * size_) {}
+
+  int size() const { return size_; }
+  const std::vector<uint8_t>& modules() const { return modules_; }
+
+  void Draw(const std::vector<uint8_t>& codewords) {
+    DrawFunctionPatterns();
+    DrawCodewords(codewords);
+
+    int best_mask = 0;
+    long best_penalty = -1;
+    for (int mask = 0; mask < 8; mask++) {
+      ApplyMask(mask);
+      DrawFormatBits(mask);
+      long penalty = Penalty();
+      if (best_penalty < 0 || penalty < best_penalty) {
+        best_mask = mask;
+        best_penalty = penalty;
+      }
+      ApplyMask(mask);
+    }
+    ApplyMask(best_mask);
+    DrawFormatBits(best_mask);
+  }
+
+ private:
+  bool Get(int x, int y) const { return modules_[y * size_ + x] != 0; }
+
+  void SetFunction(int x, int y, bool dark) {
+    modules_[y * size_ + x] = dark;
+    function_[y * size_ + x] = 1;
+  }
+
+  void DrawFunctionPatterns() {
+    for (int i = 0; i < size_; i++) {
+      SetFunction(6, i, i % 2 == 0);
+      SetFunction(i, 6, i % 2 == 0);
+    }
+    DrawFinder(3, 3);
+    DrawFinder(size_ - 4, 3);
+    DrawFinder(3, size_ - 4);
+
+    std::vector<int> positions = AlignmentPositions();
+    size_t count = positions.size();
+    for (size_t i = 0; i < count; i++) {
+      for (size_t j = 0; j < count; j++) {
+        // The three corners with finder patterns have no alignment pattern.
+        if ((i == 0 && j == 0) || (i == 0 && j == count - 1) ||
+            (i == count - 1 && j == 0)) {
+          continue;
+        }
+        DrawAlignment(positions[i], positions[j]);
+      }
+    }
+
+    // Reserves the format areas until a mask is chosen.
+    DrawFormatBits(0);
+    DrawVersion();
+  }
+
+  void DrawFinder(int x, int y) {
+    for (int dy = -4; dy <= 4; dy++) {
+      for (int dx = -4; dx <= 4; dx++) {
+        int distance = std::max(abs(dx), abs(dy));
+        int xx = x + dx;
+        int yy = y + dy;
+        if (xx >= 0 && xx < size_ && yy >= 0 && yy < size_) {
+          SetFunction(xx, yy, distance != 2 && distance != 4);
+        }
+      }
+    }
+  }
+
+  void DrawAlignment(int x, int y) {
+    for (int dy = -2; dy <= 2; dy++) {
+      for (int dx = -2; dx <= 2; dx++) {
+        SetFunction(x + dx, y + dy, std::max(abs(dx), abs(dy)) != 1);
+      }
+    }
+  }
+
+  std::vector<int> AlignmentPositions() const {
+    if (version_ == 1) {
+      return {};
+    }
+    int count = version_ / 7 + 2;
+    int step = version_ == 32
+                   ? 26
+                   : (version_ * 4 + count * 2 + 1) / (count * 2 - 2) * 2;
+    std::vector<int> result(count);
+    result[0] = 6;
+    for (int i = count - 1, position = size_ - 7; i >= 1;
+         i--, position -= step) {
+      result[i] = position;
+    }
+    return result;
+  }
+
+  void DrawFormatBits(int mask) {
+    int data = kEccFormatBits[ecc_] << 3 | mask;
+    int remainder = data;
+    for (int i = 0; i < 10; i++) {
+      remainder = (remainder << 1) ^ ((remainder >> 9) * 0x537);
+    }
+    int bits = (data << 10 | remainder) ^ 0x5412;
+
+    for (int i = 0; i <= 5; i++) {
+      SetFunction(8, i, (bits >> i) & 1);
+    }
+    SetFunction(8, 7, (bits >> 6) & 1);
+    SetFunction(8, 8, (bits >> 7) & 1);
+    SetFunction(7, 8, (bits >> 8) & 1);
+    for (int i = 9; i < 15; i++) {
+      SetFunction(14 - i, 8, (bits >> i) & 1);
+    }
+    for (int i = 0; i < 8; i++) {
+      SetFunction(size_ - 1 - i, 8, (bits >> i) & 1);
+    }
+    for (int i = 8; i < 15; i++) {
+      SetFunction(8, size_ - 15 + i, (bits >> i) & 1);
+    }
+    SetFunction(8, size_ - 8, true);
+  }
+
+  void DrawVersion() {
+    if (version_ < 7) {
+      return;
+    }
+    int remainder = version_;
+    for (int i = 0; i < 12; i++) {
+      remainder = (remainder << 1) ^ ((remainder >> 11) * 0x1f25);
+    }
+    long bits = static_cast<long>(version_) << 12 | remainder;
+    for (int i = 0; i < 18; i++) {
+      bool dark = (bits >> i) & 1;
+      int a = size_ - 11 + i % 3;
+      int b = i / 3;
+      SetFunction(a, b, dark);
+      SetFunction(b, a, dark);
+    }
+  }
+
+  // Places the codewords in two-module columns, zigzagging up and down
+  // from the bottom-right corner and skipping the vertical timing pattern.
+  void DrawCodewords(const std::vector<uint8_t>& codewords) {
+    size_t bit = 0;
+    size_t bit_count = codewords.size() * 8;
+    for (int right = size_ - 1; right >= 1; right -= 2) {
+      if (right == 6) {
+        right = 5;
+      }
+      bool upward = ((right + 1) & 2) == 0;
+      for (int step = 0; step < size_; step++) {
+        int y = upward ? size_ - 1 - step : step;
+        for (int j = 0; j < 2; j++) {
+          int x = right - j;
+          if (function_[y * size_ + x] || bit >= bit_count) {
+            continue;
+          }
+          modules_[y * size_ + x] =
+              (codewords[bit / 8] >> (7 - bit % 8)) & 1;
+          bit++;
+        }
+      }
+    }
+  }
+
+  // XORs a mask pattern onto the data modules; applying it twice undoes it.
+  void ApplyMask(int mask) {
+    for (int y = 0; y < size_; y++) {
+      for (int x = 0; x < size_; x++) {
+        bool invert;
+        switch (mask) {
+          case 0:
+            invert = (x + y) % 2 == 0;
+            break;
+          case 1:
+            invert = y % 2 == 0;
+            break;
+          case 2:
+            invert = x % 3 == 0;
+            break;
+          case 3:
+            invert = (x + y) % 3 == 0;
+            break;
+          case 4:
+            invert = (x / 3 + y / 2) % 2 == 0;
+            break;
+          case 5:
+            invert = x * y % 2 + x * y % 3 == 0;
+            break;
+          case 6:
+            invert = (x * y % 2 + x * y % 3) % 2 == 0;
+            break;
+          default:
+            invert = ((x + y) % 2 + x * y % 3) % 2 == 0;
+            break;
+        }
+        if (invert && !function_[y * size_ + x]) {
+          modules_[y * size_ + x] ^= 1;
+        }
+      }
+    }
+  }
+
+  // Scores one row or column for runs and finder-like patterns.
+  static long LinePenalty(const uint8_t* line, int size) {
+    long penalty = 0;
+    int run = 1;
+    for (int i = 1; i <= size; i++) {
+      if (i < size && line[i] == line[i - 1]) {
+        run++;
+        continue;
+      }
+      if (run >= 5) {
+        penalty += 3 + (run - 5);
+      }
+      run = 1;
+    }
+
+    // 1:1:3:1:1 with four light modules on either side, where the edge of
+    // the symbol counts as light. The last 11 modules are kept as bits.
+    uint32_t window = 0;
+    for (int i = 0; i < size + 4; i++) {
+      window = ((window << 1) | (i < size ? line[i] : 0)) & 0x7ff;
+      if (window == 0x5d0 || window == 0x05d) {
+        penalty += 40;
+      }
+    }
+    return penalty;
+  }
+
+  long Penalty() const {
+    long penalty = 0;
+    uint8_t line[177];
+    for (int y = 0; y < size_; y++) {
+      penalty += LinePenalty(&modules_[y * size_], size_);
+    }
+    for (int x = 0; x < size_; x++) {
+      for (int y = 0; y < size_; y++) {
+        line[y] = modules_[y * size_ + x];
+      }
+      penalty += LinePenalty(line, size_);
+    }
+
+    long dark = 0;
+    for (int y = 0; y < size_; y++) {
+      for (int x = 0; x < size_; x++) {
+        bool color = Get(x, y);
+        dark += color;
+        if (x + 1 < size_ && y + 1 < size_ && color == Get(x + 1, y) &&
+            color == Get(x, y + 1) && color == Get(x + 1, y + 1)) {
+          penalty += 3;
+        }
+      }
+    }
+    // 10 points for every 5% the dark share is away from half.
+    long total = static_cast<long>(size_) * size_;
+    long k = (labs(dark * 20 - total * 10) + total - 1) / total - 1;
+    return penalty + k * 10;
+  }
+
+  int version_;
+  int ecc_;
+  int size_;
+  std::vector<uint8_t> modules_;
+  std::vector<uint8_t> function_;
+};
+
+
+static std::shared_ptr<QrSymbol> encode_symbol(const uint8_t* data,
+                                               size_t length, int ecc) {
+  QrMode mode = pick_mode(data, length);
+  int version = 1;
+  size_t bit_length = 0;
+  for (; version <= 40; version++) {
+    int length_bits = count_bits(mode, version);
+    bit_length = 4 + length_bits + payload_bits(mode, length);
+    if (length < (size_t{1} << length_bits) &&
+        bit_length <= static_cast<size_t>(data_codewords(version, ecc)) * 8) {
+      break;
+    }
+  }
+  if (version > 40) {
+    return nullptr;
+  }
+  int requested_ecc = ecc;
+  while (ecc < BIZSYNC_QR_ECC_HIGH &&
+         bit_length <=
+             static_cast<size_t>(data_codewords(version, ecc + 1)) * 8) {
+    ecc++;
+  }
+
+  static const uint32_t kModeIndicators[3] = {0x1, 0x2, 0x4};
+  BitBuffer bits;
+  bits.Append(kModeIndicators[mode], 4);
+  bits.Append(length, count_bits(mode, version));
+  append_payload(mode, data, length, &bits);
+  // Terminator, padding to a byte and then alternating pad codewords.
+  size_t capacity = static_cast<size_t>(data_codewords(version, ecc)) * 8;
+  bits.Append(0, std::min<size_t>(4, capacity - bits.size()));
+  bits.Append(0, (8 - bits.size() % 8) % 8);
+  for (uint32_t pad = 0xec; bits.size() < capacity; pad ^= 0xec ^ 0x11) {
+    bits.Append(pad, 8);
+  }
+
+  QrMatrix matrix(version, ecc);
+  matrix.Draw(add_error_correction(bits.ToBytes(), version, ecc));
+
+  auto symbol = std::make_shared<QrSymbol>();
+  symbol->payload.assign(reinterpret_cast<const char*>(data), length);
+  symbol->requested_ecc = requested_ecc;
+  symbol->version = version;
+  symbol->ecc = ecc;
+  symbol->size = matrix.size();
+  symbol->modules = matrix.modules();
+  int size = symbol->size;
+  for (int y = 0; y < size; y++) {
+    for (int x = 0; x < size;) {
+      if (!symbol->modules[y * size + x]) {
+        x++;
+        continue;
+      }
+      int start = x;
+      while (x < size && symbol->modules[y * size + x]) {
+        x++;
+      }
+      symbol->runs.insert(symbol->runs.end(), {start, y, x - start});
+    }
+  }
+  return symbol;
+}
+
+// FNV-1a over the payload, then the level.
+static uint64_t symbol_key(const uint8_t* data, size_t length, int ecc) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ data[i]) * 0x100000001b3;
+  }
+  return (hash ^ static_cast<uint64_t>(ecc)) * 0x100000001b3;
+}
+
+// Least recently used symbols are dropped once the cache is full. Handles
+// given out keep their symbol alive after it has been dropped.
+class QrCache {
+ public:
+  std::shared_ptr<const QrSymbol> Find(uint64_t key, const uint8_t* data,
+                                       size_t length, int ecc) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end() || it->second->second->requested_ecc != ecc ||
+        it->second->second->payload.compare(
+            0, std::string::npos, reinterpret_cast<const char*>(data),
+            length) != 0) {
+      misses_++;
+      return nullptr;
+    }
+    hits_++;
+    order_.splice(order_.begin(), order_, it->second);
+    return it->second->second;
+  }
+
+  // Adds |symbol|, replacing another payload with the same key.
+  void Insert(uint64_t key, std::shared_ptr<const QrSymbol> symbol) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+      order_.erase(it->second);
+      index_.erase(it);
+    }
+    order_.emplace_front(key, std::move(symbol));
+    index_[key] = order_.begin();
+    if (order_.size() > kCacheCapacity) {
+      index_.erase(order_.back().first);
+      order_.pop_back();
+    }
+  }
+
+  void GetStats(BizsyncQrCacheStats* stats) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats->hits = hits_;
+    stats->misses = misses_;
+    stats->entries = order_.size();
+    stats->capacity = kCacheCapacity;
+  }
+
+ private:
+  typedef std::list<std::pair<uint64_t, std::shared_ptr<const QrSymbol>>>
+      Order;
+
+  std::mutex mutex_;
+  Order order_;
+  std::unordered_map<uint64_t, Order::iterator> index_;
+  int64_t hits_ = 0;
+  int64_t misses_ = 0;
+};
+
+// Never destroyed, so PDF workers still running at exit stay safe.
+static QrCache* cache() {
+  static QrCache* cache = new QrCache();
+  return cache;
+}
+
+// Appends one EMVCo data object: a two-digit id, a two-digit length and
+// the value.
+static bool append_field(std::string* out, int id, const std::string& value) {
+  if (value.empty() || value.size() > 99) {
+    return false;
+  }
+  char prefix[5];
+  snprintf(prefix, sizeof(prefix), "%02d%02zu", id, value.size());
+  out->append(prefix);
+  out->append(value);
+  return true;
+}
+
+// Copies a request string, cut to |limit| characters. Fails for strings
+// with characters outside printable ASCII.
+static bool request_string(const char* value, size_t limit,
+                           std::string* out) {
+  out->clear();
+  for (const char* c = value; c != nullptr && *c != '\0'; c++) {
+    if (*c < 0x20 || *c > 0x7e) {
+      return false;
+    }
+    if (out->size() < limit) {
+      out->push_back(*c);
+    }
+  }
+  return true;
+}
+
+uint16_t Crc16CcittFalse(const std::string& data) {
+  uint16_t crc = 0xffff;
+  for (unsigned char c : data) {
+    crc ^= static_cast<uint16_t>(c) << 8;
+    for (int i = 0; i < 8; i++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+static int build_paynow_payload(const BizsyncPayNowRequest& request,
+                                std::string* payload) {
+  std::string proxy;
+  std::string name;
+  std::string city;
+  std::string reference;
+  std::string expiry;
+  if (!request_string(request.proxy, SIZE_MAX, &proxy) ||
+      !request_string(request.merchant_name, 25, &name) ||
+      !request_string(request.merchant_city, 15, &city) ||
+      !request_string(request.reference, SIZE_MAX, &reference) ||
+      !request_string(request.expiry, SIZE_MAX, &expiry)) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "payment details must be printable ASCII");
+  }
+  if (request.proxy_type != BIZSYNC_PAYNOW_MOBILE &&
+      request.proxy_type != BIZSYNC_PAYNOW_UEN) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "unknown proxy type %d",
+                    request.proxy_type);
+  }
+  // The proxy shares the 99-character account template with its headers.
+  if (proxy.empty() || proxy.size() > 60) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "proxy must be 1 to 60 characters");
+  }
+  if (reference.size() > 25) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "reference is longer than 25 characters");
+  }
+  if (!expiry.empty() &&
+      (expiry.size() != 8 ||
+       expiry.find_first_not_of("0123456789") != std::string::npos)) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "expiry must be YYYYMMDD");
+  }
+  if (request.amount_cents < 0 || request.amount_cents > 99999999999) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "amount out of range");
+  }
+  if (name.empty()) {
+    name = "NA";
+  }
+  if (city.empty()) {
+    city = "Singapore";
+  }
+
+  std::string account;
+  append_field(&account, 0, "SG.PAYNOW");
+  append_field(&account, 1, std::to_string(request.proxy_type));
+  append_field(&account, 2, proxy);
+  append_field(&account, 3, request.editable ? "1" : "0");
+  if (!expiry.empty()) {
+    append_field(&account, 4, expiry);
+  }
+
+  payload->clear();
+  append_field(payload, 0, "01");
+  append_field(payload, 1, request.amount_cents > 0 ? "12" : "11");
+  append_field(payload, 26, account);
+  append_field(payload, 52, "0000");
+  append_field(payload, 53, "702");
+  if (request.amount_cents > 0) {
+    char amount[24];
+    snprintf(amount, sizeof(amount), "%lld.%02lld",
+             static_cast<long long>(request.amount_cents / 100),
+             static_cast<long long>(request.amount_cents % 100));
+    append_field(payload, 54, amount);
+  }
+  append_field(payload, 58, "SG");
+  append_field(payload, 59, name);
+  append_field(payload, 60, city);
+  if (!reference.empty()) {
+    std::string additional;
+    append_field(&additional, 1, reference);
+    append_field(payload, 62, additional);
+  }
+
+  // The checksum covers its own id and length.
+  payload->append("6304");
+  char checksum[5];
+  snprintf(checksum, sizeof(checksum), "%04X",
+           Crc16CcittFalse(*payload));
+  payload->append(checksum);
+  return BIZSYNC_OK;
+}
+
+}  // namespace bizsync
+
+using bizsync::SetError;
+
+int bizsync_paynow_payload(const BizsyncPayNowRequest* request, char* out,
+                           size_t* out_length) {
+  if (request == nullptr || out == nullptr) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "missing argument");
+  }
+  std::string payload;
+  int status = bizsync::build_paynow_payload(*request, &payload);
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+  memcpy(out, payload.c_str(), payload.size() + 1);
+  if (out_length != nullptr) {
+    *out_length = payload.size();
+  }
+  return BIZSYNC_OK;
+}
+
+int bizsync_qr_encode(const uint8_t* data, size_t length, int32_t ecc,
+                      BizsyncQrCode** out_code) {
+  if ((data == nullptr && length > 0) || out_code == nullptr ||
+      ecc < BIZSYNC_QR_ECC_LOW || ecc > BIZSYNC_QR_ECC_HIGH) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "missing argument");
+  }
+  uint64_t key = bizsync::symbol_key(data, length, ecc);
+  std::shared_ptr<const bizsync::QrSymbol> symbol =
+      bizsync::cache()->Find(key, data, length, ecc);
+  if (symbol == nullptr) {
+    symbol = bizsync::encode_symbol(data, length, ecc);
+    if (symbol == nullptr) {
+      return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                      "%zu bytes do not fit in a QR code", length);
+    }
+    bizsync::cache()->Insert(key, symbol);
+  }
+
+  BizsyncQrCode* code = new BizsyncQrCode();
+  code->version = symbol->version;
+  code->ecc = symbol->ecc;
+  code->size = symbol->size;
+  code->run_count = symbol->runs.size() / 3;
+  code->modules = symbol->modules.data();
+  code->runs = symbol->runs.data();
+  code->internal = new std::shared_ptr<const bizsync::QrSymbol>(symbol);
+  *out_code = code;
+  return BIZSYNC_OK;
+}
+
+void bizsync_qr_code_free(BizsyncQrCode* code) {
+  if (code == nullptr) {
+    return;
+  }
+  delete static_cast<std::shared_ptr<const bizsync::QrSymbol>*>(
+      code->internal);
+  delete code;
+}
+
+int bizsync_qr_rasterize(const BizsyncQrCode* code, int32_t module_pixels,
+                         int32_t quiet_modules, uint8_t* out, size_t stride) {
+  if (code == nullptr || out == nullptr || module_pixels < 1 ||
+      quiet_modules < 0) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "missing argument");
+  }
+  size_t side = static_cast<size_t>(code->size + 2 * quiet_modules) *
+                module_pixels;
+  if (stride < side) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "stride %zu is narrower than %zu pixels", stride, side);
+  }
+  for (size_t y = 0; y < side; y++) {
+    memset(out + y * stride, 0, side);
+  }
+  // Each run becomes one memset per pixel row.
+  for (int32_t i = 0; i < code->run_count; i++) {
+    const int32_t* run = code->runs + i * 3;
+    size_t left = static_cast<size_t>(run[0] + quiet_modules) * module_pixels;
+    size_t top = static_cast<size_t>(run[1] + quiet_modules) * module_pixels;
+    size_t width = static_cast<size_t>(run[2]) * module_pixels;
+    for (int32_t row = 0; row < module_pixels; row++) {
+      memset(out + (top + row) * stride + left, 0xff, width);
+    }
+  }
+  return BIZSYNC_OK;
+}
+
+void bizsync_qr_cache_get_stats(BizsyncQrCacheStats* out_stats) {
+  if (out_stats != nullptr) {
+    bizsync::cache()->GetStats(out_stats);
+  }
+}
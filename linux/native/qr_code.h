@@ -0,0 +1,160 @@
+#ifndef BIZSYNC_NATIVE_QR_CODE_H_
+#define BIZSYNC_NATIVE_QR_CODE_H_
+
+#include "native_status.h"
+
+// PayNow payment QR codes for invoices. bizsync_paynow_payload() builds
+// the EMVCo merchant-presented payload that SGQR and PayNow apps scan, and
+// bizsync_qr_encode() turns any payload into a QR code symbol (ISO/IEC
+// 18004, versions 1 to 40).
+//
+// Symbols are kept in a process-wide LRU cache keyed by a hash of the
+// payload and error correction level. Previews that repaint and batch PDF
+// runs that print the same payment details therefore encode each payload
+// once. The cache is shared by every thread, including the runner's
+// invoice PDF workers, which draw symbols straight from it.
+//
+// A symbol can be drawn two ways. Vector output fills its dark runs,
+// which are horizontal strips one module high. Bitmaps come from
+// bizsync_qr_rasterize(), as A8 8-bit alpha coverage.
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  BIZSYNC_QR_ECC_LOW = 0,       // recovers 7% of codewords
+  BIZSYNC_QR_ECC_MEDIUM = 1,    // 15%
+  BIZSYNC_QR_ECC_QUARTILE = 2,  // 25%
+  BIZSYNC_QR_ECC_HIGH = 3,      // 30%
+} BizsyncQrEcc;
+
+// Quiet zone required around a symbol, in modules.
+#define BIZSYNC_QR_QUIET_ZONE 4
+
+// Longest payload bizsync_paynow_payload() produces, including the NUL.
+#define BIZSYNC_PAYNOW_PAYLOAD_MAX 512
+
+typedef enum {
+  BIZSYNC_PAYNOW_MOBILE = 0,
+  BIZSYNC_PAYNOW_UEN = 2,
+} BizsyncPayNowProxyType;
+
+// Zero fields select the default noted beside them. Strings are printable
+// ASCII.
+typedef struct {
+  int32_t proxy_type;         // BizsyncPayNowProxyType, mobile
+  int32_t editable;           // nonzero lets the payer change the amount
+  const char* proxy;          // "+6591234567" or a UEN. Required.
+  const char* merchant_name;  // "NA"; cut to 25 characters
+  const char* merchant_city;  // "Singapore"; cut to 15 characters
+  const char* reference;      // bill number, up to 25 characters; none
+  const char* expiry;         // last day payable, "YYYYMMDD"; none
+  int64_t amount_cents;       // none, so the payer enters it
+} BizsyncPayNowRequest;
+
+// An encoded symbol. Everything it points to belongs to it and stays valid
+// until bizsync_qr_code_free().
+typedef struct {
+  int32_t version;
+  int32_t ecc;  // BizsyncQrEcc, at least the level asked for
+  // Modules per side, without the quiet zone.
+  int32_t size;
+  int32_t run_count;
+  // size * size bytes, row-major, 1 for dark modules.
+  const uint8_t* modules;
+  // run_count triples of x, y and width in modules, from the top-left
+  // corner of the symbol; every run is one module high.
+  const int32_t* runs;
+  void* internal;
+} BizsyncQrCode;
+
+typedef struct {
+  int64_t hits;
+  int64_t misses;
+  int32_t entries;
+  int32_t capacity;
+} BizsyncQrCacheStats;
+
+/**
+ * bizsync_paynow_payload:
+ * @request: the payment details.
+ * @out: BIZSYNC_PAYNOW_PAYLOAD_MAX bytes for the NUL-terminated payload.
+ * @out_length: (out) (allow-none): length of the payload.
+ *
+ * Builds the EMVCo payload for @request, finished with its CRC-16. The
+ * code is dynamic, and so for this payment only, when it carries an
+ * amount, and static otherwise.
+ *
+ * Returns: %BIZSYNC_OK or %BIZSYNC_ERROR_INVALID_ARGUMENT.
+ */
+BIZSYNC_EXPORT int bizsync_paynow_payload(const BizsyncPayNowRequest* request,
+                                          char* out, size_t* out_length);
+
+/**
+ * bizsync_qr_encode:
+ * @data: the payload.
+ * @length: size of @data.
+ * @ecc: the minimum #BizsyncQrEcc. A higher level is used when it fits in
+ * the same version.
+ * @out_code: (out): location for the symbol, free with
+ * bizsync_qr_code_free().
+ *
+ * Uses numeric or alphanumeric mode when every byte allows it, and byte
+ * mode otherwise, in the smallest version that fits.
+ *
+ * Returns: %BIZSYNC_OK or %BIZSYNC_ERROR_INVALID_ARGUMENT if @data does
+ * not fit in version 40.
+ */
+BIZSYNC_EXPORT int bizsync_qr_encode(const uint8_t* data, size_t length,
+                                     int32_t ecc, BizsyncQrCode** out_code);
+
+/**
+ * bizsync_qr_code_free:
+ * @code: (allow-none): a #BizsyncQrCode.
+ *
+ * Releases @code. The cache keeps its own reference to the symbol.
+ * Suitable as a NativeFinalizer callback.
+ */
+BIZSYNC_EXPORT void bizsync_qr_code_free(BizsyncQrCode* code);
+
+/**
+ * bizsync_qr_rasterize:
+ * @code: a #BizsyncQrCode.
+ * @module_pixels: pixels per module, at least 1.
+ * @quiet_modules: modules of quiet zone drawn on each side, usually
+ * BIZSYNC_QR_QUIET_ZONE.
+ * @out: a bitmap @stride bytes per row of
+ * (size + 2 * @quiet_modules) * @module_pixels rows and columns.
+ * @stride: bytes per row of @out.
+ *
+ * Draws @code as an A8 bitmap: 255 for dark modules, 0 for light, so it
+ * can be used as a mask and painted in any colour.
+ *
+ * Returns: %BIZSYNC_OK or %BIZSYNC_ERROR_INVALID_ARGUMENT.
+ */
+BIZSYNC_EXPORT int bizsync_qr_rasterize(const BizsyncQrCode* code,
+                                        int32_t module_pixels,
+                                        int32_t quiet_modules, uint8_t* out,
+                                        size_t stride);
+
+/**
+ * bizsync_qr_cache_get_stats:
+ * @out_stats: (out): counters since the process started.
+ */
+BIZSYNC_EXPORT void bizsync_qr_cache_get_stats(BizsyncQrCacheStats* out_stats);
+
+#ifdef __cplusplus
+}  // extern "C"
+
+#include <string>
+
+namespace bizsync {
+
+// CRC-16/CCITT-FALSE, as EMVCo specifies for tag 63. Exported for the
+// tests, which cannot reach hidden symbols.
+BIZSYNC_EXPORT uint16_t Crc16CcittFalse(const std::string& data);
+
+}  // namespace bizsync
+#endif
+
+#endif  // BIZSYNC_NATIVE_QR_CODE_H_
@@ -0,0 +1,1265 @@
+#include "search_index.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "task_scheduler.h"
+
+static const char kTokenizerName[] = "bizsync";
+static const char kRankFunctionName[] = "bizsync_rank";
+static const int kMaxTokenBytes = 64;
+// Index rowids are the source kind above the source rowid.
+static const int kKindShift = 40;
+static const int64_t kMaxSourceRowid = (int64_t{1} << kKindShift) - 1;
+static const int32_t kMaxKind = 255;
+static const int32_t kDefaultLimit = 50;
+// Queued rows per transaction when a query has the queue indexed in the
+// background.
+static const int32_t kQueryRefreshRows = 256;
+static const size_t kMinTypoTermBytes = 4;
+static const size_t kTwoEditTermBytes = 8;
+static const size_t kMaxSimilarTerms = 16;
+// Terms longer than the longest prefix index with at most this many
+// completions are matched as those words rather than as a prefix.
+static const size_t kLongestIndexedPrefix = 4;
+static const size_t kMaxCompletions = 16;
+// Matches ranked per source kind; see run_match().
+static const int32_t kRankedCandidates = 1000;
+// Refreshes indexing more rows than this reload the vocabulary afterwards
+// instead of adding each word.
+static const size_t kMaxVocabularyAdds = 4096;
+
+namespace bizsync {
+
+// Indexed words and how many documents hold each, for typo tolerance.
+// Words indexed after the load are kept apart until it is reloaded.
+class Vocabulary {
+ public:
+  // Reads every word of search_index, replacing the loaded words and the
+  // added ones the new load covers. Runs as a background task.
+  void Load(BizsyncDb* db);
+
+  // Records a word whose indexing has committed since the load.
+  void Add(const char* term, int length);
+
+  // Fills |out| with the words that start with |term| and returns true, or
+  // returns false if the vocabulary is not loaded or holds more than
+  // kMaxCompletions of them.
+  bool Complete(const std::string& term, std::vector<std::string>* out);
+
+  // Fills |out| with up to kMaxSimilarTerms words that share |term|'s first
+  // byte and have a prefix within |max_edits| of it, closest and most
+  // common first. Words starting with |term| are left out, as the prefix
+  // query already finds them.
+  void FindSimilar(const std::string& term, int max_edits,
+                   std::vector<std::string>* out);
+
+ private:
+  struct Candidate {
+    int distance;
+    uint32_t documents;
+    std::string term;
+
+    bool operator<(const Candidate& other) const {
+      if (distance != other.distance) {
+        return distance < other.distance;
+      }
+      return documents > other.documents;
+    }
+  };
+
+  // Index of the first loaded word not less than |length| bytes at |term|.
+  size_t LowerBound(const char* term, size_t length) const;
+
+  void Consider(const std::string& term, const char* word, size_t length,
+                uint32_t documents, int max_edits,
+                std::vector<Candidate>* candidates);
+
+  std::mutex mutex_;
+  bool ready_ = false;
+  // Sorted words, each spanning [offsets_[i], offsets_[i + 1]) of bytes_.
+  std::string bytes_;
+  std::vector<uint32_t> offsets_;
+  std::vector<uint32_t> documents_;
+  // Added words, each with the value of |add_count_| when last added.
+  std::map<std::string, uint64_t> added_;
+  uint64_t add_count_ = 0;
+};
+
+}  // namespace bizsync
+
+struct BizsyncSearch {
+  BizsyncDb* db;
+  // SELECT of the indexed columns by rowid, per kind. Only used while
+  // holding the writer.
+  std::map<int32_t, std::string> sources;
+  bizsync::Vocabulary vocabulary;
+  // Set while a catch-up task is posted but has not started.
+  std::atomic<bool> catch_up_posted{false};
+  // Vocabulary loads and catch-up indexing.
+  bizsync::TaskGroup loader{BIZSYNC_TASK_BACKGROUND};
+};
+
+struct BizsyncSearchStorage {
+  BizsyncSearchResult header;
+  std::vector<int64_t> ids;
+  std::vector<int32_t> kinds;
+  std::vector<double> scores;
+};
+
+namespace bizsync {
+
+static bool is_word_byte(unsigned char c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+         (c >= 'A' && c <= 'Z') || c >= 0x80;
+}
+
+// Punctuation that joins the parts of one identifier, e.g. INV-2024-0001.
+static bool is_joiner(char c) {
+  return c == '-' || c == '/' || c == '.' || c == '_';
+}
+
+static bool is_digit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+// Appends |text| lowercased to |token|, stopping at kMaxTokenBytes without
+// splitting a UTF-8 sequence.
+static void fold_into(std::string* token, const char* text, int length) {
+  for (int i = 0; i < length; i++) {
+    unsigned char c = static_cast<unsigned char>(text[i]);
+    if (token->size() >= static_cast<size_t>(kMaxTokenBytes)) {
+      while (!token->empty() && (token->back() & 0xc0) == 0x80) {
+        token->pop_back();
+      }
+      if (!token->empty() &&
+          static_cast<unsigned char>(token->back()) >= 0xc0) {
+        token->pop_back();
+      }
+      return;
+    }
+    token->push_back(c >= 'A' && c <= 'Z' ? static_cast<char>(c + 32)
+                                          : static_cast<char>(c));
+  }
+}
+
+// Splits |text| into words and calls |emit|(token, length, start, end,
+// colocated) for each token. Runs of word bytes joined by is_joiner() form
+// one identifier. Documents index its parts, then the whole identifier
+// without joiners at the first part's position. Any letter and digit groups
+// of two or more bytes are indexed at their part's position too. Queries
+// only produce the whole identifier, which the prefix index matches against
+// every form.
+template <typename Emit>
+static int tokenize(const char* text, int length, bool query, Emit&& emit) {
+  std::string token;
+  std::string joined;
+  int i = 0;
+  while (i < length) {
+    if (!is_word_byte(static_cast<unsigned char>(text[i]))) {
+      i++;
+      continue;
+    }
+
+    // Each part is [start, end) of |text|.
+    std::vector<std::pair<int, int>> parts;
+    int start = i;
+    while (true) {
+      int part_start = i;
+      while (i < length && is_word_byte(static_cast<unsigned char>(text[i]))) {
+        i++;
+      }
+      parts.emplace_back(part_start, i);
+      if (i + 1 < length && is_joiner(text[i]) &&
+          is_word_byte(static_cast<unsigned char>(text[i + 1]))) {
+        i++;
+        continue;
+      }
+      break;
+    }
+
+    joined.clear();
+    for (const auto& part : parts) {
+      fold_into(&joined, text + part.first, part.second - part.first);
+    }
+    if (query) {
+      int rc = emit(joined.data(), static_cast<int>(joined.size()), start, i,
+                    false);
+      if (rc != SQLITE_OK) {
+        return rc;
+      }
+      continue;
+    }
+
+    for (size_t p = 0; p < parts.size(); p++) {
+      int part_start = parts[p].first;
+      int part_end = parts[p].second;
+      token.clear();
+      fold_into(&token, text + part_start, part_end - part_start);
+      int rc = emit(token.data(), static_cast<int>(token.size()), part_start,
+                    part_end, false);
+      if (rc == SQLITE_OK && p == 0 && parts.size() > 1) {
+        rc = emit(joined.data(), static_cast<int>(joined.size()), start, i,
+                  true);
+      }
+      if (rc != SQLITE_OK) {
+        return rc;
+      }
+
+      // Letter and digit groups, e.g. the digits of S1234567D.
+      bool mixed = false;
+      for (int j = part_start + 1; j < part_end; j++) {
+        if (is_digit(text[j]) != is_digit(text[j - 1])) {
+          mixed = true;
+          break;
+        }
+      }
+      if (!mixed) {
+        continue;
+      }
+      int group_start = part_start;
+      for (int j = part_start + 1; j <= part_end; j++) {
+        if (j < part_end && is_digit(text[j]) == is_digit(text[j - 1])) {
+          continue;
+        }
+        if (j - group_start >= 2) {
+          token.clear();
+          fold_into(&token, text + group_start, j - group_start);
+          rc = emit(token.data(), static_cast<int>(token.size()), group_start,
+                    j, true);
+          if (rc != SQLITE_OK) {
+            return rc;
+          }
+        }
+        group_start = j;
+      }
+    }
+  }
+  return SQLITE_OK;
+}
+
+// The tokenizer keeps no state, so every instance is this one.
+static int tokenizer_instance;
+
+static int tokenizer_create(void* context, const char** arguments,
+                            int argument_count, Fts5Tokenizer** out) {
+  *out = reinterpret_cast<Fts5Tokenizer*>(&tokenizer_instance);
+  return SQLITE_OK;
+}
+
+static void tokenizer_delete(Fts5Tokenizer* tokenizer) {}
+
+static int tokenizer_tokenize(Fts5Tokenizer* tokenizer, void* context,
+                              int flags, const char* text, int length,
+                              int (*token_cb)(void*, int, const char*, int,
+                                              int, int)) {
+  bool query = (flags & FTS5_TOKENIZE_QUERY) != 0;
+  return tokenize(text, length, query,
+                  [&](const char* token, int token_length, int start, int end,
+                      bool colocated) {
+                    return token_cb(context,
+                                    colocated ? FTS5_TOKEN_COLOCATED : 0,
+                                    token, token_length, start, end);
+                  });
+}
+
+static fts5_tokenizer tokenizer_methods = {
+    tokenizer_create,
+    tokenizer_delete,
+    tokenizer_tokenize,
+};
+
+// bizsync_rank(search_index, title_weight, body_weight): BM25 with each
+// term counted once per column and no inverse document frequency, lower is
+// better. Every term must match anyway, and computing IDF would read each
+// term's whole doclist on every query.
+static void rank_function(const Fts5ExtensionApi* api, Fts5Context* fts,
+                          sqlite3_context* context, int argument_count,
+                          sqlite3_value** arguments) {
+  const double k1 = 1.2;
+  const double b = 0.75;
+  sqlite3_int64 rows = 0;
+  api->xRowCount(fts, &rows);
+  double score = 0.0;
+  for (int phrase = 0; phrase < api->xPhraseCount(fts); phrase++) {
+    Fts5PhraseIter iterator;
+    int column = -1;
+    int rc = api->xPhraseFirstColumn(fts, phrase, &iterator, &column);
+    for (; rc == SQLITE_OK && column >= 0;
+         api->xPhraseNextColumn(fts, &iterator, &column)) {
+      int length = 0;
+      sqlite3_int64 total = 0;
+      api->xColumnSize(fts, column, &length);
+      api->xColumnTotalSize(fts, column, &total);
+      double average = rows > 0 && total > 0
+                           ? static_cast<double>(total) / rows
+                           : 1.0;
+      double weight = column < argument_count
+                          ? sqlite3_value_double(arguments[column])
+                          : 1.0;
+      score += weight * (k1 + 1.0) / (1.0 + k1 * (1.0 - b + b * length / average));
+    }
+  }
+  sqlite3_result_double(context, -score);
+}
+
+// Extensions are registered per connection; leases from the pool may not
+// have seen these yet.
+static int register_extensions(ConnectionLease* lease) {
+  sqlite3_stmt* statement = nullptr;
+  int status = lease->Prepare("SELECT fts5(?1)", &statement);
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+  fts5_api* api = nullptr;
+  sqlite3_bind_pointer(statement, 1, &api, "fts5_api_ptr", nullptr);
+  sqlite3_step(statement);
+  sqlite3_reset(statement);
+  sqlite3_clear_bindings(statement);
+  if (api == nullptr || api->iVersion < 2) {
+    return SetError(BIZSYNC_ERROR_UNSUPPORTED, "SQLite built without FTS5");
+  }
+
+  void* user_data = nullptr;
+  fts5_tokenizer existing;
+  if (api->xFindTokenizer(api, kTokenizerName, &user_data, &existing) ==
+      SQLITE_OK) {
+    return BIZSYNC_OK;
+  }
+  if (api->xCreateTokenizer(api, kTokenizerName, nullptr, &tokenizer_methods,
+                            nullptr) != SQLITE_OK ||
+      api->xCreateFunction(api, kRankFunctionName, nullptr, rank_function,
+                           nullptr) != SQLITE_OK) {
+    return SetSqliteError(lease->handle(), "register search extensions");
+  }
+  return BIZSYNC_OK;
+}
+
+static int execute(ConnectionLease* lease, const char* sql) {
+  if (sqlite3_exec(lease->handle(), sql, nullptr, nullptr, nullptr) !=
+      SQLITE_OK) {
+    return SetSqliteError(lease->handle(), "search");
+  }
+  return BIZSYNC_OK;
+}
+
+// Steps a statement that returns no rows and resets it.
+static int step_done(ConnectionLease* lease, sqlite3_stmt* statement) {
+  int step = sqlite3_step(statement);
+  sqlite3_reset(statement);
+  if (step != SQLITE_DONE) {
+    return SetSqliteError(lease->handle(), "search");
+  }
+  return BIZSYNC_OK;
+}
+
+static int64_t index_rowid(int32_t kind, int64_t rowid) {
+  return (static_cast<int64_t>(kind) << kKindShift) | rowid;
+}
+
+static std::string select_sql(const char* table,
+                              const std::vector<std::string>& columns) {
+  std::string sql = "SELECT ";
+  for (size_t i = 0; i < columns.size(); i++) {
+    char* name = sqlite3_mprintf("%s\"%w\"", i > 0 ? ", " : "",
+                                 columns[i].c_str());
+    sql += name;
+    sqlite3_free(name);
+  }
+  char* from = sqlite3_mprintf(" FROM \"%w\" WHERE rowid = ?1", table);
+  sql += from;
+  sqlite3_free(from);
+  return sql;
+}
+
+static int load_sources(BizsyncSearch* search, ConnectionLease* lease) {
+  sqlite3_stmt* statement = nullptr;
+  int status = lease->Prepare(
+      "SELECT kind, table_name, columns FROM search_sources", &statement);
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+  int step;
+  while ((step = sqlite3_step(statement)) == SQLITE_ROW) {
+    const char* table =
+        reinterpret_cast<const char*>(sqlite3_column_text(statement, 1));
+    const char* list =
+        reinterpret_cast<const char*>(sqlite3_column_text(statement, 2));
+    std::vector<std::string> columns;
+    std::string column;
+    for (const char* c = list; c != nullptr && *c != '\0'; c++) {
+      if (*c == '\n') {
+        columns.push_back(column);
+        column.clear();
+      } else {
+        column.push_back(*c);
+      }
+    }
+    columns.push_back(column);
+    search->sources[sqlite3_column_int(statement, 0)] =
+        select_sql(table != nullptr ? table : "", columns);
+  }
+  sqlite3_reset(statement);
+  if (step != SQLITE_DONE) {
+    return SetSqliteError(lease->handle(), "load search sources");
+  }
+  return BIZSYNC_OK;
+}
+
+// Indexes up to |max_rows| queued rows inside the caller's transaction and
+// adds the words of up to kMaxVocabularyAdds of them to |words|. Sets
+// |reload| if more rows changed, so the vocabulary should be loaded again
+// rather than added to.
+static int index_queued(BizsyncSearch* search, ConnectionLease* lease,
+                        int64_t max_rows, int64_t* indexed, bool* reload,
+                        std::vector<std::string>* words) {
+  sqlite3_stmt* queued = nullptr;
+  int status = lease->Prepare(
+      "SELECT rowid, kind, ref FROM search_queue ORDER BY rowid LIMIT ?1",
+      &queued);
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+  sqlite3_bind_int64(queued, 1, max_rows > 0 ? max_rows : -1);
+  std::vector<std::pair<int32_t, int64_t>> rows;
+  int64_t last = 0;
+  int step;
+  while ((step = sqlite3_step(queued)) == SQLITE_ROW) {
+    last = sqlite3_column_int64(queued, 0);
+    rows.emplace_back(sqlite3_column_int(queued, 1),
+                      sqlite3_column_int64(queued, 2));
+  }
+  sqlite3_reset(queued);
+  if (step != SQLITE_DONE) {
+    return SetSqliteError(lease->handle(), "read search queue");
+  }
+  if (rows.empty()) {
+    return BIZSYNC_OK;
+  }
+  *indexed = static_cast<int64_t>(rows.size());
+  std::sort(rows.begin(), rows.end());
+  rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+  *reload = rows.size() > kMaxVocabularyAdds;
+
+  sqlite3_stmt* remove = nullptr;
+  sqlite3_stmt* insert = nullptr;
+  status = lease->Prepare("DELETE FROM search_index WHERE rowid = ?1", &remove);
+  if (status == BIZSYNC_OK) {
+    status = lease->Prepare(
+        "INSERT INTO search_index(rowid, title, body) VALUES(?1, ?2, ?3)",
+        &insert);
+  }
+
+  std::string title;
+  std::string body;
+  for (size_t i = 0; status == BIZSYNC_OK && i < rows.size(); i++) {
+    int32_t kind = rows[i].first;
+    int64_t rowid = rows[i].second;
+    if (rowid < 0 || rowid > kMaxSourceRowid) {
+      continue;
+    }
+    int64_t id = index_rowid(kind, rowid);
+    sqlite3_bind_int64(remove, 1, id);
+    status = step_done(lease, remove);
+
+    auto source = search->sources.find(kind);
+    if (status != BIZSYNC_OK || source == search->sources.end()) {
+      continue;
+    }
+    sqlite3_stmt* select = nullptr;
+    status = lease->Prepare(source->second.c_str(), &select);
+    if (status != BIZSYNC_OK) {
+      break;
+    }
+    sqlite3_bind_int64(select, 1, rowid);
+    step = sqlite3_step(select);
+    if (step == SQLITE_ROW) {
+      title.clear();
+      body.clear();
+      int count = sqlite3_column_count(select);
+      for (int c = 0; c < count; c++) {
+        const char* text =
+            reinterpret_cast<const char*>(sqlite3_column_text(select, c));
+        if (text == nullptr) {
+          continue;
+        }
+        std::string* field = c == 0 ? &title : &body;
+        if (!field->empty()) {
+          field->push_back(' ');
+        }
+        field->append(text, sqlite3_column_bytes(select, c));
+      }
+    }
+    sqlite3_reset(select);
+    if (step == SQLITE_ROW) {
+      for (const std::string* field : {&title, &body}) {
+        if (*reload) {
+          break;
+        }
+        tokenize(field->data(), static_cast<int>(field->size()), false,
+                 [words](const char* token, int length, int, int, bool) {
+                   words->emplace_back(token, length);
+                   return SQLITE_OK;
+                 });
+      }
+      sqlite3_bind_int64(insert, 1, id);
+      sqlite3_bind_text(insert, 2, title.data(),
+                        static_cast<int>(title.size()), SQLITE_STATIC);
+      sqlite3_bind_text(insert, 3, body.data(), static_cast<int>(body.size()),
+                        SQLITE_STATIC);
+      status = step_done(lease, insert);
+      sqlite3_clear_bindings(insert);
+    } else if (step != SQLITE_DONE) {
+      status = SetSqliteError(lease->handle(), "read search source");
+    }
+  }
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+
+  sqlite3_stmt* dequeue = nullptr;
+  status =
+      lease->Prepare("DELETE FROM search_queue WHERE rowid <= ?1", &dequeue);
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+  sqlite3_bind_int64(dequeue, 1, last);
+  return step_done(lease, dequeue);
+}
+
+// Runs index_queued() in its own transaction and, once it commits, adds the
+// new words to the vocabulary. A load that starts later then sees them in
+// the index. |indexed| counts the queue entries taken.
+static int refresh(BizsyncSearch* search, ConnectionLease* lease,
+                   int64_t max_rows, int64_t* indexed, bool* reload) {
+  *indexed = 0;
+  int status = register_extensions(lease);
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+  status = execute(lease, "BEGIN IMMEDIATE");
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+  std::vector<std::string> words;
+  status = index_queued(search, lease, max_rows, indexed, reload, &words);
+  if (status == BIZSYNC_OK && *reload) {
+    // Bulk indexing leaves many small segments; merging them keeps each
+    // term's doclist in one place for queries.
+    status = execute(lease,
+                     "INSERT INTO search_index(search_index) "
+                     "VALUES('optimize')");
+  }
+  if (status == BIZSYNC_OK) {
+    status = execute(lease, "COMMIT");
+  }
+  if (status != BIZSYNC_OK) {
+    sqlite3_exec(lease->handle(), "ROLLBACK", nullptr, nullptr, nullptr);
+    return status;
+  }
+  for (const std::string& word : words) {
+    search->vocabulary.Add(word.data(), static_cast<int>(word.size()));
+  }
+  return BIZSYNC_OK;
+}
+
+// Indexes the queue in kQueryRefreshRows transactions, letting other
+// writers in between, and reloads the vocabulary if that indexed a lot.
+// Runs as a background task.
+static void catch_up(BizsyncSearch* search) {
+  // Edits queued from here on post another run.
+  search->catch_up_posted = false;
+  bool reload = false;
+  int64_t indexed = kQueryRefreshRows;
+  while (indexed == kQueryRefreshRows) {
+    ConnectionLease writer = [search] {
+      ScopedBlockingWait blocking;
+      return AcquireWriter(search->db);
+    }();
+    bool batch_reload = false;
+    if (refresh(search, &writer, kQueryRefreshRows, &indexed,
+                &batch_reload) != BIZSYNC_OK) {
+      break;
+    }
+    reload = reload || batch_reload;
+  }
+  if (reload) {
+    search->vocabulary.Load(search->db);
+  }
+}
+
+// Posts catch_up() unless a run is already waiting to start.
+static void post_catch_up(BizsyncSearch* search) {
+  if (!search->catch_up_posted.exchange(true) &&
+      search->loader.Post([search] { catch_up(search); }) != BIZSYNC_OK) {
+    search->catch_up_posted = false;
+  }
+}
+
+// Returns the edit distance between |term| and the closest prefix of
+// |word| counting adjacent transpositions as one edit, or |max_edits| + 1
+// once it is known to exceed |max_edits|.
+static int prefix_distance(const std::string& term, const char* word,
+                           size_t length, int max_edits) {
+  size_t n = term.size();
+  size_t m = std::min(length, n + max_edits);
+  int rows[3][kMaxTokenBytes + 3];
+  int* before = rows[0];
+  int* previous = rows[1];
+  int* current = rows[2];
+  for (size_t j = 0; j <= m; j++) {
+    previous[j] = static_cast<int>(j);
+  }
+  for (size_t i = 1; i <= n; i++) {
+    current[0] = static_cast<int>(i);
+    int best = current[0];
+    for (size_t j = 1; j <= m; j++) {
+      int cost = term[i - 1] == word[j - 1] ? 0 : 1;
+      int value = std::min({previous[j] + 1, current[j - 1] + 1,
+                            previous[j - 1] + cost});
+      if (i > 1 && j > 1 && term[i - 1] == word[j - 2] &&
+          term[i - 2] == word[j - 1]) {
+        value = std::min(value, before[j - 2] + 1);
+      }
+      current[j] = value;
+      best = std::min(best, value);
+    }
+    if (best > max_edits) {
+      return max_edits + 1;
+    }
+    std::swap(before, previous);
+    std::swap(previous, current);
+  }
+  // |previous| now holds the last row; any prefix of the word may end it.
+  int distance = max_edits + 1;
+  for (size_t j = 0; j <= m; j++) {
+    distance = std::min(distance, previous[j]);
+  }
+  return distance;
+}
+
+void Vocabulary::Load(BizsyncDb* db) {
+  // Words added before this point were committed before the read below
+  // starts, so the load covers them.
+  uint64_t covered;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    covered = add_count_;
+  }
+  ConnectionLease lease = AcquireReader(db);
+  if (register_extensions(&lease) != BIZSYNC_OK ||
+      execute(&lease,
+              "CREATE VIRTUAL TABLE IF NOT EXISTS temp.search_vocabulary "
+              "USING fts5vocab(main, search_index, row)") != BIZSYNC_OK) {
+    return;
+  }
+  sqlite3_stmt* statement = nullptr;
+  if (sqlite3_prepare_v2(lease.handle(),
+                         "SELECT term, doc FROM temp.search_vocabulary", -1,
+                         &statement, nullptr) != SQLITE_OK) {
+    return;
+  }
+
+  std::string bytes;
+  std::vector<uint32_t> offsets{0};
+  std::vector<uint32_t> documents;
+  while (sqlite3_step(statement) == SQLITE_ROW) {
+    const char* term =
+        reinterpret_cast<const char*>(sqlite3_column_text(statement, 0));
+    int length = sqlite3_column_bytes(statement, 0);
+    if (term == nullptr || bytes.size() + length > UINT32_MAX) {
+      continue;
+    }
+    bytes.append(term, length);
+    offsets.push_back(static_cast<uint32_t>(bytes.size()));
+    documents.push_back(static_cast<uint32_t>(sqlite3_column_int(statement, 1)));
+  }
+  sqlite3_finalize(statement);
+  sqlite3_exec(lease.handle(), "DROP TABLE temp.search_vocabulary", nullptr,
+               nullptr, nullptr);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  bytes_ = std::move(bytes);
+  offsets_ = std::move(offsets);
+  documents_ = std::move(documents);
+  for (auto it = added_.begin(); it != added_.end();) {
+    it = it->second < covered ? added_.erase(it) : std::next(it);
+  }
+  ready_ = true;
+}
+
+size_t Vocabulary::LowerBound(const char* term, size_t length) const {
+  size_t low = 0;
+  size_t high = documents_.size();
+  while (low < high) {
+    size_t middle = (low + high) / 2;
+    size_t start = offsets_[middle];
+    size_t size = offsets_[middle + 1] - start;
+    int order = memcmp(bytes_.data() + start, term, std::min(size, length));
+    if (order < 0 || (order == 0 && size < length)) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+void Vocabulary::Add(const char* term, int length) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t index = LowerBound(term, length);
+  if (index < documents_.size() &&
+      offsets_[index + 1] - offsets_[index] == static_cast<size_t>(length) &&
+      memcmp(bytes_.data() + offsets_[index], term, length) == 0) {
+    return;
+  }
+  added_[std::string(term, length)] = add_count_++;
+}
+
+bool Vocabulary::Complete(const std::string& term,
+                          std::vector<std::string>* out) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!ready_) {
+    return false;
+  }
+  std::set<std::string> words;
+  for (size_t i = LowerBound(term.data(), term.size());
+       i < documents_.size(); i++) {
+    size_t size = offsets_[i + 1] - offsets_[i];
+    const char* word = bytes_.data() + offsets_[i];
+    if (size < term.size() || memcmp(word, term.data(), term.size()) != 0) {
+      break;
+    }
+    if (words.size() >= kMaxCompletions) {
+      return false;
+    }
+    words.emplace(word, size);
+  }
+  for (auto it = added_.lower_bound(term);
+       it != added_.end() && it->first.compare(0, term.size(), term) == 0;
+       ++it) {
+    if (words.size() >= kMaxCompletions && words.count(it->first) == 0) {
+      return false;
+    }
+    words.insert(it->first);
+  }
+  out->assign(words.begin(), words.end());
+  return true;
+}
+
+void Vocabulary::Consider(const std::string& term, const char* word,
+                          size_t length, uint32_t documents, int max_edits,
+                          std::vector<Candidate>* candidates) {
+  if (length + max_edits < term.size() ||
+      (length >= term.size() && memcmp(word, term.data(), term.size()) == 0)) {
+    return;
+  }
+  int distance = prefix_distance(term, word, length, max_edits);
+  if (distance <= max_edits) {
+    candidates->push_back({distance, documents, std::string(word, length)});
+  }
+}
+
+void Vocabulary::FindSimilar(const std::string& term, int max_edits,
+                             std::vector<std::string>* out) {
+  std::vector<Candidate> candidates;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!ready_) {
+      return;
+    }
+    // Words are sorted, so those sharing the first byte are contiguous.
+    size_t count = documents_.size();
+    auto first_byte_before = [this, &term](size_t index) {
+      return static_cast<unsigned char>(bytes_[offsets_[index]]) <
+             static_cast<unsigned char>(term[0]);
+    };
+    size_t low = 0;
+    size_t high = count;
+    while (low < high) {
+      size_t middle = (low + high) / 2;
+      if (first_byte_before(middle)) {
+        low = middle + 1;
+      } else {
+        high = middle;
+      }
+    }
+    for (size_t i = low; i < count && bytes_[offsets_[i]] == term[0]; i++) {
+      Consider(term, bytes_.data() + offsets_[i], offsets_[i + 1] - offsets_[i],
+               documents_[i], max_edits, &candidates);
+    }
+    for (auto it = added_.lower_bound(term.substr(0, 1));
+         it != added_.end() && it->first[0] == term[0]; ++it) {
+      Consider(term, it->first.data(), it->first.size(), 1, max_edits,
+               &candidates);
+    }
+  }
+
+  std::sort(candidates.begin(), candidates.end());
+  std::unordered_set<std::string> seen;
+  for (const Candidate& candidate : candidates) {
+    if (out->size() >= kMaxSimilarTerms) {
+      break;
+    }
+    if (seen.insert(candidate.term).second) {
+      out->push_back(candidate.term);
+    }
+  }
+}
+
+// Appends |term| to a MATCH expression as a quoted string.
+static void append_quoted(std::string* expression, const std::string& term) {
+  expression->push_back('"');
+  for (char c : term) {
+    if (c == '"') {
+      expression->push_back('"');
+    }
+    expression->push_back(c);
+  }
+  expression->push_back('"');
+}
+
+// Runs one MATCH against each of |kinds| and appends the best rows not in
+// |seen| to |storage| until it holds |limit|. Only the newest
+// kRankedCandidates matches of each kind are ranked, which bounds the cost
+// of terms that match a large part of the index.
+static int run_match(ConnectionLease* lease, const std::string& expression,
+                     const std::vector<int32_t>& kinds, int32_t limit,
+                     std::unordered_set<int64_t>* seen,
+                     BizsyncSearchStorage* storage) {
+  sqlite3_stmt* statement = nullptr;
+  int status = lease->Prepare(
+      "SELECT rowid, score FROM ("
+      "  SELECT rowid, bizsync_rank(search_index, 4.0, 1.0) AS score"
+      "  FROM search_index"
+      "  WHERE search_index MATCH ?1 AND rowid BETWEEN ?2 AND ?3"
+      "  ORDER BY rowid DESC LIMIT ?4) "
+      "ORDER BY score LIMIT ?5",
+      &statement);
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+
+  std::vector<std::pair<double, int64_t>> matches;
+  for (int32_t kind : kinds) {
+    sqlite3_bind_text(statement, 1, expression.data(),
+                      static_cast<int>(expression.size()), SQLITE_STATIC);
+    sqlite3_bind_int64(statement, 2, index_rowid(kind, 0));
+    sqlite3_bind_int64(statement, 3, index_rowid(kind, kMaxSourceRowid));
+    sqlite3_bind_int(statement, 4, kRankedCandidates);
+    sqlite3_bind_int64(statement, 5,
+                       limit + static_cast<int64_t>(seen->size()));
+    int step;
+    while ((step = sqlite3_step(statement)) == SQLITE_ROW) {
+      matches.emplace_back(sqlite3_column_double(statement, 1),
+                           sqlite3_column_int64(statement, 0));
+    }
+    sqlite3_reset(statement);
+    sqlite3_clear_bindings(statement);
+    if (step != SQLITE_DONE) {
+      return SetSqliteError(lease->handle(), "search");
+    }
+  }
+
+  std::sort(matches.begin(), matches.end());
+  for (const auto& match : matches) {
+    if (storage->ids.size() >= static_cast<size_t>(limit)) {
+      break;
+    }
+    int64_t id = match.second;
+    if (!seen->insert(id).second) {
+      continue;
+    }
+    storage->ids.push_back(id & kMaxSourceRowid);
+    storage->kinds.push_back(static_cast<int32_t>(id >> kKindShift));
+    storage->scores.push_back(match.first);
+  }
+  return BIZSYNC_OK;
+}
+
+// Lists the registered source kinds.
+static int source_kinds(ConnectionLease* lease, std::vector<int32_t>* kinds) {
+  sqlite3_stmt* statement = nullptr;
+  int status = lease->Prepare("SELECT kind FROM search_sources", &statement);
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+  int step;
+  while ((step = sqlite3_step(statement)) == SQLITE_ROW) {
+    kinds->push_back(sqlite3_column_int(statement, 0));
+  }
+  sqlite3_reset(statement);
+  if (step != SQLITE_DONE) {
+    return SetSqliteError(lease->handle(), "search");
+  }
+  return BIZSYNC_OK;
+}
+
+// Identifiers such as NRICs and invoice numbers are not typo tolerant: one
+// edit away is usually another customer or invoice.
+static bool typo_tolerant(const std::string& term) {
+  if (term.size() < kMinTypoTermBytes) {
+    return false;
+  }
+  return std::none_of(term.begin(), term.end(), is_digit);
+}
+
+}  // namespace bizsync
+
+int bizsync_search_open(BizsyncDb* db, BizsyncSearch** out_search) {
+  using namespace bizsync;
+
+  if (db == nullptr || out_search == nullptr) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "db and out_search required");
+  }
+  *out_search = nullptr;
+
+  std::unique_ptr<BizsyncSearch> search(new BizsyncSearch());
+  search->db = db;
+  {
+    ConnectionLease lease = AcquireWriter(db);
+    int status = register_extensions(&lease);
+    if (status == BIZSYNC_OK) {
+      status = execute(
+          &lease,
+          "CREATE TABLE IF NOT EXISTS search_queue("
+          "  kind INTEGER NOT NULL, ref INTEGER NOT NULL);"
+          "CREATE TABLE IF NOT EXISTS search_sources("
+          "  kind INTEGER PRIMARY KEY, table_name TEXT NOT NULL,"
+          "  columns TEXT NOT NULL)");
+    }
+    if (status == BIZSYNC_OK &&
+        sqlite3_table_column_metadata(lease.handle(), "main", "search_index",
+                                      nullptr, nullptr, nullptr, nullptr,
+                                      nullptr, nullptr) != SQLITE_OK) {
+      // detail=column keeps the index small; queries never need phrases.
+      status = execute(
+          &lease,
+          "CREATE VIRTUAL TABLE search_index USING fts5("
+          "  title, body, tokenize = 'bizsync', prefix = '1 2 3 4',"
+          "  detail = column)");
+    }
+    if (status == BIZSYNC_OK) {
+      status = load_sources(search.get(), &lease);
+    }
+    if (status != BIZSYNC_OK) {
+      return status;
+    }
+  }
+
+  BizsyncSearch* raw = search.release();
+  // Without a scheduler queries just stay prefix-only.
+  raw->loader.Post([raw] { raw->vocabulary.Load(raw->db); });
+  *out_search = raw;
+  return BIZSYNC_OK;
+}
+
+int bizsync_search_add_source(BizsyncSearch* search, int32_t kind,
+                              const char* table, const char* const* columns,
+                              int32_t column_count) {
+  using namespace bizsync;
+
+  if (search == nullptr || table == nullptr || columns == nullptr ||
+      column_count <= 0) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "search, table and columns required");
+  }
+  if (kind < 1 || kind > kMaxKind) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "kind %d outside 1 to %d", kind, kMaxKind);
+  }
+  std::vector<std::string> names;
+  std::string list;
+  for (int32_t i = 0; i < column_count; i++) {
+    if (columns[i] == nullptr || strchr(columns[i], '\n') != nullptr) {
+      return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "bad column %d", i);
+    }
+    names.push_back(columns[i]);
+    list += (i > 0 ? "\n" : "") + names.back();
+  }
+  std::string select = select_sql(table, names);
+
+  ConnectionLease lease = AcquireWriter(search->db);
+  // Unknown names in double quotes would otherwise be taken as strings.
+  if (sqlite3_table_column_metadata(lease.handle(), "main", table, "rowid",
+                                    nullptr, nullptr, nullptr, nullptr,
+                                    nullptr) != SQLITE_OK) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "%s is not a rowid table", table);
+  }
+  for (const std::string& name : names) {
+    if (sqlite3_table_column_metadata(lease.handle(), "main", table,
+                                      name.c_str(), nullptr, nullptr, nullptr,
+                                      nullptr, nullptr) != SQLITE_OK) {
+      return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "%s has no column %s",
+                      table, name.c_str());
+    }
+  }
+  int status = register_extensions(&lease);
+  if (status == BIZSYNC_OK) {
+    status = execute(&lease, "BEGIN IMMEDIATE");
+  }
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+
+  // The source is current if it is unchanged and its triggers still exist;
+  // dropping the table drops them too.
+  char* sql = sqlite3_mprintf(
+      "SELECT (SELECT count(*) FROM search_sources"
+      "        WHERE kind = %d AND table_name = %Q AND columns = %Q) +"
+      "       (SELECT count(*) FROM sqlite_schema WHERE type = 'trigger'"
+      "        AND name IN ('search_%d_insert', 'search_%d_update',"
+      "                     'search_%d_delete'))",
+      kind, table, list.c_str(), kind, kind, kind);
+  bool current = false;
+  sqlite3_stmt* statement = nullptr;
+  if (sqlite3_prepare_v2(lease.handle(), sql, -1, &statement, nullptr) ==
+      SQLITE_OK) {
+    current = sqlite3_step(statement) == SQLITE_ROW &&
+              sqlite3_column_int(statement, 0) == 4;
+    sqlite3_finalize(statement);
+  } else {
+    status = SetSqliteError(lease.handle(), "check search source");
+  }
+  sqlite3_free(sql);
+
+  if (status == BIZSYNC_OK && !current) {
+    std::string columns_sql;
+    for (size_t i = 0; i < names.size(); i++) {
+      char* name = sqlite3_mprintf("%s\"%w\"", i > 0 ? ", " : "",
+                                   names[i].c_str());
+      columns_sql += name;
+      sqlite3_free(name);
+    }
+    sql = sqlite3_mprintf(
+        "DROP TRIGGER IF EXISTS search_%d_insert;"
+        "DROP TRIGGER IF EXISTS search_%d_update;"
+        "DROP TRIGGER IF EXISTS search_%d_delete;"
+        "DELETE FROM search_queue WHERE kind = %d;"
+        "DELETE FROM search_index WHERE rowid BETWEEN %lld AND %lld;"
+        "INSERT OR REPLACE INTO search_sources VALUES(%d, %Q, %Q);"
+        "CREATE TRIGGER search_%d_insert AFTER INSERT ON \"%w\" BEGIN"
+        "  INSERT INTO search_queue VALUES(%d, new.rowid); END;"
+        "CREATE TRIGGER search_%d_update AFTER UPDATE OF %s ON \"%w\" BEGIN"
+        "  INSERT INTO search_queue VALUES(%d, new.rowid); END;"
+        "CREATE TRIGGER search_%d_delete AFTER DELETE ON \"%w\" BEGIN"
+        "  INSERT INTO search_queue VALUES(%d, old.rowid); END;"
+        "INSERT INTO search_queue SELECT %d, rowid FROM \"%w\"",
+        kind, kind, kind, kind,
+        static_cast<long long>(index_rowid(kind, 0)),
+        static_cast<long long>(index_rowid(kind, kMaxSourceRowid)), kind,
+        table, list.c_str(), kind, table, kind, kind, columns_sql.c_str(),
+        table, kind, kind, table, kind, kind, table);
+    status = execute(&lease, sql);
+    sqlite3_free(sql);
+  }
+
+  if (status == BIZSYNC_OK) {
+    status = execute(&lease, "COMMIT");
+  }
+  if (status != BIZSYNC_OK) {
+    sqlite3_exec(lease.handle(), "ROLLBACK", nullptr, nullptr, nullptr);
+    return status;
+  }
+  search->sources[kind] = select;
+  return BIZSYNC_OK;
+}
+
+int bizsync_search_refresh(BizsyncSearch* search, int32_t max_rows,
+                           int64_t* out_remaining) {
+  using namespace bizsync;
+
+  if (search == nullptr || max_rows < 0) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "search required");
+  }
+  bool reload = false;
+  {
+    ConnectionLease lease = AcquireWriter(search->db);
+    int64_t indexed = 0;
+    int status = refresh(search, &lease, max_rows, &indexed, &reload);
+    if (status == BIZSYNC_OK && out_remaining != nullptr) {
+      sqlite3_stmt* statement = nullptr;
+      status = lease.Prepare("SELECT count(*) FROM search_queue", &statement);
+      if (status != BIZSYNC_OK) {
+        return status;
+      }
+      *out_remaining = sqlite3_step(statement) == SQLITE_ROW
+                           ? sqlite3_column_int64(statement, 0)
+                           : 0;
+      sqlite3_reset(statement);
+    }
+    if (status != BIZSYNC_OK) {
+      return status;
+    }
+  }
+  if (reload) {
+    search->vocabulary.Load(search->db);
+  }
+  return BIZSYNC_OK;
+}
+
+int bizsync_search_query(BizsyncSearch* search, const char* query,
+                         const BizsyncSearchOptions* options,
+                         BizsyncSearchResult** out_result) {
+  using namespace bizsync;
+
+  if (search == nullptr || query == nullptr || out_result == nullptr) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "search, query and out_result required");
+  }
+  *out_result = nullptr;
+  BizsyncSearchOptions settings = {};
+  if (options != nullptr) {
+    settings = *options;
+  }
+  int32_t limit = settings.limit > 0 ? settings.limit : kDefaultLimit;
+  if (settings.kind < 0 || settings.kind > kMaxKind) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "kind %d outside 0 to %d",
+                    settings.kind, kMaxKind);
+  }
+
+  std::vector<std::string> terms;
+  tokenize(query, static_cast<int>(strlen(query)), true,
+           [&terms](const char* token, int length, int, int, bool) {
+             terms.emplace_back(token, length);
+             return SQLITE_OK;
+           });
+
+  std::unique_ptr<BizsyncSearchStorage> storage(new BizsyncSearchStorage());
+  if (!terms.empty()) {
+    ConnectionLease lease = AcquireReader(search->db);
+    int status = register_extensions(&lease);
+    if (status != BIZSYNC_OK) {
+      return status;
+    }
+
+    // Recent edits are indexed in the background, off the caller's thread,
+    // so they show up a keystroke or two later.
+    sqlite3_stmt* queued = nullptr;
+    status = lease.Prepare("SELECT 1 FROM search_queue LIMIT 1", &queued);
+    if (status != BIZSYNC_OK) {
+      return status;
+    }
+    if (sqlite3_step(queued) == SQLITE_ROW) {
+      post_catch_up(search);
+    }
+    sqlite3_reset(queued);
+
+    // FTS5 merges every completion of a prefix longer than the prefix
+    // index into a new doclist, so a few known completions are cheaper to
+    // list.
+    std::vector<std::string> prefixes;
+    std::vector<std::string> completions;
+    for (const std::string& term : terms) {
+      std::string prefix;
+      completions.clear();
+      if (term.size() > kLongestIndexedPrefix &&
+          search->vocabulary.Complete(term, &completions)) {
+        for (const std::string& word : completions) {
+          if (!prefix.empty()) {
+            prefix += " OR ";
+          }
+          append_quoted(&prefix, word);
+        }
+      }
+      if (prefix.empty()) {
+        append_quoted(&prefix, term);
+        prefix.push_back('*');
+      }
+      prefixes.push_back(prefix);
+    }
+
+    std::string exact;
+    for (const std::string& prefix : prefixes) {
+      if (!exact.empty()) {
+        exact += " AND ";
+      }
+      exact += "(" + prefix + ")";
+    }
+    std::vector<int32_t> kinds;
+    if (settings.kind > 0) {
+      kinds.push_back(settings.kind);
+    } else {
+      status = source_kinds(&lease, &kinds);
+      if (status != BIZSYNC_OK) {
+        return status;
+      }
+    }
+    std::unordered_set<int64_t> seen;
+    status = run_match(&lease, exact, kinds, limit, &seen, storage.get());
+    if (status != BIZSYNC_OK) {
+      return status;
+    }
+
+    size_t exact_count = storage->ids.size();
+    if (exact_count < static_cast<size_t>(limit) &&
+        (settings.flags & BIZSYNC_SEARCH_EXACT) == 0) {
+      std::string tolerant;
+      bool extended = false;
+      std::vector<std::string> similar;
+      for (size_t t = 0; t < terms.size(); t++) {
+        const std::string& term = terms[t];
+        similar.clear();
+        if (typo_tolerant(term)) {
+          search->vocabulary.FindSimilar(
+              term, term.size() >= kTwoEditTermBytes ? 2 : 1, &similar);
+        }
+        if (!tolerant.empty()) {
+          tolerant += " AND ";
+        }
+        tolerant += "(" + prefixes[t];
+        for (const std::string& word : similar) {
+          tolerant += " OR ";
+          append_quoted(&tolerant, word);
+        }
+        tolerant.push_back(')');
+        extended = extended || !similar.empty();
+      }
+      if (extended) {
+        status =
+            run_match(&lease, tolerant, kinds, limit, &seen, storage.get());
+        if (status != BIZSYNC_OK) {
+          return status;
+        }
+      }
+    }
+    storage->header.typo_count =
+        static_cast<int64_t>(storage->ids.size() - exact_count);
+  }
+
+  storage->header.count = static_cast<int64_t>(storage->ids.size());
+  storage->header.ids = storage->ids.data();
+  storage->header.kinds = storage->kinds.data();
+  storage->header.scores = storage->scores.data();
+  storage->header.internal = storage.get();
+  *out_result = &storage.release()->header;
+  return BIZSYNC_OK;
+}
+
+void bizsync_search_result_free(BizsyncSearchResult* result) {
+  if (result == nullptr) {
+    return;
+  }
+  delete static_cast<BizsyncSearchStorage*>(result->internal);
+}
+
+void bizsync_search_close(BizsyncSearch* search) {
+  if (search == nullptr) {
+    return;
+  }
+  search->loader.CancelPending();
+  search->loader.Wait();
+  delete search;
+}
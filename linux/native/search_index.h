@@ -0,0 +1,152 @@
+#ifndef BIZSYNC_NATIVE_SEARCH_INDEX_H_
+#define BIZSYNC_NATIVE_SEARCH_INDEX_H_
+
+#include "sqlite_engine.h"
+
+// Global search over invoices, customers and products. Rows are indexed in
+// an FTS5 table, search_index, with a prefix index. The table uses the
+// "bizsync" tokenizer, which keeps identifiers searchable the way they are
+// typed. "INV-2024-0001" is indexed as its parts plus "inv20240001". For
+// NRICs and UENs such as "S1234567D" or "201912345K", the digit run is also
+// indexed, so users can search by the number alone.
+//
+// Each searchable table is registered once with bizsync_search_add_source().
+// Triggers on that table queue the rowid of every inserted, updated or
+// deleted row in search_queue. This works for writes from any connection,
+// including ones that do not have the tokenizer. Queued rows are indexed by
+// bizsync_search_refresh(). A query that finds rows queued has a background
+// task index them, off the caller's thread, so an edit usually shows up a
+// keystroke or two later.
+//
+// Every query term matches as a prefix, and all terms must match. If that
+// finds fewer rows than requested, words of four or more letters are also
+// matched against indexed words within one edit (two from eight letters)
+// that share their first letter. Those extra matches are ranked after the
+// exact ones. Terms with digits are identifiers and are never widened this
+// way. The vocabulary used for this is loaded in the background when the
+// index is opened. Until it is ready, queries match prefixes only.
+//
+// Broad terms can match most of the index. To keep each keystroke cheap,
+// only the newest 1000 matches of each source, by rowid, are ranked.
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct BizsyncSearch BizsyncSearch;
+
+typedef enum {
+  // Match the terms as typed only.
+  BIZSYNC_SEARCH_EXACT = 1 << 0,
+} BizsyncSearchFlags;
+
+// Zero fields select the default noted beside them.
+typedef struct {
+  int32_t limit;  // 50 results
+  int32_t flags;  // BizsyncSearchFlags, none
+  int32_t kind;   // a source kind to search alone; every source
+  int32_t reserved;
+} BizsyncSearchOptions;
+
+// Results in rank order. Dart views the arrays with Pointer.asTypedList()
+// and attaches bizsync_search_result_free as a NativeFinalizer.
+typedef struct {
+  int64_t count;
+  // Source rowids, and the kind passed to bizsync_search_add_source() for
+  // the table each one belongs to.
+  const int64_t* ids;
+  const int32_t* kinds;
+  // Scores, lower is better: BM25 without inverse document frequency,
+  // with title matches weighted four times. Typo matches follow every
+  // exact match.
+  const double* scores;
+  // Results found only through typo tolerance.
+  int64_t typo_count;
+  void* internal;
+} BizsyncSearchResult;
+
+/**
+ * bizsync_search_open:
+ * @db: a #BizsyncDb.
+ * @out_search: (out): location for the index, close with
+ * bizsync_search_close() before closing @db.
+ *
+ * Creates the search tables on @db if missing and starts loading the
+ * vocabulary used for typo tolerance.
+ *
+ * Returns: %BIZSYNC_OK or a negative #BizsyncStatus.
+ */
+BIZSYNC_EXPORT int bizsync_search_open(BizsyncDb* db,
+                                       BizsyncSearch** out_search);
+
+/**
+ * bizsync_search_add_source:
+ * @search: a #BizsyncSearch.
+ * @kind: identifies @table in results, 1 to 255.
+ * @table: a rowid table whose rowids stay below 2^40.
+ * @columns: (array length=column_count): columns to index. The first is the
+ * title, which ranks above the rest.
+ * @column_count: entries in @columns.
+ *
+ * Installs the triggers that queue changes to @table. If the source is new
+ * or its columns changed, it also queues every existing row. Safe to call
+ * on every start.
+ *
+ * Returns: %BIZSYNC_OK or a negative #BizsyncStatus.
+ */
+BIZSYNC_EXPORT int bizsync_search_add_source(BizsyncSearch* search,
+                                             int32_t kind, const char* table,
+                                             const char* const* columns,
+                                             int32_t column_count);
+
+/**
+ * bizsync_search_refresh:
+ * @search: a #BizsyncSearch.
+ * @max_rows: most queued rows to index, or 0 for all of them.
+ * @out_remaining: (out) (allow-none): rows still queued afterwards.
+ *
+ * Indexes queued rows on the writer connection in one transaction. Indexing
+ * a new source can take seconds, so call this from a background isolate.
+ *
+ * Returns: %BIZSYNC_OK or a negative #BizsyncStatus.
+ */
+BIZSYNC_EXPORT int bizsync_search_refresh(BizsyncSearch* search,
+                                          int32_t max_rows,
+                                          int64_t* out_remaining);
+
+/**
+ * bizsync_search_query:
+ * @search: a #BizsyncSearch.
+ * @query: UTF-8 text as typed; words are combined with AND.
+ * @options: (allow-none): query settings, or %NULL for the defaults.
+ * @out_result: (out): location for the result, free with
+ * bizsync_search_result_free().
+ *
+ * Returns: %BIZSYNC_OK or a negative #BizsyncStatus.
+ */
+BIZSYNC_EXPORT int bizsync_search_query(BizsyncSearch* search,
+                                        const char* query,
+                                        const BizsyncSearchOptions* options,
+                                        BizsyncSearchResult** out_result);
+
+/**
+ * bizsync_search_result_free:
+ * @result: (allow-none): a #BizsyncSearchResult.
+ *
+ * Suitable as a NativeFinalizer callback.
+ */
+BIZSYNC_EXPORT void bizsync_search_result_free(BizsyncSearchResult* result);
+
+/**
+ * bizsync_search_close:
+ * @search: (allow-none): a #BizsyncSearch.
+ *
+ * Waits for the vocabulary to finish loading and releases @search. The
+ * index and its triggers stay in the database.
+ */
+BIZSYNC_EXPORT void bizsync_search_close(BizsyncSearch* search);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // BIZSYNC_NATIVE_SEARCH_INDEX_H_
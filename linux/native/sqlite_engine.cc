@@ -0,0 +1,490 @@
+#include "sqlite_engine.h"
+
+#include <stdio.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace bizsync {
+
+static const int32_t kDefaultReaderCount = 4;
+static const int32_t kDefaultStatementCacheSize = 64;
+static const int32_t kDefaultBusyTimeoutMs = 5000;
+static const int32_t kDefaultCacheSizeKib = 16 * 1024;
+static const int64_t kDefaultMmapSize = 256 * 1024 * 1024;
+
+// One sqlite3 handle and its prepared statements, most recently used first.
+class Connection {
+ public:
+  Connection(sqlite3* handle, size_t cache_capacity)
+      : handle_(handle), cache_capacity_(cache_capacity) {}
+
+  ~Connection() {
+    for (auto& entry : lru_) {
+      sqlite3_finalize(entry.second);
+    }
+    sqlite3_close_v2(handle_);
+  }
+
+  sqlite3* handle() const { return handle_; }
+
+  // Looks up |sql|, preparing and caching it on a miss. |hit| reports which.
+  int Prepare(const char* sql, sqlite3_stmt** out_statement, bool* hit) {
+    auto found = index_.find(sql);
+    if (found != index_.end()) {
+      lru_.splice(lru_.begin(), lru_, found->second);
+      sqlite3_stmt* statement = found->second->second;
+      sqlite3_reset(statement);
+      sqlite3_clear_bindings(statement);
+      *out_statement = statement;
+      *hit = true;
+      return BIZSYNC_OK;
+    }
+
+    sqlite3_stmt* statement = nullptr;
+    const char* tail = nullptr;
+    if (sqlite3_prepare_v3(handle_, sql, -1, SQLITE_PREPARE_PERSISTENT,
+                           &statement, &tail) != SQLITE_OK) {
+      return SetSqliteError(handle_, "prepare");
+    }
+    if (statement == nullptr) {
+      return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "SQL is empty");
+    }
+    while (tail != nullptr && (*tail == ' ' || *tail == '\t' ||
+                               *tail == '\n' || *tail == '\r' ||
+                               *tail == ';')) {
+      tail++;
+    }
+    if (tail != nullptr && *tail != '\0') {
+      sqlite3_finalize(statement);
+      return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                      "expected a single statement, found trailing SQL");
+    }
+
+    lru_.emplace_front(sql, statement);
+    index_.emplace(lru_.front().first, lru_.begin());
+    if (lru_.size() > cache_capacity_) {
+      sqlite3_finalize(lru_.back().second);
+      index_.erase(lru_.back().first);
+      lru_.pop_back();
+    }
+    *out_statement = statement;
+    *hit = false;
+    return BIZSYNC_OK;
+  }
+
+ private:
+  using Entry = std::pair<std::string, sqlite3_stmt*>;
+
+  sqlite3* handle_;
+  size_t cache_capacity_;
+  std::list<Entry> lru_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+};
+
+}  // namespace bizsync
+
+struct BizsyncDb {
+  std::unique_ptr<bizsync::Connection> writer;
+  std::vector<std::unique_ptr<bizsync::Connection>> readers;
+
+  // Guards the two fields below; |released| is signalled on every return.
+  std::mutex mutex;
+  std::condition_variable released;
+  bool writer_busy = false;
+  std::vector<bizsync::Connection*> idle_readers;
+
+  std::atomic<uint64_t> statement_cache_hits{0};
+  std::atomic<uint64_t> statement_cache_misses{0};
+  std::atomic<uint64_t> batches{0};
+  std::atomic<uint64_t> batch_rows{0};
+  std::atomic<uint64_t> reader_waits{0};
+};
+
+namespace bizsync {
+
+int SetSqliteError(sqlite3* handle, const char* context) {
+  return SetError(BIZSYNC_ERROR_SQLITE, "%s: %s (%d)", context,
+                  sqlite3_errmsg(handle), sqlite3_extended_errcode(handle));
+}
+
+ConnectionLease::ConnectionLease(ConnectionLease&& other)
+    : db_(other.db_), connection_(other.connection_), writer_(other.writer_) {
+  other.connection_ = nullptr;
+}
+
+ConnectionLease::~ConnectionLease() {
+  if (connection_ == nullptr) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(db_->mutex);
+    if (writer_) {
+      db_->writer_busy = false;
+    } else {
+      db_->idle_readers.push_back(connection_);
+    }
+  }
+  db_->released.notify_all();
+}
+
+sqlite3* ConnectionLease::handle() const {
+  return connection_->handle();
+}
+
+int ConnectionLease::Prepare(const char* sql, sqlite3_stmt** out_statement) {
+  bool hit = false;
+  int status = connection_->Prepare(sql, out_statement, &hit);
+  if (status == BIZSYNC_OK) {
+    (hit ? db_->statement_cache_hits : db_->statement_cache_misses)++;
+  }
+  return status;
+}
+
+int ConnectionLease::Bind(sqlite3_stmt* statement, PackedRowReader* reader) {
+  for (uint32_t column = 1; column <= reader->column_count(); column++) {
+    PackedValue value;
+    if (!reader->Next(&value)) {
+      return SetError(BIZSYNC_ERROR_FORMAT, "packed rows are truncated");
+    }
+
+    int result = SQLITE_OK;
+    switch (value.type) {
+      case BIZSYNC_VALUE_NULL:
+        result = sqlite3_bind_null(statement, column);
+        break;
+      case BIZSYNC_VALUE_INT64:
+        result = sqlite3_bind_int64(statement, column, value.int64_value);
+        break;
+      case BIZSYNC_VALUE_FLOAT64:
+        result = sqlite3_bind_double(statement, column, value.float64_value);
+        break;
+      case BIZSYNC_VALUE_TEXT:
+        // The packed buffer outlives the step, so SQLite need not copy.
+        result = sqlite3_bind_text(statement, column,
+                                   reinterpret_cast<const char*>(value.bytes),
+                                   value.length, SQLITE_STATIC);
+        break;
+      case BIZSYNC_VALUE_BLOB:
+        result = sqlite3_bind_blob(statement, column, value.bytes,
+                                   value.length, SQLITE_STATIC);
+        break;
+    }
+    if (result != SQLITE_OK) {
+      return SetSqliteError(handle(), "bind");
+    }
+  }
+  return BIZSYNC_OK;
+}
+
+int ConnectionLease::BindParameters(sqlite3_stmt* statement,
+                                    const uint8_t* params, size_t length) {
+  int parameter_count = sqlite3_bind_parameter_count(statement);
+  if (params == nullptr) {
+    if (parameter_count != 0) {
+      return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                      "statement takes %d parameters but none were given",
+                      parameter_count);
+    }
+    return BIZSYNC_OK;
+  }
+
+  PackedRowReader reader(params, length);
+  if (!reader.ok() || reader.row_count() != 1) {
+    return SetError(BIZSYNC_ERROR_FORMAT,
+                    "params must hold exactly one packed row");
+  }
+  if (static_cast<int>(reader.column_count()) != parameter_count) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "statement takes %d parameters but %u were given",
+                    parameter_count, reader.column_count());
+  }
+  return Bind(statement, &reader);
+}
+
+int ConnectionLease::ExecuteRows(const char* sql, PackedRowReader* reader,
+                                 int64_t* changes) {
+  if (!writer_) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "batches must run on the writer connection");
+  }
+  if (!reader->ok()) {
+    return SetError(BIZSYNC_ERROR_FORMAT, "packed rows have no header");
+  }
+
+  sqlite3_stmt* statement = nullptr;
+  int status = Prepare(sql, &statement);
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+  if (sqlite3_bind_parameter_count(statement) !=
+      static_cast<int>(reader->column_count())) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "statement takes %d parameters but rows have %u columns",
+                    sqlite3_bind_parameter_count(statement),
+                    reader->column_count());
+  }
+
+  int64_t total = 0;
+  for (uint32_t row = 0; row < reader->row_count(); row++) {
+    status = Bind(statement, reader);
+    if (status != BIZSYNC_OK) {
+      break;
+    }
+    int result;
+    while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
+      // RETURNING rows are not reported.
+    }
+    if (result != SQLITE_DONE) {
+      status = SetSqliteError(handle(), "step");
+      break;
+    }
+    total += sqlite3_changes(handle());
+    sqlite3_reset(statement);
+  }
+
+  // Bindings point into the caller's buffer; drop them before returning.
+  sqlite3_reset(statement);
+  sqlite3_clear_bindings(statement);
+  if (status == BIZSYNC_OK && changes != nullptr) {
+    *changes += total;
+  }
+  return status;
+}
+
+int ConnectionLease::RunBatch(const char* sql, PackedRowReader* reader,
+                              int64_t* changes) {
+  if (!writer_) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "batches must run on the writer connection");
+  }
+  if (sqlite3_exec(handle(), "BEGIN IMMEDIATE", nullptr, nullptr, nullptr) !=
+      SQLITE_OK) {
+    return SetSqliteError(handle(), "begin");
+  }
+
+  int64_t total = 0;
+  int status = ExecuteRows(sql, reader, &total);
+  if (status == BIZSYNC_OK &&
+      sqlite3_exec(handle(), "COMMIT", nullptr, nullptr, nullptr) !=
+          SQLITE_OK) {
+    status = SetSqliteError(handle(), "commit");
+  }
+  if (status != BIZSYNC_OK) {
+    sqlite3_exec(handle(), "ROLLBACK", nullptr, nullptr, nullptr);
+    return status;
+  }
+
+  if (changes != nullptr) {
+    *changes = total;
+  }
+  return BIZSYNC_OK;
+}
+
+ConnectionLease AcquireWriter(BizsyncDb* db) {
+  std::unique_lock<std::mutex> lock(db->mutex);
+  db->released.wait(lock, [db] { return !db->writer_busy; });
+  db->writer_busy = true;
+  return ConnectionLease(db, db->writer.get(), true);
+}
+
+ConnectionLease TryAcquireWriter(BizsyncDb* db) {
+  std::lock_guard<std::mutex> lock(db->mutex);
+  if (db->writer_busy) {
+    return ConnectionLease(db, nullptr, true);
+  }
+  db->writer_busy = true;
+  return ConnectionLease(db, db->writer.get(), true);
+}
+
+ConnectionLease AcquireReader(BizsyncDb* db) {
+  std::unique_lock<std::mutex> lock(db->mutex);
+  if (db->idle_readers.empty()) {
+    db->reader_waits++;
+    db->released.wait(lock, [db] { return !db->idle_readers.empty(); });
+  }
+  Connection* connection = db->idle_readers.back();
+  db->idle_readers.pop_back();
+  return ConnectionLease(db, connection, false);
+}
+
+int32_t ReaderCount(BizsyncDb* db) {
+  return static_cast<int32_t>(db->readers.size());
+}
+
+// Captures the single value returned by a PRAGMA.
+static int pragma_result_cb(void* user_data, int count, char** values,
+                            char** names) {
+  std::string* result = static_cast<std::string*>(user_data);
+  if (count > 0 && values[0] != nullptr) {
+    *result = values[0];
+  }
+  return 0;
+}
+
+static int open_connection(const char* path, bool writer,
+                           const BizsyncDbOptions& options,
+                           std::unique_ptr<Connection>* out_connection) {
+  // Each connection is used by one thread at a time, so SQLite's own
+  // per-connection mutex is redundant.
+  int flags = SQLITE_OPEN_NOMUTEX |
+              (writer ? SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE
+                      : SQLITE_OPEN_READONLY);
+  sqlite3* handle = nullptr;
+  if (sqlite3_open_v2(path, &handle, flags, nullptr) != SQLITE_OK) {
+    int status = SetSqliteError(handle, path);
+    sqlite3_close_v2(handle);
+    return status;
+  }
+  out_connection->reset(
+      new Connection(handle, options.statement_cache_size));
+
+  sqlite3_busy_timeout(handle, options.busy_timeout_ms);
+
+  if (writer) {
+    std::string mode;
+    if (sqlite3_exec(handle, "PRAGMA journal_mode=WAL", pragma_result_cb,
+                     &mode, nullptr) != SQLITE_OK) {
+      return SetSqliteError(handle, "journal_mode");
+    }
+    if (sqlite3_stricmp(mode.c_str(), "wal") != 0) {
+      return SetError(BIZSYNC_ERROR_UNSUPPORTED,
+                      "%s does not support WAL (journal mode %s)", path,
+                      mode.c_str());
+    }
+  }
+
+  // synchronous=NORMAL is durable across application crashes in WAL mode;
+  // only a power loss can drop the most recent commits.
+  char pragmas[256];
+  snprintf(pragmas, sizeof(pragmas),
+           "PRAGMA synchronous=NORMAL;"
+           "PRAGMA temp_store=MEMORY;"
+           "PRAGMA cache_size=-%d;"
+           "PRAGMA mmap_size=%lld;",
+           options.cache_size_kib,
+           static_cast<long long>(options.mmap_size));
+  if (sqlite3_exec(handle, pragmas, nullptr, nullptr, nullptr) != SQLITE_OK) {
+    return SetSqliteError(handle, "configure");
+  }
+  return BIZSYNC_OK;
+}
+
+}  // namespace bizsync
+
+int bizsync_db_open(const char* path, const BizsyncDbOptions* options,
+                    BizsyncDb** out_db) {
+  using namespace bizsync;
+
+  if (path == nullptr || out_db == nullptr) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "path and out_db required");
+  }
+  *out_db = nullptr;
+
+  BizsyncDbOptions resolved = {};
+  if (options != nullptr) {
+    resolved = *options;
+  }
+  if (resolved.reader_count <= 0) {
+    resolved.reader_count = kDefaultReaderCount;
+  }
+  if (resolved.statement_cache_size <= 0) {
+    resolved.statement_cache_size = kDefaultStatementCacheSize;
+  }
+  if (resolved.busy_timeout_ms <= 0) {
+    resolved.busy_timeout_ms = kDefaultBusyTimeoutMs;
+  }
+  if (resolved.cache_size_kib <= 0) {
+    resolved.cache_size_kib = kDefaultCacheSizeKib;
+  }
+  if (resolved.mmap_size == 0) {
+    resolved.mmap_size = kDefaultMmapSize;
+  } else if (resolved.mmap_size < 0) {
+    resolved.mmap_size = 0;
+  }
+
+  std::unique_ptr<BizsyncDb> db(new BizsyncDb());
+
+  // The writer goes first: it creates the file and switches it to WAL, which
+  // read-only connections cannot do themselves.
+  int status = open_connection(path, true, resolved, &db->writer);
+  for (int32_t i = 0; status == BIZSYNC_OK && i < resolved.reader_count; i++) {
+    std::unique_ptr<Connection> reader;
+    status = open_connection(path, false, resolved, &reader);
+    if (reader != nullptr) {
+      db->idle_readers.push_back(reader.get());
+      db->readers.push_back(std::move(reader));
+    }
+  }
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+
+  *out_db = db.release();
+  return BIZSYNC_OK;
+}
+
+void bizsync_db_close(BizsyncDb* db) {
+  if (db == nullptr) {
+    return;
+  }
+  // Closing the writer last lets it checkpoint and remove the WAL.
+  db->readers.clear();
+  db->writer.reset();
+  delete db;
+}
+
+int bizsync_db_execute(BizsyncDb* db, const char* sql) {
+  using namespace bizsync;
+
+  if (db == nullptr || sql == nullptr) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "db and sql required");
+  }
+
+  ConnectionLease lease = AcquireWriter(db);
+  char* message = nullptr;
+  if (sqlite3_exec(lease.handle(), sql, nullptr, nullptr, &message) !=
+      SQLITE_OK) {
+    int status = SetError(BIZSYNC_ERROR_SQLITE, "execute: %s",
+                          message != nullptr ? message : "unknown error");
+    sqlite3_free(message);
+    return status;
+  }
+  return BIZSYNC_OK;
+}
+
+int bizsync_db_batch(BizsyncDb* db, const char* sql, const uint8_t* rows,
+                     size_t length, int64_t* out_changes) {
+  using namespace bizsync;
+
+  if (db == nullptr || sql == nullptr || rows == nullptr) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "db, sql and rows required");
+  }
+
+  PackedRowReader reader(rows, length);
+  ConnectionLease lease = AcquireWriter(db);
+  int status = lease.RunBatch(sql, &reader, out_changes);
+  if (status == BIZSYNC_OK) {
+    db->batches++;
+    db->batch_rows += reader.row_count();
+  }
+  return status;
+}
+
+void bizsync_db_get_stats(BizsyncDb* db, BizsyncDbStats* out_stats) {
+  if (db == nullptr || out_stats == nullptr) {
+    return;
+  }
+  out_stats->statement_cache_hits = db->statement_cache_hits;
+  out_stats->statement_cache_misses = db->statement_cache_misses;
+  out_stats->batches = db->batches;
+  out_stats->batch_rows = db->batch_rows;
+  out_stats->reader_waits = db->reader_waits;
+}
@@ -0,0 +1,172 @@
+#ifndef BIZSYNC_NATIVE_SQLITE_ENGINE_H_
+#define BIZSYNC_NATIVE_SQLITE_ENGINE_H_
+
+#include "native_status.h"
+#include "packed_rows.h"
+
+// Direct SQLite access for dart:ffi, replacing the sqflite_common_ffi isolate
+// hop on the hot paths. A BizsyncDb is a pool of connections to one database
+// file in WAL mode: a single writer plus readers that run concurrently with
+// it. Each connection keeps an LRU cache of prepared statements keyed by SQL
+// text, so repeated batches skip sqlite3_prepare entirely.
+//
+// Every function may be called from any thread; connections are handed out
+// to one caller at a time.
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct BizsyncDb BizsyncDb;
+
+// Zero fields select the default noted beside them.
+typedef struct {
+  int32_t reader_count;          // 4
+  int32_t statement_cache_size;  // 64 statements per connection
+  int32_t busy_timeout_ms;       // 5000
+  int32_t cache_size_kib;        // 16384 per connection
+  int64_t mmap_size;             // 256 MiB; negative disables mmap I/O
+} BizsyncDbOptions;
+
+typedef struct {
+  uint64_t statement_cache_hits;
+  uint64_t statement_cache_misses;
+  uint64_t batches;
+  uint64_t batch_rows;
+  uint64_t reader_waits;
+} BizsyncDbStats;
+
+/**
+ * bizsync_db_open:
+ * @path: UTF-8 path of the database file, created if missing.
+ * @options: (allow-none): pool settings, or %NULL for the defaults.
+ * @out_db: (out): location for the new pool.
+ *
+ * Opens the writer and reader connections and switches the file to WAL mode.
+ *
+ * Returns: %BIZSYNC_OK or a negative #BizsyncStatus.
+ */
+BIZSYNC_EXPORT int bizsync_db_open(const char* path,
+                                   const BizsyncDbOptions* options,
+                                   BizsyncDb** out_db);
+
+/**
+ * bizsync_db_close:
+ * @db: (allow-none): a #BizsyncDb.
+ *
+ * Finalizes cached statements and closes every connection. No other call on
+ * @db may be in progress.
+ */
+BIZSYNC_EXPORT void bizsync_db_close(BizsyncDb* db);
+
+/**
+ * bizsync_db_execute:
+ * @db: a #BizsyncDb.
+ * @sql: one or more `;`-separated statements without parameters.
+ *
+ * Runs @sql on the writer connection, e.g. for migrations and DDL.
+ *
+ * Returns: %BIZSYNC_OK or a negative #BizsyncStatus.
+ */
+BIZSYNC_EXPORT int bizsync_db_execute(BizsyncDb* db, const char* sql);
+
+/**
+ * bizsync_db_batch:
+ * @db: a #BizsyncDb.
+ * @sql: a single INSERT, UPDATE, DELETE or UPSERT statement.
+ * @rows: packed row buffer, see packed_rows.h. Its column count must equal
+ * the number of parameters in @sql.
+ * @length: size of @rows in bytes.
+ * @out_changes: (out) (allow-none): total rows changed.
+ *
+ * Binds and steps @sql once per row inside one IMMEDIATE transaction. Any
+ * failure rolls the whole batch back.
+ *
+ * Returns: %BIZSYNC_OK or a negative #BizsyncStatus.
+ */
+BIZSYNC_EXPORT int bizsync_db_batch(BizsyncDb* db, const char* sql,
+                                    const uint8_t* rows, size_t length,
+                                    int64_t* out_changes);
+
+/**
+ * bizsync_db_get_stats:
+ * @db: a #BizsyncDb.
+ * @out_stats: (out): counters accumulated since bizsync_db_open().
+ */
+BIZSYNC_EXPORT void bizsync_db_get_stats(BizsyncDb* db,
+                                         BizsyncDbStats* out_stats);
+
+#ifdef __cplusplus
+}  // extern "C"
+
+#include <sqlite3.h>
+
+#include <memory>
+
+namespace bizsync {
+
+class Connection;
+
+// Exclusive use of one pooled connection, returned to the pool on
+// destruction. Other native engines use this to run their own statements.
+class ConnectionLease {
+ public:
+  ConnectionLease(BizsyncDb* db, Connection* connection, bool writer)
+      : db_(db), connection_(connection), writer_(writer) {}
+  ConnectionLease(ConnectionLease&& other);
+  ~ConnectionLease();
+
+  // False for a lease from TryAcquireWriter() that got nothing.
+  bool held() const { return connection_ != nullptr; }
+
+  sqlite3* handle() const;
+
+  // Returns a reset statement for |sql| from the connection's cache,
+  // preparing it on a miss. The statement stays owned by the cache.
+  int Prepare(const char* sql, sqlite3_stmt** out_statement);
+
+  // Binds |column_count| values from |reader| to |statement|'s parameters.
+  int Bind(sqlite3_stmt* statement, PackedRowReader* reader);
+
+  // Binds a packed buffer holding one row of parameters, or checks that
+  // |statement| takes none if |params| is null.
+  int BindParameters(sqlite3_stmt* statement, const uint8_t* params,
+                     size_t length);
+
+  // Runs every row of |reader| through |sql| in one transaction. Writer
+  // leases only.
+  int RunBatch(const char* sql, PackedRowReader* reader, int64_t* changes);
+
+  // Like RunBatch() but inside the caller's transaction, adding to
+  // |changes|. Callers that import in several batches use this between
+  // their own BEGIN and COMMIT.
+  int ExecuteRows(const char* sql, PackedRowReader* reader, int64_t* changes);
+
+ private:
+  ConnectionLease(const ConnectionLease&) = delete;
+  ConnectionLease& operator=(const ConnectionLease&) = delete;
+
+  BizsyncDb* db_;
+  Connection* connection_;
+  bool writer_;
+};
+
+// Blocks until the writer connection is free.
+ConnectionLease AcquireWriter(BizsyncDb* db);
+
+// Returns the writer without waiting, or a lease that is not held() if it
+// is busy.
+ConnectionLease TryAcquireWriter(BizsyncDb* db);
+
+// Blocks until a reader connection is free.
+ConnectionLease AcquireReader(BizsyncDb* db);
+
+// Reader connections in the pool; the most scans that run at once.
+int32_t ReaderCount(BizsyncDb* db);
+
+// Reports a SQLite failure on |handle| through SetError().
+int SetSqliteError(sqlite3* handle, const char* context);
+
+}  // namespace bizsync
+#endif
+
+#endif  // BIZSYNC_NATIVE_SQLITE_ENGINE_H_
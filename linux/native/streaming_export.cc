@@ -0,0 +1,721 @@
+#include "streaming_export.h"
+
+#include <locale.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "output_file.h"
+#include "task_scheduler.h"
+
+static const int32_t kDefaultProgressRows = 4096;
+static const int32_t kDefaultBufferSize = 1024 * 1024;
+static const char* kDefaultSheetName = "Sheet1";
+
+// Excel refuses sheets with more rows than this.
+static const int64_t kXlsxMaxRows = 1048576;
+
+struct BizsyncExport {
+  BizsyncDb* db;
+  std::string sql;
+  std::vector<uint8_t> params;
+  bool has_params;
+  std::string path;
+  BizsyncExportOptions options;
+  std::string sheet_name;
+
+  std::atomic<bool> cancelled{false};
+  bizsync::CancelOnStop cancel_on_stop{&cancelled};
+  bizsync::TaskGroup task{BIZSYNC_TASK_INTERACTIVE};
+};
+
+namespace bizsync {
+
+// Where formatted rows go: the output file for CSV, a deflate stream inside
+// the zip for XLSX.
+class ByteSink {
+ public:
+  virtual ~ByteSink() = default;
+  virtual int Write(const void* data, size_t length) = 0;
+
+  int Write(const std::string& text) { return Write(text.data(), text.size()); }
+};
+
+class FileSink : public ByteSink {
+ public:
+  explicit FileSink(OutputFile* file) : file_(file) {}
+  using ByteSink::Write;
+  int Write(const void* data, size_t length) override {
+    return file_->Write(data, length);
+  }
+
+ private:
+  OutputFile* file_;
+};
+
+// Minimal streaming zip writer. Entries are deflated as they are written and
+// sizes follow in a data descriptor, so nothing needs to be seeked back to.
+// Archives are limited to 4 GiB; there is no zip64 support.
+class ZipWriter : public ByteSink {
+ public:
+  explicit ZipWriter(OutputFile* file) : file_(file) {
+    memset(&stream_, 0, sizeof(stream_));
+    // Level 3 keeps compression well ahead of SQLite on typical ledgers.
+    stream_ready_ = deflateInit2(&stream_, 3, Z_DEFLATED, -MAX_WBITS, 8,
+                                 Z_DEFAULT_STRATEGY) == Z_OK;
+    SetDosTime();
+  }
+
+  ~ZipWriter() override {
+    if (stream_ready_) {
+      deflateEnd(&stream_);
+    }
+  }
+
+  int BeginEntry(const char* name) {
+    if (!stream_ready_) {
+      return SetError(BIZSYNC_ERROR_IO, "cannot initialise zlib");
+    }
+    if (file_->bytes_written() > UINT32_MAX) {
+      return SetError(BIZSYNC_ERROR_UNSUPPORTED, "XLSX exceeds 4 GiB");
+    }
+
+    Entry entry;
+    entry.name = name;
+    entry.offset = static_cast<uint32_t>(file_->bytes_written());
+    entries_.push_back(entry);
+
+    std::string header;
+    Put32(&header, 0x04034b50);
+    Put16(&header, 20);      // version needed: deflate
+    Put16(&header, kFlags);  // sizes in data descriptor, UTF-8 name
+    Put16(&header, Z_DEFLATED);
+    Put16(&header, dos_time_);
+    Put16(&header, dos_date_);
+    Put32(&header, 0);  // crc-32
+    Put32(&header, 0);  // compressed size
+    Put32(&header, 0);  // uncompressed size
+    Put16(&header, static_cast<uint16_t>(entry.name.size()));
+    Put16(&header, 0);  // extra field length
+    header += entry.name;
+
+    deflateReset(&stream_);
+    pending_.clear();
+    return file_->Write(header.data(), header.size());
+  }
+
+  // Buffers small writes so deflate sees reasonably sized input.
+  using ByteSink::Write;
+  int Write(const void* data, size_t length) override {
+    pending_.append(static_cast<const char*>(data), length);
+    if (pending_.size() >= kPendingSize) {
+      return Deflate(Z_NO_FLUSH);
+    }
+    return BIZSYNC_OK;
+  }
+
+  int EndEntry() {
+    int status = Deflate(Z_FINISH);
+    if (status != BIZSYNC_OK) {
+      return status;
+    }
+
+    Entry& entry = entries_.back();
+    if (entry.uncompressed > UINT32_MAX || entry.compressed > UINT32_MAX) {
+      return SetError(BIZSYNC_ERROR_UNSUPPORTED, "%s exceeds 4 GiB",
+                      entry.name.c_str());
+    }
+    std::string descriptor;
+    Put32(&descriptor, 0x08074b50);
+    Put32(&descriptor, entry.crc);
+    Put32(&descriptor, static_cast<uint32_t>(entry.compressed));
+    Put32(&descriptor, static_cast<uint32_t>(entry.uncompressed));
+    return file_->Write(descriptor.data(), descriptor.size());
+  }
+
+  // Writes the central directory; the archive is complete afterwards.
+  int Finish() {
+    uint64_t directory_offset = file_->bytes_written();
+    if (directory_offset > UINT32_MAX) {
+      return SetError(BIZSYNC_ERROR_UNSUPPORTED, "XLSX exceeds 4 GiB");
+    }
+
+    std::string directory;
+    for (const Entry& entry : entries_) {
+      Put32(&directory, 0x02014b50);
+      Put16(&directory, 20);  // version made by
+      Put16(&directory, 20);  // version needed
+      Put16(&directory, kFlags);
+      Put16(&directory, Z_DEFLATED);
+      Put16(&directory, dos_time_);
+      Put16(&directory, dos_date_);
+      Put32(&directory, entry.crc);
+      Put32(&directory, static_cast<uint32_t>(entry.compressed));
+      Put32(&directory, static_cast<uint32_t>(entry.uncompressed));
+      Put16(&directory, static_cast<uint16_t>(entry.name.size()));
+      Put16(&directory, 0);  // extra field length
+      Put16(&directory, 0);  // comment length
+      Put16(&directory, 0);  // disk number
+      Put16(&directory, 0);  // internal attributes
+      Put32(&directory, 0);  // external attributes
+      Put32(&directory, entry.offset);
+      directory += entry.name;
+    }
+
+    uint32_t directory_size = static_cast<uint32_t>(directory.size());
+    Put32(&directory, 0x06054b50);
+    Put16(&directory, 0);  // this disk
+    Put16(&directory, 0);  // disk with the directory
+    Put16(&directory, static_cast<uint16_t>(entries_.size()));
+    Put16(&directory, static_cast<uint16_t>(entries_.size()));
+    Put32(&directory, directory_size);
+    Put32(&directory, static_cast<uint32_t>(directory_offset));
+    Put16(&directory, 0);  // comment length
+    return file_->Write(directory.data(), directory.size());
+  }
+
+ private:
+  struct Entry {
+    std::string name;
+    uint32_t offset = 0;
+    uint32_t crc = 0;
+    uint64_t compressed = 0;
+    uint64_t uncompressed = 0;
+  };
+
+  static const uint16_t kFlags = 0x0008 | 0x0800;
+  static const size_t kPendingSize = 64 * 1024;
+
+  static void Put16(std::string* out, uint16_t value) {
+    out->push_back(static_cast<char>(value & 0xff));
+    out->push_back(static_cast<char>(value >> 8));
+  }
+
+  static void Put32(std::string* out, uint32_t value) {
+    Put16(out, static_cast<uint16_t>(value & 0xffff));
+    Put16(out, static_cast<uint16_t>(value >> 16));
+  }
+
+  void SetDosTime() {
+    time_t now = time(nullptr);
+    struct tm local;
+    localtime_r(&now, &local);
+    dos_time_ = static_cast<uint16_t>((local.tm_hour << 11) |
+                                      (local.tm_min << 5) | (local.tm_sec / 2));
+    dos_date_ = static_cast<uint16_t>(((local.tm_year - 80) << 9) |
+                                      ((local.tm_mon + 1) << 5) |
+                                      local.tm_mday);
+  }
+
+  int Deflate(int flush) {
+    Entry& entry = entries_.back();
+    entry.crc = crc32(entry.crc, reinterpret_cast<const Bytef*>(pending_.data()),
+                      pending_.size());
+    entry.uncompressed += pending_.size();
+
+    stream_.next_in =
+        reinterpret_cast<Bytef*>(const_cast<char*>(pending_.data()));
+    stream_.avail_in = static_cast<uInt>(pending_.size());
+    int result;
+    do {
+      stream_.next_out = output_;
+      stream_.avail_out = sizeof(output_);
+      result = deflate(&stream_, flush);
+      if (result == Z_STREAM_ERROR) {
+        return SetError(BIZSYNC_ERROR_IO, "deflate failed");
+      }
+      size_t produced = sizeof(output_) - stream_.avail_out;
+      entry.compressed += produced;
+      int status = file_->Write(output_, produced);
+      if (status != BIZSYNC_OK) {
+        return status;
+      }
+    } while (stream_.avail_out == 0 ||
+             (flush == Z_FINISH && result != Z_STREAM_END));
+    pending_.clear();
+    return BIZSYNC_OK;
+  }
+
+  OutputFile* file_;
+  z_stream stream_;
+  bool stream_ready_ = false;
+  uint16_t dos_time_ = 0;
+  uint16_t dos_date_ = 0;
+  std::vector<Entry> entries_;
+  std::string pending_;
+  Bytef output_[64 * 1024];
+};
+
+static void append_csv_field(std::string* out, const char* text, size_t length,
+                             bool escape_formulas) {
+  bool formula = escape_formulas && length > 0 && text[0] != '\0' &&
+                 strchr("=+-@", text[0]) != nullptr;
+  bool quote = formula || memchr(text, ',', length) != nullptr ||
+               memchr(text, '"', length) != nullptr ||
+               memchr(text, '\n', length) != nullptr ||
+               memchr(text, '\r', length) != nullptr;
+  if (!quote) {
+    out->append(text, length);
+    return;
+  }
+
+  out->push_back('"');
+  if (formula) {
+    out->push_back('\'');
+  }
+  for (size_t i = 0; i < length; i++) {
+    if (text[i] == '"') {
+      out->push_back('"');
+    }
+    out->push_back(text[i]);
+  }
+  out->push_back('"');
+}
+
+// Appends |text| with the XML special characters escaped. Control characters
+// that XML 1.0 cannot represent are dropped.
+static void append_xml_text(std::string* out, const char* text,
+                            size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    unsigned char c = static_cast<unsigned char>(text[i]);
+    switch (c) {
+      case '&':
+        out->append("&amp;");
+        break;
+      case '<':
+        out->append("&lt;");
+        break;
+      case '>':
+        out->append("&gt;");
+        break;
+      case '"':
+        out->append("&quot;");
+        break;
+      case '\t':
+      case '\n':
+      case '\r':
+        out->push_back(static_cast<char>(c));
+        break;
+      default:
+        if (c >= 0x20) {
+          out->push_back(static_cast<char>(c));
+        }
+        break;
+    }
+  }
+}
+
+static void append_hex(std::string* out, const void* data, size_t length) {
+  static const char kDigits[] = "0123456789abcdef";
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < length; i++) {
+    out->push_back(kDigits[bytes[i] >> 4]);
+    out->push_back(kDigits[bytes[i] & 0xf]);
+  }
+}
+
+// Formats numbers with the "C" locale regardless of the desktop's.
+static void append_number(std::string* out, sqlite3_stmt* statement,
+                          int column) {
+  char buffer[32];
+  int length;
+  if (sqlite3_column_type(statement, column) == SQLITE_INTEGER) {
+    length = snprintf(buffer, sizeof(buffer), "%lld",
+                      static_cast<long long>(
+                          sqlite3_column_int64(statement, column)));
+  } else {
+    length = snprintf(buffer, sizeof(buffer), "%.15g",
+                      sqlite3_column_double(statement, column));
+  }
+  out->append(buffer, length);
+}
+
+class Exporter {
+ public:
+  Exporter(BizsyncExport* job, sqlite3_stmt* statement, ByteSink* sink,
+           OutputFile* file)
+      : job_(job), statement_(statement), sink_(sink), file_(file) {
+    columns_ = sqlite3_column_count(statement);
+  }
+
+  int64_t rows() const { return rows_; }
+
+  int WriteCsv() {
+    bool escape = job_->options.flags & BIZSYNC_EXPORT_ESCAPE_FORMULAS;
+    if (!(job_->options.flags & BIZSYNC_EXPORT_NO_HEADER)) {
+      for (int i = 0; i < columns_; i++) {
+        const char* name = sqlite3_column_name(statement_, i);
+        if (i > 0) {
+          line_.push_back(',');
+        }
+        append_csv_field(&line_, name, strlen(name), escape);
+      }
+      line_.append("\r\n");
+    }
+
+    return StepRows([this, escape]() {
+      for (int i = 0; i < columns_; i++) {
+        if (i > 0) {
+          line_.push_back(',');
+        }
+        switch (sqlite3_column_type(statement_, i)) {
+          case SQLITE_NULL:
+            break;
+          case SQLITE_INTEGER:
+          case SQLITE_FLOAT:
+            append_number(&line_, statement_, i);
+            break;
+          case SQLITE_TEXT:
+            append_csv_field(
+                &line_,
+                reinterpret_cast<const char*>(
+                    sqlite3_column_text(statement_, i)),
+                sqlite3_column_bytes(statement_, i), escape);
+            break;
+          default:
+            append_hex(&line_, sqlite3_column_blob(statement_, i),
+                       sqlite3_column_bytes(statement_, i));
+            break;
+        }
+      }
+      line_.append("\r\n");
+    });
+  }
+
+  int WriteSheet() {
+    line_.append(
+        "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+        "<worksheet xmlns=\"http://schemas.openxmlformats.org/"
+        "spreadsheetml/2006/main\"><sheetData>");
+    if (!(job_->options.flags & BIZSYNC_EXPORT_NO_HEADER)) {
+      line_.append("<row>");
+      for (int i = 0; i < columns_; i++) {
+        const char* name = sqlite3_column_name(statement_, i);
+        AppendInlineString(name, strlen(name));
+      }
+      line_.append("</row>");
+    }
+
+    int status = StepRows([this]() {
+      line_.append("<row>");
+      for (int i = 0; i < columns_; i++) {
+        switch (sqlite3_column_type(statement_, i)) {
+          case SQLITE_NULL:
+            line_.append("<c/>");
+            break;
+          case SQLITE_INTEGER:
+          case SQLITE_FLOAT:
+            if (!isfinite(sqlite3_column_double(statement_, i))) {
+              line_.append("<c/>");
+              break;
+            }
+            line_.append("<c><v>");
+            append_number(&line_, statement_, i);
+            line_.append("</v></c>");
+            break;
+          case SQLITE_TEXT:
+            AppendInlineString(reinterpret_cast<const char*>(
+                                   sqlite3_column_text(statement_, i)),
+                               sqlite3_column_bytes(statement_, i));
+            break;
+          default: {
+            // Raw bytes would not be valid UTF-8; hex as in CSV.
+            std::string hex;
+            append_hex(&hex, sqlite3_column_blob(statement_, i),
+                       sqlite3_column_bytes(statement_, i));
+            AppendInlineString(hex.data(), hex.size());
+            break;
+          }
+        }
+      }
+      line_.append("</row>");
+    });
+    if (status != BIZSYNC_OK) {
+      return status;
+    }
+    line_.append("</sheetData></worksheet>");
+    return sink_->Write(line_);
+  }
+
+ private:
+  void AppendInlineString(const char* text, size_t length) {
+    line_.append("<c t=\"inlineStr\"><is><t xml:space=\"preserve\">");
+    append_xml_text(&line_, text, length);
+    line_.append("</t></is></c>");
+  }
+
+  // Formats every remaining row with |format_row| into |line_|, handing it
+  // to the sink whenever it grows past a few KiB.
+  template <typename FormatRow>
+  int StepRows(FormatRow format_row) {
+    const BizsyncExportOptions& options = job_->options;
+    bool xlsx = options.format == BIZSYNC_EXPORT_XLSX;
+    int64_t header_rows = options.flags & BIZSYNC_EXPORT_NO_HEADER ? 0 : 1;
+
+    int result;
+    while ((result = sqlite3_step(statement_)) == SQLITE_ROW) {
+      if (job_->cancelled.load(std::memory_order_relaxed)) {
+        return SetError(BIZSYNC_ERROR_CANCELLED, "export cancelled");
+      }
+      if (xlsx && rows_ + header_rows >= kXlsxMaxRows) {
+        return SetError(BIZSYNC_ERROR_UNSUPPORTED,
+                        "XLSX sheets hold at most %lld rows",
+                        static_cast<long long>(kXlsxMaxRows));
+      }
+
+      format_row();
+      rows_++;
+      if (line_.size() >= kLineFlushSize) {
+        int status = sink_->Write(line_);
+        if (status != BIZSYNC_OK) {
+          return status;
+        }
+        line_.clear();
+      }
+      if (options.callback != nullptr && rows_ % options.progress_rows == 0) {
+        options.callback(options.user_data, BIZSYNC_EXPORT_RUNNING, rows_,
+                         file_->bytes_written());
+      }
+    }
+    if (result != SQLITE_DONE) {
+      return SetSqliteError(sqlite3_db_handle(statement_), "step");
+    }
+    if (!xlsx) {
+      int status = sink_->Write(line_);
+      line_.clear();
+      return status;
+    }
+    return BIZSYNC_OK;
+  }
+
+  static const size_t kLineFlushSize = 16 * 1024;
+
+  BizsyncExport* job_;
+  sqlite3_stmt* statement_;
+  ByteSink* sink_;
+  OutputFile* file_;
+  int columns_ = 0;
+  int64_t rows_ = 0;
+  // Formatted rows not yet handed to the sink.
+  std::string line_;
+};
+
+// Writes the fixed parts of the workbook around a streamed sheet1.xml.
+static int write_xlsx(BizsyncExport* job, Exporter* exporter, ZipWriter* zip) {
+  std::string sheet_name;
+  append_xml_text(&sheet_name, job->sheet_name.data(), job->sheet_name.size());
+
+  struct Part {
+    const char* name;
+    std::string content;
+  };
+  const std::string xml_header =
+      "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n";
+  const Part parts[] = {
+      {"[Content_Types].xml",
+       xml_header +
+           "<Types xmlns=\"http://schemas.openxmlformats.org/package/2006/"
+           "content-types\">"
+           "<Default Extension=\"rels\" ContentType=\"application/"
+           "vnd.openxmlformats-package.relationships+xml\"/>"
+           "<Default Extension=\"xml\" ContentType=\"application/xml\"/>"
+           "<Override PartName=\"/xl/workbook.xml\" ContentType=\"application/"
+           "vnd.openxmlformats-officedocument.spreadsheetml.sheet.main+xml\"/>"
+           "<Override PartName=\"/xl/worksheets/sheet1.xml\" "
+           "ContentType=\"application/"
+           "vnd.openxmlformats-officedocument.spreadsheetml.worksheet+xml\"/>"
+           "</Types>"},
+      {"_rels/.rels",
+       xml_header +
+           "<Relationships xmlns=\"http://schemas.openxmlformats.org/package/"
+           "2006/relationships\">"
+           "<Relationship Id=\"rId1\" Type=\"http://schemas.openxmlformats.org/"
+           "officeDocument/2006/relationships/officeDocument\" "
+           "Target=\"xl/workbook.xml\"/></Relationships>"},
+      {"xl/workbook.xml",
+       xml_header +
+           "<workbook xmlns=\"http://schemas.openxmlformats.org/spreadsheetml/"
+           "2006/main\" xmlns:r=\"http://schemas.openxmlformats.org/"
+           "officeDocument/2006/relationships\"><sheets><sheet name=\"" +
+           sheet_name + "\" sheetId=\"1\" r:id=\"rId1\"/></sheets></workbook>"},
+      {"xl/_rels/workbook.xml.rels",
+       xml_header +
+           "<Relationships xmlns=\"http://schemas.openxmlformats.org/package/"
+           "2006/relationships\">"
+           "<Relationship Id=\"rId1\" Type=\"http://schemas.openxmlformats.org/"
+           "officeDocument/2006/relationships/worksheet\" "
+           "Target=\"worksheets/sheet1.xml\"/></Relationships>"},
+  };
+
+  for (const Part& part : parts) {
+    int status = zip->BeginEntry(part.name);
+    if (status == BIZSYNC_OK) {
+      status = zip->Write(part.content);
+    }
+    if (status == BIZSYNC_OK) {
+      status = zip->EndEntry();
+    }
+    if (status != BIZSYNC_OK) {
+      return status;
+    }
+  }
+
+  int status = zip->BeginEntry("xl/worksheets/sheet1.xml");
+  if (status == BIZSYNC_OK) {
+    status = exporter->WriteSheet();
+  }
+  if (status == BIZSYNC_OK) {
+    status = zip->EndEntry();
+  }
+  if (status == BIZSYNC_OK) {
+    status = zip->Finish();
+  }
+  return status;
+}
+
+static int run_export(BizsyncExport* job, int64_t* rows, uint64_t* bytes) {
+  ConnectionLease lease = AcquireReader(job->db);
+  sqlite3_stmt* statement = nullptr;
+  int status = lease.Prepare(job->sql.c_str(), &statement);
+  if (status == BIZSYNC_OK) {
+    status = lease.BindParameters(
+        statement, job->has_params ? job->params.data() : nullptr,
+        job->params.size());
+  }
+  if (status != BIZSYNC_OK) {
+    return status;
+  }
+
+  OutputFile file;
+  status = file.Open(job->path, job->options.buffer_size,
+                     job->options.flags & BIZSYNC_EXPORT_DIRECT_IO);
+  if (status == BIZSYNC_OK) {
+    if (job->options.format == BIZSYNC_EXPORT_XLSX) {
+      ZipWriter zip(&file);
+      Exporter exporter(job, statement, &zip, &file);
+      status = write_xlsx(job, &exporter, &zip);
+      *rows = exporter.rows();
+    } else {
+      FileSink sink(&file);
+      Exporter exporter(job, statement, &sink, &file);
+      status = exporter.WriteCsv();
+      *rows = exporter.rows();
+    }
+  }
+  if (status == BIZSYNC_OK) {
+    status = file.Commit();
+  }
+  *bytes = file.bytes_written();
+
+  sqlite3_reset(statement);
+  sqlite3_clear_bindings(statement);
+  return status;
+}
+
+static void export_task_main(BizsyncExport* job) {
+  // SQLite's own number formatting is locale independent, but snprintf's is
+  // not; the desktop locale may use a decimal comma.
+  locale_t c_locale = newlocale(LC_ALL_MASK, "C", static_cast<locale_t>(0));
+  locale_t previous = uselocale(c_locale);
+
+  int64_t rows = 0;
+  uint64_t bytes = 0;
+  int status = run_export(job, &rows, &bytes);
+
+  if (c_locale != static_cast<locale_t>(0)) {
+    uselocale(previous);
+    freelocale(c_locale);
+  }
+
+  if (job->options.callback != nullptr) {
+    job->options.callback(job->options.user_data, status, rows,
+                          static_cast<int64_t>(bytes));
+  }
+}
+
+}  // namespace bizsync
+
+int bizsync_export_start(BizsyncDb* db, const char* sql, const uint8_t* params,
+                         size_t params_length, const char* path,
+                         const BizsyncExportOptions* options,
+                         BizsyncExport** out_export) {
+  using namespace bizsync;
+
+  if (db == nullptr || sql == nullptr || path == nullptr ||
+      out_export == nullptr) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "db, sql, path and out_export required");
+  }
+  *out_export = nullptr;
+
+  BizsyncExport* job = new BizsyncExport();
+  job->db = db;
+  job->sql = sql;
+  job->has_params = params != nullptr;
+  if (params != nullptr) {
+    job->params.assign(params, params + params_length);
+  }
+  job->path = path;
+  job->options = options != nullptr ? *options : BizsyncExportOptions{};
+  if (job->options.format != BIZSYNC_EXPORT_CSV &&
+      job->options.format != BIZSYNC_EXPORT_XLSX) {
+    delete job;
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "unknown export format %d",
+                    options->format);
+  }
+  if (job->options.progress_rows <= 0) {
+    job->options.progress_rows = kDefaultProgressRows;
+  }
+  if (job->options.buffer_size <= 0) {
+    job->options.buffer_size = kDefaultBufferSize;
+  }
+
+  // Excel limits sheet names to 31 characters and forbids a few.
+  job->sheet_name = job->options.sheet_name != nullptr &&
+                            job->options.sheet_name[0] != '\0'
+                        ? job->options.sheet_name
+                        : kDefaultSheetName;
+  for (char& c : job->sheet_name) {
+    if (strchr("[]:*?/\\", c) != nullptr) {
+      c = '_';
+    }
+  }
+  // Cut before the 32nd character, counting UTF-8 lead bytes.
+  size_t characters = 0;
+  for (size_t i = 0; i < job->sheet_name.size(); i++) {
+    if ((static_cast<unsigned char>(job->sheet_name[i]) & 0xc0) != 0x80 &&
+        ++characters > 31) {
+      job->sheet_name.resize(i);
+      break;
+    }
+  }
+  job->options.sheet_name = nullptr;
+
+  int status = job->task.Post([job] { export_task_main(job); });
+  if (status != BIZSYNC_OK) {
+    delete job;
+    return status;
+  }
+  *out_export = job;
+  return BIZSYNC_OK;
+}
+
+void bizsync_export_cancel(BizsyncExport* job) {
+  if (job != nullptr) {
+    job->cancelled = true;
+  }
+}
+
+void bizsync_export_free(BizsyncExport* job) {
+  if (job == nullptr) {
+    return;
+  }
+  job->task.Wait();
+  delete job;
+}
@@ -0,0 +1,100 @@
+#ifndef BIZSYNC_NATIVE_STREAMING_EXPORT_H_
+#define BIZSYNC_NATIVE_STREAMING_EXPORT_H_
+
+#include "sqlite_engine.h"
+
+// Streams the rows of a SELECT to a CSV or XLSX file on a scheduler worker.
+// Rows are stepped straight from a reader connection into one fixed-size
+// output buffer, so memory use does not grow with the row count. Written
+// ranges are flushed and dropped from the page cache as the export goes,
+// which keeps multi-gigabyte exports from crowding out the desktop session.
+//
+// The file appears at its final path only once the export succeeds; failed
+// or cancelled exports leave nothing behind.
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct BizsyncExport BizsyncExport;
+
+typedef enum {
+  BIZSYNC_EXPORT_CSV = 0,
+  // A single-sheet workbook with inline strings, so no shared-string table
+  // has to be held in memory.
+  BIZSYNC_EXPORT_XLSX = 1,
+} BizsyncExportFormat;
+
+typedef enum {
+  // Omit the row of column names.
+  BIZSYNC_EXPORT_NO_HEADER = 1 << 0,
+  // Write with O_DIRECT, bypassing the page cache entirely. Falls back to
+  // buffered I/O on filesystems that refuse it.
+  BIZSYNC_EXPORT_DIRECT_IO = 1 << 1,
+  // Prefix CSV text starting with = + - @ with a quote so spreadsheet apps
+  // do not evaluate it as a formula.
+  BIZSYNC_EXPORT_ESCAPE_FORMULAS = 1 << 2,
+} BizsyncExportFlags;
+
+// Status passed to the callback while rows are still being written.
+#define BIZSYNC_EXPORT_RUNNING 1
+
+// Called on the export's worker, every |progress_rows| rows with
+// BIZSYNC_EXPORT_RUNNING and exactly once at the end with the final
+// #BizsyncStatus. Use NativeCallable.listener from Dart.
+typedef void (*BizsyncExportCallback)(void* user_data, int32_t status,
+                                      int64_t rows, int64_t bytes);
+
+// Zero fields select the default noted beside them.
+typedef struct {
+  int32_t format;                  // BIZSYNC_EXPORT_CSV
+  int32_t flags;                   // none
+  int32_t progress_rows;           // 4096
+  int32_t buffer_size;             // 1 MiB
+  const char* sheet_name;          // "Sheet1"
+  BizsyncExportCallback callback;  // none
+  void* user_data;
+} BizsyncExportOptions;
+
+/**
+ * bizsync_export_start:
+ * @db: a #BizsyncDb that outlives the export.
+ * @sql: a single SELECT statement.
+ * @params: (allow-none): packed row buffer holding one row of parameters.
+ * @params_length: size of @params in bytes.
+ * @path: destination file, replaced when the export succeeds.
+ * @options: (allow-none): export settings, or %NULL for a CSV with header.
+ * @out_export: (out): location for the running export.
+ *
+ * Copies the arguments and starts exporting on the shared scheduler.
+ *
+ * Returns: %BIZSYNC_OK or a negative #BizsyncStatus.
+ */
+BIZSYNC_EXPORT int bizsync_export_start(BizsyncDb* db, const char* sql,
+                                        const uint8_t* params,
+                                        size_t params_length,
+                                        const char* path,
+                                        const BizsyncExportOptions* options,
+                                        BizsyncExport** out_export);
+
+/**
+ * bizsync_export_cancel:
+ * @job: a #BizsyncExport.
+ *
+ * Asks @job to stop; its callback then reports
+ * %BIZSYNC_ERROR_CANCELLED unless it had already finished.
+ */
+BIZSYNC_EXPORT void bizsync_export_cancel(BizsyncExport* job);
+
+/**
+ * bizsync_export_free:
+ * @job: (allow-none): a #BizsyncExport.
+ *
+ * Waits for the export to finish and releases @job.
+ */
+BIZSYNC_EXPORT void bizsync_export_free(BizsyncExport* job);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // BIZSYNC_NATIVE_STREAMING_EXPORT_H_
@@ -0,0 +1,913 @@
+#include "sync_transport.h"
+
+#include <curl/curl.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "compression.h"
+
+static const int32_t kDefaultBatchOperations = 2000;
+static const int32_t kDefaultMaxInFlight = 4;
+static const int32_t kDefaultCompressionLevel = 3;
+static const int32_t kDefaultIntervalMs = 30000;
+static const int32_t kDefaultTimeoutMs = 30000;
+
+// Transient failures are retried this often, backing off from
+// kRetryDelayMs, before the round gives up until the next interval.
+static const int kMaxAttempts = 4;
+static const int64_t kRetryDelayMs = 500;
+
+// Acknowledgements are tiny; anything larger is not one.
+static const size_t kMaxResponseSize = 64 * 1024;
+
+static const char* kSchemaSql =
+    "CREATE TABLE IF NOT EXISTS sync_acks("
+    "collection TEXT NOT NULL, node INTEGER NOT NULL, hlc INTEGER NOT NULL, "
+    "PRIMARY KEY(collection, node)) WITHOUT ROWID;"
+    "CREATE INDEX IF NOT EXISTS crdt_ops_sync "
+    "ON crdt_ops(collection, node, hlc);";
+
+// Pending operations in index order, resuming after the last one read.
+static const char* kDeltaSql =
+    "SELECT o.rowid, o.kind, o.collection, o.key, o.field, o.hlc, o.node, "
+    "o.value FROM crdt_ops AS o "
+    "LEFT JOIN sync_acks AS a ON a.collection = o.collection "
+    "AND a.node = o.node "
+    "WHERE o.hlc > coalesce(a.hlc, -9223372036854775808) "
+    "AND (o.collection, o.node, o.hlc, o.rowid) > (?1, ?2, ?3, ?4) "
+    "ORDER BY o.collection, o.node, o.hlc, o.rowid LIMIT ?5";
+
+static const char* kPendingSql =
+    "SELECT count(*) FROM crdt_ops AS o "
+    "LEFT JOIN sync_acks AS a ON a.collection = o.collection "
+    "AND a.node = o.node "
+    "WHERE o.hlc > coalesce(a.hlc, -9223372036854775808)";
+
+static const char* kAckSql =
+    "INSERT INTO sync_acks(collection, node, hlc) VALUES(?, ?, ?) "
+    "ON CONFLICT(collection, node) DO UPDATE SET "
+    "hlc = max(hlc, excluded.hlc)";
+
+static std::atomic<BizsyncSync*> default_sync{nullptr};
+
+namespace bizsync {
+
+static int64_t monotonic_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Protocol buffers wire format, enough for sync.proto.
+class ProtoWriter {
+ public:
+  void Varint(uint32_t field, uint64_t value) {
+    Tag(field, 0);
+    WriteVarint(value);
+  }
+
+  void Sint64(uint32_t field, int64_t value) {
+    Varint(field, (static_cast<uint64_t>(value) << 1) ^
+                      static_cast<uint64_t>(value >> 63));
+  }
+
+  void Fixed64(uint32_t field, uint64_t value) {
+    Tag(field, 1);
+    buffer_.append(reinterpret_cast<const char*>(&value), 8);
+  }
+
+  void Double(uint32_t field, double value) {
+    Tag(field, 1);
+    buffer_.append(reinterpret_cast<const char*>(&value), 8);
+  }
+
+  void Bytes(uint32_t field, const void* data, size_t length) {
+    Tag(field, 2);
+    WriteVarint(length);
+    buffer_.append(static_cast<const char*>(data), length);
+  }
+
+  void Message(uint32_t field, const ProtoWriter& message) {
+    Bytes(field, message.buffer_.data(), message.buffer_.size());
+  }
+
+  // Appends already encoded fields of the same message.
+  void Append(const ProtoWriter& fields) { buffer_.append(fields.buffer_); }
+
+  void Clear() { buffer_.clear(); }
+  const std::string& data() const { return buffer_; }
+
+ private:
+  void Tag(uint32_t field, uint32_t wire_type) {
+    WriteVarint((field << 3) | wire_type);
+  }
+
+  void WriteVarint(uint64_t value) {
+    while (value >= 0x80) {
+      buffer_.push_back(static_cast<char>(value | 0x80));
+      value >>= 7;
+    }
+    buffer_.push_back(static_cast<char>(value));
+  }
+
+  std::string buffer_;
+};
+
+class ProtoReader {
+ public:
+  ProtoReader(const uint8_t* data, size_t length)
+      : cursor_(data), end_(data + length) {}
+
+  // Reads the next field's number and wire type. Returns false at the end
+  // of the message; check ok() to tell that from malformed input.
+  bool Next(uint32_t* field, uint32_t* wire_type) {
+    uint64_t tag;
+    if (cursor_ == end_ || !ReadVarint(&tag)) {
+      return false;
+    }
+    *field = static_cast<uint32_t>(tag >> 3);
+    *wire_type = static_cast<uint32_t>(tag & 7);
+    return true;
+  }
+
+  bool ReadVarint(uint64_t* value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (cursor_ == end_) {
+        return Fail();
+      }
+      uint8_t byte = *cursor_++;
+      *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0) {
+        return true;
+      }
+    }
+    return Fail();
+  }
+
+  bool ReadFixed64(uint64_t* value) {
+    if (end_ - cursor_ < 8) {
+      return Fail();
+    }
+    memcpy(value, cursor_, 8);
+    cursor_ += 8;
+    return true;
+  }
+
+  bool ReadBytes(const uint8_t** data, size_t* length) {
+    uint64_t size;
+    if (!ReadVarint(&size) || size > static_cast<uint64_t>(end_ - cursor_)) {
+      return Fail();
+    }
+    *data = cursor_;
+    *length = size;
+    cursor_ += size;
+    return true;
+  }
+
+  bool Skip(uint32_t wire_type) {
+    uint64_t ignored;
+    const uint8_t* data;
+    size_t length;
+    switch (wire_type) {
+      case 0:
+        return ReadVarint(&ignored);
+      case 1:
+        return ReadFixed64(&ignored);
+      case 2:
+        return ReadBytes(&data, &length);
+      case 5:
+        if (end_ - cursor_ < 4) {
+          return Fail();
+        }
+        cursor_ += 4;
+        return true;
+      default:
+        return Fail();
+    }
+  }
+
+  bool ok() const { return !failed_; }
+
+ private:
+  bool Fail() {
+    failed_ = true;
+    cursor_ = end_;
+    return false;
+  }
+
+  const uint8_t* cursor_;
+  const uint8_t* end_;
+  bool failed_ = false;
+};
+
+struct ClockEntry {
+  int64_t node;
+  int64_t hlc;
+};
+
+// One encoded batch and its HTTP request.
+struct Batch {
+  ~Batch() {
+    if (easy != nullptr) {
+      curl_easy_cleanup(easy);
+    }
+    curl_slist_free_all(headers);
+  }
+
+  uint64_t sequence = 0;
+  std::string collection;
+  std::vector<ClockEntry> clock;
+  int64_t operations = 0;
+  std::string body;
+
+  CURL* easy = nullptr;
+  curl_slist* headers = nullptr;
+  std::string response;
+  bool attached = false;  // Added to the multi handle.
+  int attempts = 0;
+  int64_t sent_at_ms = 0;
+  int64_t retry_at_ms = 0;  // Non-zero while waiting to be re-sent.
+  bool acknowledged = false;
+  int status = BIZSYNC_OK;
+};
+
+// Where the next batch starts: just after the last operation read.
+struct Cursor {
+  std::string collection;
+  int64_t node = INT64_MIN;
+  int64_t hlc = INT64_MIN;
+  int64_t rowid = INT64_MIN;
+};
+
+// Settings copied by bizsync_sync_configure().
+struct Config {
+  BizsyncDb* db = nullptr;
+  BizsyncSyncOptions options = {};
+  std::string url;
+  std::string authorization;
+};
+
+}  // namespace bizsync
+
+struct BizsyncSync {
+  std::thread thread;
+
+  // Guards everything below it. Held by configure() and the transport
+  // thread for a whole round so the database cannot be swapped under it.
+  std::mutex round_mutex;
+  bizsync::Config config;
+  std::unique_ptr<bizsync::Compressor> compressor;
+  CURLM* multi = nullptr;
+  uint64_t next_sequence = 1;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool requested = false;
+  bool stopping = false;
+  int64_t stop_deadline_ms = 0;
+  BizsyncSyncStats stats = {};
+};
+
+namespace bizsync {
+
+static size_t collect_response(char* data, size_t size, size_t count,
+                               void* user_data) {
+  std::string* response = static_cast<std::string*>(user_data);
+  size_t length = size * count;
+  if (response->size() + length > kMaxResponseSize) {
+    return 0;
+  }
+  response->append(data, length);
+  return length;
+}
+
+// Runs one upload round: reads pending operations batch by batch, keeps up
+// to max_in_flight of them on the wire and stores acknowledgements in send
+// order.
+class Round {
+ public:
+  explicit Round(BizsyncSync* sync)
+      : sync_(sync), config_(sync->config), options_(config_.options) {}
+
+  ~Round() {
+    for (std::unique_ptr<Batch>& batch : window_) {
+      Detach(batch.get());
+    }
+  }
+
+  int Run() {
+    int status = CountPending();
+    while (status == BIZSYNC_OK) {
+      while (!exhausted_ && !Stopping() &&
+             static_cast<int32_t>(window_.size()) < options_.max_in_flight) {
+        std::unique_ptr<Batch> batch;
+        status = ReadBatch(&batch);
+        if (status != BIZSYNC_OK || batch == nullptr) {
+          exhausted_ = true;
+          break;
+        }
+        status = Send(batch.get());
+        if (status != BIZSYNC_OK) {
+          break;
+        }
+        window_.push_back(std::move(batch));
+      }
+      if (status != BIZSYNC_OK || window_.empty()) {
+        break;
+      }
+      if (Stopping() && monotonic_ms() >= StopDeadline()) {
+        status = SetError(BIZSYNC_ERROR_CANCELLED,
+                          "stopped with %zu batches unacknowledged",
+                          window_.size());
+        break;
+      }
+      status = Pump();
+      if (status == BIZSYNC_OK) {
+        status = StoreAcknowledged();
+      }
+    }
+    return status;
+  }
+
+  int64_t acknowledged() const { return acknowledged_; }
+  int64_t pending() const {
+    return std::max<int64_t>(0, pending_ - acknowledged_);
+  }
+
+ private:
+  bool Stopping() {
+    std::lock_guard<std::mutex> lock(sync_->mutex);
+    return sync_->stopping;
+  }
+
+  int64_t StopDeadline() {
+    std::lock_guard<std::mutex> lock(sync_->mutex);
+    return sync_->stop_deadline_ms;
+  }
+
+  int CountPending() {
+    ConnectionLease lease = AcquireReader(config_.db);
+    sqlite3_stmt* statement = nullptr;
+    int status = lease.Prepare(kPendingSql, &statement);
+    if (status != BIZSYNC_OK) {
+      return status;
+    }
+    if (sqlite3_step(statement) == SQLITE_ROW) {
+      pending_ = sqlite3_column_int64(statement, 0);
+    } else {
+      status = SetSqliteError(lease.handle(), "count pending operations");
+    }
+    sqlite3_reset(statement);
+    return status;
+  }
+
+  // Reads and encodes the operations after |cursor_|, all from one
+  // collection. Leaves |*out_batch| null once nothing is pending.
+  int ReadBatch(std::unique_ptr<Batch>* out_batch) {
+    ConnectionLease lease = AcquireReader(config_.db);
+    sqlite3_stmt* statement = nullptr;
+    int status = lease.Prepare(kDeltaSql, &statement);
+    if (status != BIZSYNC_OK) {
+      return status;
+    }
+    sqlite3_bind_text(statement, 1, cursor_.collection.data(),
+                      cursor_.collection.size(), SQLITE_TRANSIENT);
+    sqlite3_bind_int64(statement, 2, cursor_.node);
+    sqlite3_bind_int64(statement, 3, cursor_.hlc);
+    sqlite3_bind_int64(statement, 4, cursor_.rowid);
+    // One row more than fits, to see whether the batch ends mid-timestamp.
+    sqlite3_bind_int(statement, 5, options_.batch_operations + 1);
+
+    std::unique_ptr<Batch> batch(new Batch());
+    operations_.Clear();
+    bool have_node = false;
+    int64_t node = 0;
+    int64_t hlc = 0;
+    bool split = false;
+    int result;
+    while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
+      const char* collection =
+          reinterpret_cast<const char*>(sqlite3_column_text(statement, 2));
+      size_t collection_length = sqlite3_column_bytes(statement, 2);
+      if (batch->operations == 0) {
+        batch->collection.assign(collection, collection_length);
+      } else if (batch->collection.compare(0, std::string::npos, collection,
+                                           collection_length) != 0) {
+        break;
+      }
+
+      int64_t row_node = sqlite3_column_int64(statement, 6);
+      if (batch->operations == options_.batch_operations) {
+        split = row_node == node && sqlite3_column_int64(statement, 5) == hlc;
+        break;
+      }
+      if (have_node && row_node != node) {
+        batch->clock.push_back({node, hlc});
+      }
+      have_node = true;
+      node = row_node;
+      hlc = sqlite3_column_int64(statement, 5);
+      EncodeOperation(statement, node, hlc);
+
+      cursor_.collection = batch->collection;
+      cursor_.node = node;
+      cursor_.hlc = hlc;
+      cursor_.rowid = sqlite3_column_int64(statement, 0);
+      batch->operations++;
+    }
+    if (result != SQLITE_ROW && result != SQLITE_DONE) {
+      status = SetSqliteError(lease.handle(), "read pending operations");
+    }
+    sqlite3_reset(statement);
+    sqlite3_clear_bindings(statement);
+    if (status != BIZSYNC_OK || batch->operations == 0) {
+      return status;
+    }
+
+    // If the batch stopped partway through the operations sharing one
+    // timestamp, only those before it are complete.
+    batch->clock.push_back({node, split ? hlc - 1 : hlc});
+
+    batch->sequence = sync_->next_sequence++;
+    message_.Clear();
+    message_.Fixed64(1, static_cast<uint64_t>(options_.device));
+    message_.Varint(2, batch->sequence);
+    message_.Bytes(3, batch->collection.data(), batch->collection.size());
+    message_.Append(operations_);
+    for (const ClockEntry& entry : batch->clock) {
+      entry_.Clear();
+      entry_.Fixed64(1, static_cast<uint64_t>(entry.node));
+      entry_.Fixed64(2, static_cast<uint64_t>(entry.hlc));
+      message_.Message(5, entry_);
+    }
+    status = sync_->compressor->Compress(message_.data(), &batch->body);
+    if (status != BIZSYNC_OK) {
+      return status;
+    }
+
+    std::lock_guard<std::mutex> lock(sync_->mutex);
+    sync_->stats.bytes_encoded += message_.data().size();
+    sync_->stats.operations_sent += batch->operations;
+    *out_batch = std::move(batch);
+    return BIZSYNC_OK;
+  }
+
+  void EncodeOperation(sqlite3_stmt* statement, int64_t node, int64_t hlc) {
+    operation_.Clear();
+    value_.Clear();
+    int64_t kind = sqlite3_column_int64(statement, 1);
+    if (kind != 0) {
+      operation_.Varint(1, static_cast<uint64_t>(kind));
+    }
+    operation_.Bytes(2, sqlite3_column_text(statement, 3),
+                     sqlite3_column_bytes(statement, 3));
+    operation_.Bytes(3, sqlite3_column_text(statement, 4),
+                     sqlite3_column_bytes(statement, 4));
+    operation_.Fixed64(4, static_cast<uint64_t>(hlc));
+    operation_.Fixed64(5, static_cast<uint64_t>(node));
+    switch (sqlite3_column_type(statement, 7)) {
+      case SQLITE_INTEGER:
+        value_.Sint64(1, sqlite3_column_int64(statement, 7));
+        break;
+      case SQLITE_FLOAT:
+        value_.Double(2, sqlite3_column_double(statement, 7));
+        break;
+      case SQLITE_TEXT:
+        value_.Bytes(3, sqlite3_column_text(statement, 7),
+                     sqlite3_column_bytes(statement, 7));
+        break;
+      case SQLITE_BLOB:
+        value_.Bytes(4, sqlite3_column_blob(statement, 7),
+                     sqlite3_column_bytes(statement, 7));
+        break;
+      default:
+        break;
+    }
+    if (!value_.data().empty()) {
+      operation_.Message(6, value_);
+    }
+    operations_.Message(4, operation_);
+  }
+
+  int Send(Batch* batch) {
+    if (batch->easy == nullptr) {
+      batch->easy = curl_easy_init();
+      if (batch->easy == nullptr) {
+        return SetError(BIZSYNC_ERROR_IO, "curl_easy_init failed");
+      }
+      std::string encoding =
+          std::string("Content-Encoding: ") + sync_->compressor->encoding();
+      batch->headers = curl_slist_append(
+          batch->headers, "Content-Type: application/x-protobuf");
+      batch->headers = curl_slist_append(batch->headers, encoding.c_str());
+      // POSTs would otherwise wait a round trip for 100 Continue.
+      batch->headers = curl_slist_append(batch->headers, "Expect:");
+      if (!config_.authorization.empty()) {
+        batch->headers = curl_slist_append(batch->headers,
+                                           config_.authorization.c_str());
+      }
+
+      CURL* easy = batch->easy;
+      curl_easy_setopt(easy, CURLOPT_URL, config_.url.c_str());
+      curl_easy_setopt(easy, CURLOPT_HTTPHEADER, batch->headers);
+      curl_easy_setopt(easy, CURLOPT_POSTFIELDS, batch->body.data());
+      curl_easy_setopt(easy, CURLOPT_POSTFIELDSIZE_LARGE,
+                       static_cast<curl_off_t>(batch->body.size()));
+      curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, collect_response);
+      curl_easy_setopt(easy, CURLOPT_WRITEDATA, &batch->response);
+      curl_easy_setopt(easy, CURLOPT_PRIVATE, batch);
+      curl_easy_setopt(easy, CURLOPT_TIMEOUT_MS,
+                       static_cast<long>(options_.timeout_ms));
+      curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+      curl_easy_setopt(easy, CURLOPT_TCP_KEEPALIVE, 1L);
+      // Multiplex every batch over one HTTP/2 connection rather than opening
+      // a connection per batch while the first is still negotiating.
+      curl_easy_setopt(easy, CURLOPT_HTTP_VERSION,
+                       static_cast<long>(CURL_HTTP_VERSION_2TLS));
+      curl_easy_setopt(easy, CURLOPT_PIPEWAIT, 1L);
+    }
+    batch->response.clear();
+    batch->attempts++;
+    batch->sent_at_ms = monotonic_ms();
+    batch->retry_at_ms = 0;
+    CURLMcode result = curl_multi_add_handle(sync_->multi, batch->easy);
+    if (result != CURLM_OK) {
+      return SetError(BIZSYNC_ERROR_IO, "curl_multi_add_handle: %s",
+                      curl_multi_strerror(result));
+    }
+    batch->attached = true;
+    std::lock_guard<std::mutex> lock(sync_->mutex);
+    sync_->stats.batches_sent++;
+    sync_->stats.bytes_sent += batch->body.size();
+    if (batch->attempts > 1) {
+      sync_->stats.batches_retried++;
+    }
+    return BIZSYNC_OK;
+  }
+
+  void Detach(Batch* batch) {
+    if (batch->attached) {
+      curl_multi_remove_handle(sync_->multi, batch->easy);
+      batch->attached = false;
+    }
+  }
+
+  // Drives the transfers until one finishes or a retry is due.
+  int Pump() {
+    int64_t now = monotonic_ms();
+    int timeout_ms = 1000;
+    for (std::unique_ptr<Batch>& batch : window_) {
+      if (batch->retry_at_ms == 0) {
+        continue;
+      }
+      if (batch->retry_at_ms <= now) {
+        int status = Send(batch.get());
+        if (status != BIZSYNC_OK) {
+          return status;
+        }
+      } else {
+        timeout_ms = std::min<int64_t>(timeout_ms, batch->retry_at_ms - now);
+      }
+    }
+
+    int running = 0;
+    CURLMcode result = curl_multi_perform(sync_->multi, &running);
+    if (result == CURLM_OK) {
+      result = curl_multi_poll(sync_->multi, nullptr, 0, timeout_ms, nullptr);
+    }
+    if (result == CURLM_OK) {
+      result = curl_multi_perform(sync_->multi, &running);
+    }
+    if (result != CURLM_OK) {
+      return SetError(BIZSYNC_ERROR_IO, "curl_multi: %s",
+                      curl_multi_strerror(result));
+    }
+
+    int queued;
+    while (CURLMsg* message = curl_multi_info_read(sync_->multi, &queued)) {
+      if (message->msg != CURLMSG_DONE) {
+        continue;
+      }
+      Batch* batch = nullptr;
+      curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, &batch);
+      Detach(batch);
+      Finish(batch, message->data.result);
+    }
+    return BIZSYNC_OK;
+  }
+
+  // Settles one finished transfer: acknowledged, due for a retry or failed.
+  void Finish(Batch* batch, CURLcode result) {
+    long http_status = 0;
+    curl_easy_getinfo(batch->easy, CURLINFO_RESPONSE_CODE, &http_status);
+
+    bool transient = false;
+    if (result != CURLE_OK) {
+      transient = true;
+      batch->status = SetError(BIZSYNC_ERROR_IO, "sync upload: %s",
+                               curl_easy_strerror(result));
+    } else if (http_status == 200) {
+      batch->status = ParseAck(batch);
+      batch->acknowledged = batch->status == BIZSYNC_OK;
+      if (batch->acknowledged) {
+        std::lock_guard<std::mutex> lock(sync_->mutex);
+        sync_->stats.last_round_trip_ms =
+            static_cast<uint32_t>(monotonic_ms() - batch->sent_at_ms);
+      }
+      return;
+    } else {
+      transient = http_status == 408 || http_status == 429 ||
+                  http_status >= 500;
+      batch->status = SetError(BIZSYNC_ERROR_IO,
+                               "sync server answered HTTP %ld", http_status);
+    }
+
+    if (transient && batch->attempts < kMaxAttempts && !Stopping()) {
+      batch->status = BIZSYNC_OK;
+      batch->retry_at_ms =
+          monotonic_ms() + (kRetryDelayMs << (batch->attempts - 1));
+    }
+  }
+
+  int ParseAck(Batch* batch) {
+    ProtoReader reader(reinterpret_cast<const uint8_t*>(batch->response.data()),
+                       batch->response.size());
+    uint64_t sequence = 0;
+    std::vector<ClockEntry> clock;
+    uint32_t field;
+    uint32_t wire_type;
+    while (reader.Next(&field, &wire_type)) {
+      if (field == 1 && wire_type == 0) {
+        reader.ReadVarint(&sequence);
+      } else if (field == 2 && wire_type == 2) {
+        const uint8_t* data;
+        size_t length;
+        if (!reader.ReadBytes(&data, &length)) {
+          break;
+        }
+        ProtoReader entry_reader(data, length);
+        ClockEntry entry = {0, 0};
+        uint64_t value;
+        while (entry_reader.Next(&field, &wire_type)) {
+          if (field <= 2 && wire_type == 1 &&
+              entry_reader.ReadFixed64(&value)) {
+            (field == 1 ? entry.node : entry.hlc) =
+                static_cast<int64_t>(value);
+          } else {
+            entry_reader.Skip(wire_type);
+          }
+        }
+        if (!entry_reader.ok()) {
+          return SetError(BIZSYNC_ERROR_FORMAT, "malformed clock entry");
+        }
+        clock.push_back(entry);
+      } else {
+        reader.Skip(wire_type);
+      }
+    }
+    if (!reader.ok() || sequence != batch->sequence) {
+      return SetError(BIZSYNC_ERROR_FORMAT,
+                      "acknowledgement for batch %llu does not match",
+                      static_cast<unsigned long long>(batch->sequence));
+    }
+    if (!clock.empty()) {
+      batch->clock = std::move(clock);
+    }
+    return BIZSYNC_OK;
+  }
+
+  // Stores the acknowledged batches at the front of the window in one
+  // transaction. A failed batch there ends the round.
+  int StoreAcknowledged() {
+    ack_rows_.Clear();
+    int64_t operations = 0;
+    while (!window_.empty() && window_.front()->acknowledged) {
+      const Batch& batch = *window_.front();
+      for (const ClockEntry& entry : batch.clock) {
+        ack_rows_.AppendText(batch.collection.data(), batch.collection.size());
+        ack_rows_.AppendInt64(entry.node);
+        ack_rows_.AppendInt64(entry.hlc);
+        ack_rows_.EndRow();
+      }
+      operations += batch.operations;
+      window_.pop_front();
+    }
+
+    if (ack_rows_.row_count() > 0) {
+      ConnectionLease lease = AcquireWriter(config_.db);
+      PackedRowReader reader(ack_rows_.data(), ack_rows_.size());
+      int64_t changes = 0;
+      int status = lease.RunBatch(kAckSql, &reader, &changes);
+      if (status != BIZSYNC_OK) {
+        return status;
+      }
+      acknowledged_ += operations;
+      if (options_.callback != nullptr) {
+        options_.callback(options_.user_data, BIZSYNC_SYNC_RUNNING,
+                          acknowledged_,
+                          std::max<int64_t>(0, pending_ - acknowledged_));
+      }
+    }
+
+    for (const std::unique_ptr<Batch>& batch : window_) {
+      if (batch->status != BIZSYNC_OK && batch->retry_at_ms == 0) {
+        return SetError(batch->status, "batch %llu of %s failed",
+                        static_cast<unsigned long long>(batch->sequence),
+                        batch->collection.c_str());
+      }
+    }
+    return BIZSYNC_OK;
+  }
+
+  BizsyncSync* sync_;
+  const Config& config_;
+  const BizsyncSyncOptions& options_;
+
+  Cursor cursor_;
+  bool exhausted_ = false;
+  std::deque<std::unique_ptr<Batch>> window_;
+  int64_t pending_ = 0;
+  int64_t acknowledged_ = 0;
+
+  ProtoWriter message_;
+  ProtoWriter operations_;
+  ProtoWriter operation_;
+  ProtoWriter value_;
+  ProtoWriter entry_;
+  PackedRowWriter ack_rows_{3};
+};
+
+static void sync_thread_main(BizsyncSync* sync) {
+  std::unique_lock<std::mutex> lock(sync->mutex);
+  while (!sync->stopping) {
+    int32_t interval_ms = kDefaultIntervalMs;
+    {
+      lock.unlock();
+      std::lock_guard<std::mutex> round_lock(sync->round_mutex);
+      if (sync->config.db != nullptr) {
+        interval_ms = sync->config.options.interval_ms;
+      }
+      lock.lock();
+    }
+    sync->wake.wait_for(lock, std::chrono::milliseconds(interval_ms), [sync] {
+      return sync->requested || sync->stopping;
+    });
+    if (sync->stopping) {
+      break;
+    }
+    sync->requested = false;
+    lock.unlock();
+
+    {
+      std::lock_guard<std::mutex> round_lock(sync->round_mutex);
+      if (sync->config.db != nullptr) {
+        Round round(sync);
+        int status = round.Run();
+        {
+          std::lock_guard<std::mutex> stats_lock(sync->mutex);
+          sync->stats.rounds++;
+          sync->stats.last_status = status;
+        }
+        const BizsyncSyncOptions& options = sync->config.options;
+        if (options.callback != nullptr) {
+          options.callback(options.user_data, status, round.acknowledged(),
+                           round.pending());
+        }
+      }
+    }
+    lock.lock();
+  }
+}
+
+}  // namespace bizsync
+
+BizsyncSync* bizsync_sync_start(void) {
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+  BizsyncSync* sync = new BizsyncSync();
+  sync->multi = curl_multi_init();
+  curl_multi_setopt(sync->multi, CURLMOPT_PIPELINING,
+                    static_cast<long>(CURLPIPE_MULTIPLEX));
+  sync->thread = std::thread(bizsync::sync_thread_main, sync);
+
+  BizsyncSync* expected = nullptr;
+  default_sync.compare_exchange_strong(expected, sync);
+  return sync;
+}
+
+BizsyncSync* bizsync_sync_get_default(void) { return default_sync; }
+
+int bizsync_sync_configure(BizsyncSync* sync, BizsyncDb* db,
+                           const BizsyncSyncOptions* options) {
+  using namespace bizsync;
+
+  if (sync == nullptr) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "sync required");
+  }
+  if (db != nullptr &&
+      (options == nullptr || options->endpoint == nullptr ||
+       options->endpoint[0] == '\0' || options->device == 0)) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "endpoint and device required");
+  }
+
+  Config config;
+  if (db != nullptr) {
+    ConnectionLease lease = AcquireWriter(db);
+    if (sqlite3_exec(lease.handle(), kSchemaSql, nullptr, nullptr, nullptr) !=
+        SQLITE_OK) {
+      return SetSqliteError(lease.handle(), "create sync tables");
+    }
+
+    config.db = db;
+    config.options = *options;
+    BizsyncSyncOptions& settings = config.options;
+    if (settings.batch_operations <= 0) {
+      settings.batch_operations = kDefaultBatchOperations;
+    }
+    if (settings.max_in_flight <= 0) {
+      settings.max_in_flight = kDefaultMaxInFlight;
+    }
+    if (settings.compression_level <= 0) {
+      settings.compression_level = kDefaultCompressionLevel;
+    }
+    if (settings.interval_ms <= 0) {
+      settings.interval_ms = kDefaultIntervalMs;
+    }
+    if (settings.timeout_ms <= 0) {
+      settings.timeout_ms = kDefaultTimeoutMs;
+    }
+    config.url = settings.endpoint;
+    while (!config.url.empty() && config.url.back() == '/') {
+      config.url.pop_back();
+    }
+    config.url += "/v1/delta";
+    if (settings.auth_token != nullptr && settings.auth_token[0] != '\0') {
+      config.authorization =
+          std::string("Authorization: Bearer ") + settings.auth_token;
+    }
+    settings.endpoint = nullptr;
+    settings.auth_token = nullptr;
+  }
+
+  {
+    std::lock_guard<std::mutex> round_lock(sync->round_mutex);
+    int level = config.options.compression_level;
+    sync->config = std::move(config);
+    if (sync->config.db != nullptr) {
+      sync->compressor.reset(new Compressor(level));
+    }
+  }
+  if (db != nullptr) {
+    bizsync_sync_request(sync);
+  }
+  return BIZSYNC_OK;
+}
+
+void bizsync_sync_request(BizsyncSync* sync) {
+  if (sync == nullptr) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(sync->mutex);
+  sync->requested = true;
+  sync->wake.notify_all();
+}
+
+void bizsync_sync_get_stats(BizsyncSync* sync, BizsyncSyncStats* out_stats) {
+  if (sync == nullptr || out_stats == nullptr) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(sync->mutex);
+  *out_stats = sync->stats;
+}
+
+void bizsync_sync_stop(BizsyncSync* sync, int32_t grace_ms) {
+  if (sync == nullptr) {
+    return;
+  }
+  BizsyncSync* expected = sync;
+  default_sync.compare_exchange_strong(expected, nullptr);
+  {
+    std::lock_guard<std::mutex> lock(sync->mutex);
+    sync->stopping = true;
+    sync->stop_deadline_ms = bizsync::monotonic_ms() + std::max(0, grace_ms);
+    sync->wake.notify_all();
+  }
+  curl_multi_wakeup(sync->multi);
+  if (sync->thread.joinable()) {
+    sync->thread.join();
+  }
+  curl_multi_cleanup(sync->multi);
+  delete sync;
+}
@@ -0,0 +1,138 @@
+#ifndef BIZSYNC_NATIVE_SYNC_TRANSPORT_H_
+#define BIZSYNC_NATIVE_SYNC_TRANSPORT_H_
+
+#include "sqlite_engine.h"
+
+// Uploads local CRDT operations (see crdt.h) to the sync server as deltas.
+// After each acknowledgement the server's vector clock is stored per
+// collection, as the newest timestamp it holds from each node. Each round
+// then sends only the operations newer than that clock. Nothing is re-sent
+// just because it is in a changed record.
+//
+// Deltas go out one collection per batch. Each batch is protobuf encoded
+// (sync.proto) and compressed with zstd, or deflate where zstd is not
+// available. Several batches are in flight at once over one HTTP/2
+// connection. The database is only read again when a slot in the window
+// frees up. A slow link therefore holds back reading and compression rather
+// than queueing batches in memory. Acknowledgements are stored in send
+// order, so an interrupted round resumes after the last contiguous one.
+// Operations are idempotent, so re-sending a few is harmless.
+//
+// The runner starts the transport at startup and stops it at shutdown. Dart
+// finds it with bizsync_sync_get_default() and attaches its database with
+// bizsync_sync_configure(). The database must have the operation log table:
+//
+//   CREATE TABLE crdt_ops(kind INTEGER, collection TEXT, key TEXT,
+//                         field TEXT, hlc INTEGER, node INTEGER, value);
+//
+// sync_acks(collection, node, hlc) and an index on crdt_ops are created on
+// first use. Operations pulled from the server should be recorded in
+// sync_acks as well, so they are not echoed back.
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct BizsyncSync BizsyncSync;
+
+// Called on the transport thread after each acknowledged batch with
+// BIZSYNC_SYNC_RUNNING, and once at the end of each round with its
+// #BizsyncStatus. Use NativeCallable.listener from Dart.
+typedef void (*BizsyncSyncCallback)(void* user_data, int32_t status,
+                                    int64_t operations_acknowledged,
+                                    int64_t operations_pending);
+
+// Status passed to the callback while a round is still running.
+#define BIZSYNC_SYNC_RUNNING 1
+
+// Zero fields select the default noted beside them.
+typedef struct {
+  // Base URL; batches are POSTed to {endpoint}/v1/delta. Required.
+  const char* endpoint;
+  const char* auth_token;        // sent as a Bearer token; none
+  int64_t device;                // this device's node id. Required.
+  int32_t batch_operations;      // 2000 operations per batch
+  int32_t max_in_flight;         // 4 unacknowledged batches
+  int32_t compression_level;     // 3
+  int32_t interval_ms;           // 30000 between rounds
+  int32_t timeout_ms;            // 30000 per request
+  BizsyncSyncCallback callback;  // none
+  void* user_data;
+} BizsyncSyncOptions;
+
+typedef struct {
+  uint64_t rounds;
+  uint64_t batches_sent;
+  uint64_t batches_retried;
+  uint64_t operations_sent;
+  // Encoded protobuf size and the compressed size actually sent.
+  uint64_t bytes_encoded;
+  uint64_t bytes_sent;
+  // Round trip of the last acknowledged batch.
+  uint32_t last_round_trip_ms;
+  int32_t last_status;
+} BizsyncSyncStats;
+
+/**
+ * bizsync_sync_start:
+ *
+ * Starts the transport thread, idle until bizsync_sync_configure(). The
+ * first transport started becomes the default one. Called by the runner.
+ *
+ * Returns: (transfer full): the transport, stop with bizsync_sync_stop().
+ */
+BIZSYNC_EXPORT BizsyncSync* bizsync_sync_start(void);
+
+/**
+ * bizsync_sync_get_default:
+ *
+ * Returns: (transfer none) (nullable): the transport started by the runner.
+ */
+BIZSYNC_EXPORT BizsyncSync* bizsync_sync_get_default(void);
+
+/**
+ * bizsync_sync_configure:
+ * @sync: a #BizsyncSync.
+ * @db: (allow-none): database holding the operation log, or %NULL to
+ * detach.
+ * @options: (allow-none): settings; required unless detaching.
+ *
+ * Copies @options and sets up the sync tables on @db. Waits for a running
+ * round to finish first. Detach before closing @db.
+ *
+ * Returns: %BIZSYNC_OK or a negative #BizsyncStatus.
+ */
+BIZSYNC_EXPORT int bizsync_sync_configure(BizsyncSync* sync, BizsyncDb* db,
+                                          const BizsyncSyncOptions* options);
+
+/**
+ * bizsync_sync_request:
+ * @sync: a #BizsyncSync.
+ *
+ * Starts a round now rather than at the next interval. Call it after local
+ * writes; requests made during a round start another one after it.
+ */
+BIZSYNC_EXPORT void bizsync_sync_request(BizsyncSync* sync);
+
+/**
+ * bizsync_sync_get_stats:
+ * @sync: a #BizsyncSync.
+ * @out_stats: (out): counters since bizsync_sync_start().
+ */
+BIZSYNC_EXPORT void bizsync_sync_get_stats(BizsyncSync* sync,
+                                           BizsyncSyncStats* out_stats);
+
+/**
+ * bizsync_sync_stop:
+ * @sync: (allow-none): a #BizsyncSync.
+ * @grace_ms: how long in-flight batches may take to be acknowledged.
+ *
+ * Stops @sync and releases it. Batches still unacknowledged after @grace_ms
+ * are abandoned and sent again by the next run.
+ */
+BIZSYNC_EXPORT void bizsync_sync_stop(BizsyncSync* sync, int32_t grace_ms);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // BIZSYNC_NATIVE_SYNC_TRANSPORT_H_
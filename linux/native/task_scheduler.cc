@@ -0,0 +1,574 @@
+#include "task_scheduler.h"
+
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// From linux/ioprio.h, which older kernel headers do not ship.
+static const int kIoprioWhoProcess = 1;
+static const int kIoprioClassShift = 13;
+static const int kIoprioClassIdle = 3;
+
+namespace bizsync {
+
+using Clock = std::chrono::steady_clock;
+
+struct Task {
+  std::function<void()> run;
+  Clock::time_point posted;
+};
+
+// The tasks queued on one worker, or on the shared queue, per priority.
+struct TaskQueue {
+  std::mutex mutex;
+  std::deque<Task> tasks[BIZSYNC_TASK_PRIORITY_COUNT];
+};
+
+// The worker the calling thread is, if any.
+struct CurrentWorker {
+  BizsyncScheduler* scheduler = nullptr;
+  // Index into BizsyncScheduler::queues; 0 is the shared queue.
+  int32_t index = 0;
+  int32_t priority = BIZSYNC_TASK_INTERACTIVE;
+  int32_t blocking_depth = 0;
+};
+
+static thread_local CurrentWorker current_worker;
+
+}  // namespace bizsync
+
+struct BizsyncScheduler {
+  int32_t worker_count = 0;
+  int32_t background_limit = 0;
+  int32_t max_threads = 0;
+
+  // max_threads + 1 queues, allocated up front so thieves can scan them
+  // without a lock. Only the first thread_count + 1 are in use.
+  std::unique_ptr<bizsync::TaskQueue[]> queues;
+  std::atomic<int32_t> thread_count{0};
+  std::atomic<uint64_t> steals{0};
+
+  // Guards everything below it. A worker reserves a task under it before
+  // taking one from the queues, so the counts here are always exact.
+  std::mutex mutex;
+  std::condition_variable work_available;
+  std::condition_variable drained;
+  std::vector<std::thread> threads;
+  // Queued tasks not yet reserved by a worker.
+  int32_t queued[BIZSYNC_TASK_PRIORITY_COUNT] = {};
+  // Reserved or running tasks, and those of them not in a blocking wait.
+  int32_t running[BIZSYNC_TASK_PRIORITY_COUNT] = {};
+  int32_t active[BIZSYNC_TASK_PRIORITY_COUNT] = {};
+  int32_t blocked = 0;
+  int32_t idle = 0;
+  bool stopping = false;
+  bool exiting = false;
+  BizsyncTaskClassStats stats[BIZSYNC_TASK_PRIORITY_COUNT] = {};
+};
+
+namespace bizsync {
+
+static std::mutex default_mutex;
+static BizsyncScheduler* default_scheduler = nullptr;
+static bool default_stopped = false;
+// Cancel flags of running jobs, guarded by |default_mutex|. Never freed:
+// workers a timed-out stop leaves behind may still reach it during exit.
+static std::set<std::atomic<bool>*>* stop_flags =
+    new std::set<std::atomic<bool>*>();
+
+static void worker_main(BizsyncScheduler* scheduler, int32_t index);
+
+// The priority a worker may start next, or -1 if none; interactive first.
+// Called with |scheduler->mutex| held.
+static int32_t takeable_priority(const BizsyncScheduler* scheduler) {
+  int32_t active = scheduler->active[BIZSYNC_TASK_INTERACTIVE] +
+                   scheduler->active[BIZSYNC_TASK_BACKGROUND];
+  if (active >= scheduler->worker_count) {
+    return -1;
+  }
+  if (scheduler->queued[BIZSYNC_TASK_INTERACTIVE] > 0) {
+    return BIZSYNC_TASK_INTERACTIVE;
+  }
+  if (scheduler->queued[BIZSYNC_TASK_BACKGROUND] > 0 &&
+      scheduler->active[BIZSYNC_TASK_BACKGROUND] <
+          scheduler->background_limit) {
+    return BIZSYNC_TASK_BACKGROUND;
+  }
+  return -1;
+}
+
+// Wakes a parked worker for takeable work, or starts a spare thread when
+// every thread not in a blocking wait is busy. Called with
+// |scheduler->mutex| held.
+static void dispatch(BizsyncScheduler* scheduler) {
+  if (takeable_priority(scheduler) < 0) {
+    return;
+  }
+  if (scheduler->idle > 0) {
+    scheduler->work_available.notify_one();
+    return;
+  }
+  int32_t threads = scheduler->thread_count.load(std::memory_order_relaxed);
+  if (threads - scheduler->blocked < scheduler->worker_count &&
+      threads < scheduler->max_threads && !scheduler->exiting) {
+    // Publish the new queue before a thief can look at it.
+    scheduler->thread_count.store(threads + 1, std::memory_order_release);
+    scheduler->threads.emplace_back(worker_main, scheduler, threads + 1);
+  }
+}
+
+static int post(BizsyncScheduler* scheduler, int32_t priority,
+                std::function<void()> run) {
+  if (priority != BIZSYNC_TASK_INTERACTIVE &&
+      priority != BIZSYNC_TASK_BACKGROUND) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT, "unknown priority %d",
+                    priority);
+  }
+  // Workers keep their own tasks; everyone else uses the shared queue.
+  bool from_worker = current_worker.scheduler == scheduler;
+  TaskQueue& queue =
+      scheduler->queues[from_worker ? current_worker.index : 0];
+
+  std::lock_guard<std::mutex> lock(scheduler->mutex);
+  // Tasks may still post follow-up work while the pool drains.
+  if (scheduler->stopping && !from_worker) {
+    return SetError(BIZSYNC_ERROR_CANCELLED, "scheduler stopped");
+  }
+  {
+    std::lock_guard<std::mutex> queue_lock(queue.mutex);
+    queue.tasks[priority].push_back(Task{std::move(run), Clock::now()});
+  }
+  scheduler->queued[priority]++;
+  dispatch(scheduler);
+  return BIZSYNC_OK;
+}
+
+// Pops the task reserved by the caller: its own newest first, then the
+// oldest shared one, then the oldest of another worker's. The reservation
+// guarantees one is queued somewhere.
+static Task take(BizsyncScheduler* scheduler, int32_t index,
+                 int32_t priority) {
+  for (;;) {
+    {
+      TaskQueue& own = scheduler->queues[index];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      std::deque<Task>& tasks = own.tasks[priority];
+      if (!tasks.empty()) {
+        Task task = std::move(tasks.back());
+        tasks.pop_back();
+        return task;
+      }
+    }
+    int32_t count =
+        scheduler->thread_count.load(std::memory_order_acquire) + 1;
+    // The shared queue first, then the workers after this one.
+    for (int32_t offset = 0; offset < count; offset++) {
+      int32_t victim = offset == 0 ? 0 : (index + offset) % count;
+      TaskQueue& queue = scheduler->queues[victim];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      std::deque<Task>& tasks = queue.tasks[priority];
+      if (!tasks.empty()) {
+        Task task = std::move(tasks.front());
+        tasks.pop_front();
+        if (victim != 0) {
+          scheduler->steals.fetch_add(1, std::memory_order_relaxed);
+        }
+        return task;
+      }
+    }
+  }
+}
+
+// Background tasks run with idle I/O priority; interactive ones with the
+// priority derived from the thread's nice value.
+static void set_io_priority(int32_t priority) {
+  int value = priority == BIZSYNC_TASK_BACKGROUND
+                  ? kIoprioClassIdle << kIoprioClassShift
+                  : 0;
+  syscall(SYS_ioprio_set, kIoprioWhoProcess, 0, value);
+}
+
+static uint64_t elapsed_us(Clock::time_point from, Clock::time_point to) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(to - from)
+      .count();
+}
+
+static void worker_main(BizsyncScheduler* scheduler, int32_t index) {
+  pthread_setname_np(pthread_self(), "bizsync-worker");
+  current_worker.scheduler = scheduler;
+  current_worker.index = index;
+  int32_t io_priority = BIZSYNC_TASK_INTERACTIVE;
+
+  std::unique_lock<std::mutex> lock(scheduler->mutex);
+  for (;;) {
+    int32_t priority = takeable_priority(scheduler);
+    if (priority < 0) {
+      if (scheduler->exiting) {
+        break;
+      }
+      scheduler->idle++;
+      scheduler->work_available.wait(lock);
+      scheduler->idle--;
+      continue;
+    }
+    scheduler->queued[priority]--;
+    scheduler->running[priority]++;
+    scheduler->active[priority]++;
+    // Another worker may be able to take the next task.
+    dispatch(scheduler);
+    lock.unlock();
+
+    Task task = take(scheduler, index, priority);
+    if (priority != io_priority) {
+      set_io_priority(priority);
+      io_priority = priority;
+    }
+    Clock::time_point started = Clock::now();
+    current_worker.priority = priority;
+    task.run();
+    task.run = nullptr;
+    Clock::time_point finished = Clock::now();
+
+    lock.lock();
+    scheduler->running[priority]--;
+    scheduler->active[priority]--;
+    BizsyncTaskClassStats& stats = scheduler->stats[priority];
+    uint64_t wait_us = elapsed_us(task.posted, started);
+    stats.completed++;
+    stats.wait_us_total += wait_us;
+    stats.wait_us_last = static_cast<uint32_t>(
+        std::min<uint64_t>(wait_us, UINT32_MAX));
+    stats.wait_us_max = std::max(stats.wait_us_max, stats.wait_us_last);
+    stats.run_us_total += elapsed_us(started, finished);
+    if (scheduler->stopping &&
+        scheduler->running[BIZSYNC_TASK_INTERACTIVE] +
+                scheduler->running[BIZSYNC_TASK_BACKGROUND] +
+                scheduler->queued[BIZSYNC_TASK_INTERACTIVE] +
+                scheduler->queued[BIZSYNC_TASK_BACKGROUND] ==
+            0) {
+      scheduler->drained.notify_all();
+    }
+  }
+  current_worker = CurrentWorker();
+}
+
+static BizsyncScheduler* create_scheduler(
+    const BizsyncSchedulerOptions* options) {
+  BizsyncSchedulerOptions settings =
+      options != nullptr ? *options : BizsyncSchedulerOptions{};
+  if (settings.worker_count <= 0) {
+    settings.worker_count =
+        static_cast<int32_t>(std::max(1u, std::thread::hardware_concurrency()));
+  }
+  if (settings.background_limit <= 0) {
+    settings.background_limit = std::max(1, settings.worker_count - 1);
+  }
+  if (settings.max_threads <= 0) {
+    settings.max_threads = 4 * settings.worker_count;
+  }
+  settings.max_threads = std::max(settings.max_threads, settings.worker_count);
+
+  BizsyncScheduler* scheduler = new BizsyncScheduler();
+  scheduler->worker_count = settings.worker_count;
+  scheduler->background_limit =
+      std::min(settings.background_limit, settings.worker_count);
+  scheduler->max_threads = settings.max_threads;
+  scheduler->queues.reset(new TaskQueue[settings.max_threads + 1]);
+
+  std::lock_guard<std::mutex> lock(scheduler->mutex);
+  scheduler->thread_count.store(settings.worker_count,
+                                std::memory_order_release);
+  for (int32_t i = 1; i <= settings.worker_count; i++) {
+    scheduler->threads.emplace_back(worker_main, scheduler, i);
+  }
+  return scheduler;
+}
+
+int PostTask(int32_t priority, std::function<void()> task) {
+  // Tasks posting follow-up work must reach their own pool even while it
+  // drains.
+  if (current_worker.scheduler != nullptr) {
+    return post(current_worker.scheduler, priority, std::move(task));
+  }
+  std::lock_guard<std::mutex> lock(default_mutex);
+  if (default_scheduler == nullptr) {
+    if (default_stopped) {
+      return SetError(BIZSYNC_ERROR_CANCELLED, "scheduler stopped");
+    }
+    default_scheduler = create_scheduler(nullptr);
+  }
+  return post(default_scheduler, priority, std::move(task));
+}
+
+CancelOnStop::CancelOnStop(std::atomic<bool>* cancelled)
+    : cancelled_(cancelled) {
+  std::lock_guard<std::mutex> lock(default_mutex);
+  if (default_stopped) {
+    *cancelled_ = true;
+  }
+  stop_flags->insert(cancelled_);
+}
+
+CancelOnStop::~CancelOnStop() {
+  std::lock_guard<std::mutex> lock(default_mutex);
+  stop_flags->erase(cancelled_);
+}
+
+int32_t SchedulerWorkerCount() {
+  if (current_worker.scheduler != nullptr) {
+    return current_worker.scheduler->worker_count;
+  }
+  std::lock_guard<std::mutex> lock(default_mutex);
+  if (default_scheduler != nullptr) {
+    return default_scheduler->worker_count;
+  }
+  return static_cast<int32_t>(
+      std::max(1u, std::thread::hardware_concurrency()));
+}
+
+ScopedBlockingWait::ScopedBlockingWait()
+    : scheduler_(current_worker.scheduler) {
+  if (scheduler_ == nullptr || current_worker.blocking_depth++ > 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(scheduler_->mutex);
+  scheduler_->active[current_worker.priority]--;
+  scheduler_->blocked++;
+  dispatch(scheduler_);
+}
+
+ScopedBlockingWait::~ScopedBlockingWait() {
+  if (scheduler_ == nullptr || --current_worker.blocking_depth > 0) {
+    return;
+  }
+  // May briefly run more tasks than worker_count; new ones wait until the
+  // count drops again.
+  std::lock_guard<std::mutex> lock(scheduler_->mutex);
+  scheduler_->active[current_worker.priority]++;
+  scheduler_->blocked--;
+}
+
+// A posted task, run by whichever of its worker and Wait() claims it
+// first.
+struct TaskGroupEntry {
+  std::function<void()> run;
+  std::atomic<bool> claimed{false};
+};
+
+TaskGroup::TaskGroup(int32_t priority) : priority_(priority) {}
+
+TaskGroup::~TaskGroup() { Wait(); }
+
+void TaskGroup::Run(TaskGroupEntry* entry) {
+  entry->run();
+  entry->run = nullptr;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (--pending_ == 0) {
+    finished_.notify_all();
+  }
+}
+
+int TaskGroup::Post(std::function<void()> task) {
+  std::shared_ptr<TaskGroupEntry> entry(new TaskGroupEntry());
+  entry->run = std::move(task);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_++;
+    entries_.push_back(entry);
+  }
+  // The worker that loses the claim only touches the entry, which the
+  // group may have outlived by then.
+  int status = PostTask(priority_, [this, entry] {
+    if (!entry->claimed.exchange(true)) {
+      Run(entry.get());
+    }
+  });
+  if (status != BIZSYNC_OK && !entry->claimed.exchange(true)) {
+    entry->run = nullptr;
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_--;
+  }
+  return status;
+}
+
+void TaskGroup::Wait() {
+  // Newest first: the tasks posted last are the least likely to have been
+  // picked up.
+  for (;;) {
+    std::shared_ptr<TaskGroupEntry> entry;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      while (!entries_.empty() && entries_.back()->claimed) {
+        entries_.pop_back();
+      }
+      if (entries_.empty()) {
+        break;
+      }
+      entry = std::move(entries_.back());
+      entries_.pop_back();
+    }
+    if (!entry->claimed.exchange(true)) {
+      Run(entry.get());
+    }
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (pending_ == 0) {
+    return;
+  }
+  ScopedBlockingWait blocking;
+  finished_.wait(lock, [this] { return pending_ == 0; });
+}
+
+void TaskGroup::CancelPending() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (std::shared_ptr<TaskGroupEntry>& entry : entries_) {
+    if (!entry->claimed.exchange(true)) {
+      entry->run = nullptr;
+      pending_--;
+    }
+  }
+  entries_.clear();
+  if (pending_ == 0) {
+    finished_.notify_all();
+  }
+}
+
+void RunParallel(int32_t priority, size_t copies,
+                 const std::function<void(size_t)>& work) {
+  TaskGroup group(priority);
+  for (size_t i = 1; i < copies; i++) {
+    group.Post([&work, i] { work(i); });
+  }
+  if (copies > 0) {
+    work(0);
+  }
+  group.Wait();
+}
+
+// Stops |scheduler| for bizsync_scheduler_stop() and, with a
+// non-negative |timeout_ms|, bizsync_scheduler_stop_within(). Returns the
+// tasks left when the wait timed out.
+static int32_t stop_scheduler(BizsyncScheduler* scheduler,
+                              int64_t timeout_ms) {
+  if (scheduler == nullptr) {
+    return 0;
+  }
+  {
+    std::lock_guard<std::mutex> lock(default_mutex);
+    if (default_scheduler == scheduler) {
+      default_scheduler = nullptr;
+      default_stopped = true;
+      for (std::atomic<bool>* cancelled : *stop_flags) {
+        *cancelled = true;
+      }
+    }
+    std::lock_guard<std::mutex> scheduler_lock(scheduler->mutex);
+    scheduler->stopping = true;
+  }
+
+  auto left = [scheduler] {
+    int32_t tasks = 0;
+    for (int32_t i = 0; i < BIZSYNC_TASK_PRIORITY_COUNT; i++) {
+      tasks += scheduler->queued[i] + scheduler->running[i];
+    }
+    return tasks;
+  };
+  std::vector<std::thread> threads;
+  int32_t remaining = 0;
+  {
+    std::unique_lock<std::mutex> lock(scheduler->mutex);
+    if (timeout_ms < 0) {
+      scheduler->drained.wait(lock, [&left] { return left() == 0; });
+    } else {
+      scheduler->drained.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                                  [&left] { return left() == 0; });
+      remaining = left();
+    }
+    scheduler->exiting = true;
+    scheduler->work_available.notify_all();
+    // No thread starts once exiting is set.
+    threads.swap(scheduler->threads);
+  }
+  if (remaining > 0) {
+    // Workers finish what is left and exit; the process goes first.
+    for (std::thread& thread : threads) {
+      thread.detach();
+    }
+    return remaining;
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  delete scheduler;
+  return 0;
+}
+
+}  // namespace bizsync
+
+BizsyncScheduler* bizsync_scheduler_start(
+    const BizsyncSchedulerOptions* options) {
+  using namespace bizsync;
+
+  std::lock_guard<std::mutex> lock(default_mutex);
+  if (default_scheduler == nullptr) {
+    default_scheduler = create_scheduler(options);
+    default_stopped = false;
+  }
+  return default_scheduler;
+}
+
+BizsyncScheduler* bizsync_scheduler_get_default(void) {
+  using namespace bizsync;
+
+  std::lock_guard<std::mutex> lock(default_mutex);
+  return default_scheduler;
+}
+
+int bizsync_scheduler_post(BizsyncScheduler* scheduler, int32_t priority,
+                           BizsyncTaskFunc task, void* user_data) {
+  using namespace bizsync;
+
+  if (scheduler == nullptr || task == nullptr) {
+    return SetError(BIZSYNC_ERROR_INVALID_ARGUMENT,
+                    "scheduler and task required");
+  }
+  return post(scheduler, priority, [task, user_data] { task(user_data); });
+}
+
+void bizsync_scheduler_get_stats(BizsyncScheduler* scheduler,
+                                 BizsyncSchedulerStats* out_stats) {
+  if (scheduler == nullptr || out_stats == nullptr) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(scheduler->mutex);
+  *out_stats = BizsyncSchedulerStats{};
+  out_stats->worker_count = scheduler->worker_count;
+  out_stats->thread_count = scheduler->thread_count.load();
+  out_stats->blocked = scheduler->blocked;
+  out_stats->steals = scheduler->steals.load();
+  for (int32_t i = 0; i < BIZSYNC_TASK_PRIORITY_COUNT; i++) {
+    out_stats->classes[i] = scheduler->stats[i];
+    out_stats->classes[i].queued = scheduler->queued[i];
+    out_stats->classes[i].running = scheduler->running[i];
+  }
+}
+
+void bizsync_scheduler_stop(BizsyncScheduler* scheduler) {
+  bizsync::stop_scheduler(scheduler, -1);
+}
+
+int32_t bizsync_scheduler_stop_within(BizsyncScheduler* scheduler,
+                                      int32_t timeout_ms) {
+  return bizsync::stop_scheduler(scheduler, std::max(timeout_ms, 0));
+}
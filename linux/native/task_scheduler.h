@@ -0,0 +1,242 @@
+#ifndef BIZSYNC_NATIVE_TASK_SCHEDULER_H_
+#define BIZSYNC_NATIVE_TASK_SCHEDULER_H_
+
+#include "native_status.h"
+
+// The worker threads shared by every native engine: imports, exports,
+// backups, CRDT merges, search loading, key derivation and the runner's
+// invoice PDF renderer. One pool sized to the machine replaces a thread
+// pool per engine, so a backup and an import running together share the
+// cores instead of each claiming all of them.
+//
+// Each worker keeps its own queue. Tasks posted from a worker go onto that
+// worker's queue, and idle workers steal from the others. Tasks posted from
+// other threads go onto a shared queue. There are two priority classes:
+//
+//   interactive  work the user is waiting for. Always taken first.
+//   background   maintenance such as backups and index loading. At most
+//                background_limit workers run it at once, so a core stays
+//                free for interactive work. Its I/O runs at idle priority.
+//
+// A task that waits for another task, or for I/O another task performs,
+// must say so (see bizsync::ScopedBlockingWait). The scheduler then starts
+// a spare thread if queued work would otherwise have no worker to run it.
+//
+// The runner starts the scheduler at startup and stops it at shutdown.
+// Without the runner, for example from Dart tests, the first engine that
+// needs it starts one with the defaults.
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct BizsyncScheduler BizsyncScheduler;
+
+typedef enum {
+  BIZSYNC_TASK_INTERACTIVE = 0,
+  BIZSYNC_TASK_BACKGROUND = 1,
+} BizsyncTaskPriority;
+
+#define BIZSYNC_TASK_PRIORITY_COUNT 2
+
+typedef void (*BizsyncTaskFunc)(void* user_data);
+
+// Zero fields select the default noted beside them.
+typedef struct {
+  int32_t worker_count;      // one per core
+  int32_t background_limit;  // worker_count - 1, at least 1
+  int32_t max_threads;       // 4 * worker_count, including spares
+} BizsyncSchedulerOptions;
+
+typedef struct {
+  // Posted but not started yet, and started but not finished.
+  int32_t queued;
+  int32_t running;
+  uint64_t completed;
+  // Time from posting to starting, in microseconds.
+  uint64_t wait_us_total;
+  uint32_t wait_us_max;
+  uint32_t wait_us_last;
+  uint64_t run_us_total;
+} BizsyncTaskClassStats;
+
+typedef struct {
+  int32_t worker_count;
+  // Worker threads started so far, spares included.
+  int32_t thread_count;
+  // Tasks inside a ScopedBlockingWait.
+  int32_t blocked;
+  uint64_t steals;
+  BizsyncTaskClassStats classes[BIZSYNC_TASK_PRIORITY_COUNT];
+} BizsyncSchedulerStats;
+
+/**
+ * bizsync_scheduler_start:
+ * @options: (allow-none): pool settings, or %NULL for the defaults.
+ *
+ * Starts the shared scheduler. Only one runs per process; if it is already
+ * running it is returned unchanged. Called by the runner.
+ *
+ * Returns: (transfer none): the scheduler, stop with
+ * bizsync_scheduler_stop().
+ */
+BIZSYNC_EXPORT BizsyncScheduler* bizsync_scheduler_start(
+    const BizsyncSchedulerOptions* options);
+
+/**
+ * bizsync_scheduler_get_default:
+ *
+ * Returns: (transfer none) (nullable): the running scheduler, or %NULL if
+ * none has been started or it was stopped.
+ */
+BIZSYNC_EXPORT BizsyncScheduler* bizsync_scheduler_get_default(void);
+
+/**
+ * bizsync_scheduler_post:
+ * @scheduler: a #BizsyncScheduler.
+ * @priority: a #BizsyncTaskPriority.
+ * @task: function to run on a worker.
+ * @user_data: passed to @task.
+ *
+ * Queues @task. It runs exactly once unless this fails.
+ *
+ * Returns: %BIZSYNC_OK, %BIZSYNC_ERROR_INVALID_ARGUMENT or
+ * %BIZSYNC_ERROR_CANCELLED once the scheduler is stopping.
+ */
+BIZSYNC_EXPORT int bizsync_scheduler_post(BizsyncScheduler* scheduler,
+                                          int32_t priority,
+                                          BizsyncTaskFunc task,
+                                          void* user_data);
+
+/**
+ * bizsync_scheduler_get_stats:
+ * @scheduler: a #BizsyncScheduler.
+ * @out_stats: (out): current queue depths and counters since the start.
+ */
+BIZSYNC_EXPORT void bizsync_scheduler_get_stats(
+    BizsyncScheduler* scheduler, BizsyncSchedulerStats* out_stats);
+
+/**
+ * bizsync_scheduler_stop:
+ * @scheduler: (allow-none): a #BizsyncScheduler.
+ *
+ * Refuses new tasks from outside the pool and cancels the imports, exports
+ * and backups still running, which then end with %BIZSYNC_ERROR_CANCELLED.
+ * Waits for every queued and running task, including those they post, then
+ * joins the workers and releases @scheduler. Engines started afterwards
+ * fail with %BIZSYNC_ERROR_CANCELLED.
+ */
+BIZSYNC_EXPORT void bizsync_scheduler_stop(BizsyncScheduler* scheduler);
+
+/**
+ * bizsync_scheduler_stop_within:
+ * @scheduler: (allow-none): a #BizsyncScheduler.
+ * @timeout_ms: longest wait for the tasks left, in milliseconds.
+ *
+ * Like bizsync_scheduler_stop(), but gives up on tasks still queued or
+ * running after @timeout_ms. The workers are then left to finish them and
+ * @scheduler is never released, so call this only on the way out of the
+ * process.
+ *
+ * Returns: the tasks still queued or running, or 0 once @scheduler has
+ * been released.
+ */
+BIZSYNC_EXPORT int32_t bizsync_scheduler_stop_within(
+    BizsyncScheduler* scheduler, int32_t timeout_ms);
+
+#ifdef __cplusplus
+}  // extern "C"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace bizsync {
+
+// Posts |task| to the shared scheduler, starting it with the defaults if
+// needed. Returns BIZSYNC_OK or, once it is stopping, a
+// BIZSYNC_ERROR_CANCELLED error.
+int PostTask(int32_t priority, std::function<void()> task);
+
+// Workers that run tasks at once; the natural fan-out for parallel work.
+int32_t SchedulerWorkerCount();
+
+// Sets |*cancelled| once the scheduler starts stopping, or at once if it
+// already has, for as long as it lives. Jobs keep one beside their cancel
+// flag so shutdown ends them as bizsync_*_cancel() would instead of waiting
+// for them.
+class CancelOnStop {
+ public:
+  explicit CancelOnStop(std::atomic<bool>* cancelled);
+  ~CancelOnStop();
+
+ private:
+  CancelOnStop(const CancelOnStop&) = delete;
+  CancelOnStop& operator=(const CancelOnStop&) = delete;
+
+  std::atomic<bool>* cancelled_;
+};
+
+// Marks the calling thread as waiting, for a task or for I/O or a lock
+// another task holds, for as long as it lives. On a worker the wait then
+// no longer counts against the pool's concurrency, and a spare thread
+// starts if nobody else could run the queued work. Elsewhere it does
+// nothing.
+class ScopedBlockingWait {
+ public:
+  ScopedBlockingWait();
+  ~ScopedBlockingWait();
+
+ private:
+  ScopedBlockingWait(const ScopedBlockingWait&) = delete;
+  ScopedBlockingWait& operator=(const ScopedBlockingWait&) = delete;
+
+  BizsyncScheduler* scheduler_;
+};
+
+// Tasks waited for together. Wait() runs the tasks no worker has started
+// yet itself, so a task can post more and wait for them without tying up
+// threads. Engines keep one in each job in place of a thread; freeing the
+// job waits for it.
+struct TaskGroupEntry;
+
+class TaskGroup {
+ public:
+  explicit TaskGroup(int32_t priority);
+  ~TaskGroup();
+
+  // Returns PostTask()'s status; |task| does not run on failure.
+  int Post(std::function<void()> task);
+
+  // Returns once every posted task has finished.
+  void Wait();
+
+  // Drops the tasks no worker has started yet; they never run.
+  void CancelPending();
+
+ private:
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+
+  void Run(TaskGroupEntry* entry);
+
+  int32_t priority_;
+  std::mutex mutex_;
+  std::condition_variable finished_;
+  int pending_ = 0;
+  // Posted since the last Wait(), started or not.
+  std::vector<std::shared_ptr<TaskGroupEntry>> entries_;
+};
+
+// Runs work(0) .. work(copies - 1) at once, work(0) on the calling thread,
+// and returns when all have. Copies no worker picks up in time run on the
+// calling thread after work(0), so copies must not wait for each other.
+void RunParallel(int32_t priority, size_t copies,
+                 const std::function<void(size_t)>& work);
+
+}  // namespace bizsync
+#endif
+
+#endif  // BIZSYNC_NATIVE_TASK_SCHEDULER_H_
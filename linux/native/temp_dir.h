@@ -0,0 +1,50 @@
+#ifndef BIZSYNC_NATIVE_TEMP_DIR_H_
+#define BIZSYNC_NATIVE_TEMP_DIR_H_
+
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+
+namespace bizsync {
+
+// A directory under $TMPDIR, removed with everything in it when the
+// object goes away. path() is empty if it could not be created. Shared by
+// the engine tests and the benchmarks; the library does not use it.
+class TempDir {
+ public:
+  explicit TempDir(const char* prefix) {
+    const char* base = getenv("TMPDIR");
+    std::string pattern = std::string(base != nullptr ? base : "/tmp") + "/" +
+                          prefix + "-XXXXXX";
+    if (mkdtemp(&pattern[0]) != nullptr) {
+      path_ = pattern;
+    }
+  }
+
+  ~TempDir() {
+    if (!path_.empty()) {
+      nftw(path_.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+  }
+
+  TempDir(const TempDir&) = delete;
+  TempDir& operator=(const TempDir&) = delete;
+
+  const std::string& path() const { return path_; }
+  std::string Join(const std::string& name) const { return path_ + "/" + name; }
+
+ private:
+  static int remove_entry(const char* path, const struct stat* info, int type,
+                          struct FTW* ftw) {
+    remove(path);
+    return 0;
+  }
+
+  std::string path_;
+};
+
+}  // namespace bizsync
+
+#endif  // BIZSYNC_NATIVE_TEMP_DIR_H_
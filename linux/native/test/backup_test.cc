@@ -0,0 +1,192 @@
+#include "backup.h"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "test_util.h"
+
+namespace bizsync {
+namespace {
+
+// Enough rows for the snapshot to span many chunks.
+const char* kSchema =
+    "CREATE TABLE invoices (id INTEGER PRIMARY KEY, customer TEXT,"
+    " total_cents INTEGER);"
+    "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n"
+    " WHERE i < 40000)"
+    " INSERT INTO invoices SELECT i, 'Customer ' || (i * 7919 % 1000),"
+    " i * 1301 % 100000 FROM n";
+const char* kChecksum =
+    "SELECT count(*) || ':' || sum(total_cents) || ':' ||"
+    " sum(length(customer)) FROM invoices";
+
+std::string ReadFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(file),
+                     std::istreambuf_iterator<char>());
+}
+
+void PutU64(std::string* data, size_t at, uint64_t value) {
+  for (int i = 0; i < 8; i++) {
+    (*data)[at + i] = static_cast<char>(value >> (8 * i));
+  }
+}
+
+class BackupTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_FALSE(dir_.path().empty());
+    ASSERT_EQ(bizsync_db_open(database().c_str(), nullptr, &db_), BIZSYNC_OK)
+        << bizsync_last_error();
+    ASSERT_EQ(bizsync_db_execute(db_, kSchema), BIZSYNC_OK);
+    for (size_t i = 0; i < sizeof(key_); i++) {
+      key_[i] = static_cast<uint8_t>(i * 37 + 11);
+    }
+  }
+
+  void TearDown() override { bizsync_db_close(db_); }
+
+  std::string database() const { return dir_.Join("test.db"); }
+
+  BizsyncBackupOptions Options(const std::vector<const char*>& bases) {
+    BizsyncBackupOptions options = {};
+    options.key = key_;
+    options.base_paths = bases.empty() ? nullptr : bases.data();
+    options.base_count = static_cast<int32_t>(bases.size());
+    options.callback = [](void* user_data, int32_t status, int64_t bytes_done,
+                          int64_t bytes_total) {
+      if (status != BIZSYNC_BACKUP_RUNNING) {
+        static_cast<FinalStatus*>(user_data)->Set(status);
+      }
+    };
+    return options;
+  }
+
+  // Runs a started job to the end and returns its final status.
+  int32_t Finish(int started, BizsyncBackup* job, FinalStatus* status,
+                 BizsyncBackupResult* result) {
+    if (started != BIZSYNC_OK) {
+      return started;
+    }
+    int32_t final_status = status->Wait();
+    BizsyncBackupResult ignored;
+    bizsync_backup_get_result(job, result != nullptr ? result : &ignored);
+    bizsync_backup_free(job);
+    return final_status;
+  }
+
+  int32_t Backup(const std::string& path,
+                 const std::vector<const char*>& bases,
+                 BizsyncBackupResult* result) {
+    BizsyncBackupOptions options = Options(bases);
+    FinalStatus status;
+    options.user_data = &status;
+    BizsyncBackup* job = nullptr;
+    int started = bizsync_backup_start(db_, path.c_str(), &options, &job);
+    return Finish(started, job, &status, result);
+  }
+
+  int32_t Restore(const std::string& path, const std::string& db_path,
+                  const std::vector<const char*>& bases,
+                  BizsyncBackupResult* result) {
+    BizsyncBackupOptions options = Options(bases);
+    FinalStatus status;
+    options.user_data = &status;
+    BizsyncBackup* job = nullptr;
+    int started = bizsync_restore_start(
+        path.c_str(), db_path.empty() ? nullptr : db_path.c_str(), &options,
+        &job);
+    return Finish(started, job, &status, result);
+  }
+
+  TempDir dir_{"bizsync-test-backup"};
+  BizsyncDb* db_ = nullptr;
+  uint8_t key_[BIZSYNC_BACKUP_KEY_SIZE];
+};
+
+TEST_F(BackupTest, RestoresTheSnapshot) {
+  std::string expected = QueryText(database(), kChecksum);
+  BizsyncBackupResult backup;
+  ASSERT_EQ(Backup(dir_.Join("full.bak"), {}, &backup), BIZSYNC_OK)
+      << bizsync_last_error();
+  EXPECT_GT(backup.chunk_count, 1);
+  EXPECT_EQ(backup.reused_chunks, 0);
+
+  // Writes after the snapshot must not reach the backup.
+  ASSERT_EQ(bizsync_db_execute(db_, "DELETE FROM invoices WHERE id > 100"),
+            BIZSYNC_OK);
+
+  BizsyncBackupResult restore;
+  std::string restored = dir_.Join("restored.db");
+  ASSERT_EQ(Restore(dir_.Join("full.bak"), restored, {}, &restore),
+            BIZSYNC_OK)
+      << bizsync_last_error();
+  EXPECT_EQ(restore.database_bytes, backup.database_bytes);
+  EXPECT_EQ(restore.chunk_count, backup.chunk_count);
+  EXPECT_EQ(QueryText(restored, kChecksum), expected);
+  EXPECT_EQ(QueryText(restored, "PRAGMA integrity_check"), "ok");
+}
+
+TEST_F(BackupTest, IncrementalBackupReusesBaseChunks) {
+  std::string full = dir_.Join("full.bak");
+  ASSERT_EQ(Backup(full, {}, nullptr), BIZSYNC_OK) << bizsync_last_error();
+  ASSERT_EQ(bizsync_db_execute(
+                db_, "UPDATE invoices SET total_cents = 1 WHERE id = 20000"),
+            BIZSYNC_OK);
+  std::string expected = QueryText(database(), kChecksum);
+
+  std::string incremental = dir_.Join("incremental.bak");
+  BizsyncBackupResult backup;
+  ASSERT_EQ(Backup(incremental, {full.c_str()}, &backup), BIZSYNC_OK)
+      << bizsync_last_error();
+  EXPECT_GT(backup.reused_chunks, backup.chunk_count / 2);
+
+  std::string restored = dir_.Join("restored.db");
+  EXPECT_NE(Restore(incremental, restored, {}, nullptr), BIZSYNC_OK);
+  ASSERT_EQ(Restore(incremental, restored, {full.c_str()}, nullptr),
+            BIZSYNC_OK)
+      << bizsync_last_error();
+  EXPECT_EQ(QueryText(restored, kChecksum), expected);
+}
+
+TEST_F(BackupTest, RejectsWrongKeyAndLeavesDestinationAlone) {
+  std::string full = dir_.Join("full.bak");
+  ASSERT_EQ(Backup(full, {}, nullptr), BIZSYNC_OK) << bizsync_last_error();
+  std::string restored = dir_.Join("restored.db");
+  ASSERT_TRUE(WriteFile(restored, "untouched"));
+
+  key_[0] ^= 1;
+  EXPECT_NE(Restore(full, restored, {}, nullptr), BIZSYNC_OK);
+  EXPECT_EQ(ReadFile(restored), "untouched");
+}
+
+// Trailer fields whose sum wraps around must be refused, not used to size
+// the manifest buffer.
+TEST_F(BackupTest, RejectsTrailersThatWrap) {
+  std::string full = dir_.Join("full.bak");
+  ASSERT_EQ(Backup(full, {}, nullptr), BIZSYNC_OK) << bizsync_last_error();
+  std::string data = ReadFile(full);
+  ASSERT_GT(data.size(), 64u + 32u);
+  size_t trailer = data.size() - 32;
+
+  std::string corrupt = dir_.Join("corrupt.bak");
+  PutU64(&data, trailer, trailer + 1000);
+  PutU64(&data, trailer + 8, ~uint64_t{0} - 999);
+  ASSERT_TRUE(WriteFile(corrupt, data));
+  EXPECT_EQ(Restore(corrupt, "", {}, nullptr), BIZSYNC_ERROR_FORMAT);
+
+  PutU64(&data, trailer, 64);
+  PutU64(&data, trailer + 8, ~uint64_t{0});
+  ASSERT_TRUE(WriteFile(corrupt, data));
+  EXPECT_EQ(Restore(corrupt, "", {}, nullptr), BIZSYNC_ERROR_FORMAT);
+
+  ASSERT_TRUE(WriteFile(corrupt, data.substr(0, trailer)));
+  EXPECT_EQ(Restore(corrupt, "", {}, nullptr), BIZSYNC_ERROR_FORMAT);
+}
+
+}  // namespace
+}  // namespace bizsync
@@ -0,0 +1,186 @@
+#include "crdt.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "test_util.h"
+
+namespace bizsync {
+namespace {
+
+const uint64_t kBaseHlc = static_cast<uint64_t>(1700000000000ULL) << 16;
+const int64_t kLocalNode = 1;
+const int64_t kRemoteNode = 2;
+
+void AppendOperation(PackedRowWriter* log, BizsyncCrdtKind kind,
+                     const std::string& key, const std::string& field,
+                     uint64_t hlc, int64_t node) {
+  log->AppendInt64(kind);
+  log->AppendText("customers", 9);
+  log->AppendText(key.data(), key.size());
+  log->AppendText(field.data(), field.size());
+  log->AppendInt64(static_cast<int64_t>(kBaseHlc + hlc));
+  log->AppendInt64(node);
+}
+
+void AppendText(PackedRowWriter* log, BizsyncCrdtKind kind,
+                const std::string& key, const std::string& field,
+                uint64_t hlc, int64_t node, const std::string& value) {
+  AppendOperation(log, kind, key, field, hlc, node);
+  log->AppendText(value.data(), value.size());
+  log->EndRow();
+}
+
+void AppendInt(PackedRowWriter* log, BizsyncCrdtKind kind,
+               const std::string& key, const std::string& field, uint64_t hlc,
+               int64_t node, int64_t value) {
+  AppendOperation(log, kind, key, field, hlc, node);
+  log->AppendInt64(value);
+  log->EndRow();
+}
+
+// Merges the logs and returns the change set as "KIND key.field=value"
+// strings in change set order.
+std::vector<std::string> Merge(const PackedRowWriter& local,
+                               const PackedRowWriter& remote,
+                               int32_t* status = nullptr) {
+  std::vector<std::string> changes;
+  FinalStatus done;
+  BizsyncCrdtMerge* merge = nullptr;
+  int started = bizsync_crdt_merge_start(
+      local.data(), local.size(), remote.data(), remote.size(),
+      [](void* user_data, int32_t status) {
+        static_cast<FinalStatus*>(user_data)->Set(status);
+      },
+      &done, &merge);
+  EXPECT_EQ(started, BIZSYNC_OK);
+  if (started != BIZSYNC_OK) {
+    return changes;
+  }
+  int32_t final_status = done.Wait();
+  if (status != nullptr) {
+    *status = final_status;
+  }
+
+  BizsyncCrdtResult result;
+  if (bizsync_crdt_merge_get_result(merge, &result) == BIZSYNC_OK) {
+    static const char* kKinds[] = {"SET", "ADD", "REMOVE"};
+    PackedRowReader reader(result.changes, result.changes_length);
+    PackedValue v[7];
+    for (uint32_t row = 0; row < reader.row_count(); row++) {
+      for (PackedValue& value : v) {
+        EXPECT_TRUE(reader.Next(&value));
+      }
+      std::string change = kKinds[v[0].int64_value];
+      change += " " + std::string(reinterpret_cast<const char*>(v[2].bytes),
+                                  v[2].length);
+      change += "." + std::string(reinterpret_cast<const char*>(v[3].bytes),
+                                  v[3].length);
+      change += "=";
+      change += v[6].type == BIZSYNC_VALUE_INT64
+                    ? std::to_string(v[6].int64_value)
+                    : std::string(reinterpret_cast<const char*>(v[6].bytes),
+                                  v[6].length);
+      changes.push_back(change);
+    }
+    EXPECT_EQ(result.change_count, static_cast<int64_t>(changes.size()));
+  }
+  bizsync_crdt_merge_free(merge);
+  return changes;
+}
+
+TEST(CrdtMergeTest, LastWriterWinsPerField) {
+  PackedRowWriter local(7);
+  PackedRowWriter remote(7);
+  AppendText(&local, BIZSYNC_CRDT_SET, "c1", "name", 10, kLocalNode, "Tan");
+  AppendText(&local, BIZSYNC_CRDT_SET, "c1", "email", 30, kLocalNode,
+             "tan@example.sg");
+  AppendText(&remote, BIZSYNC_CRDT_SET, "c1", "name", 20, kRemoteNode, "Lim");
+  AppendText(&remote, BIZSYNC_CRDT_SET, "c1", "email", 25, kRemoteNode,
+             "lim@example.sg");
+  // Equal timestamps are ordered by device id.
+  AppendText(&local, BIZSYNC_CRDT_SET, "c2", "name", 40, kLocalNode, "Ong");
+  AppendText(&remote, BIZSYNC_CRDT_SET, "c2", "name", 40, kRemoteNode, "Goh");
+
+  EXPECT_EQ(Merge(local, remote),
+            (std::vector<std::string>{"SET c1.name=Lim", "SET c2.name=Goh"}));
+}
+
+TEST(CrdtMergeTest, IgnoresOperationsBothSidesHave) {
+  PackedRowWriter local(7);
+  AppendText(&local, BIZSYNC_CRDT_SET, "c1", "name", 10, kRemoteNode, "Tan");
+  AppendText(&local, BIZSYNC_CRDT_ADD, "c1", "tags", 11, kRemoteNode, "vip");
+
+  EXPECT_TRUE(Merge(local, local).empty());
+}
+
+TEST(CrdtMergeTest, ConcurrentAddSurvivesRemove) {
+  PackedRowWriter local(7);
+  PackedRowWriter remote(7);
+  // The remote device removed the tag it saw; the local device added it
+  // again meanwhile.
+  AppendText(&local, BIZSYNC_CRDT_ADD, "c1", "tags", 10, kLocalNode, "vip");
+  AppendText(&local, BIZSYNC_CRDT_ADD, "c1", "tags", 20, kLocalNode, "vip");
+  AppendText(&remote, BIZSYNC_CRDT_REMOVE, "c1", "tags", 10, kLocalNode,
+             "vip");
+  AppendText(&remote, BIZSYNC_CRDT_ADD, "c1", "tags", 30, kRemoteNode,
+             "wholesale");
+
+  EXPECT_EQ(Merge(local, remote),
+            (std::vector<std::string>{"ADD c1.tags=wholesale"}));
+}
+
+// Integer elements read after a TEXT value once kept that value's bytes in
+// their key, so a REMOVE never matched its ADD.
+TEST(CrdtMergeTest, RemovesIntegerElementsAfterTextValues) {
+  PackedRowWriter local(7);
+  PackedRowWriter remote(7);
+  AppendInt(&local, BIZSYNC_CRDT_ADD, "c1", "tags", 10, kLocalNode, 7);
+  AppendText(&remote, BIZSYNC_CRDT_SET, "c1", "note", 20, kRemoteNode,
+             "call back");
+  AppendInt(&remote, BIZSYNC_CRDT_REMOVE, "c1", "tags", 10, kLocalNode, 7);
+  AppendText(&remote, BIZSYNC_CRDT_ADD, "c1", "tags", 30, kRemoteNode,
+             "7");
+  AppendInt(&remote, BIZSYNC_CRDT_ADD, "c2", "tags", 40, kRemoteNode, 7);
+
+  // The text "7" is a different element from the integer 7.
+  EXPECT_EQ(Merge(local, remote),
+            (std::vector<std::string>{"REMOVE c1.tags=7", "ADD c1.tags=7",
+                                      "SET c1.note=call back",
+                                      "ADD c2.tags=7"}));
+}
+
+TEST(CrdtMergeTest, RejectsMalformedLogs) {
+  PackedRowWriter local(7);
+  PackedRowWriter remote(3);
+  remote.AppendInt64(BIZSYNC_CRDT_SET);
+  remote.AppendText("customers", 9);
+  remote.AppendText("c1", 2);
+  remote.EndRow();
+
+  int32_t status = BIZSYNC_OK;
+  EXPECT_TRUE(Merge(local, remote, &status).empty());
+  EXPECT_EQ(status, BIZSYNC_ERROR_FORMAT);
+}
+
+TEST(HlcTest, IssuesIncreasingTimestampsAndRefusesFarFuturePeers) {
+  BizsyncHlc clock = {};
+  uint64_t first = bizsync_hlc_now(&clock);
+  uint64_t second = bizsync_hlc_now(&clock);
+  EXPECT_GT(second, first);
+
+  uint64_t received = 0;
+  ASSERT_EQ(bizsync_hlc_receive(&clock, second + 5, &received), BIZSYNC_OK);
+  EXPECT_GT(received, second + 5);
+
+  uint64_t hour_ahead = second + (static_cast<uint64_t>(3600 * 1000) << 16);
+  EXPECT_EQ(bizsync_hlc_receive(&clock, hour_ahead, nullptr),
+            BIZSYNC_ERROR_INVALID_ARGUMENT);
+  EXPECT_GT(bizsync_hlc_now(&clock), received);
+  EXPECT_LT(bizsync_hlc_now(&clock), hour_ahead);
+}
+
+}  // namespace
+}  // namespace bizsync
@@ -0,0 +1,108 @@
+#include "crypto.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace bizsync {
+namespace {
+
+std::string Hex(const uint8_t* bytes, size_t length) {
+  static const char kDigits[] = "0123456789abcdef";
+  std::string hex;
+  for (size_t i = 0; i < length; i++) {
+    hex += kDigits[bytes[i] >> 4];
+    hex += kDigits[bytes[i] & 0xf];
+  }
+  return hex;
+}
+
+// RFC 9106 section 5.3.
+std::string Argon2idRfcTag() {
+  std::vector<uint8_t> password(32, 0x01);
+  std::vector<uint8_t> salt(16, 0x02);
+  std::vector<uint8_t> secret(8, 0x03);
+  std::vector<uint8_t> associated_data(12, 0x04);
+  BizsyncArgon2Options options = {};
+  options.iterations = 3;
+  options.memory_kib = 32;
+  options.parallelism = 4;
+  uint8_t tag[32];
+  if (Argon2id(password.data(), password.size(), salt.data(), salt.size(),
+               secret.data(), secret.size(), associated_data.data(),
+               associated_data.size(), &options, tag,
+               sizeof(tag)) != BIZSYNC_OK) {
+    return bizsync_last_error();
+  }
+  return Hex(tag, sizeof(tag));
+}
+
+const char* kArgon2idRfcTag =
+    "0d640df58d78766c08c037a34a8b53c9d01ef0452d75b65eb52520e96b01e659";
+
+class Argon2idTest : public testing::Test {
+ protected:
+  void TearDown() override { SetArgon2idAvx2Enabled(true); }
+};
+
+TEST_F(Argon2idTest, MatchesRfc9106WithThePortableBlockFunction) {
+  ASSERT_FALSE(SetArgon2idAvx2Enabled(false));
+  EXPECT_EQ(Argon2idRfcTag(), kArgon2idRfcTag);
+}
+
+TEST_F(Argon2idTest, MatchesRfc9106WithTheAvx2BlockFunction) {
+  if (!SetArgon2idAvx2Enabled(true)) {
+    GTEST_SKIP() << "the CPU has no AVX2";
+  }
+  EXPECT_EQ(Argon2idRfcTag(), kArgon2idRfcTag);
+}
+
+TEST(Blake2bTest, MatchesRfc7693) {
+  uint8_t digest[64];
+  Blake2bDigest("abc", 3, digest, sizeof(digest));
+  EXPECT_EQ(Hex(digest, sizeof(digest)),
+            "ba80a53f981c4d0d6a2797b69f12f6e94c212f14685ac4b74b12bb6fdbffa2d1"
+            "7d87c5392aab792dc252d5de4533cc9518d38aa8dbf1925ab92386edd4009923");
+}
+
+class AeadTest : public testing::TestWithParam<int32_t> {};
+
+TEST_P(AeadTest, OpensWhatItSealsAndRejectsTampering) {
+  uint8_t key[BIZSYNC_AEAD_KEY_SIZE];
+  for (size_t i = 0; i < sizeof(key); i++) {
+    key[i] = uint8_t(i * 7);
+  }
+  const std::string aad = "customers.uen";
+  const std::string plain = "201912345K";
+  std::vector<uint8_t> sealed(plain.size() + BIZSYNC_AEAD_OVERHEAD);
+  ASSERT_EQ(bizsync_aead_seal(GetParam(), key,
+                              reinterpret_cast<const uint8_t*>(aad.data()),
+                              aad.size(),
+                              reinterpret_cast<const uint8_t*>(plain.data()),
+                              plain.size(), sealed.data()),
+            BIZSYNC_OK)
+      << bizsync_last_error();
+
+  std::vector<uint8_t> opened(plain.size());
+  auto open = [&](const std::string& with_aad) {
+    return bizsync_aead_open(
+        GetParam(), key, reinterpret_cast<const uint8_t*>(with_aad.data()),
+        with_aad.size(), sealed.data(), sealed.size(), opened.data());
+  };
+  ASSERT_EQ(open(aad), BIZSYNC_OK) << bizsync_last_error();
+  EXPECT_EQ(std::string(opened.begin(), opened.end()), plain);
+
+  EXPECT_EQ(open("customers.name"), BIZSYNC_ERROR_FORMAT);
+
+  sealed.back() ^= 0x01;
+  EXPECT_EQ(open(aad), BIZSYNC_ERROR_FORMAT);
+  EXPECT_EQ(opened, std::vector<uint8_t>(plain.size(), 0));
+}
+
+INSTANTIATE_TEST_SUITE_P(Algorithms, AeadTest,
+                         testing::Values(BIZSYNC_AEAD_AES_256_GCM,
+                                         BIZSYNC_AEAD_CHACHA20_POLY1305));
+
+}  // namespace
+}  // namespace bizsync
@@ -0,0 +1,156 @@
+#include "csv_import.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "test_util.h"
+
+namespace bizsync {
+namespace {
+
+const char* kSchema =
+    "CREATE TABLE customers (uen TEXT, name TEXT, credit_limit_cents INTEGER,"
+    " gst_rate REAL)";
+const char* kInsert =
+    "INSERT INTO customers (uen, name, credit_limit_cents, gst_rate)"
+    " VALUES (?, ?, ?, ?)";
+const int32_t kColumnTypes[] = {BIZSYNC_VALUE_TEXT, BIZSYNC_VALUE_TEXT,
+                                BIZSYNC_VALUE_INT64, BIZSYNC_VALUE_FLOAT64};
+
+class CsvImportTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_FALSE(dir_.path().empty());
+    ASSERT_EQ(bizsync_db_open(database().c_str(), nullptr, &db_), BIZSYNC_OK)
+        << bizsync_last_error();
+    ASSERT_EQ(bizsync_db_execute(db_, kSchema), BIZSYNC_OK);
+  }
+
+  void TearDown() override { bizsync_db_close(db_); }
+
+  std::string database() const { return dir_.Join("test.db"); }
+
+  // Imports |csv| and returns the final status passed to the callback.
+  int32_t Import(const std::string& csv, int32_t flags,
+                 BizsyncImportResult* result) {
+    std::string path = dir_.Join("import.csv");
+    EXPECT_TRUE(WriteFile(path, csv));
+    return ImportFile(path, flags, result);
+  }
+
+  int32_t ImportFile(const std::string& path, int32_t flags,
+                     BizsyncImportResult* result) {
+    BizsyncImportOptions options = {};
+    options.flags = flags;
+    options.column_types = kColumnTypes;
+    options.column_count = 4;
+    options.callback = [](void* user_data, int32_t status, int64_t imported,
+                          int64_t rejected) {
+      if (status != BIZSYNC_IMPORT_RUNNING) {
+        static_cast<FinalStatus*>(user_data)->Set(status);
+      }
+    };
+    FinalStatus status;
+    options.user_data = &status;
+    BizsyncImport* job = nullptr;
+    int started =
+        bizsync_import_csv_start(db_, path.c_str(), kInsert, &options, &job);
+    if (started != BIZSYNC_OK) {
+      return started;
+    }
+    int32_t final_status = status.Wait();
+    bizsync_import_get_result(job, result);
+    bizsync_import_free(job);
+    return final_status;
+  }
+
+  TempDir dir_{"bizsync-test-csv"};
+  BizsyncDb* db_ = nullptr;
+};
+
+TEST_F(CsvImportTest, RoundTripsQuotedFieldsAndTypes) {
+  BizsyncImportResult result;
+  ASSERT_EQ(Import("\xef\xbb\xbfuen,name,credit_limit_cents,gst_rate\r\n"
+                   "201912345K,\"Tan, Lim & Co\",150000,0.09\r\n"
+                   "T08LL0001A,\"Say \"\"Hi\"\" Pte\nLtd\",,0\r\n"
+                   "\n"
+                   "53312345M,Kopi Stall,42, 0.08 \n",
+                   BIZSYNC_IMPORT_HEADER, &result),
+            BIZSYNC_OK);
+
+  EXPECT_EQ(result.rows_imported, 3);
+  EXPECT_EQ(result.rows_rejected, 0);
+  EXPECT_EQ(result.first_rejected_record, 0);
+  EXPECT_EQ(QueryText(database(),
+                      "SELECT name FROM customers WHERE uen = '201912345K'"),
+            "Tan, Lim & Co");
+  EXPECT_EQ(QueryText(database(),
+                      "SELECT name FROM customers WHERE uen = 'T08LL0001A'"),
+            "Say \"Hi\" Pte\nLtd");
+  EXPECT_EQ(QueryText(database(), "SELECT credit_limit_cents FROM customers"
+                                  " WHERE uen = 'T08LL0001A'"),
+            "NULL");
+  EXPECT_EQ(QueryText(database(), "SELECT typeof(gst_rate) || gst_rate"
+                                  " FROM customers WHERE uen = '53312345M'"),
+            "real0.08");
+  EXPECT_EQ(QueryInt64(database(),
+                       "SELECT sum(credit_limit_cents) FROM customers"),
+            150042);
+}
+
+TEST_F(CsvImportTest, CountsAndSkipsInvalidRows) {
+  BizsyncImportResult result;
+  ASSERT_EQ(Import("A1,ok,1,0.09\n"
+                   "A2,bad integer,1x,0.09\n"
+                   "A3,too few fields\n"
+                   "A4,\"bad \xff utf-8\",4,0.09\n"
+                   "A5,ok,5,0.09\n",
+                   0, &result),
+            BIZSYNC_OK);
+
+  EXPECT_EQ(result.rows_imported, 2);
+  EXPECT_EQ(result.rows_rejected, 3);
+  EXPECT_EQ(result.first_rejected_record, 2);
+  EXPECT_STREQ(result.first_rejection, "column 3 is not an integer");
+  EXPECT_EQ(QueryText(database(),
+                      "SELECT group_concat(uen) FROM"
+                      " (SELECT uen FROM customers ORDER BY uen)"),
+            "A1,A5");
+}
+
+// Large enough for several chunks per worker, with quoted newlines that land
+// on either side of chunk boundaries.
+TEST_F(CsvImportTest, SplitsLargeFilesAtRecordBoundaries) {
+  const int64_t kRows = 200000;
+  std::string csv;
+  int64_t total = 0;
+  for (int64_t i = 0; i < kRows; i++) {
+    csv += "U" + std::to_string(i) + ",";
+    csv += i % 7 == 0 ? "\"multi\nline, \"\"quoted\"\"\"" : "plain name";
+    csv += "," + std::to_string(i) + ",0.09\n";
+    total += i;
+  }
+  ASSERT_GT(csv.size(), 4u * 1024 * 1024);
+
+  BizsyncImportResult result;
+  ASSERT_EQ(Import(csv, 0, &result), BIZSYNC_OK);
+  EXPECT_EQ(result.rows_imported, kRows);
+  EXPECT_EQ(result.rows_rejected, 0);
+  EXPECT_EQ(QueryInt64(database(),
+                       "SELECT sum(credit_limit_cents) FROM customers"),
+            total);
+  EXPECT_EQ(QueryInt64(database(), "SELECT count(*) FROM customers"
+                                   " WHERE name = 'multi\nline, \"quoted\"'"),
+            (kRows + 6) / 7);
+}
+
+TEST_F(CsvImportTest, FailsOnMissingFile) {
+  BizsyncImportResult result;
+  EXPECT_EQ(ImportFile(dir_.Join("missing.csv"), 0, &result),
+            BIZSYNC_ERROR_IO);
+  EXPECT_EQ(QueryInt64(database(), "SELECT count(*) FROM customers"), 0);
+}
+
+}  // namespace
+}  // namespace bizsync
@@ -0,0 +1,214 @@
+#include "gst_rollup.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "test_util.h"
+
+namespace bizsync {
+namespace {
+
+const int32_t kSales = 1;
+const int32_t kPurchases = 2;
+
+// Invoice dates are in milliseconds on the invoice, purchase dates in
+// seconds on the line.
+const char* kSchema =
+    "CREATE TABLE sales_invoices (id INTEGER PRIMARY KEY, issued_ms INTEGER);"
+    "CREATE TABLE sales_lines (id INTEGER PRIMARY KEY, invoice_id INTEGER,"
+    " code TEXT, net INTEGER, tax INTEGER);"
+    "CREATE TABLE purchases (id INTEGER PRIMARY KEY, code TEXT, net INTEGER,"
+    " tax INTEGER, bought_at INTEGER)";
+
+// 2025-01-15 and 2025-02-15 00:00 UTC.
+const int64_t kJanuary = 1736899200;
+const int64_t kFebruary = 1739577600;
+// 2024-12-31 23:30 and 2025-01-01 00:30 in Singapore.
+const int64_t kLastHourOf2024 = 1735659000;
+const int64_t kFirstHourOf2025 = 1735662600;
+
+const char* kRollups =
+    "SELECT group_concat(row, ';') FROM (SELECT source || ',' || period ||"
+    " ',' || code || ',' || net_cents || ',' || tax_cents || ',' || lines"
+    " AS row FROM gst_rollups WHERE lines != 0"
+    " ORDER BY source, period, code)";
+
+class GstRollupTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_FALSE(dir_.path().empty());
+    ASSERT_EQ(bizsync_db_open(database().c_str(), nullptr, &db_), BIZSYNC_OK)
+        << bizsync_last_error();
+    Execute(kSchema);
+    ASSERT_EQ(bizsync_gst_open(db_, &gst_), BIZSYNC_OK)
+        << bizsync_last_error();
+  }
+
+  void TearDown() override {
+    bizsync_gst_close(gst_);
+    bizsync_db_close(db_);
+  }
+
+  std::string database() const { return dir_.Join("test.db"); }
+
+  void Execute(const std::string& sql) {
+    ASSERT_EQ(bizsync_db_execute(db_, sql.c_str()), BIZSYNC_OK)
+        << bizsync_last_error();
+  }
+
+  void AddSources() {
+    BizsyncGstSource sales = {};
+    sales.source = kSales;
+    sales.time_unit = BIZSYNC_GST_TIME_MILLISECONDS;
+    sales.table = "sales_lines";
+    sales.code_column = "code";
+    sales.net_column = "net";
+    sales.tax_column = "tax";
+    sales.time_column = "issued_ms";
+    sales.parent_table = "sales_invoices";
+    sales.parent_key = "id";
+    sales.link_column = "invoice_id";
+    ASSERT_EQ(bizsync_gst_add_source(gst_, &sales), BIZSYNC_OK)
+        << bizsync_last_error();
+
+    BizsyncGstSource purchases = {};
+    purchases.source = kPurchases;
+    purchases.time_unit = BIZSYNC_GST_TIME_SECONDS;
+    purchases.table = "purchases";
+    purchases.code_column = "code";
+    purchases.net_column = "net";
+    purchases.tax_column = "tax";
+    purchases.time_column = "bought_at";
+    ASSERT_EQ(bizsync_gst_add_source(gst_, &purchases), BIZSYNC_OK)
+        << bizsync_last_error();
+  }
+
+  BizsyncGstReturn Return(int32_t first_period, int32_t last_period) {
+    BizsyncGstReturn figures = {};
+    EXPECT_EQ(bizsync_gst_return(gst_, first_period, last_period, &figures),
+              BIZSYNC_OK)
+        << bizsync_last_error();
+    return figures;
+  }
+
+  TempDir dir_{"bizsync-test-gst"};
+  BizsyncDb* db_ = nullptr;
+  BizsyncGst* gst_ = nullptr;
+};
+
+// Invoice 1 is rolled up by the rebuild on registration, everything else by
+// the triggers.
+TEST_F(GstRollupTest, FillsF5BoxesFromRebuildAndTriggers) {
+  Execute("INSERT INTO sales_invoices VALUES (1, " +
+          std::to_string(kJanuary * 1000) +
+          ");"
+          "INSERT INTO sales_lines VALUES (1, 1, 'SR', 10000, 900),"
+          " (2, 1, 'SR', 5000, 450), (3, 1, 'ZR', 3000, 0),"
+          " (4, 1, 'ES33', 2000, 0), (5, 1, 'OS', 700, 0)");
+  AddSources();
+  Execute("INSERT INTO sales_invoices VALUES (2, " +
+          std::to_string(kLastHourOf2024 * 1000) + "), (3, " +
+          std::to_string(kFirstHourOf2025 * 1000) +
+          ");"
+          "INSERT INTO sales_lines VALUES (6, 2, 'SR', 99999, 9000),"
+          " (7, 3, 'DS', 1000, 90);"
+          "INSERT INTO purchases VALUES"
+          " (1, 'TX', 4000, 360, " + std::to_string(kFebruary) + "),"
+          " (2, 'IM', 2500, 225, " + std::to_string(kFebruary) + "),"
+          " (3, 'ZP', 800, 0, " + std::to_string(kFebruary) + "),"
+          " (4, 'BL', 300, 27, " + std::to_string(kFebruary) + ")");
+
+  BizsyncGstReturn quarter = Return(202501, 202503);
+  EXPECT_EQ(quarter.standard_rated_cents, 16000);
+  EXPECT_EQ(quarter.zero_rated_cents, 3000);
+  EXPECT_EQ(quarter.exempt_cents, 2000);
+  EXPECT_EQ(quarter.total_supplies_cents, 21000);
+  EXPECT_EQ(quarter.taxable_purchases_cents, 7300);
+  EXPECT_EQ(quarter.output_tax_cents, 1440);
+  EXPECT_EQ(quarter.input_tax_cents, 585);
+  EXPECT_EQ(quarter.net_gst_cents, 855);
+  EXPECT_EQ(quarter.lines, 8);
+  EXPECT_EQ(quarter.other_lines, 2);
+
+  // Periods follow Singapore time, not UTC.
+  BizsyncGstReturn december = Return(202412, 202412);
+  EXPECT_EQ(december.standard_rated_cents, 99999);
+  EXPECT_EQ(december.lines, 1);
+}
+
+TEST_F(GstRollupTest, TriggersMatchARebuildAfterEdits) {
+  AddSources();
+  Execute("INSERT INTO sales_invoices VALUES (1, " +
+          std::to_string(kJanuary * 1000) + "), (2, " +
+          std::to_string(kJanuary * 1000) +
+          ");"
+          "INSERT INTO sales_lines VALUES (1, 1, 'SR', 10000, 900),"
+          " (2, 1, 'SR', 5000, 450), (3, 2, 'ZR', 3000, 0),"
+          " (4, 2, 'SR', 2000, 180), (5, NULL, 'SR', 100, 9);"
+          "INSERT INTO purchases VALUES"
+          " (1, 'TX', 4000, 360, " + std::to_string(kJanuary) + "),"
+          " (2, 'TX', 600, 54, NULL)");
+  Execute(
+      "UPDATE sales_lines SET code = 'ZR', tax = 0 WHERE id = 2;"
+      "UPDATE sales_lines SET net = 2500, tax = 225 WHERE id = 4;"
+      "UPDATE sales_lines SET invoice_id = 1 WHERE id = 3;"
+      "DELETE FROM sales_lines WHERE id = 1;"
+      "UPDATE purchases SET bought_at = " + std::to_string(kFebruary) +
+      " WHERE id = 1;"
+      "UPDATE purchases SET bought_at = " + std::to_string(kJanuary) +
+      " WHERE id = 2");
+  Execute("UPDATE sales_invoices SET issued_ms = " +
+          std::to_string(kFebruary * 1000) + " WHERE id = 2");
+
+  std::string maintained = QueryText(database(), kRollups);
+  ASSERT_EQ(bizsync_gst_rebuild(gst_, 0), BIZSYNC_OK) << bizsync_last_error();
+  EXPECT_EQ(QueryText(database(), kRollups), maintained);
+  EXPECT_EQ(maintained,
+            "1,0,SR,100,9,1;"
+            "1,202501,ZR,8000,0,2;"
+            "1,202502,SR,2500,225,1;"
+            "2,202501,TX,600,54,1;"
+            "2,202502,TX,4000,360,1");
+}
+
+// Re-dating an invoice moves its lines to the new month, and lines without
+// an invoice count as undated, as in a rebuild.
+TEST_F(GstRollupTest, RedatingAnInvoiceMovesItsLines) {
+  AddSources();
+  Execute("INSERT INTO sales_invoices VALUES (1, " +
+          std::to_string(kJanuary * 1000) +
+          ");"
+          "INSERT INTO sales_lines VALUES (1, 1, 'SR', 10000, 900),"
+          " (2, 1, 'ZR', 3000, 0)");
+  EXPECT_EQ(Return(202501, 202501).lines, 2);
+
+  Execute("UPDATE sales_invoices SET issued_ms = " +
+          std::to_string(kFebruary * 1000) + " WHERE id = 1");
+  EXPECT_EQ(Return(202501, 202501).lines, 0);
+  BizsyncGstReturn february = Return(202502, 202502);
+  EXPECT_EQ(february.standard_rated_cents, 10000);
+  EXPECT_EQ(february.zero_rated_cents, 3000);
+  EXPECT_EQ(february.output_tax_cents, 900);
+
+  Execute("DELETE FROM sales_invoices WHERE id = 1");
+  EXPECT_EQ(Return(202502, 202502).lines, 0);
+  EXPECT_EQ(Return(0, 0).lines, 2);
+
+  // Lines written before their invoice, as a sync may deliver them.
+  Execute("INSERT INTO sales_lines VALUES (3, 2, 'SR', 400, 36);"
+          "INSERT INTO sales_invoices VALUES (2, " +
+          std::to_string(kJanuary * 1000) + ")");
+  EXPECT_EQ(Return(202501, 202501).standard_rated_cents, 400);
+  Execute("UPDATE sales_invoices SET id = 1 WHERE id = 2");
+  EXPECT_EQ(Return(202501, 202501).standard_rated_cents, 10000);
+  EXPECT_EQ(Return(0, 0).lines, 1);
+
+  std::string maintained = QueryText(database(), kRollups);
+  ASSERT_EQ(bizsync_gst_rebuild(gst_, kSales), BIZSYNC_OK)
+      << bizsync_last_error();
+  EXPECT_EQ(QueryText(database(), kRollups), maintained);
+}
+
+}  // namespace
+}  // namespace bizsync
@@ -0,0 +1,95 @@
+#include "qr_code.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+namespace bizsync {
+namespace {
+
+TEST(PayNowTest, ChecksumMatchesTheCrcCheckValue) {
+  EXPECT_EQ(Crc16CcittFalse("123456789"), 0x29b1);
+}
+
+TEST(PayNowTest, BuildsTheEmvcoPayload) {
+  BizsyncPayNowRequest request = {};
+  request.proxy_type = BIZSYNC_PAYNOW_UEN;
+  request.proxy = "201912345K";
+  request.merchant_name = "BIZSYNC PTE LTD";
+  request.reference = "INV-0042";
+  request.expiry = "20261231";
+  request.amount_cents = 12345;
+  char payload[BIZSYNC_PAYNOW_PAYLOAD_MAX];
+  size_t length = 0;
+  ASSERT_EQ(bizsync_paynow_payload(&request, payload, &length), BIZSYNC_OK)
+      << bizsync_last_error();
+
+  const std::string expected =
+      "000201"
+      "010212"
+      "2649"
+      "0009SG.PAYNOW"
+      "010120"
+      "210201912345K"
+      "030100"
+      "40820261231"
+      "52040000"
+      "5303702"
+      "5406123.45"
+      "5802SG"
+      "5915BIZSYNC PTE LTD"
+      "6009Singapore"
+      "62120108INV-0042"
+      "6304CACC";
+  EXPECT_EQ(std::string(payload), expected);
+  EXPECT_EQ(length, expected.size());
+}
+
+// "HELLO WORLD" at level Q is the worked example of most QR tutorials; its
+// codewords are 20 5b 0b 78 d1 72 dc 4d 43 40 ec 11 ec, then a8 48 16 52
+// d9 36 9c 00 2e 0f b4 7a 10, and mask 0 scores lowest.
+TEST(QrCodeTest, EncodesAKnownSymbol) {
+  const std::string text = "HELLO WORLD";
+  BizsyncQrCode* code = nullptr;
+  ASSERT_EQ(bizsync_qr_encode(reinterpret_cast<const uint8_t*>(text.data()),
+                              text.size(), BIZSYNC_QR_ECC_LOW, &code),
+            BIZSYNC_OK);
+  EXPECT_EQ(code->version, 1);
+  EXPECT_EQ(code->ecc, BIZSYNC_QR_ECC_QUARTILE);
+  ASSERT_EQ(code->size, 21);
+
+  std::string modules;
+  for (int y = 0; y < code->size; y++) {
+    for (int x = 0; x < code->size; x++) {
+      modules += code->modules[y * code->size + x] ? '#' : '.';
+    }
+    modules += '\n';
+  }
+  bizsync_qr_code_free(code);
+
+  EXPECT_EQ(modules,
+            "#######.##....#######\n"
+            "#.....#.#..#..#.....#\n"
+            "#.###.#.#..##.#.###.#\n"
+            "#.###.#.#.....#.###.#\n"
+            "#.###.#.#.#...#.###.#\n"
+            "#.....#...#...#.....#\n"
+            "#######.#.#.#.#######\n"
+            "........#............\n"
+            ".##.#.##....#.#.#####\n"
+            ".#......####....#...#\n"
+            "..##.###.##...#.##...\n"
+            ".##.##.#..##.#.#.###.\n"
+            "#...#.#.#.###.###.#.#\n"
+            "........##.#..#...#.#\n"
+            "#######.#.#....#.##..\n"
+            "#.....#..#.##.##.#...\n"
+            "#.###.#.#.#...#######\n"
+            "#.###.#..#.#.#.#...#.\n"
+            "#.###.#.#..#.###.#..#\n"
+            "#.....#.#.####...#.##\n"
+            "#######....#.###....#\n");
+}
+
+}  // namespace
+}  // namespace bizsync
@@ -0,0 +1,184 @@
+#include "search_index.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "test_util.h"
+
+namespace bizsync {
+namespace {
+
+const int32_t kCustomers = 1;
+const int32_t kInvoices = 2;
+
+// Polls |condition| for up to five seconds.
+bool Eventually(const std::function<bool()>& condition) {
+  for (int i = 0; i < 500; i++) {
+    if (condition()) {
+      return true;
+    }
+    usleep(10000);
+  }
+  return condition();
+}
+
+class SearchIndexTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_FALSE(dir_.path().empty());
+    ASSERT_EQ(bizsync_db_open(dir_.Join("test.db").c_str(), nullptr, &db_),
+              BIZSYNC_OK)
+        << bizsync_last_error();
+    ASSERT_EQ(bizsync_db_execute(
+                  db_,
+                  "CREATE TABLE customers (id INTEGER PRIMARY KEY, name TEXT,"
+                  " uen TEXT, notes TEXT);"
+                  "CREATE TABLE invoices (id INTEGER PRIMARY KEY,"
+                  " number TEXT)"),
+              BIZSYNC_OK);
+    ASSERT_EQ(bizsync_search_open(db_, &search_), BIZSYNC_OK)
+        << bizsync_last_error();
+    const char* customer_columns[] = {"name", "uen", "notes"};
+    const char* invoice_columns[] = {"number"};
+    ASSERT_EQ(bizsync_search_add_source(search_, kCustomers, "customers",
+                                        customer_columns, 3),
+              BIZSYNC_OK);
+    ASSERT_EQ(bizsync_search_add_source(search_, kInvoices, "invoices",
+                                        invoice_columns, 1),
+              BIZSYNC_OK);
+  }
+
+  void TearDown() override {
+    bizsync_search_close(search_);
+    bizsync_db_close(db_);
+  }
+
+  void Execute(const std::string& sql) {
+    ASSERT_EQ(bizsync_db_execute(db_, sql.c_str()), BIZSYNC_OK)
+        << bizsync_last_error();
+  }
+
+  void Refresh() {
+    int64_t remaining = -1;
+    ASSERT_EQ(bizsync_search_refresh(search_, 0, &remaining), BIZSYNC_OK)
+        << bizsync_last_error();
+    EXPECT_EQ(remaining, 0);
+  }
+
+  // Returns "kind:id" for each result in rank order.
+  std::vector<std::string> Search(const char* query, int32_t flags = 0,
+                                  int64_t* typo_count = nullptr) {
+    std::vector<std::string> found;
+    BizsyncSearchOptions options = {};
+    options.flags = flags;
+    BizsyncSearchResult* result = nullptr;
+    EXPECT_EQ(bizsync_search_query(search_, query, &options, &result),
+              BIZSYNC_OK)
+        << bizsync_last_error();
+    if (result == nullptr) {
+      return found;
+    }
+    for (int64_t i = 0; i < result->count; i++) {
+      found.push_back(std::to_string(result->kinds[i]) + ":" +
+                      std::to_string(result->ids[i]));
+    }
+    if (typo_count != nullptr) {
+      *typo_count = result->typo_count;
+    }
+    bizsync_search_result_free(result);
+    return found;
+  }
+
+  TempDir dir_{"bizsync-test-search"};
+  BizsyncDb* db_ = nullptr;
+  BizsyncSearch* search_ = nullptr;
+};
+
+TEST_F(SearchIndexTest, FindsIdentifiersAsTypedAndByDigits) {
+  Execute(
+      "INSERT INTO customers VALUES (1, 'Tanjong Pagar Traders', "
+      "'201912345K', 'pays late');"
+      "INSERT INTO customers VALUES (2, 'Lim Hardware', 'S1234567D', '');"
+      "INSERT INTO invoices VALUES (7, 'INV-2024-0001')");
+  Refresh();
+
+  EXPECT_EQ(Search("tanj"), std::vector<std::string>{"1:1"});
+  EXPECT_EQ(Search("tanjong traders"), std::vector<std::string>{"1:1"});
+  EXPECT_EQ(Search("201912345"), std::vector<std::string>{"1:1"});
+  EXPECT_EQ(Search("1234567"), std::vector<std::string>{"1:2"});
+  EXPECT_EQ(Search("INV-2024-0001"), std::vector<std::string>{"2:7"});
+  EXPECT_EQ(Search("inv20240001"), std::vector<std::string>{"2:7"});
+  EXPECT_TRUE(Search("tanjong hardware").empty());
+}
+
+TEST_F(SearchIndexTest, DeletedAndUpdatedRowsLeaveTheIndex) {
+  Execute(
+      "INSERT INTO customers VALUES (1, 'Kopi Corner', '', '');"
+      "INSERT INTO customers VALUES (2, 'Kopi Express', '', '')");
+  Refresh();
+  Execute(
+      "DELETE FROM customers WHERE id = 1;"
+      "UPDATE customers SET name = 'Teh Express' WHERE id = 2");
+  Refresh();
+
+  EXPECT_TRUE(Search("kopi").empty());
+  EXPECT_EQ(Search("teh"), std::vector<std::string>{"1:2"});
+}
+
+TEST_F(SearchIndexTest, ToleratesTyposAfterTheExactMatches) {
+  Execute(
+      "INSERT INTO customers VALUES (1, 'Wholesale Fabrics', '', '');"
+      "INSERT INTO customers VALUES (2, 'Wholesome Bakery', '', '')");
+  Refresh();
+
+  int64_t typos = 0;
+  // The vocabulary loads in the background after bizsync_search_open().
+  EXPECT_TRUE(Eventually([&] {
+    return Search("wholsale", 0, &typos) == std::vector<std::string>{"1:1"};
+  }));
+  EXPECT_EQ(typos, 1);
+  EXPECT_TRUE(Search("wholsale", BIZSYNC_SEARCH_EXACT).empty());
+  // Identifiers are never widened.
+  EXPECT_TRUE(Search("inv2024").empty());
+}
+
+// Queries leave indexing to a background task instead of writing on the
+// caller's thread.
+TEST_F(SearchIndexTest, QueriesCatchUpWithEditsInTheBackground) {
+  Refresh();
+  Execute("INSERT INTO customers VALUES (1, 'Rojak Stall', '', '')");
+
+  EXPECT_TRUE(Eventually(
+      [&] { return Search("rojak") == std::vector<std::string>{"1:1"}; }));
+  EXPECT_EQ(QueryInt64(dir_.Join("test.db"),
+                       "SELECT count(*) FROM search_queue"),
+            0);
+}
+
+// A bulk refresh reloads the vocabulary. Words added before the reload come
+// from the index afterwards and words added later are still suggested.
+TEST_F(SearchIndexTest, ReloadKeepsTyposWorkingForOldAndNewWords) {
+  Execute("INSERT INTO customers VALUES (1, 'Durian Emporium', '', '')");
+  Refresh();
+  std::string bulk = "WITH RECURSIVE n(i) AS (SELECT 10 UNION ALL"
+                     " SELECT i + 1 FROM n WHERE i < 5009)"
+                     " INSERT INTO customers SELECT i, 'Company ' || i,"
+                     " '', '' FROM n";
+  Execute(bulk);
+  Refresh();
+  Execute("INSERT INTO customers VALUES (2, 'Mangosteen Supplies', '', '')");
+  Refresh();
+
+  EXPECT_TRUE(Eventually([&] {
+    return Search("duryan emporium") == std::vector<std::string>{"1:1"} &&
+           Search("mangostene") == std::vector<std::string>{"1:2"};
+  }));
+}
+
+}  // namespace
+}  // namespace bizsync
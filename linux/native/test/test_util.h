@@ -0,0 +1,83 @@
+#ifndef BIZSYNC_NATIVE_TEST_TEST_UTIL_H_
+#define BIZSYNC_NATIVE_TEST_TEST_UTIL_H_
+
+#include <sqlite3.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+
+#include "sqlite_engine.h"
+#include "temp_dir.h"
+
+namespace bizsync {
+
+// The final status an engine reports to its completion callback, which runs
+// on a scheduler worker.
+class FinalStatus {
+ public:
+  void Set(int32_t status) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    status_ = status;
+    done_ = true;
+    changed_.notify_all();
+  }
+
+  int32_t Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this] { return done_; });
+    return status_;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  bool done_ = false;
+  int32_t status_ = 0;
+};
+
+// Writes |contents| to |path|, replacing it.
+inline bool WriteFile(const std::string& path, const std::string& contents) {
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    return false;
+  }
+  bool ok = fwrite(contents.data(), 1, contents.size(), file) ==
+            contents.size();
+  return fclose(file) == 0 && ok;
+}
+
+// Runs |sql| on its own connection to |path| and returns the first column of
+// the first row as text, "NULL" for NULL, or "" if there is no row. Checks
+// what the engines committed without going through them.
+inline std::string QueryText(const std::string& path, const std::string& sql) {
+  std::string value;
+  sqlite3* connection = nullptr;
+  if (sqlite3_open_v2(path.c_str(), &connection, SQLITE_OPEN_READONLY,
+                      nullptr) != SQLITE_OK) {
+    sqlite3_close(connection);
+    return "<cannot open " + path + ">";
+  }
+  sqlite3_stmt* statement = nullptr;
+  if (sqlite3_prepare_v2(connection, sql.c_str(), -1, &statement, nullptr) !=
+      SQLITE_OK) {
+    value = std::string("<") + sqlite3_errmsg(connection) + ">";
+  } else if (sqlite3_step(statement) == SQLITE_ROW) {
+    const unsigned char* text = sqlite3_column_text(statement, 0);
+    value = text != nullptr ? reinterpret_cast<const char*>(text) : "NULL";
+  }
+  sqlite3_finalize(statement);
+  sqlite3_close(connection);
+  return value;
+}
+
+inline int64_t QueryInt64(const std::string& path, const std::string& sql) {
+  return strtoll(QueryText(path, sql).c_str(), nullptr, 10);
+}
+
+}  // namespace bizsync
+
+#endif  // BIZSYNC_NATIVE_TEST_TEST_UTIL_H_
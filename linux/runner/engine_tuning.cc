@@ -0,0 +1,229 @@
+#include "engine_tuning.h"
+
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "runner_config.h"
+
+static const gchar* kConfigGroup = "engine";
+static const gchar* kChannelName = "bizsync/engine_tuning";
+
+typedef struct {
+  const gchar* name;
+  // 0 leaves the engine's, the VM's or glibc's default.
+  gint old_gen_heap_size;
+  gint resource_cache_mb;
+  gint malloc_arenas;
+} MachinePreset;
+
+static const MachinePreset kPresets[] = {
+    // Caps the heap and Skia's GPU cache so several tabs of tables fit in
+    // 4 GB alongside the browser.
+    {"low-memory", 512, 64, 2},
+    {"standard", 0, 0, 4},
+    // A larger cache saves the raster thread re-uploading images and
+    // glyphs when scrolling back through long lists.
+    {"workstation", 0, 512, 0},
+};
+
+// Physical memory below which a machine is low-memory; 4 GB machines
+// report a little less than 4 GiB.
+static const guint64 kLowMemoryBytes = 4608ull << 20;
+static const guint64 kWorkstationBytes = 15ull << 30;
+static const guint kWorkstationCores = 8;
+
+// The resolved settings, served on the channel.
+static const MachinePreset* selected_preset = nullptr;
+static gint old_gen_heap_size = 0;
+static gint resource_cache_mb = 0;
+static gint malloc_arenas = 0;
+static gboolean switches_applied = FALSE;
+
+static FlMethodChannel* settings_channel = nullptr;
+
+static const MachinePreset* detect_preset() {
+  guint64 memory = static_cast<guint64>(sysconf(_SC_PHYS_PAGES)) *
+                   static_cast<guint64>(sysconf(_SC_PAGESIZE));
+  if (memory < kLowMemoryBytes) {
+    return &kPresets[0];
+  }
+  if (memory >= kWorkstationBytes &&
+      g_get_num_processors() >= kWorkstationCores) {
+    return &kPresets[2];
+  }
+  return &kPresets[1];
+}
+
+static const MachinePreset* preset_from_string(const gchar* name) {
+  for (guint i = 0; i < G_N_ELEMENTS(kPresets); i++) {
+    if (g_ascii_strcasecmp(name, kPresets[i].name) == 0) {
+      return &kPresets[i];
+    }
+  }
+  g_warning("Unknown machine class '%s'", name);
+  return nullptr;
+}
+
+static const MachinePreset* select_preset(const gchar* requested,
+                                          const gchar** source) {
+  const MachinePreset* preset = nullptr;
+  if (requested != nullptr &&
+      (preset = preset_from_string(requested)) != nullptr) {
+    *source = "command line";
+    return preset;
+  }
+
+  g_autofree gchar* configured = g_key_file_get_string(
+      runner_config_get(), kConfigGroup, "machine-class", nullptr);
+  if (configured != nullptr &&
+      (preset = preset_from_string(configured)) != nullptr) {
+    *source = "bizsync.conf";
+    return preset;
+  }
+
+  *source = "detected";
+  return detect_preset();
+}
+
+// Returns |requested| if set, else the non-negative value of |key| in
+// bizsync.conf, else |preset_value|.
+static gint select_int(gint requested, const gchar* key, gint preset_value) {
+  if (requested > 0) {
+    return requested;
+  }
+  g_autoptr(GError) error = nullptr;
+  gint value =
+      g_key_file_get_integer(runner_config_get(), kConfigGroup, key, &error);
+  return error == nullptr && value >= 0 ? value : preset_value;
+}
+
+static void add_switch(GPtrArray* switches, const gchar* value) {
+  while (*value == '-') {
+    value++;
+  }
+  if (*value != '\0') {
+    g_ptr_array_add(switches, g_strdup(value));
+  }
+}
+
+// Appends |switches| to any FLUTTER_ENGINE_SWITCHES already in the
+// environment. The engine adds the leading "--" itself.
+static void export_switches(GPtrArray* switches) {
+  const char* existing = getenv("FLUTTER_ENGINE_SWITCHES");
+  gint count = existing != nullptr ? atoi(existing) : 0;
+  for (guint i = 0; i < switches->len; i++) {
+    g_autofree gchar* key =
+        g_strdup_printf("FLUTTER_ENGINE_SWITCH_%d", ++count);
+    setenv(key, static_cast<const gchar*>(g_ptr_array_index(switches, i)),
+           1);
+  }
+  g_autofree gchar* total = g_strdup_printf("%d", count);
+  setenv("FLUTTER_ENGINE_SWITCHES", total, 1);
+}
+
+void engine_tuning_apply(const EngineTuningOptions* options) {
+  const gchar* source = nullptr;
+  const MachinePreset* preset = select_preset(options->machine_class, &source);
+  GKeyFile* config = runner_config_get();
+
+  selected_preset = preset;
+  old_gen_heap_size = select_int(options->old_gen_heap_size,
+                                 "old-gen-heap-size",
+                                 preset->old_gen_heap_size);
+  resource_cache_mb =
+      select_int(0, "resource-cache-mb", preset->resource_cache_mb);
+  malloc_arenas = select_int(0, "malloc-arenas", preset->malloc_arenas);
+
+  g_autoptr(GPtrArray) switches = g_ptr_array_new_with_free_func(g_free);
+  if (old_gen_heap_size > 0) {
+    g_ptr_array_add(switches,
+                    g_strdup_printf("old-gen-heap-size=%d", old_gen_heap_size));
+  }
+  g_autofree gchar* configured_flags =
+      g_key_file_get_string(config, kConfigGroup, "dart-flags", nullptr);
+  const gchar* dart_flags = options->dart_flags != nullptr
+                                ? options->dart_flags
+                                : configured_flags;
+  if (dart_flags != nullptr && *dart_flags != '\0') {
+    g_ptr_array_add(switches, g_strdup_printf("dart-flags=%s", dart_flags));
+  }
+  g_auto(GStrv) configured_switches = g_key_file_get_string_list(
+      config, kConfigGroup, "switches", nullptr, nullptr);
+  for (gchar** value = configured_switches;
+       value != nullptr && *value != nullptr; value++) {
+    add_switch(switches, *value);
+  }
+  for (const gchar* const* value = options->switches;
+       value != nullptr && *value != nullptr; value++) {
+    add_switch(switches, *value);
+  }
+
+  if (malloc_arenas > 0) {
+    mallopt(M_ARENA_MAX, malloc_arenas);
+  }
+
+  g_print("BizSync: machine class '%s' (%s)\n", preset->name, source);
+  g_print("  - malloc arenas: %d\n", malloc_arenas);
+  g_print("  - resource cache: %d MB\n", resource_cache_mb);
+#ifdef FLUTTER_RELEASE
+  for (guint i = 0; i < switches->len; i++) {
+    g_print("  - --%s skipped: release engines ignore switches\n",
+            static_cast<const gchar*>(g_ptr_array_index(switches, i)));
+  }
+#else
+  export_switches(switches);
+  switches_applied = TRUE;
+  for (guint i = 0; i < switches->len; i++) {
+    g_print("  - --%s\n",
+            static_cast<const gchar*>(g_ptr_array_index(switches, i)));
+  }
+#endif
+}
+
+static void method_call_cb(FlMethodChannel* channel, FlMethodCall* method_call,
+                           gpointer user_data) {
+  const gchar* method = fl_method_call_get_name(method_call);
+
+  g_autoptr(FlMethodResponse) response = nullptr;
+  if (strcmp(method, "getSettings") == 0 && selected_preset != nullptr) {
+    g_autoptr(FlValue) result = fl_value_new_map();
+    fl_value_set_string_take(result, "machineClass",
+                             fl_value_new_string(selected_preset->name));
+    fl_value_set_string_take(
+        result, "resourceCacheBytes",
+        resource_cache_mb > 0
+            ? fl_value_new_int(static_cast<int64_t>(resource_cache_mb) << 20)
+            : fl_value_new_null());
+    fl_value_set_string_take(
+        result, "oldGenHeapSize",
+        old_gen_heap_size > 0 && switches_applied
+            ? fl_value_new_int(old_gen_heap_size)
+            : fl_value_new_null());
+    fl_value_set_string_take(result, "mallocArenas",
+                             fl_value_new_int(malloc_arenas));
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else {
+    response = FL_METHOD_RESPONSE(fl_method_not_implemented_response_new());
+  }
+
+  g_autoptr(GError) error = nullptr;
+  if (!fl_method_call_respond(method_call, response, &error)) {
+    g_warning("Failed to send engine tuning response: %s", error->message);
+  }
+}
+
+void engine_tuning_register_channel(FlPluginRegistry* registry) {
+  if (settings_channel != nullptr) {
+    return;
+  }
+  g_autoptr(FlPluginRegistrar) registrar =
+      fl_plugin_registry_get_registrar_for_plugin(registry, "EngineTuning");
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  settings_channel = fl_method_channel_new(
+      fl_plugin_registrar_get_messenger(registrar), kChannelName,
+      FL_METHOD_CODEC(codec));
+  fl_method_channel_set_method_call_handler(settings_channel, method_call_cb,
+                                            nullptr, nullptr);
+}
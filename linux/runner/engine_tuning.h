@@ -0,0 +1,61 @@
+#ifndef FLUTTER_ENGINE_TUNING_H_
+#define FLUTTER_ENGINE_TUNING_H_
+
+#include <flutter_linux/flutter_linux.h>
+
+// Sizes the engine, the Dart VM and the allocator to the machine. The
+// machine class is detected from memory and cores, and each class has a
+// preset:
+//
+//   class        RAM, cores    old-gen heap  resource cache  malloc arenas
+//   low-memory   up to 4 GB    512 MB        64 MB           2
+//   standard     otherwise     VM default    engine default  4
+//   workstation  16 GB, 8      VM default    512 MB          glibc default
+//
+// The class and each setting can be overridden by the `[engine]` group of
+// bizsync.conf (machine-class, old-gen-heap-size, resource-cache-mb,
+// malloc-arenas, dart-flags, and switches, a list of extra engine
+// switches). The command line takes precedence with --machine-class,
+// --old-gen-heap-size, --dart-flags and --engine-switch; the resource cache
+// and arena limit are set only in bizsync.conf.
+//
+// The old-gen heap, Dart flags and extra switches reach the engine as
+// FLUTTER_ENGINE_SWITCHES. The engine only reads those in debug and
+// profile builds, so release builds log that they were skipped. The arena
+// limit is set with mallopt() in every build. Only Dart can resize Skia's
+// resource cache, through SystemChannels.skia, so it reads the size here.
+//
+// Methods on "bizsync/engine_tuning":
+//   getSettings -> {machineClass: String, resourceCacheBytes: int?,
+//     oldGenHeapSize: int?, mallocArenas: int}; null fields keep the
+//     engine's default, and oldGenHeapSize is null in release builds.
+
+typedef struct {
+  // Each is unset when nullptr or 0.
+  const gchar* machine_class;
+  gint old_gen_heap_size;
+  const gchar* dart_flags;
+  // Extra engine switches, with or without the leading "--".
+  const gchar* const* switches;
+} EngineTuningOptions;
+
+/**
+ * engine_tuning_apply:
+ * @options: settings from the command line.
+ *
+ * Resolves the machine class and settings, exports the engine switches and
+ * limits the malloc arenas. Must run before the engine starts and before
+ * the runner starts any threads.
+ */
+void engine_tuning_apply(const EngineTuningOptions* options);
+
+/**
+ * engine_tuning_register_channel:
+ * @registry: the registry of the Flutter view.
+ *
+ * Serves the resolved settings on the "bizsync/engine_tuning" method
+ * channel.
+ */
+void engine_tuning_register_channel(FlPluginRegistry* registry);
+
+#endif  // FLUTTER_ENGINE_TUNING_H_
@@ -0,0 +1,576 @@
+#include "folder_watcher.h"
+
+#include <errno.h>
+#include <glib-unix.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "packed_channel.h"
+#include "runner_config.h"
+
+static const gchar* kChannelName = "bizsync/folder_watcher";
+static const gchar* kEventChannelName = "bizsync/folder_watcher/events";
+static const gint kDefaultDebounceMs = 500;
+// A constant stream of changes is still delivered after this many windows.
+static const gint64 kMaxDelayWindows = 4;
+// path, type and directory; see folder_watcher.h.
+static const uint32_t kBatchColumns = 3;
+
+// IN_MODIFY is left out: it fires on every write() of a copy in progress,
+// and IN_CLOSE_WRITE already reports the finished file.
+static const uint32_t kWatchMask = IN_CREATE | IN_CLOSE_WRITE | IN_DELETE |
+                                   IN_MOVED_FROM | IN_MOVED_TO |
+                                   IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR |
+                                   IN_EXCL_UNLINK;
+
+typedef enum {
+  // Moved in, a directory or a special file: complete as soon as it
+  // appears.
+  CHANGE_CREATED,
+  // A new regular file, presumably still open for writing.
+  CHANGE_OPENED,
+  CHANGE_WRITTEN,
+  CHANGE_DELETED,
+} ChangeEvent;
+
+// What happened to one path since the last batch. Only the state before
+// the first event and after the last one matter.
+typedef struct {
+  gboolean existed;
+  gboolean exists;
+  // Created but not yet closed after writing; held back until it is, or
+  // until it has settled.
+  gboolean open;
+  gboolean directory;
+  // For open files: size and modification time when last checked, and
+  // when they last differed.
+  gint64 size;
+  gint64 mtime;
+  gint64 unchanged_since;
+} Change;
+
+typedef struct {
+  gboolean recursive;
+} Root;
+
+struct _FolderWatcher {
+  FlMethodChannel* channel;
+  FlEventChannel* events;
+  // Sends batches on the event channel; see packed_channel.h.
+  PackedChannel* batches;
+  gboolean listening;
+
+  gint fd;
+  guint fd_source;
+  // Watch descriptor -> path of the watched directory.
+  GHashTable* directories;
+  // Path -> Root, as passed to watch.
+  GHashTable* roots;
+
+  // Path -> Change, waiting for the next batch.
+  GHashTable* changes;
+  gboolean overflowed;
+  gint debounce_ms;
+  guint flush_source;
+  gint64 first_change;
+  gint64 last_change;
+};
+
+static gboolean flush_cb(gpointer user_data);
+
+static gboolean is_under(const gchar* path, const gchar* ancestor) {
+  size_t length = strlen(ancestor);
+  return strncmp(path, ancestor, length) == 0 && path[length] == '/';
+}
+
+// Returns whether some root still wants @path watched.
+static gboolean is_covered(FolderWatcher* self, const gchar* path) {
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, self->roots);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    const gchar* root = static_cast<const gchar*>(key);
+    if (strcmp(path, root) == 0 ||
+        (static_cast<Root*>(value)->recursive && is_under(path, root))) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+static gboolean is_covered_recursively(FolderWatcher* self,
+                                       const gchar* path) {
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, self->roots);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    if (static_cast<Root*>(value)->recursive &&
+        (strcmp(path, static_cast<const gchar*>(key)) == 0 ||
+         is_under(path, static_cast<const gchar*>(key)))) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+// Arms the debounce timer, unless it is already running.
+static void schedule_flush(FolderWatcher* self) {
+  gint64 now = g_get_monotonic_time();
+  if (self->first_change == 0) {
+    self->first_change = now;
+  }
+  self->last_change = now;
+  if (self->flush_source == 0) {
+    self->flush_source = g_timeout_add(self->debounce_ms, flush_cb, self);
+  }
+}
+
+static void record_change(FolderWatcher* self, const gchar* path,
+                          ChangeEvent event, gboolean directory) {
+  Change* change =
+      static_cast<Change*>(g_hash_table_lookup(self->changes, path));
+  if (change == nullptr) {
+    change = g_new0(Change, 1);
+    change->existed = event == CHANGE_WRITTEN || event == CHANGE_DELETED;
+    g_hash_table_insert(self->changes, g_strdup(path), change);
+  }
+  change->directory = directory;
+  change->exists = event != CHANGE_DELETED;
+  change->open = event == CHANGE_OPENED;
+  change->size = -1;
+  change->unchanged_since = g_get_monotonic_time();
+  schedule_flush(self);
+}
+
+// Whether the open file at |path| has been left alone for kMaxDelayWindows
+// windows: nothing will close it after writing, or it would have by now.
+static gboolean has_settled(FolderWatcher* self, const gchar* path,
+                            Change* change) {
+  struct stat info;
+  if (lstat(path, &info) != 0) {
+    // Gone again; its IN_DELETE or IN_MOVED_FROM follows.
+    return FALSE;
+  }
+  gint64 now = g_get_monotonic_time();
+  gint64 mtime = static_cast<gint64>(info.st_mtim.tv_sec) * G_USEC_PER_SEC +
+                 info.st_mtim.tv_nsec / 1000;
+  if (info.st_size != change->size || mtime != change->mtime) {
+    change->size = info.st_size;
+    change->mtime = mtime;
+    change->unchanged_since = now;
+    return FALSE;
+  }
+  return now - change->unchanged_since >=
+         kMaxDelayWindows * static_cast<gint64>(self->debounce_ms) * 1000;
+}
+
+static void append_row(bizsync::PackedRowWriter* batch, const gchar* path,
+                       const gchar* type, gboolean directory) {
+  batch->AppendText(path, strlen(path));
+  batch->AppendText(type, strlen(type));
+  batch->AppendInt64(directory ? 1 : 0);
+  batch->EndRow();
+}
+
+// Sends every settled change to Dart as one batch.
+static void deliver(FolderWatcher* self) {
+  self->first_change = 0;
+  if (!self->listening) {
+    return;
+  }
+
+  bizsync::PackedRowWriter batch =
+      packed_channel_begin(self->batches, kBatchColumns);
+  if (self->overflowed) {
+    self->overflowed = FALSE;
+    GHashTableIter iter;
+    gpointer key;
+    g_hash_table_iter_init(&iter, self->roots);
+    while (g_hash_table_iter_next(&iter, &key, nullptr)) {
+      append_row(&batch, static_cast<const gchar*>(key), "overflow", FALSE);
+    }
+  }
+
+  // Sorted, so a new directory comes before its contents.
+  GList* paths = g_hash_table_get_keys(self->changes);
+  paths = g_list_sort(paths, reinterpret_cast<GCompareFunc>(strcmp));
+  gboolean held_back = FALSE;
+  for (GList* link = paths; link != nullptr; link = link->next) {
+    const gchar* path = static_cast<const gchar*>(link->data);
+    Change* change =
+        static_cast<Change*>(g_hash_table_lookup(self->changes, path));
+    if (change->open && !has_settled(self, path, change)) {
+      held_back = TRUE;
+      continue;
+    }
+
+    const gchar* type = nullptr;
+    if (change->existed && change->exists) {
+      type = "modified";
+    } else if (change->exists) {
+      type = "created";
+    } else if (change->existed) {
+      type = "deleted";
+    }
+    if (type != nullptr) {
+      append_row(&batch, path, type, change->directory);
+    }
+    g_hash_table_remove(self->changes, path);
+  }
+  g_list_free(paths);
+
+  if (batch.row_count() > 0) {
+    packed_channel_send(self->batches, &batch);
+  }
+  // Check the files held back again until they close or settle.
+  if (held_back && self->flush_source == 0) {
+    self->flush_source = g_timeout_add(self->debounce_ms, flush_cb, self);
+  }
+}
+
+// Delivers once nothing has changed for a whole window, or once the oldest
+// change has waited kMaxDelayWindows windows.
+static gboolean flush_cb(gpointer user_data) {
+  FolderWatcher* self = static_cast<FolderWatcher*>(user_data);
+  gint64 now = g_get_monotonic_time();
+  gint64 window = static_cast<gint64>(self->debounce_ms) * 1000;
+  gint64 quiet = now - self->last_change;
+  if (quiet < window && now - self->first_change < kMaxDelayWindows * window) {
+    self->flush_source = g_timeout_add(
+        MAX((window - quiet) / 1000, 1), flush_cb, self);
+    return G_SOURCE_REMOVE;
+  }
+
+  self->flush_source = 0;
+  deliver(self);
+  return G_SOURCE_REMOVE;
+}
+
+static void remove_watch(FolderWatcher* self, gint wd) {
+  inotify_rm_watch(self->fd, wd);
+  g_hash_table_remove(self->directories, GINT_TO_POINTER(wd));
+}
+
+// Stops watching @path and every directory below it.
+static void remove_subtree(FolderWatcher* self, const gchar* path) {
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, self->directories);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    const gchar* directory = static_cast<const gchar*>(value);
+    if (strcmp(directory, path) == 0 || is_under(directory, path)) {
+      inotify_rm_watch(self->fd, GPOINTER_TO_INT(key));
+      g_hash_table_iter_remove(&iter);
+    }
+  }
+}
+
+// Watches @path and, if @recursive, every directory below it. With @record,
+// everything found below @path is recorded as created; it may have
+// appeared before the watch was in place.
+static gboolean watch_tree(FolderWatcher* self, const gchar* path,
+                           gboolean recursive, gboolean record,
+                           GError** error) {
+  gint wd = inotify_add_watch(self->fd, path, kWatchMask);
+  if (wd < 0) {
+    int saved_errno = errno;
+    g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved_errno),
+                "Cannot watch %s: %s", path, g_strerror(saved_errno));
+    return FALSE;
+  }
+  g_hash_table_insert(self->directories, GINT_TO_POINTER(wd),
+                      g_strdup(path));
+  if (!recursive && !record) {
+    return TRUE;
+  }
+
+  g_autoptr(GDir) dir = g_dir_open(path, 0, nullptr);
+  if (dir == nullptr) {
+    return TRUE;
+  }
+  const gchar* name;
+  while ((name = g_dir_read_name(dir)) != nullptr) {
+    g_autofree gchar* child = g_build_filename(path, name, nullptr);
+    gboolean is_directory = g_file_test(child, G_FILE_TEST_IS_DIR) &&
+                            !g_file_test(child, G_FILE_TEST_IS_SYMLINK);
+    if (record) {
+      record_change(self, child, CHANGE_CREATED, is_directory);
+    }
+    if (is_directory && recursive) {
+      g_autoptr(GError) child_error = nullptr;
+      if (!watch_tree(self, child, TRUE, record, &child_error)) {
+        g_warning("%s", child_error->message);
+      }
+    }
+  }
+  return TRUE;
+}
+
+static void handle_event(FolderWatcher* self,
+                         const struct inotify_event* event) {
+  if ((event->mask & IN_Q_OVERFLOW) != 0) {
+    self->overflowed = TRUE;
+    schedule_flush(self);
+    return;
+  }
+  const gchar* directory = static_cast<const gchar*>(
+      g_hash_table_lookup(self->directories, GINT_TO_POINTER(event->wd)));
+  if (directory == nullptr) {
+    return;
+  }
+  if ((event->mask & IN_IGNORED) != 0) {
+    g_hash_table_remove(self->directories, GINT_TO_POINTER(event->wd));
+    return;
+  }
+  if ((event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) != 0) {
+    // Subdirectories are reported by their parent; only roots report
+    // themselves.
+    if (g_hash_table_contains(self->roots, directory)) {
+      record_change(self, directory, CHANGE_DELETED, TRUE);
+    }
+    if ((event->mask & IN_MOVE_SELF) != 0) {
+      remove_watch(self, event->wd);
+    }
+    return;
+  }
+  if (event->len == 0) {
+    return;
+  }
+
+  g_autofree gchar* path = g_build_filename(directory, event->name, nullptr);
+  gboolean is_directory = (event->mask & IN_ISDIR) != 0;
+  if ((event->mask & (IN_CREATE | IN_MOVED_TO)) != 0) {
+    // Symlinks, hard links, FIFOs and device nodes are never opened for
+    // writing as they are made, so no IN_CLOSE_WRITE would follow.
+    struct stat info;
+    gboolean written = !is_directory && (event->mask & IN_CREATE) != 0 &&
+                       lstat(path, &info) == 0 && S_ISREG(info.st_mode) &&
+                       info.st_nlink == 1;
+    record_change(self, path, written ? CHANGE_OPENED : CHANGE_CREATED,
+                  is_directory);
+    if (is_directory && is_covered_recursively(self, path)) {
+      g_autoptr(GError) error = nullptr;
+      if (!watch_tree(self, path, TRUE, TRUE, &error)) {
+        g_warning("%s", error->message);
+      }
+    }
+  } else if ((event->mask & IN_CLOSE_WRITE) != 0) {
+    record_change(self, path, CHANGE_WRITTEN, FALSE);
+  } else if ((event->mask & (IN_DELETE | IN_MOVED_FROM)) != 0) {
+    record_change(self, path, CHANGE_DELETED, is_directory);
+    // A directory moved away keeps its watches under the old path.
+    if (is_directory && (event->mask & IN_MOVED_FROM) != 0) {
+      remove_subtree(self, path);
+    }
+  }
+}
+
+static gboolean inotify_cb(gint fd, GIOCondition condition,
+                           gpointer user_data) {
+  FolderWatcher* self = static_cast<FolderWatcher*>(user_data);
+  alignas(struct inotify_event) gchar buffer[16 * 1024];
+  while (TRUE) {
+    ssize_t length = read(fd, buffer, sizeof(buffer));
+    if (length < 0 && errno == EINTR) {
+      continue;
+    }
+    if (length < 0 && errno == EAGAIN) {
+      break;
+    }
+    if (length <= 0) {
+      g_warning("Failed to read inotify events: %s", g_strerror(errno));
+      self->fd_source = 0;
+      return G_SOURCE_REMOVE;
+    }
+    for (gchar* next = buffer; next < buffer + length;) {
+      const struct inotify_event* event =
+          reinterpret_cast<const struct inotify_event*>(next);
+      handle_event(self, event);
+      next += sizeof(struct inotify_event) + event->len;
+    }
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+static const gchar* lookup_path(FlValue* args) {
+  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return nullptr;
+  }
+  FlValue* value = fl_value_lookup_string(args, "path");
+  if (value == nullptr || fl_value_get_type(value) != FL_VALUE_TYPE_STRING) {
+    return nullptr;
+  }
+  return fl_value_get_string(value);
+}
+
+static FlMethodResponse* watch(FolderWatcher* self, FlValue* args) {
+  const gchar* path = lookup_path(args);
+  if (path == nullptr) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "bad_arguments", "path is required", nullptr));
+  }
+  FlValue* value = fl_value_lookup_string(args, "recursive");
+  gboolean recursive = value != nullptr &&
+                       fl_value_get_type(value) == FL_VALUE_TYPE_BOOL &&
+                       fl_value_get_bool(value);
+  if (self->fd < 0) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "watch_failed", "inotify is not available", nullptr));
+  }
+
+  g_autofree gchar* root = g_canonicalize_filename(path, nullptr);
+  Root* existing = static_cast<Root*>(g_hash_table_lookup(self->roots, root));
+  if (existing != nullptr && (existing->recursive || !recursive)) {
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  }
+  g_autoptr(GError) error = nullptr;
+  if (!watch_tree(self, root, recursive, FALSE, &error)) {
+    return FL_METHOD_RESPONSE(
+        fl_method_error_response_new("watch_failed", error->message, nullptr));
+  }
+  if (existing != nullptr) {
+    existing->recursive = TRUE;
+  } else {
+    Root* entry = g_new0(Root, 1);
+    entry->recursive = recursive;
+    g_hash_table_insert(self->roots, g_steal_pointer(&root), entry);
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+static FlMethodResponse* unwatch(FolderWatcher* self, FlValue* args) {
+  const gchar* path = lookup_path(args);
+  if (path == nullptr) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "bad_arguments", "path is required", nullptr));
+  }
+  g_autofree gchar* root = g_canonicalize_filename(path, nullptr);
+  gboolean removed = g_hash_table_remove(self->roots, root);
+  if (removed) {
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, self->directories);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+      if (!is_covered(self, static_cast<const gchar*>(value))) {
+        inotify_rm_watch(self->fd, GPOINTER_TO_INT(key));
+        g_hash_table_iter_remove(&iter);
+      }
+    }
+  }
+  g_autoptr(FlValue) result = fl_value_new_bool(removed);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+static FlMethodResponse* set_debounce(FolderWatcher* self, FlValue* args) {
+  FlValue* value = fl_value_get_type(args) == FL_VALUE_TYPE_MAP
+                       ? fl_value_lookup_string(args, "ms")
+                       : nullptr;
+  if (value == nullptr || fl_value_get_type(value) != FL_VALUE_TYPE_INT ||
+      fl_value_get_int(value) < 0 || fl_value_get_int(value) > G_MAXINT) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "bad_arguments", "ms must be a non-negative int", nullptr));
+  }
+  self->debounce_ms = static_cast<gint>(fl_value_get_int(value));
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+static void method_call_cb(FlMethodChannel* channel, FlMethodCall* method_call,
+                           gpointer user_data) {
+  FolderWatcher* self = static_cast<FolderWatcher*>(user_data);
+  const gchar* method = fl_method_call_get_name(method_call);
+  FlValue* args = fl_method_call_get_args(method_call);
+
+  g_autoptr(FlMethodResponse) response = nullptr;
+  if (strcmp(method, "watch") == 0) {
+    response = watch(self, args);
+  } else if (strcmp(method, "unwatch") == 0) {
+    response = unwatch(self, args);
+  } else if (strcmp(method, "setDebounce") == 0) {
+    response = set_debounce(self, args);
+  } else {
+    response = FL_METHOD_RESPONSE(fl_method_not_implemented_response_new());
+  }
+
+  g_autoptr(GError) error = nullptr;
+  if (!fl_method_call_respond(method_call, response, &error)) {
+    g_warning("Failed to send folder watcher response: %s", error->message);
+  }
+}
+
+static FlMethodErrorResponse* listen_cb(FlEventChannel* channel, FlValue* args,
+                                        gpointer user_data) {
+  FolderWatcher* self = static_cast<FolderWatcher*>(user_data);
+  self->listening = TRUE;
+  // Changes kept while nobody listened go out now unless a batch is
+  // already being collected.
+  if (self->flush_source == 0) {
+    deliver(self);
+  }
+  return nullptr;
+}
+
+static FlMethodErrorResponse* cancel_cb(FlEventChannel* channel, FlValue* args,
+                                        gpointer user_data) {
+  FolderWatcher* self = static_cast<FolderWatcher*>(user_data);
+  self->listening = FALSE;
+  return nullptr;
+}
+
+FolderWatcher* folder_watcher_new(FlPluginRegistry* registry) {
+  FolderWatcher* self = g_new0(FolderWatcher, 1);
+  self->directories =
+      g_hash_table_new_full(g_direct_hash, g_direct_equal, nullptr, g_free);
+  self->roots = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  self->changes =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+  g_autoptr(GError) error = nullptr;
+  self->debounce_ms = g_key_file_get_integer(
+      runner_config_get(), "folder-watcher", "debounce-ms", &error);
+  if (error != nullptr || self->debounce_ms < 0) {
+    self->debounce_ms = kDefaultDebounceMs;
+  }
+
+  self->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (self->fd < 0) {
+    g_warning("Folder watching disabled: %s", g_strerror(errno));
+  } else {
+    self->fd_source = g_unix_fd_add(self->fd, G_IO_IN, inotify_cb, self);
+  }
+
+  g_autoptr(FlPluginRegistrar) registrar =
+      fl_plugin_registry_get_registrar_for_plugin(registry, "FolderWatcher");
+  FlBinaryMessenger* messenger = fl_plugin_registrar_get_messenger(registrar);
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  self->channel = fl_method_channel_new(messenger, kChannelName,
+                                        FL_METHOD_CODEC(codec));
+  fl_method_channel_set_method_call_handler(self->channel, method_call_cb,
+                                            self, nullptr);
+  self->events = fl_event_channel_new(messenger, kEventChannelName,
+                                      FL_METHOD_CODEC(codec));
+  fl_event_channel_set_stream_handlers(self->events, listen_cb, cancel_cb,
+                                       self, nullptr);
+  self->batches = packed_channel_new(messenger, kEventChannelName);
+  return self;
+}
+
+void folder_watcher_free(FolderWatcher* self) {
+  if (self->flush_source != 0) {
+    g_source_remove(self->flush_source);
+  }
+  if (self->fd_source != 0) {
+    g_source_remove(self->fd_source);
+  }
+  if (self->fd >= 0) {
+    close(self->fd);
+  }
+  g_clear_object(&self->channel);
+  g_clear_object(&self->events);
+  g_clear_pointer(&self->batches, packed_channel_free);
+  g_clear_pointer(&self->directories, g_hash_table_unref);
+  g_clear_pointer(&self->roots, g_hash_table_unref);
+  g_clear_pointer(&self->changes, g_hash_table_unref);
+  g_free(self);
+}
@@ -0,0 +1,57 @@
+#ifndef FLUTTER_FOLDER_WATCHER_H_
+#define FLUTTER_FOLDER_WATCHER_H_
+
+#include <flutter_linux/flutter_linux.h>
+
+// Watches import and backup folders with inotify on the GLib main loop.
+// This replaces the Dart watcher package, which falls back to polling. The
+// main loop only wakes when the kernel reports a change. Changes are
+// coalesced by path and delivered once the folder has been quiet for the
+// debounce window, or after four windows during a constant stream of
+// changes.
+//
+// A path's events within one batch collapse into one change, by comparing
+// the start of the batch with its end. A file created and removed again is
+// dropped, and one deleted and recreated is "modified". Files are reported
+// when they are closed after writing or moved in. Files still open for
+// writing are held back to a later batch, so Dart never imports half a
+// copy. A new file that is never closed after writing, such as one created
+// read-only or with mknod, is reported once its size and modification time
+// have stood still for four windows. Symlinks, hard links, FIFOs and other
+// special files are complete as soon as they appear. Moves are reported as
+// deleted plus created.
+//
+// Methods on "bizsync/folder_watcher":
+//   watch({path: String, recursive: bool?}) -> null; recursive watches
+//     also follow subdirectories created later. Fails with "watch_failed".
+//   unwatch({path: String}) -> bool, whether @path was watched.
+//   setDebounce({ms: int}) -> null; 500 ms unless [folder-watcher]
+//     debounce-ms is set in bizsync.conf.
+// Events on the "bizsync/folder_watcher/events" event channel are Uint8List
+// packed row buffers (see native/packed_rows.h, sent by packed_channel.h)
+// with one row per change:
+//   path TEXT, type TEXT, directory INT64 (0 or 1)
+// where type is "created", "modified", "deleted", or "overflow" when the
+// kernel dropped events and the watched folder at path should be rescanned.
+// Changes are kept while no listener is attached.
+typedef struct _FolderWatcher FolderWatcher;
+
+/**
+ * folder_watcher_new:
+ * @registry: the registry of the Flutter view.
+ *
+ * Returns: a new #FolderWatcher, free with folder_watcher_free().
+ */
+FolderWatcher* folder_watcher_new(FlPluginRegistry* registry);
+
+/**
+ * folder_watcher_free:
+ * @watcher: a #FolderWatcher.
+ *
+ * Removes every watch and drops undelivered changes.
+ */
+void folder_watcher_free(FolderWatcher* watcher);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(FolderWatcher, folder_watcher_free)
+
+#endif  // FLUTTER_FOLDER_WATCHER_H_
@@ -0,0 +1,284 @@
+#include "frame_pacer.h"
+
+#include <string.h>
+
+#include "runner_config.h"
+
+static const gchar* kChannelName = "bizsync/frame_pacing";
+
+static const gint kDefaultIdleAfterMs = 10000;
+static const gint kDefaultIdleFps = 10;
+static const gint kDefaultUnfocusedFps = 15;
+
+typedef enum {
+  FRAME_PACING_ACTIVE,
+  FRAME_PACING_IDLE,
+  FRAME_PACING_UNFOCUSED,
+  FRAME_PACING_HIDDEN,
+} FramePacingState;
+
+struct _FramePacer {
+  // Cleared when the window is destroyed.
+  GtkWindow* window;
+  FlMethodChannel* channel;
+  // GtkWidget::event emission hook counting the window's input.
+  guint event_signal;
+  gulong event_hook;
+
+  gint64 idle_after_us;
+  gint idle_fps;
+  gint unfocused_fps;
+
+  gboolean focused;
+  gboolean mapped;
+  gboolean iconified;
+  gboolean obscured;
+  // Monotonic time of the last input event.
+  gint64 last_input;
+  // Fires when an active window goes idle.
+  guint idle_source;
+
+  FramePacingState state;
+};
+
+static const gchar* state_to_string(FramePacingState state) {
+  switch (state) {
+    case FRAME_PACING_ACTIVE:
+      return "active";
+    case FRAME_PACING_IDLE:
+      return "idle";
+    case FRAME_PACING_UNFOCUSED:
+      return "unfocused";
+    case FRAME_PACING_HIDDEN:
+      return "hidden";
+  }
+  return "active";
+}
+
+// Returns {state, maxFps} for the current state.
+static FlValue* state_to_value(FramePacer* self) {
+  FlValue* max_fps = nullptr;
+  switch (self->state) {
+    case FRAME_PACING_ACTIVE:
+      max_fps = fl_value_new_null();
+      break;
+    case FRAME_PACING_IDLE:
+      max_fps = fl_value_new_int(self->idle_fps);
+      break;
+    case FRAME_PACING_UNFOCUSED:
+      max_fps = fl_value_new_int(self->unfocused_fps);
+      break;
+    case FRAME_PACING_HIDDEN:
+      max_fps = fl_value_new_int(0);
+      break;
+  }
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "state",
+                           fl_value_new_string(state_to_string(self->state)));
+  fl_value_set_string_take(value, "maxFps", max_fps);
+  return value;
+}
+
+static gboolean idle_timeout_cb(gpointer user_data);
+
+// Works out the pacing state from the window and the last input, and tells
+// Dart when it changes.
+static void update_state(FramePacer* self) {
+  gint64 now = g_get_monotonic_time();
+  gint64 idle_in = self->last_input + self->idle_after_us - now;
+
+  FramePacingState state;
+  if (!self->mapped || self->iconified || self->obscured) {
+    state = FRAME_PACING_HIDDEN;
+  } else if (idle_in > 0) {
+    state = FRAME_PACING_ACTIVE;
+  } else if (!self->focused) {
+    state = FRAME_PACING_UNFOCUSED;
+  } else {
+    state = FRAME_PACING_IDLE;
+  }
+
+  // Input while active only moves last_input; the timeout checks again when
+  // it fires rather than being rearmed on every event.
+  if (state == FRAME_PACING_ACTIVE && self->idle_source == 0) {
+    self->idle_source =
+        g_timeout_add(static_cast<guint>(idle_in / 1000) + 1, idle_timeout_cb,
+                      self);
+  }
+
+  if (state == self->state) {
+    return;
+  }
+  self->state = state;
+  g_autoptr(FlValue) value = state_to_value(self);
+  fl_method_channel_invoke_method(self->channel, "stateChanged", value,
+                                  nullptr, nullptr, nullptr);
+}
+
+static gboolean idle_timeout_cb(gpointer user_data) {
+  FramePacer* self = static_cast<FramePacer*>(user_data);
+  self->idle_source = 0;
+  update_state(self);
+  return G_SOURCE_REMOVE;
+}
+
+static void note_input(FramePacer* self) {
+  self->last_input = g_get_monotonic_time();
+  if (self->state != FRAME_PACING_ACTIVE) {
+    update_state(self);
+  }
+}
+
+// Runs as GtkWidget::event is emitted on any widget, before the widget
+// handles the event, so input the view consumes still counts. A hook only
+// observes: GTK's own event handling is untouched, and a capture-phase
+// GtkEventControllerScroll would swallow the scrolling it reports.
+static gboolean event_hook_cb(GSignalInvocationHint* hint, guint n_params,
+                              const GValue* params, gpointer user_data) {
+  FramePacer* self = static_cast<FramePacer*>(user_data);
+  GdkEvent* event = static_cast<GdkEvent*>(g_value_get_boxed(&params[1]));
+  if (self->window == nullptr || event == nullptr) {
+    return TRUE;
+  }
+  switch (event->type) {
+    case GDK_KEY_PRESS:
+    case GDK_BUTTON_PRESS:
+    case GDK_MOTION_NOTIFY:
+    case GDK_SCROLL:
+    case GDK_TOUCH_BEGIN:
+    case GDK_TOUCH_UPDATE:
+      if (gtk_widget_get_toplevel(GTK_WIDGET(g_value_get_object(
+              &params[0]))) == GTK_WIDGET(self->window)) {
+        note_input(self);
+      }
+      break;
+    default:
+      break;
+  }
+  return TRUE;
+}
+
+static void is_active_cb(GObject* object, GParamSpec* pspec,
+                         gpointer user_data) {
+  FramePacer* self = static_cast<FramePacer*>(user_data);
+  self->focused = gtk_window_is_active(GTK_WINDOW(object));
+  // Focusing the window is input; losing focus leaves the idle timer as is.
+  if (self->focused) {
+    self->last_input = g_get_monotonic_time();
+  }
+  update_state(self);
+}
+
+static void map_cb(GtkWidget* widget, gpointer user_data) {
+  FramePacer* self = static_cast<FramePacer*>(user_data);
+  self->mapped = TRUE;
+  self->last_input = g_get_monotonic_time();
+  update_state(self);
+}
+
+static void unmap_cb(GtkWidget* widget, gpointer user_data) {
+  FramePacer* self = static_cast<FramePacer*>(user_data);
+  self->mapped = FALSE;
+  update_state(self);
+}
+
+static gboolean window_state_cb(GtkWidget* widget, GdkEventWindowState* event,
+                                gpointer user_data) {
+  FramePacer* self = static_cast<FramePacer*>(user_data);
+  self->iconified = (event->new_window_state &
+                     (GDK_WINDOW_STATE_ICONIFIED |
+                      GDK_WINDOW_STATE_WITHDRAWN)) != 0;
+  update_state(self);
+  return FALSE;
+}
+
+// Only X11 reports this; Wayland compositors stop sending frame callbacks
+// to covered windows instead.
+static gboolean visibility_cb(GtkWidget* widget, GdkEventVisibility* event,
+                              gpointer user_data) {
+  FramePacer* self = static_cast<FramePacer*>(user_data);
+  self->obscured = event->state == GDK_VISIBILITY_FULLY_OBSCURED;
+  update_state(self);
+  return FALSE;
+}
+
+static void method_call_cb(FlMethodChannel* channel, FlMethodCall* method_call,
+                           gpointer user_data) {
+  FramePacer* self = static_cast<FramePacer*>(user_data);
+  const gchar* method = fl_method_call_get_name(method_call);
+
+  g_autoptr(FlMethodResponse) response = nullptr;
+  if (strcmp(method, "getState") == 0) {
+    g_autoptr(FlValue) result = state_to_value(self);
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else {
+    response = FL_METHOD_RESPONSE(fl_method_not_implemented_response_new());
+  }
+
+  g_autoptr(GError) error = nullptr;
+  if (!fl_method_call_respond(method_call, response, &error)) {
+    g_warning("Failed to send frame pacing response: %s", error->message);
+  }
+}
+
+// Reads a non-negative integer from the [frame-pacing] group.
+static gint config_int(const gchar* key, gint default_value) {
+  g_autoptr(GError) error = nullptr;
+  gint value =
+      g_key_file_get_integer(runner_config_get(), "frame-pacing", key, &error);
+  return error == nullptr && value >= 0 ? value : default_value;
+}
+
+FramePacer* frame_pacer_new(GtkWindow* window, FlPluginRegistry* registry) {
+  FramePacer* self = g_new0(FramePacer, 1);
+  self->idle_after_us =
+      static_cast<gint64>(config_int("idle-after-ms", kDefaultIdleAfterMs)) *
+      1000;
+  self->idle_fps = config_int("idle-fps", kDefaultIdleFps);
+  self->unfocused_fps = config_int("unfocused-fps", kDefaultUnfocusedFps);
+
+  g_autoptr(FlPluginRegistrar) registrar =
+      fl_plugin_registry_get_registrar_for_plugin(registry, "FramePacer");
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  self->channel = fl_method_channel_new(
+      fl_plugin_registrar_get_messenger(registrar), kChannelName,
+      FL_METHOD_CODEC(codec));
+  fl_method_channel_set_method_call_handler(self->channel, method_call_cb,
+                                            self, nullptr);
+
+  self->window = window;
+  g_object_add_weak_pointer(G_OBJECT(window),
+                            reinterpret_cast<gpointer*>(&self->window));
+  gtk_widget_add_events(GTK_WIDGET(window), GDK_VISIBILITY_NOTIFY_MASK);
+  g_signal_connect(window, "notify::is-active", G_CALLBACK(is_active_cb),
+                   self);
+  g_signal_connect(window, "map", G_CALLBACK(map_cb), self);
+  g_signal_connect(window, "unmap", G_CALLBACK(unmap_cb), self);
+  g_signal_connect(window, "window-state-event", G_CALLBACK(window_state_cb),
+                   self);
+  g_signal_connect(window, "visibility-notify-event",
+                   G_CALLBACK(visibility_cb), self);
+  self->event_signal = g_signal_lookup("event", GTK_TYPE_WIDGET);
+  self->event_hook = g_signal_add_emission_hook(self->event_signal, 0,
+                                                event_hook_cb, self, nullptr);
+
+  self->focused = gtk_window_is_active(window);
+  self->mapped = gtk_widget_get_mapped(GTK_WIDGET(window));
+  self->last_input = g_get_monotonic_time();
+  update_state(self);
+  return self;
+}
+
+void frame_pacer_free(FramePacer* self) {
+  g_signal_remove_emission_hook(self->event_signal, self->event_hook);
+  if (self->window != nullptr) {
+    g_signal_handlers_disconnect_by_data(self->window, self);
+    g_object_remove_weak_pointer(G_OBJECT(self->window),
+                                 reinterpret_cast<gpointer*>(&self->window));
+  }
+  if (self->idle_source != 0) {
+    g_source_remove(self->idle_source);
+  }
+  g_clear_object(&self->channel);
+  g_free(self);
+}
@@ -0,0 +1,54 @@
+#ifndef FLUTTER_FRAME_PACER_H_
+#define FLUTTER_FRAME_PACER_H_
+
+#include <flutter_linux/flutter_linux.h>
+#include <gtk/gtk.h>
+
+// Follows what the user can see of the window and how recently they
+// touched it, so an untouched dashboard stops waking the CPU and GPU.
+// There are four pacing states:
+//   active     input within the last idle-after-ms; full refresh rate.
+//   idle       focused but untouched since then; idle-fps at most.
+//   unfocused  untouched while another window has focus; unfocused-fps at
+//              most.
+//   hidden     minimized, hidden to the tray, or fully covered (X11 only);
+//              no frames at all.
+// Any key, pointer, touch or scroll input makes the window active again.
+// Nothing polls: one timeout per idle-after-ms runs while the window is
+// active.
+//
+// The state follows the window's map, window-state-event and
+// visibility-notify-event signals, and input is counted as it reaches the
+// window's widgets. The embedder reports the Flutter lifecycle itself. It
+// ticks animations from the engine's vsync timer rather than the window's
+// frame clock, so Dart applies the frame rate caps and stops scheduling
+// frames while the window is hidden.
+//
+// Methods on "bizsync/frame_pacing":
+//   getState -> {state: String, maxFps: int?}
+// Runner to Dart:
+//   stateChanged({state: String, maxFps: int?}); maxFps is null for the
+//   display's rate and 0 while hidden.
+//
+// The limits come from the [frame-pacing] group of bizsync.conf:
+// idle-after-ms (10000), idle-fps (10) and unfocused-fps (15).
+typedef struct _FramePacer FramePacer;
+
+/**
+ * frame_pacer_new:
+ * @window: the application window.
+ * @registry: the registry of the Flutter view.
+ *
+ * Returns: a new #FramePacer, free with frame_pacer_free().
+ */
+FramePacer* frame_pacer_new(GtkWindow* window, FlPluginRegistry* registry);
+
+/**
+ * frame_pacer_free:
+ * @pacer: a #FramePacer.
+ */
+void frame_pacer_free(FramePacer* pacer);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(FramePacer, frame_pacer_free)
+
+#endif  // FLUTTER_FRAME_PACER_H_
@@ -0,0 +1,346 @@
+#include "frame_stats.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+static const gchar* kChannelName = "bizsync/frame_stats";
+
+// Ring capacity, a power of two so indices wrap with a mask. At 60 Hz this
+// holds a little over a minute of frames.
+static constexpr guint64 kRingCapacity = 4096;
+
+// GDK keeps timings for the last 16 frames only, so frames still waiting for
+// their presentation time after this many newer frames are published without
+// one.
+static constexpr gint64 kMaxPendingFrames = 12;
+
+static const gchar* kFieldNames[kFrameStatsFieldCount] = {
+    "frame_counter", "frame_time",    "frame_interval",
+    "layout",        "paint",         "present_latency",
+};
+
+struct FrameSample {
+  gint64 values[kFrameStatsFieldCount];
+};
+
+struct MetricSummary {
+  gsize count;
+  gint64 p50;
+  gint64 p90;
+  gint64 p99;
+  gint64 max;
+};
+
+struct _FrameStats {
+  GdkFrameClock* clock;
+  gchar* backend;
+  gchar* renderer;
+  FlMethodChannel* channel;
+
+  // Main-thread timestamps of the frame being painted.
+  gint64 before_paint_time;
+  gint64 layout_end_time;
+  gint64 last_frame_time;
+
+  // Painted frames still waiting for the compositor's presentation time.
+  std::vector<FrameSample> pending;
+
+  // Single-producer ring. |head| counts every sample ever published; the
+  // writer fills a slot before releasing the new head, and readers discard
+  // slots the writer may have lapped while they were copying.
+  FrameSample ring[kRingCapacity];
+  std::atomic<guint64> head;
+  // Samples below this index were dropped by reset.
+  std::atomic<guint64> tail;
+};
+
+static void publish(FrameStats* self, const FrameSample& sample) {
+  guint64 index = self->head.load(std::memory_order_relaxed);
+  self->ring[index & (kRingCapacity - 1)] = sample;
+  self->head.store(index + 1, std::memory_order_release);
+}
+
+// Copies the buffered samples with a frame counter above |since|.
+static std::vector<FrameSample> snapshot(FrameStats* self, gint64 since) {
+  guint64 head = self->head.load(std::memory_order_acquire);
+  guint64 first = std::max(self->tail.load(std::memory_order_acquire),
+                           head > kRingCapacity ? head - kRingCapacity : 0);
+
+  std::vector<FrameSample> samples;
+  samples.reserve(head - first);
+  for (guint64 i = first; i < head; i++) {
+    samples.push_back(self->ring[i & (kRingCapacity - 1)]);
+  }
+
+  // Drop anything overwritten while copying.
+  guint64 end = self->head.load(std::memory_order_acquire);
+  if (end > kRingCapacity && end - kRingCapacity > first) {
+    gsize lapped = std::min<gsize>(end - kRingCapacity - first, samples.size());
+    samples.erase(samples.begin(), samples.begin() + lapped);
+  }
+
+  samples.erase(std::remove_if(samples.begin(), samples.end(),
+                               [since](const FrameSample& sample) {
+                                 return sample.values[kFrameStatsFrameCounter] <=
+                                        since;
+                               }),
+                samples.end());
+  return samples;
+}
+
+// Publishes pending frames, in order, once GDK has their presentation time
+// or they are about to fall out of the frame clock history. With |force| set
+// everything is published.
+static void flush_pending(FrameStats* self, gint64 current_counter,
+                          gboolean force) {
+  gsize published = 0;
+  for (FrameSample& sample : self->pending) {
+    gint64 counter = sample.values[kFrameStatsFrameCounter];
+    GdkFrameTimings* timings = gdk_frame_clock_get_timings(self->clock, counter);
+    gboolean complete =
+        timings != nullptr && gdk_frame_timings_get_complete(timings);
+    if (!complete && !force && current_counter - counter < kMaxPendingFrames) {
+      break;
+    }
+
+    if (complete) {
+      gint64 presentation_time =
+          gdk_frame_timings_get_presentation_time(timings);
+      if (presentation_time != 0) {
+        sample.values[kFrameStatsPresentLatency] =
+            presentation_time - sample.values[kFrameStatsFrameTime];
+      }
+    }
+    publish(self, sample);
+    published++;
+  }
+  self->pending.erase(self->pending.begin(),
+                      self->pending.begin() + published);
+}
+
+static void before_paint_cb(GdkFrameClock* clock, gpointer user_data) {
+  FrameStats* self = static_cast<FrameStats*>(user_data);
+  self->before_paint_time = g_get_monotonic_time();
+}
+
+static void layout_cb(GdkFrameClock* clock, gpointer user_data) {
+  FrameStats* self = static_cast<FrameStats*>(user_data);
+  self->layout_end_time = g_get_monotonic_time();
+}
+
+static void after_paint_cb(GdkFrameClock* clock, gpointer user_data) {
+  FrameStats* self = static_cast<FrameStats*>(user_data);
+  gint64 now = g_get_monotonic_time();
+  gint64 frame_time = gdk_frame_clock_get_frame_time(clock);
+  gint64 counter = gdk_frame_clock_get_frame_counter(clock);
+
+  // The layout phase only runs when something queued a resize, in which case
+  // layout_end_time is left over from an earlier frame.
+  gboolean had_layout = self->layout_end_time >= self->before_paint_time;
+  gint64 paint_start = had_layout ? self->layout_end_time : self->before_paint_time;
+
+  FrameSample sample = {};
+  sample.values[kFrameStatsFrameCounter] = counter;
+  sample.values[kFrameStatsFrameTime] = frame_time;
+  sample.values[kFrameStatsFrameInterval] =
+      self->last_frame_time != 0 ? frame_time - self->last_frame_time : 0;
+  sample.values[kFrameStatsLayout] =
+      had_layout ? self->layout_end_time - self->before_paint_time : 0;
+  sample.values[kFrameStatsPaint] = now - paint_start;
+  sample.values[kFrameStatsPresentLatency] = -1;
+  self->last_frame_time = frame_time;
+
+  self->pending.push_back(sample);
+  flush_pending(self, counter, FALSE);
+}
+
+// Summarizes one field, skipping values that mean "not measured".
+static MetricSummary summarize(const std::vector<FrameSample>& samples,
+                               int field) {
+  std::vector<gint64> values;
+  values.reserve(samples.size());
+  for (const FrameSample& sample : samples) {
+    gint64 value = sample.values[field];
+    if (value < 0 || (field == kFrameStatsFrameInterval && value == 0)) {
+      continue;
+    }
+    values.push_back(value);
+  }
+
+  MetricSummary summary = {};
+  summary.count = values.size();
+  if (values.empty()) {
+    return summary;
+  }
+
+  auto percentile = [&values](double p) {
+    gsize rank = static_cast<gsize>(p * (values.size() - 1) + 0.5);
+    std::nth_element(values.begin(), values.begin() + rank, values.end());
+    return values[rank];
+  };
+  summary.p50 = percentile(0.50);
+  summary.p90 = percentile(0.90);
+  summary.p99 = percentile(0.99);
+  summary.max = *std::max_element(values.begin(), values.end());
+  return summary;
+}
+
+static FlValue* summary_to_value(FrameStats* self) {
+  std::vector<FrameSample> samples = snapshot(self, -1);
+
+  FlValue* result = fl_value_new_map();
+  fl_value_set_string_take(result, "backend",
+                           fl_value_new_string(self->backend));
+  fl_value_set_string_take(result, "renderer",
+                           fl_value_new_string(self->renderer));
+  fl_value_set_string_take(result, "frames", fl_value_new_int(samples.size()));
+  for (int field = kFrameStatsFrameInterval; field < kFrameStatsFieldCount;
+       field++) {
+    MetricSummary summary = summarize(samples, field);
+    FlValue* metric = fl_value_new_map();
+    fl_value_set_string_take(metric, "count", fl_value_new_int(summary.count));
+    fl_value_set_string_take(metric, "p50", fl_value_new_int(summary.p50));
+    fl_value_set_string_take(metric, "p90", fl_value_new_int(summary.p90));
+    fl_value_set_string_take(metric, "p99", fl_value_new_int(summary.p99));
+    fl_value_set_string_take(metric, "max", fl_value_new_int(summary.max));
+    fl_value_set_string_take(result, kFieldNames[field], metric);
+  }
+  return result;
+}
+
+static FlValue* samples_to_value(FrameStats* self, FlValue* args) {
+  gint64 since = -1;
+  if (args != nullptr && fl_value_get_type(args) == FL_VALUE_TYPE_MAP) {
+    FlValue* value = fl_value_lookup_string(args, "since");
+    if (value != nullptr && fl_value_get_type(value) == FL_VALUE_TYPE_INT) {
+      since = fl_value_get_int(value);
+    }
+  }
+
+  std::vector<FrameSample> samples = snapshot(self, since);
+  return fl_value_new_int64_list(
+      reinterpret_cast<const int64_t*>(samples.data()),
+      samples.size() * kFrameStatsFieldCount);
+}
+
+static void method_call_cb(FlMethodChannel* channel, FlMethodCall* method_call,
+                           gpointer user_data) {
+  FrameStats* self = static_cast<FrameStats*>(user_data);
+  const gchar* method = fl_method_call_get_name(method_call);
+
+  g_autoptr(FlMethodResponse) response = nullptr;
+  if (strcmp(method, "getSummary") == 0) {
+    g_autoptr(FlValue) result = summary_to_value(self);
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else if (strcmp(method, "getSamples") == 0) {
+    g_autoptr(FlValue) result =
+        samples_to_value(self, fl_method_call_get_args(method_call));
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else if (strcmp(method, "reset") == 0) {
+    self->tail.store(self->head.load(std::memory_order_acquire),
+                     std::memory_order_release);
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  } else {
+    response = FL_METHOD_RESPONSE(fl_method_not_implemented_response_new());
+  }
+
+  g_autoptr(GError) error = nullptr;
+  if (!fl_method_call_respond(method_call, response, &error)) {
+    g_warning("Failed to send frame stats response: %s", error->message);
+  }
+}
+
+static void append_json_string(GString* json, const gchar* value) {
+  g_string_append_c(json, '"');
+  for (const gchar* c = value; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      g_string_append_printf(json, "\\%c", *c);
+    } else if (static_cast<guchar>(*c) < 0x20) {
+      g_string_append_printf(json, "\\u%04x", *c);
+    } else {
+      g_string_append_c(json, *c);
+    }
+  }
+  g_string_append_c(json, '"');
+}
+
+FrameStats* frame_stats_new(GdkFrameClock* clock, const gchar* backend,
+                            const gchar* renderer) {
+  FrameStats* self = new FrameStats();
+  self->clock = GDK_FRAME_CLOCK(g_object_ref(clock));
+  self->backend = g_strdup(backend);
+  self->renderer = g_strdup(renderer);
+
+  g_signal_connect(clock, "before-paint", G_CALLBACK(before_paint_cb), self);
+  g_signal_connect(clock, "layout", G_CALLBACK(layout_cb), self);
+  g_signal_connect(clock, "after-paint", G_CALLBACK(after_paint_cb), self);
+  return self;
+}
+
+void frame_stats_register_channel(FrameStats* self,
+                                  FlPluginRegistry* registry) {
+  g_autoptr(FlPluginRegistrar) registrar =
+      fl_plugin_registry_get_registrar_for_plugin(registry, "FrameStats");
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  g_clear_object(&self->channel);
+  self->channel = fl_method_channel_new(
+      fl_plugin_registrar_get_messenger(registrar), kChannelName,
+      FL_METHOD_CODEC(codec));
+  fl_method_channel_set_method_call_handler(self->channel, method_call_cb,
+                                            self, nullptr);
+}
+
+gboolean frame_stats_write_json(FrameStats* self, const gchar* path,
+                                GError** error) {
+  flush_pending(self, gdk_frame_clock_get_frame_counter(self->clock), TRUE);
+  std::vector<FrameSample> samples = snapshot(self, -1);
+
+  g_autoptr(GString) json = g_string_new("{\n  \"backend\": ");
+  append_json_string(json, self->backend);
+  g_string_append(json, ",\n  \"renderer\": ");
+  append_json_string(json, self->renderer);
+  g_string_append_printf(json, ",\n  \"frames\": %zu,\n  \"summary\": {",
+                         samples.size());
+  for (int field = kFrameStatsFrameInterval; field < kFrameStatsFieldCount;
+       field++) {
+    MetricSummary summary = summarize(samples, field);
+    g_string_append_printf(
+        json,
+        "%s\n    \"%s\": {\"count\": %zu, \"p50\": %" G_GINT64_FORMAT
+        ", \"p90\": %" G_GINT64_FORMAT ", \"p99\": %" G_GINT64_FORMAT
+        ", \"max\": %" G_GINT64_FORMAT "}",
+        field == kFrameStatsFrameInterval ? "" : ",", kFieldNames[field],
+        summary.count, summary.p50, summary.p90, summary.p99, summary.max);
+  }
+
+  g_string_append(json, "\n  },\n  \"fields\": [");
+  for (int field = 0; field < kFrameStatsFieldCount; field++) {
+    g_string_append_printf(json, "%s\"%s\"", field == 0 ? "" : ", ",
+                           kFieldNames[field]);
+  }
+
+  g_string_append(json, "],\n  \"samples\": [");
+  for (gsize i = 0; i < samples.size(); i++) {
+    g_string_append(json, i == 0 ? "\n    [" : ",\n    [");
+    for (int field = 0; field < kFrameStatsFieldCount; field++) {
+      g_string_append_printf(json, "%s%" G_GINT64_FORMAT, field == 0 ? "" : ", ",
+                             samples[i].values[field]);
+    }
+    g_string_append_c(json, ']');
+  }
+  g_string_append(json, "\n  ]\n}\n");
+
+  return g_file_set_contents(path, json->str, json->len, error);
+}
+
+void frame_stats_free(FrameStats* self) {
+  g_signal_handlers_disconnect_by_data(self->clock, self);
+  g_object_unref(self->clock);
+  g_clear_object(&self->channel);
+  g_free(self->backend);
+  g_free(self->renderer);
+  delete self;
+}
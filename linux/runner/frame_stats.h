@@ -0,0 +1,77 @@
+#ifndef FLUTTER_FRAME_STATS_H_
+#define FLUTTER_FRAME_STATS_H_
+
+#include <flutter_linux/flutter_linux.h>
+#include <gtk/gtk.h>
+
+// Records per-frame timings from a GdkFrameClock into a fixed-size lock-free
+// ring. Samples are published from the GTK main thread and may be read from
+// any thread.
+//
+// Exposed to Dart on the "bizsync/frame_stats" method channel:
+//   getSummary -> map of frame count and p50/p90/p99 per timing, in µs.
+//   getSamples(since: int?) -> Int64List of samples newer than frame counter
+//     |since|, kFrameStatsFieldCount values per sample (see below).
+//   reset -> clears the ring.
+typedef struct _FrameStats FrameStats;
+
+// Layout of one sample in getSamples and the JSON dump. Durations are µs;
+// a present latency of -1 means the compositor reported no presentation time.
+enum {
+  kFrameStatsFrameCounter,
+  kFrameStatsFrameTime,
+  kFrameStatsFrameInterval,
+  kFrameStatsLayout,
+  kFrameStatsPaint,
+  kFrameStatsPresentLatency,
+  kFrameStatsFieldCount,
+};
+
+/**
+ * frame_stats_new:
+ * @clock: the frame clock of the application window.
+ * @backend: display backend label, e.g. "wayland" or "x11".
+ * @renderer: GL renderer string reported by the renderer probe.
+ *
+ * Starts recording frames from @clock.
+ *
+ * Returns: a new #FrameStats, free with frame_stats_free().
+ */
+FrameStats* frame_stats_new(GdkFrameClock* clock, const gchar* backend,
+                            const gchar* renderer);
+
+/**
+ * frame_stats_register_channel:
+ * @stats: a #FrameStats.
+ * @registry: the registry of the Flutter view.
+ *
+ * Serves @stats on the "bizsync/frame_stats" method channel.
+ */
+void frame_stats_register_channel(FrameStats* stats,
+                                  FlPluginRegistry* registry);
+
+/**
+ * frame_stats_write_json:
+ * @stats: a #FrameStats.
+ * @path: destination file.
+ * @error: (allow-none): #GError location to store the error occurring, or
+ * %NULL to ignore.
+ *
+ * Writes the summary and every buffered sample to @path as JSON.
+ *
+ * Returns: %TRUE on success.
+ */
+gboolean frame_stats_write_json(FrameStats* stats, const gchar* path,
+                                GError** error);
+
+/**
+ * frame_stats_free:
+ * @stats: a #FrameStats.
+ *
+ * Stops recording and releases @stats.
+ */
+void frame_stats_free(FrameStats* stats);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(FrameStats, frame_stats_free)
+
+#endif  // FLUTTER_FRAME_STATS_H_
@@ -0,0 +1,320 @@
+#include "gl_renderer_probe.h"
+
+#ifdef HARDWARE_ACCELERATION_ENABLED
+#include <epoxy/egl.h>
+#include <epoxy/gl.h>
+#endif
+#include <dlfcn.h>
+#include <link.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const gchar* kCacheGroup = "renderer";
+
+// Seconds the probe child may spend in the driver before it is killed.
+static const guint kProbeTimeoutSeconds = 5;
+
+// Environment variables that change which driver Mesa or glvnd loads, so a
+// change to any of them must invalidate the cached result.
+static const char* kDriverEnvironment[] = {
+    "LIBGL_ALWAYS_SOFTWARE",
+    "GALLIUM_DRIVER",
+    "MESA_LOADER_DRIVER_OVERRIDE",
+    "DRI_PRIME",
+    "__EGL_VENDOR_LIBRARY_FILENAMES",
+    "__GLX_VENDOR_LIBRARY_NAME",
+    "DISPLAY",
+    "WAYLAND_DISPLAY",
+    nullptr,
+};
+
+// Userspace driver libraries whose file identity tracks the driver version.
+static const char* kDriverLibraries[] = {
+    "libEGL_mesa.so.0",
+    nullptr,
+};
+
+// Appends the path, size and mtime of a shared library to |key|. Package
+// upgrades replace the file, so this changes whenever the driver does.
+static void append_library_identity(GString* key, const char* library) {
+  void* handle = dlopen(library, RTLD_LAZY | RTLD_LOCAL);
+  if (handle == nullptr) {
+    return;
+  }
+
+  struct link_map* map = nullptr;
+  struct stat st;
+  if (dlinfo(handle, RTLD_DI_LINKMAP, &map) == 0 && map != nullptr &&
+      stat(map->l_name, &st) == 0) {
+    g_string_append_printf(key, "%s:%lld:%lld;", map->l_name,
+                           static_cast<long long>(st.st_size),
+                           static_cast<long long>(st.st_mtime));
+  }
+  dlclose(handle);
+}
+
+// Builds a digest identifying the installed GL driver stack without creating
+// a GL context.
+static gchar* compute_driver_key() {
+  g_autoptr(GString) key = g_string_new(nullptr);
+
+  struct utsname uts;
+  if (uname(&uts) == 0) {
+    g_string_append_printf(key, "kernel=%s;", uts.release);
+  }
+
+  // Kernel DRM drivers behind each render node.
+  g_autoptr(GDir) drm = g_dir_open("/sys/class/drm", 0, nullptr);
+  if (drm != nullptr) {
+    const gchar* name;
+    while ((name = g_dir_read_name(drm)) != nullptr) {
+      if (!g_str_has_prefix(name, "renderD")) {
+        continue;
+      }
+      g_autofree gchar* link =
+          g_strdup_printf("/sys/class/drm/%s/device/driver", name);
+      g_autofree gchar* target = g_file_read_link(link, nullptr);
+      if (target != nullptr) {
+        g_autofree gchar* driver = g_path_get_basename(target);
+        g_string_append_printf(key, "%s=%s;", name, driver);
+      }
+    }
+  }
+
+  // The proprietary NVIDIA userspace always matches its kernel module.
+  g_autofree gchar* nvidia = nullptr;
+  if (g_file_get_contents("/proc/driver/nvidia/version", &nvidia, nullptr,
+                          nullptr)) {
+    g_string_append(key, nvidia);
+  }
+
+  for (const char** library = kDriverLibraries; *library != nullptr;
+       library++) {
+    append_library_identity(key, *library);
+  }
+
+  for (const char** name = kDriverEnvironment; *name != nullptr; name++) {
+    const char* value = getenv(*name);
+    g_string_append_printf(key, "%s=%s;", *name, value != nullptr ? value : "");
+  }
+
+  return g_compute_checksum_for_string(G_CHECKSUM_SHA256, key->str, key->len);
+}
+
+static gboolean is_software_renderer(const gchar* renderer) {
+  g_autofree gchar* lower = g_ascii_strdown(renderer, -1);
+  return strstr(lower, "llvmpipe") != nullptr ||
+         strstr(lower, "softpipe") != nullptr ||
+         strstr(lower, "swrast") != nullptr ||
+         strstr(lower, "software rasterizer") != nullptr ||
+         strstr(lower, "swiftshader") != nullptr;
+}
+
+// Fills |info| from a key file written by the probe child. Returns FALSE,
+// leaving |info| untouched, if the file has no renderer.
+static gboolean load_info(GKeyFile* file, GlRendererInfo* info) {
+  gchar* renderer = g_key_file_get_string(file, kCacheGroup, "renderer", nullptr);
+  if (renderer == nullptr) {
+    return FALSE;
+  }
+
+  info->renderer = renderer;
+  info->vendor = g_key_file_get_string(file, kCacheGroup, "vendor", nullptr);
+  info->version = g_key_file_get_string(file, kCacheGroup, "version", nullptr);
+  info->is_software = is_software_renderer(renderer);
+  return TRUE;
+}
+
+// Re-executes the runner as the probe child and parses its report.
+static GKeyFile* run_probe_child() {
+  g_autofree gchar* executable = g_file_read_link("/proc/self/exe", nullptr);
+  if (executable == nullptr) {
+    return nullptr;
+  }
+
+  gchar* argv[] = {executable, const_cast<gchar*>(GL_RENDERER_PROBE_SWITCH),
+                   nullptr};
+  g_autofree gchar* output = nullptr;
+  gint wait_status = 0;
+  g_autoptr(GError) error = nullptr;
+  if (!g_spawn_sync(nullptr, argv, nullptr, G_SPAWN_STDERR_TO_DEV_NULL,
+                    nullptr, nullptr, &output, nullptr, &wait_status,
+                    &error)) {
+    g_warning("Failed to run GL renderer probe: %s", error->message);
+    return nullptr;
+  }
+  if (!WIFEXITED(wait_status) || WEXITSTATUS(wait_status) != 0) {
+    g_warning("GL renderer probe failed (wait status %d)", wait_status);
+    return nullptr;
+  }
+
+  GKeyFile* report = g_key_file_new();
+  if (!g_key_file_load_from_data(report, output, -1, G_KEY_FILE_NONE,
+                                 &error)) {
+    g_warning("Failed to parse GL renderer probe output: %s", error->message);
+    g_key_file_unref(report);
+    return nullptr;
+  }
+  return report;
+}
+
+static void save_cache(GKeyFile* report, const gchar* path) {
+  g_autofree gchar* directory = g_path_get_dirname(path);
+  if (g_mkdir_with_parents(directory, 0700) != 0) {
+    g_warning("Failed to create %s", directory);
+    return;
+  }
+
+  g_autoptr(GError) error = nullptr;
+  if (!g_key_file_save_to_file(report, path, &error)) {
+    g_warning("Failed to write GL renderer cache: %s", error->message);
+  }
+}
+
+const GlRendererInfo* gl_renderer_probe_get() {
+  static GlRendererInfo info;
+  static gboolean probed = FALSE;
+  if (probed) {
+    return &info;
+  }
+  probed = TRUE;
+
+  gchar* driver_key = compute_driver_key();
+  info.driver_key = driver_key;
+  g_autofree gchar* cache_path = g_build_filename(
+      g_get_user_cache_dir(), "bizsync", "gl-renderer.ini", nullptr);
+
+  g_autoptr(GKeyFile) cache = g_key_file_new();
+  if (g_key_file_load_from_file(cache, cache_path, G_KEY_FILE_NONE, nullptr)) {
+    g_autofree gchar* cached_key =
+        g_key_file_get_string(cache, kCacheGroup, "driver-key", nullptr);
+    if (g_strcmp0(cached_key, driver_key) == 0 && load_info(cache, &info)) {
+      info.from_cache = TRUE;
+      return &info;
+    }
+  }
+
+  g_autoptr(GKeyFile) report = run_probe_child();
+  if (report != nullptr && load_info(report, &info)) {
+    g_key_file_set_string(report, kCacheGroup, "driver-key", driver_key);
+    save_cache(report, cache_path);
+    return &info;
+  }
+
+  // Without a probe the only trustworthy signal is Mesa's own override.
+  // Failures are not cached so the next launch probes again.
+  const char* forced = getenv("LIBGL_ALWAYS_SOFTWARE");
+  info.renderer = g_strdup("unknown");
+  info.is_software = forced != nullptr && strcmp(forced, "1") == 0;
+  return &info;
+}
+
+#ifdef HARDWARE_ACCELERATION_ENABLED
+// Returns an initialized EGL display for the current session, falling back to
+// Mesa's surfaceless platform when no display server is reachable.
+static EGLDisplay open_egl_display() {
+  EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  if (display != EGL_NO_DISPLAY && eglInitialize(display, nullptr, nullptr)) {
+    return display;
+  }
+
+  if (!epoxy_has_egl_extension(EGL_NO_DISPLAY,
+                               "EGL_MESA_platform_surfaceless")) {
+    return EGL_NO_DISPLAY;
+  }
+  display = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, nullptr,
+                                     nullptr);
+  if (display != EGL_NO_DISPLAY && eglInitialize(display, nullptr, nullptr)) {
+    return display;
+  }
+  return EGL_NO_DISPLAY;
+}
+#endif
+
+int gl_renderer_probe_child_main() {
+#ifdef HARDWARE_ACCELERATION_ENABLED
+  // A wedged driver must not stall the parent's startup.
+  alarm(kProbeTimeoutSeconds);
+
+  EGLDisplay display = open_egl_display();
+  if (display == EGL_NO_DISPLAY) {
+    return 1;
+  }
+
+  const EGLint config_attributes[] = {
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+      EGL_NONE,
+  };
+  const EGLint context_attributes[] = {
+      EGL_CONTEXT_CLIENT_VERSION, 2,
+      EGL_NONE,
+  };
+  const EGLint pbuffer_attributes[] = {
+      EGL_WIDTH, 1,
+      EGL_HEIGHT, 1,
+      EGL_NONE,
+  };
+
+  EGLConfig config;
+  EGLint config_count = 0;
+  if (!eglBindAPI(EGL_OPENGL_ES_API) ||
+      !eglChooseConfig(display, config_attributes, &config, 1,
+                       &config_count) ||
+      config_count == 0) {
+    eglTerminate(display);
+    return 1;
+  }
+
+  EGLContext context =
+      eglCreateContext(display, config, EGL_NO_CONTEXT, context_attributes);
+  if (context == EGL_NO_CONTEXT) {
+    eglTerminate(display);
+    return 1;
+  }
+
+  // Prefer a surfaceless context; older drivers need a 1x1 pbuffer.
+  EGLSurface surface = EGL_NO_SURFACE;
+  gboolean current =
+      eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context);
+  if (!current) {
+    surface = eglCreatePbufferSurface(display, config, pbuffer_attributes);
+    current = surface != EGL_NO_SURFACE &&
+              eglMakeCurrent(display, surface, surface, context);
+  }
+
+  int exit_status = 1;
+  const char* renderer =
+      current ? reinterpret_cast<const char*>(glGetString(GL_RENDERER))
+              : nullptr;
+  if (renderer != nullptr) {
+    const char* vendor = reinterpret_cast<const char*>(glGetString(GL_VENDOR));
+    const char* version =
+        reinterpret_cast<const char*>(glGetString(GL_VERSION));
+
+    g_autoptr(GKeyFile) report = g_key_file_new();
+    g_key_file_set_string(report, kCacheGroup, "renderer", renderer);
+    g_key_file_set_string(report, kCacheGroup, "vendor",
+                          vendor != nullptr ? vendor : "");
+    g_key_file_set_string(report, kCacheGroup, "version",
+                          version != nullptr ? version : "");
+    g_autofree gchar* data = g_key_file_to_data(report, nullptr, nullptr);
+    fputs(data, stdout);
+    exit_status = 0;
+  }
+
+  eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  if (surface != EGL_NO_SURFACE) {
+    eglDestroySurface(display, surface);
+  }
+  eglDestroyContext(display, context);
+  eglTerminate(display);
+  return exit_status;
+#else
+  return 1;
+#endif
+}
@@ -0,0 +1,49 @@
+#ifndef FLUTTER_GL_RENDERER_PROBE_H_
+#define FLUTTER_GL_RENDERER_PROBE_H_
+
+#include <glib.h>
+
+// Command-line switch that makes the runner act as the renderer probe child.
+// It is handled in main() before any GTK or Flutter initialization.
+#define GL_RENDERER_PROBE_SWITCH "--probe-gl-renderer"
+
+typedef struct {
+  gchar* renderer;
+  gchar* vendor;
+  gchar* version;
+  // TRUE when the renderer is a CPU rasterizer (llvmpipe, softpipe, swrast).
+  gboolean is_software;
+  // TRUE when the result came from the on-disk cache rather than a probe.
+  gboolean from_cache;
+  // Digest of the installed driver stack that keys the cached result.
+  gchar* driver_key;
+} GlRendererInfo;
+
+/**
+ * gl_renderer_probe_get:
+ *
+ * Returns the GL renderer this session will really draw with. The first call
+ * looks the result up in `$XDG_CACHE_HOME/bizsync/gl-renderer.ini`, keyed by
+ * the installed driver version. On a cache miss the runner re-executes itself
+ * with #GL_RENDERER_PROBE_SWITCH, which creates a throwaway EGL context and
+ * reports `GL_RENDERER`/`GL_VENDOR`. Probing in a child keeps the driver from
+ * latching its environment before the Mesa workarounds are applied.
+ *
+ * Must be called before GTK opens the display.
+ *
+ * Returns: (transfer none): the renderer description, owned by the probe and
+ * valid for the lifetime of the process.
+ */
+const GlRendererInfo* gl_renderer_probe_get();
+
+/**
+ * gl_renderer_probe_child_main:
+ *
+ * Entry point of the probe child. Creates an EGL context, prints the
+ * renderer strings to stdout as a key file and exits.
+ *
+ * Returns: the process exit status.
+ */
+int gl_renderer_probe_child_main();
+
+#endif  // FLUTTER_GL_RENDERER_PROBE_H_
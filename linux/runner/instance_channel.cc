@@ -0,0 +1,101 @@
+#include "instance_channel.h"
+
+#include <string.h>
+
+static const gchar* kChannelName = "bizsync/instance";
+
+struct _InstanceChannel {
+  FlMethodChannel* channel;
+  gboolean listening;
+  // Events received before Dart called listen, as FlValue maps.
+  FlValue* pending;
+};
+
+static void method_call_cb(FlMethodChannel* channel, FlMethodCall* method_call,
+                           gpointer user_data) {
+  InstanceChannel* self = static_cast<InstanceChannel*>(user_data);
+  const gchar* method = fl_method_call_get_name(method_call);
+
+  g_autoptr(FlMethodResponse) response = nullptr;
+  if (strcmp(method, "listen") == 0) {
+    self->listening = TRUE;
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(self->pending));
+    g_clear_pointer(&self->pending, fl_value_unref);
+    self->pending = fl_value_new_list();
+  } else {
+    response = FL_METHOD_RESPONSE(fl_method_not_implemented_response_new());
+  }
+
+  g_autoptr(GError) error = nullptr;
+  if (!fl_method_call_respond(method_call, response, &error)) {
+    g_warning("Failed to send instance response: %s", error->message);
+  }
+}
+
+// Pushes |event| to Dart, or queues it until Dart listens. Takes ownership
+// of |event|.
+static void send_event(InstanceChannel* self, const gchar* method,
+                       FlValue* event) {
+  if (self->listening) {
+    fl_method_channel_invoke_method(self->channel, method, event, nullptr,
+                                    nullptr, nullptr);
+    fl_value_unref(event);
+    return;
+  }
+
+  fl_value_set_string_take(event, "event", fl_value_new_string(method));
+  fl_value_append_take(self->pending, event);
+}
+
+InstanceChannel* instance_channel_new(FlPluginRegistry* registry) {
+  InstanceChannel* self = g_new0(InstanceChannel, 1);
+  self->pending = fl_value_new_list();
+
+  g_autoptr(FlPluginRegistrar) registrar =
+      fl_plugin_registry_get_registrar_for_plugin(registry, "InstanceChannel");
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  self->channel = fl_method_channel_new(
+      fl_plugin_registrar_get_messenger(registrar), kChannelName,
+      FL_METHOD_CODEC(codec));
+  fl_method_channel_set_method_call_handler(self->channel, method_call_cb,
+                                            self, nullptr);
+  return self;
+}
+
+void instance_channel_send_command_line(InstanceChannel* self,
+                                        const gchar* const* arguments,
+                                        const gchar* cwd) {
+  FlValue* list = fl_value_new_list();
+  for (const gchar* const* argument = arguments; *argument != nullptr;
+       argument++) {
+    fl_value_append_take(list, fl_value_new_string(*argument));
+  }
+
+  FlValue* event = fl_value_new_map();
+  fl_value_set_string_take(event, "arguments", list);
+  fl_value_set_string_take(event, "cwd", cwd != nullptr
+                                             ? fl_value_new_string(cwd)
+                                             : fl_value_new_null());
+  send_event(self, "commandLine", event);
+}
+
+void instance_channel_send_open(InstanceChannel* self, GFile** files,
+                                gint n_files, const gchar* hint) {
+  FlValue* uris = fl_value_new_list();
+  for (gint i = 0; i < n_files; i++) {
+    g_autofree gchar* uri = g_file_get_uri(files[i]);
+    fl_value_append_take(uris, fl_value_new_string(uri));
+  }
+
+  FlValue* event = fl_value_new_map();
+  fl_value_set_string_take(event, "uris", uris);
+  fl_value_set_string_take(event, "hint",
+                           fl_value_new_string(hint != nullptr ? hint : ""));
+  send_event(self, "open", event);
+}
+
+void instance_channel_free(InstanceChannel* self) {
+  g_clear_object(&self->channel);
+  g_clear_pointer(&self->pending, fl_value_unref);
+  g_free(self);
+}
@@ -0,0 +1,56 @@
+#ifndef FLUTTER_INSTANCE_CHANNEL_H_
+#define FLUTTER_INSTANCE_CHANNEL_H_
+
+#include <flutter_linux/flutter_linux.h>
+#include <gio/gio.h>
+
+// Delivers launches forwarded from later instances to Dart on the
+// "bizsync/instance" method channel. Events that arrive before Dart is
+// listening are queued.
+//
+// Dart to runner:
+//   listen -> list of queued events; later events are pushed.
+// Runner to Dart:
+//   commandLine({arguments: List<String>, cwd: String?})
+//   open({uris: List<String>, hint: String})
+// Queued events use the same maps with an added "event" key set to
+// "commandLine" or "open".
+typedef struct _InstanceChannel InstanceChannel;
+
+/**
+ * instance_channel_new:
+ * @registry: the registry of the Flutter view.
+ *
+ * Returns: a new #InstanceChannel, free with instance_channel_free().
+ */
+InstanceChannel* instance_channel_new(FlPluginRegistry* registry);
+
+/**
+ * instance_channel_send_command_line:
+ * @channel: an #InstanceChannel.
+ * @arguments: the forwarded arguments, without the program name.
+ * @cwd: (nullable): working directory of the launching process.
+ */
+void instance_channel_send_command_line(InstanceChannel* channel,
+                                        const gchar* const* arguments,
+                                        const gchar* cwd);
+
+/**
+ * instance_channel_send_open:
+ * @channel: an #InstanceChannel.
+ * @files: (array length=n_files): the files to open.
+ * @n_files: the length of @files.
+ * @hint: the hint passed to #GApplication::open.
+ */
+void instance_channel_send_open(InstanceChannel* channel, GFile** files,
+                                gint n_files, const gchar* hint);
+
+/**
+ * instance_channel_free:
+ * @channel: an #InstanceChannel.
+ */
+void instance_channel_free(InstanceChannel* channel);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(InstanceChannel, instance_channel_free)
+
+#endif  // FLUTTER_INSTANCE_CHANNEL_H_
@@ -0,0 +1,942 @@
+#include "invoice_renderer.h"
+
+#include <cairo-pdf.h>
+#include <pango/pangocairo.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "native/packed_rows.h"
+#include "native/qr_code.h"
+#include "native_tasks.h"
+
+static const gchar* kChannelName = "bizsync/invoice_pdf";
+
+// How often a running job reports progress to Dart.
+static const guint kProgressIntervalMs = 250;
+
+// A4 in points.
+static const double kDefaultPageWidth = 595.28;
+static const double kDefaultPageHeight = 841.89;
+
+enum TextAlign {
+  kAlignLeft,
+  kAlignCenter,
+  kAlignRight,
+};
+
+enum ElementType {
+  kElementText,
+  kElementLine,
+  kElementRect,
+  kElementQr,
+  kElementPayNow,
+};
+
+struct TemplateElement {
+  ElementType type;
+  double x;
+  double y;
+  double x2;
+  double y2;
+  double width;
+  double height;
+  double size;
+  gboolean bold;
+  TextAlign align;
+  std::string text;
+  // Invoice column appended to |text|, or -1.
+  gint64 column;
+  double line_width;
+  // Grey level of a filled rect, or -1 to stroke it.
+  double fill;
+  gboolean repeat;
+  // QR codes; the payment details are PayNow only.
+  gint32 ecc;
+  gint32 proxy_type;
+  gboolean editable;
+  std::string proxy;
+  std::string merchant_name;
+  std::string merchant_city;
+  gint64 amount_column;
+  gint64 reference_column;
+  gint64 expiry_column;
+};
+
+struct TableColumn {
+  double x;
+  double width;
+  TextAlign align;
+  gint64 column;
+};
+
+struct InvoiceTemplate {
+  double page_width = kDefaultPageWidth;
+  double page_height = kDefaultPageHeight;
+  std::string font = "Sans";
+  std::vector<TemplateElement> elements;
+  gboolean has_table = FALSE;
+  double table_y = 0;
+  double table_bottom = 0;
+  double table_continued_y = 0;
+  double row_height = 16;
+  double table_size = 9;
+  std::vector<TableColumn> columns;
+};
+
+// A decoded packed row buffer with every value formatted as text.
+struct Table {
+  guint32 column_count = 0;
+  std::vector<std::string> cells;
+
+  size_t row_count() const {
+    return column_count == 0 ? 0 : cells.size() / column_count;
+  }
+
+  const std::string& cell(size_t row, gint64 column) const {
+    static const std::string empty;
+    if (column < 0 || column >= column_count) {
+      return empty;
+    }
+    return cells[row * column_count + column];
+  }
+};
+
+struct RenderJob {
+  InvoiceRenderer* renderer;
+  gint64 id;
+  FlMethodCall* method_call;
+  InvoiceTemplate layout;
+  Table invoices;
+  Table lines;
+  // Line rows grouped by invoice; invoice i owns
+  // line_order[line_begin[i]] .. line_order[line_begin[i + 1] - 1].
+  std::vector<size_t> line_order;
+  std::vector<size_t> line_begin;
+  // Output file of each invoice, decided before the workers start.
+  std::vector<std::string> paths;
+  gchar* printer = nullptr;
+
+  std::atomic<size_t> next{0};
+  std::atomic<size_t> done{0};
+  std::atomic<bool> cancelled{false};
+  std::mutex error_mutex;
+  std::string error;
+  // Scheduler tasks not yet finished; only touched on the main thread.
+  guint running = 0;
+  guint progress_source = 0;
+};
+
+struct _InvoiceRenderer {
+  FlMethodChannel* channel;
+  std::vector<RenderJob*> jobs;
+};
+
+static FlValue* lookup(FlValue* map, const gchar* key, FlValueType type) {
+  FlValue* value = fl_value_lookup_string(map, key);
+  return value != nullptr && fl_value_get_type(value) == type ? value
+                                                              : nullptr;
+}
+
+static double lookup_double(FlValue* map, const gchar* key, double fallback) {
+  FlValue* value = fl_value_lookup_string(map, key);
+  if (value == nullptr) {
+    return fallback;
+  }
+  switch (fl_value_get_type(value)) {
+    case FL_VALUE_TYPE_FLOAT:
+      return fl_value_get_float(value);
+    case FL_VALUE_TYPE_INT:
+      return fl_value_get_int(value);
+    default:
+      return fallback;
+  }
+}
+
+static gint64 lookup_int(FlValue* map, const gchar* key, gint64 fallback) {
+  FlValue* value = lookup(map, key, FL_VALUE_TYPE_INT);
+  return value != nullptr ? fl_value_get_int(value) : fallback;
+}
+
+static const gchar* lookup_string(FlValue* map, const gchar* key) {
+  FlValue* value = lookup(map, key, FL_VALUE_TYPE_STRING);
+  return value != nullptr ? fl_value_get_string(value) : nullptr;
+}
+
+static gboolean lookup_bool(FlValue* map, const gchar* key) {
+  FlValue* value = lookup(map, key, FL_VALUE_TYPE_BOOL);
+  return value != nullptr && fl_value_get_bool(value);
+}
+
+static TextAlign lookup_align(FlValue* map) {
+  const gchar* align = lookup_string(map, "align");
+  if (g_strcmp0(align, "right") == 0) {
+    return kAlignRight;
+  }
+  if (g_strcmp0(align, "center") == 0) {
+    return kAlignCenter;
+  }
+  return kAlignLeft;
+}
+
+// Converts the template map sent by Dart. Returns FALSE and sets |error| if
+// it is malformed.
+static gboolean parse_template(FlValue* value, InvoiceTemplate* layout,
+                               std::string* error) {
+  if (value == nullptr || fl_value_get_type(value) != FL_VALUE_TYPE_MAP) {
+    *error = "template must be a map";
+    return FALSE;
+  }
+  layout->page_width = lookup_double(value, "pageWidth", kDefaultPageWidth);
+  layout->page_height = lookup_double(value, "pageHeight", kDefaultPageHeight);
+  const gchar* font = lookup_string(value, "font");
+  if (font != nullptr) {
+    layout->font = font;
+  }
+
+  FlValue* elements = lookup(value, "elements", FL_VALUE_TYPE_LIST);
+  size_t count = elements != nullptr ? fl_value_get_length(elements) : 0;
+  for (size_t i = 0; i < count; i++) {
+    FlValue* map = fl_value_get_list_value(elements, i);
+    if (fl_value_get_type(map) != FL_VALUE_TYPE_MAP) {
+      *error = "template elements must be maps";
+      return FALSE;
+    }
+
+    const gchar* type = lookup_string(map, "type");
+    if (g_strcmp0(type, "table") == 0) {
+      layout->has_table = TRUE;
+      layout->table_y = lookup_double(map, "y", 0);
+      layout->table_bottom =
+          lookup_double(map, "bottom", layout->page_height - 40);
+      layout->table_continued_y =
+          lookup_double(map, "continuedY", layout->table_y);
+      layout->row_height = lookup_double(map, "rowHeight", 16);
+      layout->table_size = lookup_double(map, "size", 9);
+      if (layout->row_height <= 0 ||
+          layout->table_continued_y + layout->row_height >
+              layout->table_bottom) {
+        *error = "table rows do not fit between continuedY and bottom";
+        return FALSE;
+      }
+
+      FlValue* columns = lookup(map, "columns", FL_VALUE_TYPE_LIST);
+      size_t column_count = columns != nullptr ? fl_value_get_length(columns)
+                                               : 0;
+      for (size_t j = 0; j < column_count; j++) {
+        FlValue* column = fl_value_get_list_value(columns, j);
+        if (fl_value_get_type(column) != FL_VALUE_TYPE_MAP) {
+          *error = "table columns must be maps";
+          return FALSE;
+        }
+        layout->columns.push_back({lookup_double(column, "x", 0),
+                                   lookup_double(column, "width", 0),
+                                   lookup_align(column),
+                                   lookup_int(column, "column", -1)});
+      }
+      continue;
+    }
+
+    TemplateElement element = {};
+    if (g_strcmp0(type, "text") == 0) {
+      element.type = kElementText;
+    } else if (g_strcmp0(type, "line") == 0) {
+      element.type = kElementLine;
+    } else if (g_strcmp0(type, "rect") == 0) {
+      element.type = kElementRect;
+    } else if (g_strcmp0(type, "qr") == 0) {
+      element.type = kElementQr;
+    } else if (g_strcmp0(type, "paynow") == 0) {
+      element.type = kElementPayNow;
+    } else {
+      *error = std::string("unknown template element ") +
+               (type != nullptr ? type : "(none)");
+      return FALSE;
+    }
+    element.x = lookup_double(map, "x", 0);
+    element.y = lookup_double(map, "y", 0);
+    element.x2 = lookup_double(map, "x2", element.x);
+    element.y2 = lookup_double(map, "y2", element.y);
+    element.width = lookup_double(map, "width", 0);
+    element.height = lookup_double(map, "height", 0);
+    element.size = lookup_double(map, "size", 10);
+    element.bold = lookup_bool(map, "bold");
+    element.align = lookup_align(map);
+    const gchar* text = lookup_string(map, "text");
+    element.text = text != nullptr ? text : "";
+    element.column = lookup_int(map, "column", -1);
+    element.line_width = lookup_double(map, "lineWidth", 0.5);
+    element.fill = lookup_double(map, "fill", -1);
+    element.repeat = lookup_bool(map, "repeat");
+    const gchar* ecc = lookup_string(map, "ecc");
+    element.ecc = g_strcmp0(ecc, "L") == 0   ? BIZSYNC_QR_ECC_LOW
+                  : g_strcmp0(ecc, "Q") == 0 ? BIZSYNC_QR_ECC_QUARTILE
+                  : g_strcmp0(ecc, "H") == 0 ? BIZSYNC_QR_ECC_HIGH
+                                             : BIZSYNC_QR_ECC_MEDIUM;
+    element.proxy_type = g_strcmp0(lookup_string(map, "proxyType"), "uen") == 0
+                             ? BIZSYNC_PAYNOW_UEN
+                             : BIZSYNC_PAYNOW_MOBILE;
+    element.editable = lookup_bool(map, "editable");
+    const gchar* proxy = lookup_string(map, "proxy");
+    element.proxy = proxy != nullptr ? proxy : "";
+    const gchar* merchant_name = lookup_string(map, "merchantName");
+    element.merchant_name = merchant_name != nullptr ? merchant_name : "";
+    const gchar* merchant_city = lookup_string(map, "merchantCity");
+    element.merchant_city = merchant_city != nullptr ? merchant_city : "";
+    element.amount_column = lookup_int(map, "amountColumn", -1);
+    element.reference_column = lookup_int(map, "referenceColumn", -1);
+    element.expiry_column = lookup_int(map, "expiryColumn", -1);
+    if (element.type == kElementPayNow && element.proxy.empty()) {
+      *error = "paynow elements need a proxy";
+      return FALSE;
+    }
+    layout->elements.push_back(std::move(element));
+  }
+  return TRUE;
+}
+
+static std::string format_value(const bizsync::PackedValue& value) {
+  switch (value.type) {
+    case BIZSYNC_VALUE_INT64:
+      return std::to_string(value.int64_value);
+    case BIZSYNC_VALUE_FLOAT64: {
+      gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+      return g_ascii_formatd(buffer, sizeof(buffer), "%.2f",
+                             value.float64_value);
+    }
+    case BIZSYNC_VALUE_TEXT:
+    case BIZSYNC_VALUE_BLOB:
+      return std::string(reinterpret_cast<const char*>(value.bytes),
+                         value.length);
+    case BIZSYNC_VALUE_NULL:
+      break;
+  }
+  return std::string();
+}
+
+static gboolean decode_rows(FlValue* value, Table* table) {
+  if (value == nullptr ||
+      fl_value_get_type(value) != FL_VALUE_TYPE_UINT8_LIST) {
+    return FALSE;
+  }
+
+  size_t length = fl_value_get_length(value);
+  bizsync::PackedRowReader reader(fl_value_get_uint8_list(value), length);
+  size_t count =
+      static_cast<size_t>(reader.row_count()) * reader.column_count();
+  // Every value takes at least its tag byte, which bounds the reservation.
+  if (!reader.ok() || count > length) {
+    return FALSE;
+  }
+
+  table->column_count = reader.column_count();
+  table->cells.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    bizsync::PackedValue cell;
+    if (!reader.Next(&cell)) {
+      return FALSE;
+    }
+    table->cells.push_back(format_value(cell));
+  }
+  return TRUE;
+}
+
+// Groups the line items by the invoice index in their first column with a
+// counting sort, so each invoice finds its lines in O(1).
+static void index_lines(RenderJob* job) {
+  size_t invoice_count = job->invoices.row_count();
+  size_t line_count = job->lines.row_count();
+  std::vector<size_t> owner(line_count, invoice_count);
+  job->line_begin.assign(invoice_count + 2, 0);
+  for (size_t i = 0; i < line_count; i++) {
+    gint64 invoice = g_ascii_strtoll(job->lines.cell(i, 0).c_str(), nullptr,
+                                     10);
+    if (invoice >= 0 && static_cast<size_t>(invoice) < invoice_count) {
+      owner[i] = invoice;
+      job->line_begin[invoice + 2]++;
+    }
+  }
+  for (size_t i = 2; i < job->line_begin.size(); i++) {
+    job->line_begin[i] += job->line_begin[i - 1];
+  }
+
+  // line_begin[i + 1] is used as the insertion cursor of invoice i, which
+  // leaves it at the start of invoice i + 1 once every line is placed.
+  job->line_order.assign(job->line_begin.back(), 0);
+  for (size_t i = 0; i < line_count; i++) {
+    if (owner[i] < invoice_count) {
+      job->line_order[job->line_begin[owner[i] + 1]++] = i;
+    }
+  }
+  job->line_begin.pop_back();
+}
+
+// Picks a unique file in |directory| for each invoice, named after
+// |name_column| when given.
+static void assign_paths(RenderJob* job, const gchar* directory,
+                         gint64 name_column) {
+  g_autoptr(GHashTable) used =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, nullptr);
+  for (size_t i = 0; i < job->invoices.row_count(); i++) {
+    std::string name = job->invoices.cell(i, name_column);
+    std::replace(name.begin(), name.end(), '/', '_');
+    if (name.empty() || name[0] == '.') {
+      name = "invoice-" + std::to_string(i + 1) + name;
+    }
+
+    std::string file = name + ".pdf";
+    for (int suffix = 2; g_hash_table_contains(used, file.c_str()); suffix++) {
+      file = name + "-" + std::to_string(suffix) + ".pdf";
+    }
+    g_hash_table_add(used, g_strdup(file.c_str()));
+
+    g_autofree gchar* path =
+        g_build_filename(directory, file.c_str(), nullptr);
+    job->paths.push_back(path);
+  }
+}
+
+// Text is laid out with Pango, which shapes it and falls back to other
+// fonts for characters the template's font lacks, such as CJK names. One
+// layout per invoice is reused for every string on it.
+struct TextPainter {
+  TextPainter(cairo_t* cr, const InvoiceTemplate& layout)
+      : text(pango_cairo_create_layout(cr)),
+        font(pango_font_description_new()) {
+    pango_font_description_set_family(font, layout.font.c_str());
+  }
+  ~TextPainter() {
+    pango_font_description_free(font);
+    g_object_unref(text);
+  }
+
+  TextPainter(const TextPainter&) = delete;
+  TextPainter& operator=(const TextPainter&) = delete;
+
+  PangoLayout* text;
+  PangoFontDescription* font;
+};
+
+static void draw_text(cairo_t* cr, TextPainter* painter, double size,
+                      gboolean bold, TextAlign align, double x, double y,
+                      double width, const std::string& text) {
+  pango_font_description_set_absolute_size(painter->font, size * PANGO_SCALE);
+  pango_font_description_set_weight(
+      painter->font, bold ? PANGO_WEIGHT_BOLD : PANGO_WEIGHT_NORMAL);
+  // A no-op unless the size or weight changed since the last string.
+  pango_layout_set_font_description(painter->text, painter->font);
+  pango_layout_set_text(painter->text, text.data(),
+                        static_cast<int>(text.size()));
+
+  double left = x;
+  if (align != kAlignLeft && width > 0) {
+    int advance = 0;
+    pango_layout_get_size(painter->text, &advance, nullptr);
+    double text_width = static_cast<double>(advance) / PANGO_SCALE;
+    left = align == kAlignRight ? x + width - text_width
+                                : x + (width - text_width) / 2;
+  }
+  // |y| is the baseline; Pango draws from the top of the layout.
+  cairo_move_to(cr, left,
+                y - static_cast<double>(pango_layout_get_baseline(
+                        painter->text)) / PANGO_SCALE);
+  pango_cairo_show_layout(cr, painter->text);
+}
+
+// Parses a decimal amount such as "1234.5" into cents, rounding half up.
+static gboolean parse_cents(const std::string& text, gint64* cents) {
+  gint64 whole = 0;
+  gint64 fraction = 0;
+  int digits = 0;
+  gboolean point = FALSE;
+  for (char c : text) {
+    if (c == '.' && !point) {
+      point = TRUE;
+    } else if (!g_ascii_isdigit(c) || whole > G_MAXINT64 / 1000) {
+      return FALSE;
+    } else if (!point) {
+      whole = whole * 10 + (c - '0');
+    } else if (digits < 3) {
+      fraction = fraction * 10 + (c - '0');
+      digits++;
+    }
+  }
+  for (; digits < 3; digits++) {
+    fraction *= 10;
+  }
+  *cents = whole * 100 + (fraction + 5) / 10;
+  return TRUE;
+}
+
+// Builds the PayNow payload of |invoice| for |element|.
+static gboolean paynow_payload(const TemplateElement& element,
+                               const Table& invoices, size_t invoice,
+                               std::string* payload, std::string* error) {
+  const std::string& amount = invoices.cell(invoice, element.amount_column);
+  const std::string& reference =
+      invoices.cell(invoice, element.reference_column);
+  const std::string& expiry = invoices.cell(invoice, element.expiry_column);
+  BizsyncPayNowRequest request = {};
+  request.proxy_type = element.proxy_type;
+  request.editable = element.editable;
+  request.proxy = element.proxy.c_str();
+  request.merchant_name = element.merchant_name.c_str();
+  request.merchant_city = element.merchant_city.c_str();
+  request.reference = reference.c_str();
+  request.expiry = expiry.c_str();
+  if (!parse_cents(amount, &request.amount_cents)) {
+    *error = "PayNow amount \"" + amount + "\" is not a decimal number";
+    return FALSE;
+  }
+
+  gchar buffer[BIZSYNC_PAYNOW_PAYLOAD_MAX];
+  if (bizsync_paynow_payload(&request, buffer, nullptr) != BIZSYNC_OK) {
+    *error = std::string("PayNow: ") + bizsync_last_error();
+    return FALSE;
+  }
+  *payload = buffer;
+  return TRUE;
+}
+
+// Fills the dark runs of |payload|'s symbol as one path, so the PDF keeps
+// it as vector art. |width| excludes the quiet zone, which the template
+// leaves clear. Symbols come from the shared cache, so the same payload is
+// only encoded once per batch.
+static gboolean draw_qr(cairo_t* cr, double x, double y, double width,
+                        const std::string& payload, gint32 ecc,
+                        std::string* error) {
+  BizsyncQrCode* code = nullptr;
+  if (bizsync_qr_encode(reinterpret_cast<const uint8_t*>(payload.data()),
+                        payload.size(), ecc, &code) != BIZSYNC_OK) {
+    *error = std::string("QR code: ") + bizsync_last_error();
+    return FALSE;
+  }
+  double module = width / code->size;
+  for (gint32 i = 0; i < code->run_count; i++) {
+    const gint32* run = code->runs + i * 3;
+    cairo_rectangle(cr, x + run[0] * module, y + run[1] * module,
+                    run[2] * module, module);
+  }
+  cairo_fill(cr);
+  bizsync_qr_code_free(code);
+  return TRUE;
+}
+
+static gboolean draw_elements(cairo_t* cr, TextPainter* painter,
+                              const RenderJob* job, size_t invoice,
+                              gboolean first_page, std::string* error) {
+  const InvoiceTemplate& layout = job->layout;
+  for (const TemplateElement& element : layout.elements) {
+    if (!first_page && !element.repeat) {
+      continue;
+    }
+
+    switch (element.type) {
+      case kElementText:
+        draw_text(cr, painter, element.size, element.bold, element.align,
+                  element.x, element.y, element.width,
+                  element.column >= 0
+                      ? element.text +
+                            job->invoices.cell(invoice, element.column)
+                      : element.text);
+        break;
+      case kElementLine:
+        cairo_set_line_width(cr, element.line_width);
+        cairo_move_to(cr, element.x, element.y);
+        cairo_line_to(cr, element.x2, element.y2);
+        cairo_stroke(cr);
+        break;
+      case kElementRect:
+        cairo_rectangle(cr, element.x, element.y, element.width,
+                        element.height);
+        if (element.fill >= 0) {
+          cairo_set_source_rgb(cr, element.fill, element.fill, element.fill);
+          cairo_fill(cr);
+          cairo_set_source_rgb(cr, 0, 0, 0);
+        } else {
+          cairo_set_line_width(cr, element.line_width);
+          cairo_stroke(cr);
+        }
+        break;
+      case kElementQr: {
+        std::string payload =
+            element.column >= 0
+                ? element.text + job->invoices.cell(invoice, element.column)
+                : element.text;
+        if (!draw_qr(cr, element.x, element.y, element.width, payload,
+                     element.ecc, error)) {
+          return FALSE;
+        }
+        break;
+      }
+      case kElementPayNow: {
+        std::string payload;
+        if (!paynow_payload(element, job->invoices, invoice, &payload,
+                            error) ||
+            !draw_qr(cr, element.x, element.y, element.width, payload,
+                     element.ecc, error)) {
+          return FALSE;
+        }
+        break;
+      }
+    }
+  }
+  return TRUE;
+}
+
+// Writes one invoice to its PDF file. Runs on a worker thread; each call owns
+// its cairo surface and context.
+static gboolean render_invoice(const RenderJob* job, size_t invoice,
+                               std::string* error) {
+  const InvoiceTemplate& layout = job->layout;
+  const std::string& path = job->paths[invoice];
+  cairo_surface_t* surface = cairo_pdf_surface_create(
+      path.c_str(), layout.page_width, layout.page_height);
+  if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+    *error = path + ": " + cairo_status_to_string(cairo_surface_status(surface));
+    cairo_surface_destroy(surface);
+    return FALSE;
+  }
+
+  cairo_t* cr = cairo_create(surface);
+  cairo_set_source_rgb(cr, 0, 0, 0);
+  TextPainter painter(cr, layout);
+  gboolean drawn = draw_elements(cr, &painter, job, invoice, TRUE, error);
+
+  if (drawn && layout.has_table) {
+    double y = layout.table_y;
+    for (size_t i = job->line_begin[invoice]; i < job->line_begin[invoice + 1];
+         i++) {
+      if (y + layout.row_height > layout.table_bottom) {
+        cairo_show_page(cr);
+        if (!draw_elements(cr, &painter, job, invoice, FALSE, error)) {
+          drawn = FALSE;
+          break;
+        }
+        y = layout.table_continued_y;
+      }
+
+      size_t line = job->line_order[i];
+      for (const TableColumn& column : layout.columns) {
+        cairo_save(cr);
+        cairo_rectangle(cr, column.x, y, column.width, layout.row_height);
+        cairo_clip(cr);
+        draw_text(cr, &painter, layout.table_size, FALSE, column.align,
+                  column.x, y + layout.row_height * 0.7, column.width,
+                  job->lines.cell(line, column.column));
+        cairo_restore(cr);
+      }
+      y += layout.row_height;
+    }
+  }
+
+  cairo_destroy(cr);
+  cairo_surface_finish(surface);
+  cairo_status_t status = cairo_surface_status(surface);
+  cairo_surface_destroy(surface);
+  if (!drawn) {
+    *error = path + ": " + *error;
+    return FALSE;
+  }
+  if (status != CAIRO_STATUS_SUCCESS) {
+    *error = path + ": " + cairo_status_to_string(status);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static gboolean job_done_cb(gpointer user_data);
+
+static void worker_main(gpointer user_data) {
+  RenderJob* job = static_cast<RenderJob*>(user_data);
+  size_t total = job->invoices.row_count();
+  while (!job->cancelled) {
+    size_t invoice = job->next++;
+    if (invoice >= total) {
+      break;
+    }
+
+    std::string error;
+    if (!render_invoice(job, invoice, &error)) {
+      std::lock_guard<std::mutex> lock(job->error_mutex);
+      if (job->error.empty()) {
+        job->error = error;
+      }
+      job->cancelled = true;
+      break;
+    }
+    job->done++;
+  }
+}
+
+static void free_job(RenderJob* job);
+
+// Runs on the main thread after each worker task; the last one finishes
+// the job.
+static void worker_done_cb(gpointer user_data) {
+  RenderJob* job = static_cast<RenderJob*>(user_data);
+  if (--job->running > 0) {
+    return;
+  }
+  // The renderer was freed while the job ran.
+  if (job->renderer == nullptr) {
+    free_job(job);
+    return;
+  }
+  job_done_cb(job);
+}
+
+static void send_progress(RenderJob* job) {
+  FlValue* progress = fl_value_new_map();
+  fl_value_set_string_take(progress, "job", fl_value_new_int(job->id));
+  fl_value_set_string_take(progress, "done",
+                           fl_value_new_int(job->done.load()));
+  fl_value_set_string_take(progress, "total",
+                           fl_value_new_int(job->invoices.row_count()));
+  fl_method_channel_invoke_method(job->renderer->channel, "progress",
+                                  progress, nullptr, nullptr, nullptr);
+  fl_value_unref(progress);
+}
+
+static gboolean progress_cb(gpointer user_data) {
+  send_progress(static_cast<RenderJob*>(user_data));
+  return G_SOURCE_CONTINUE;
+}
+
+static void free_job(RenderJob* job) {
+  // Drops a pending job_done_cb or progress_cb.
+  while (g_source_remove_by_user_data(job)) {
+  }
+  g_clear_object(&job->method_call);
+  g_free(job->printer);
+  delete job;
+}
+
+// Queues every rendered file on |printer| as a single CUPS job.
+static gboolean submit_to_printer(RenderJob* job, GError** error) {
+  g_autofree gchar* title =
+      g_strdup_printf("BizSync invoices (%zu)", job->paths.size());
+  g_autoptr(GPtrArray) argv = g_ptr_array_new();
+  g_ptr_array_add(argv, const_cast<gchar*>("lp"));
+  g_ptr_array_add(argv, const_cast<gchar*>("-d"));
+  g_ptr_array_add(argv, job->printer);
+  g_ptr_array_add(argv, const_cast<gchar*>("-t"));
+  g_ptr_array_add(argv, title);
+  for (const std::string& path : job->paths) {
+    g_ptr_array_add(argv, const_cast<gchar*>(path.c_str()));
+  }
+  g_ptr_array_add(argv, nullptr);
+
+  return g_spawn_async(nullptr, reinterpret_cast<gchar**>(argv->pdata),
+                       nullptr,
+                       static_cast<GSpawnFlags>(G_SPAWN_SEARCH_PATH |
+                                                G_SPAWN_STDOUT_TO_DEV_NULL),
+                       nullptr, nullptr, nullptr, error);
+}
+
+static gboolean job_done_cb(gpointer user_data) {
+  RenderJob* job = static_cast<RenderJob*>(user_data);
+  InvoiceRenderer* self = job->renderer;
+  g_clear_handle_id(&job->progress_source, g_source_remove);
+  send_progress(job);
+
+  g_autoptr(FlMethodResponse) response = nullptr;
+  g_autoptr(GError) error = nullptr;
+  if (!job->error.empty()) {
+    response = FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "render_failed", job->error.c_str(), nullptr));
+  } else if (job->done < job->invoices.row_count()) {
+    response = FL_METHOD_RESPONSE(
+        fl_method_error_response_new("cancelled", nullptr, nullptr));
+  } else if (job->printer != nullptr && !submit_to_printer(job, &error)) {
+    response = FL_METHOD_RESPONSE(
+        fl_method_error_response_new("print_failed", error->message, nullptr));
+  } else {
+    g_autoptr(FlValue) paths = fl_value_new_list();
+    for (const std::string& path : job->paths) {
+      fl_value_append_take(paths, fl_value_new_string(path.c_str()));
+    }
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(paths));
+  }
+
+  g_autoptr(GError) respond_error = nullptr;
+  if (!fl_method_call_respond(job->method_call, response, &respond_error)) {
+    g_warning("Failed to send invoice render response: %s",
+              respond_error->message);
+  }
+
+  self->jobs.erase(std::find(self->jobs.begin(), self->jobs.end(), job));
+  free_job(job);
+  return G_SOURCE_REMOVE;
+}
+
+// Fills |job| from the arguments of a render call. On failure sets
+// |code| and |error| for the error response.
+static gboolean prepare_job(RenderJob* job, FlValue* args, const gchar** code,
+                            std::string* error) {
+  if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    *code = "bad_arguments";
+    *error = "render expects a map";
+    return FALSE;
+  }
+  const gchar* directory = lookup_string(args, "outputDirectory");
+  if (directory == nullptr) {
+    *code = "bad_arguments";
+    *error = "outputDirectory is required";
+    return FALSE;
+  }
+
+  job->id = lookup_int(args, "job", 0);
+  if (!parse_template(fl_value_lookup_string(args, "template"), &job->layout,
+                      error)) {
+    *code = "bad_template";
+    return FALSE;
+  }
+  FlValue* lines = fl_value_lookup_string(args, "lines");
+  if (!decode_rows(fl_value_lookup_string(args, "invoices"), &job->invoices) ||
+      (lines != nullptr && fl_value_get_type(lines) != FL_VALUE_TYPE_NULL &&
+       !decode_rows(lines, &job->lines))) {
+    *code = "bad_arguments";
+    *error = "invoices and lines must be packed rows";
+    return FALSE;
+  }
+
+  // lp treats relative paths as relative to its own cwd; pin them down.
+  g_autofree gchar* output = g_canonicalize_filename(directory, nullptr);
+  if (g_mkdir_with_parents(output, 0700) != 0) {
+    *code = "io_error";
+    *error = "cannot create outputDirectory";
+    return FALSE;
+  }
+  index_lines(job);
+  assign_paths(job, output, lookup_int(args, "fileNameColumn", -1));
+  return TRUE;
+}
+
+// Validates a render call and starts its workers. Returns an error response,
+// or nullptr if the call will be answered when the job finishes.
+static FlMethodResponse* start_render(InvoiceRenderer* self,
+                                      FlMethodCall* method_call) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  RenderJob* job = new RenderJob();
+  job->renderer = self;
+  const gchar* code = nullptr;
+  std::string error;
+  if (!prepare_job(job, args, &code, &error)) {
+    free_job(job);
+    return FL_METHOD_RESPONSE(
+        fl_method_error_response_new(code, error.c_str(), nullptr));
+  }
+  job->printer = g_strdup(lookup_string(args, "printer"));
+  job->method_call = FL_METHOD_CALL(g_object_ref(method_call));
+  self->jobs.push_back(job);
+
+  size_t total = job->invoices.row_count();
+  if (total == 0) {
+    g_idle_add(job_done_cb, job);
+    return nullptr;
+  }
+
+  // Finished tasks report back through the main loop, so none can complete
+  // before this returns.
+  size_t worker_count =
+      std::min<size_t>(native_tasks_get_worker_count(), total);
+  for (size_t i = 0; i < worker_count; i++) {
+    if (native_tasks_post(BIZSYNC_TASK_INTERACTIVE, worker_main,
+                          worker_done_cb, job)) {
+      job->running++;
+    }
+  }
+  if (job->running == 0) {
+    self->jobs.pop_back();
+    free_job(job);
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "cancelled", "the worker pool has stopped", nullptr));
+  }
+  job->progress_source = g_timeout_add(kProgressIntervalMs, progress_cb, job);
+  return nullptr;
+}
+
+static void method_call_cb(FlMethodChannel* channel, FlMethodCall* method_call,
+                           gpointer user_data) {
+  InvoiceRenderer* self = static_cast<InvoiceRenderer*>(user_data);
+  const gchar* method = fl_method_call_get_name(method_call);
+  FlValue* args = fl_method_call_get_args(method_call);
+
+  g_autoptr(FlMethodResponse) response = nullptr;
+  if (strcmp(method, "render") == 0) {
+    response = start_render(self, method_call);
+    if (response == nullptr) {
+      return;
+    }
+  } else if (strcmp(method, "cancel") == 0 &&
+             fl_value_get_type(args) == FL_VALUE_TYPE_MAP) {
+    gint64 id = lookup_int(args, "job", 0);
+    gboolean found = FALSE;
+    for (RenderJob* job : self->jobs) {
+      if (job->id == id) {
+        job->cancelled = true;
+        found = TRUE;
+      }
+    }
+    g_autoptr(FlValue) result = fl_value_new_bool(found);
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else {
+    response = FL_METHOD_RESPONSE(fl_method_not_implemented_response_new());
+  }
+
+  g_autoptr(GError) error = nullptr;
+  if (!fl_method_call_respond(method_call, response, &error)) {
+    g_warning("Failed to send invoice render response: %s", error->message);
+  }
+}
+
+InvoiceRenderer* invoice_renderer_new(FlPluginRegistry* registry) {
+  InvoiceRenderer* self = new InvoiceRenderer();
+
+  g_autoptr(FlPluginRegistrar) registrar =
+      fl_plugin_registry_get_registrar_for_plugin(registry, "InvoiceRenderer");
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  self->channel = fl_method_channel_new(
+      fl_plugin_registrar_get_messenger(registrar), kChannelName,
+      FL_METHOD_CODEC(codec));
+  fl_method_channel_set_method_call_handler(self->channel, method_call_cb,
+                                            self, nullptr);
+  return self;
+}
+
+gboolean invoice_renderer_render_sync(FlValue* args, GError** error) {
+  RenderJob* job = new RenderJob();
+  const gchar* code = nullptr;
+  std::string message;
+  gboolean rendered = prepare_job(job, args, &code, &message);
+  for (size_t i = 0; rendered && i < job->invoices.row_count(); i++) {
+    rendered = render_invoice(job, i, &message);
+  }
+  if (!rendered) {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "%s", message.c_str());
+  }
+  free_job(job);
+  return rendered;
+}
+
+void invoice_renderer_free(InvoiceRenderer* self) {
+  // Running jobs are cancelled and left to free themselves when their last
+  // task reports back; they no longer reply.
+  for (RenderJob* job : self->jobs) {
+    job->cancelled = true;
+    if (job->running > 0) {
+      g_clear_handle_id(&job->progress_source, g_source_remove);
+      job->renderer = nullptr;
+    } else {
+      free_job(job);
+    }
+  }
+  g_clear_object(&self->channel);
+  delete self;
+}
@@ -0,0 +1,83 @@
+#ifndef FLUTTER_INVOICE_RENDERER_H_
+#define FLUTTER_INVOICE_RENDERER_H_
+
+#include <flutter_linux/flutter_linux.h>
+
+// Renders invoices to PDF with cairo and Pango on the shared native
+// scheduler (see native_tasks.h), one invoice per worker at a time, so batch
+// printing scales with cores and never runs on the UI isolate.
+//
+// Exposed to Dart on the "bizsync/invoice_pdf" method channel:
+//   render(job: int, template: Map, invoices: Uint8List, lines: Uint8List?,
+//          outputDirectory: String, fileNameColumn: int?, printer: String?)
+//     -> list of written paths, once every invoice is done. |job| is chosen
+//     by Dart. |invoices| holds one packed row per invoice and |lines| one
+//     packed row per line item whose first column is the invoice's row index
+//     (see native/packed_rows.h). With |printer| set the files are also
+//     submitted to CUPS as one print job.
+//   cancel(job: int) stops a render; its render call fails with "cancelled".
+// While rendering the runner invokes progress({job, done, total}) on the
+// same channel a few times per second.
+//
+// Template map, coordinates in points from the top-left corner:
+//   pageWidth, pageHeight: double, A4 by default.
+//   font: family name, "Sans" by default. Characters it lacks come from
+//     fallback fonts.
+//   elements: list of maps with a "type" of
+//     "text"  x, y (baseline), size, bold, align ("left", "center",
+//             "right") within width, and a literal "text" followed by the
+//             value of invoice column "column" if given.
+//     "line"  x, y, x2, y2, lineWidth.
+//     "rect"  x, y, width, height, fill (grey level 0-1) or lineWidth.
+//     "qr"    x, y (top-left), width of the symbol without its quiet zone,
+//             ecc ("L", "M", "Q", "H"; "M" by default), and a payload of
+//             "text" followed by invoice column "column" if given.
+//     "paynow" a PayNow QR code laid out like "qr", for proxyType
+//             ("mobile" or "uen"), proxy, merchantName, merchantCity and
+//             editable. amountColumn, referenceColumn and expiryColumn
+//             name the invoice columns with the amount due in dollars, the
+//             bill number and the YYYYMMDD expiry; without an amount the
+//             payer enters one. See native/qr_code.h.
+//     "table" y, bottom, continuedY, rowHeight, size and "columns", a list
+//             of {x, width, align, column} over the line item columns.
+//             Rows past |bottom| continue on a new page from |continuedY|.
+//   Elements other than the table are drawn on the first page only unless
+//   they set repeat: true.
+typedef struct _InvoiceRenderer InvoiceRenderer;
+
+/**
+ * invoice_renderer_new:
+ * @registry: the registry of the Flutter view.
+ *
+ * Serves the "bizsync/invoice_pdf" method channel.
+ *
+ * Returns: a new #InvoiceRenderer, free with invoice_renderer_free().
+ */
+InvoiceRenderer* invoice_renderer_new(FlPluginRegistry* registry);
+
+/**
+ * invoice_renderer_render_sync:
+ * @args: the arguments of a render call; job and printer are ignored.
+ * @error: (allow-none): #GError location to store the error occurring, or
+ * %NULL to ignore.
+ *
+ * Renders every invoice on the calling thread, for benchmarks and tools
+ * that have no engine.
+ *
+ * Returns: %TRUE if every file was written.
+ */
+gboolean invoice_renderer_render_sync(FlValue* args, GError** error);
+
+/**
+ * invoice_renderer_free:
+ * @renderer: an #InvoiceRenderer.
+ *
+ * Cancels running jobs and releases @renderer without waiting for them.
+ * Each cancelled job frees itself when its last worker task returns, and
+ * sends no reply.
+ */
+void invoice_renderer_free(InvoiceRenderer* renderer);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(InvoiceRenderer, invoice_renderer_free)
+
+#endif  // FLUTTER_INVOICE_RENDERER_H_
@@ -1,6 +1,20 @@
+#include <string.h>
+
+#include "gl_renderer_probe.h"
 #include "my_application.h"
+#include "startup_trace.h"
 
 int main(int argc, char** argv) {
+  // The renderer probe runs in a re-executed child so the driver it loads
+  // never sees this process' environment before the Mesa workarounds.
+  if (argc == 2 && strcmp(argv[1], GL_RENDERER_PROBE_SWITCH) == 0) {
+    return gl_renderer_probe_child_main();
+  }
+
+  startup_trace_init();
+
+  startup_trace_begin("my_application_new");
   g_autoptr(MyApplication) app = my_application_new();
+  startup_trace_end("my_application_new");
   return g_application_run(G_APPLICATION(app), argc, argv);
 }
@@ -0,0 +1,478 @@
+#include "memory_monitor.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib-unix.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "native_tasks.h"
+#include "runner_config.h"
+
+static const gchar* kChannelName = "bizsync/memory_pressure";
+static const gchar* kEventChannelName = "bizsync/memory_pressure/events";
+static const gchar* kSystemChannelName = "flutter/system";
+// SystemChannels.system uses the JSON message codec.
+static const gchar kMemoryPressureMessage[] = "{\"type\":\"memoryPressure\"}";
+
+static const gchar* kSystemPressurePath = "/proc/pressure/memory";
+static const gchar* kCgroupRoot = "/sys/fs/cgroup";
+
+static const gdouble kDefaultModeratePercent = 10;
+static const gdouble kDefaultCriticalPercent = 5;
+static const gint kDefaultIntervalMs = 2000;
+// Unprivileged PSI triggers need a window that is a multiple of 2 s.
+static const gint64 kTriggerWindowUs = 2000000;
+// A cgroup this close to its lowest limit counts as moderate pressure.
+static const gdouble kModerateUsage = 0.9;
+
+typedef enum {
+  MEMORY_PRESSURE_NORMAL,
+  MEMORY_PRESSURE_MODERATE,
+  MEMORY_PRESSURE_CRITICAL,
+} MemoryPressureLevel;
+
+struct _MemoryMonitor {
+  FlMethodChannel* channel;
+  FlEventChannel* events;
+  FlBinaryMessenger* messenger;
+  gboolean listening;
+
+  gdouble moderate_percent;
+  gdouble critical_percent;
+  gint interval_ms;
+
+  // The process's cgroup v2 directory, or nullptr outside one.
+  gchar* cgroup_dir;
+  // memory.pressure of the cgroup, or the system-wide file.
+  gchar* pressure_path;
+  // PSI trigger on pressure_path, or -1 when the kernel refused one.
+  gint trigger_fd;
+  guint trigger_source;
+  // The cgroup's memory.events, or -1.
+  gint events_fd;
+  guint events_source;
+  // Sum of the high, max and oom_kill counters last read.
+  guint64 limit_events;
+  // Samples while the level is raised, or always without a trigger.
+  guint sample_source;
+
+  MemoryPressureLevel level;
+  gdouble some_avg10;
+  gdouble full_avg10;
+  // memory.current over the lowest limit, negative without one.
+  gdouble cgroup_usage;
+};
+
+static const gchar* level_to_string(MemoryPressureLevel level) {
+  switch (level) {
+    case MEMORY_PRESSURE_NORMAL:
+      return "normal";
+    case MEMORY_PRESSURE_MODERATE:
+      return "moderate";
+    case MEMORY_PRESSURE_CRITICAL:
+      return "critical";
+  }
+  return "normal";
+}
+
+// Returns {level, someAvg10, fullAvg10, cgroupUsage} for the last sample.
+static FlValue* level_to_value(MemoryMonitor* self) {
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "level",
+                           fl_value_new_string(level_to_string(self->level)));
+  fl_value_set_string_take(value, "someAvg10",
+                           fl_value_new_float(self->some_avg10));
+  fl_value_set_string_take(value, "fullAvg10",
+                           fl_value_new_float(self->full_avg10));
+  fl_value_set_string_take(value, "cgroupUsage",
+                           self->cgroup_usage >= 0
+                               ? fl_value_new_float(self->cgroup_usage)
+                               : fl_value_new_null());
+  return value;
+}
+
+// Returns the cgroup v2 directory from the "0::" line of /proc/self/cgroup.
+static gchar* find_cgroup_dir() {
+  g_autofree gchar* contents = nullptr;
+  if (!g_file_get_contents("/proc/self/cgroup", &contents, nullptr,
+                           nullptr)) {
+    return nullptr;
+  }
+  g_auto(GStrv) lines = g_strsplit(contents, "\n", -1);
+  for (gchar** line = lines; *line != nullptr; line++) {
+    if (g_str_has_prefix(*line, "0::")) {
+      g_autofree gchar* dir = g_build_filename(kCgroupRoot, *line + 3, nullptr);
+      g_autofree gchar* controllers =
+          g_build_filename(dir, "cgroup.controllers", nullptr);
+      if (g_file_test(controllers, G_FILE_TEST_EXISTS)) {
+        return g_steal_pointer(&dir);
+      }
+    }
+  }
+  return nullptr;
+}
+
+// Reads the avg10 shares from a PSI file such as /proc/pressure/memory.
+static gboolean read_pressure(const gchar* path, gdouble* some,
+                              gdouble* full) {
+  g_autofree gchar* contents = nullptr;
+  if (!g_file_get_contents(path, &contents, nullptr, nullptr)) {
+    return FALSE;
+  }
+  *some = 0;
+  *full = 0;
+  g_auto(GStrv) lines = g_strsplit(contents, "\n", -1);
+  for (gchar** line = lines; *line != nullptr; line++) {
+    gdouble avg10;
+    if (sscanf(*line, "some avg10=%lf", &avg10) == 1) {
+      *some = avg10;
+    } else if (sscanf(*line, "full avg10=%lf", &avg10) == 1) {
+      *full = avg10;
+    }
+  }
+  return TRUE;
+}
+
+// Reads a cgroup file holding one byte count; "max" and errors read as 0.
+static guint64 read_cgroup_bytes(const gchar* dir, const gchar* name) {
+  g_autofree gchar* path = g_build_filename(dir, name, nullptr);
+  g_autofree gchar* contents = nullptr;
+  if (!g_file_get_contents(path, &contents, nullptr, nullptr)) {
+    return 0;
+  }
+  return g_ascii_strtoull(contents, nullptr, 10);
+}
+
+// Returns memory.current over the lower of memory.high and memory.max, or
+// -1 if neither is set.
+static gdouble read_cgroup_usage(const gchar* dir) {
+  guint64 high = read_cgroup_bytes(dir, "memory.high");
+  guint64 max = read_cgroup_bytes(dir, "memory.max");
+  guint64 limit = high == 0 ? max : (max == 0 ? high : MIN(high, max));
+  if (limit == 0) {
+    return -1;
+  }
+  return static_cast<gdouble>(read_cgroup_bytes(dir, "memory.current")) /
+         static_cast<gdouble>(limit);
+}
+
+// Rereads memory.events from the start, which also rearms its poll, and
+// returns the sum of the counters for hitting a limit.
+static guint64 read_limit_events(gint fd) {
+  gchar buffer[512];
+  if (lseek(fd, 0, SEEK_SET) < 0) {
+    return 0;
+  }
+  ssize_t length = read(fd, buffer, sizeof(buffer) - 1);
+  if (length <= 0) {
+    return 0;
+  }
+  buffer[length] = '\0';
+
+  guint64 total = 0;
+  g_auto(GStrv) lines = g_strsplit(buffer, "\n", -1);
+  for (gchar** line = lines; *line != nullptr; line++) {
+    gchar name[16];
+    guint64 count;
+    if (sscanf(*line, "%15s %" G_GUINT64_FORMAT, name, &count) == 2 &&
+        (strcmp(name, "high") == 0 || strcmp(name, "max") == 0 ||
+         strcmp(name, "oom_kill") == 0)) {
+      total += count;
+    }
+  }
+  return total;
+}
+
+// Opens a PSI trigger that fires once some task has stalled for
+// @threshold_us of a 2 s window. Returns -1 if the kernel has no triggers
+// or refuses this one.
+static gint open_trigger(const gchar* path, gint64 threshold_us) {
+  gint fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  g_autofree gchar* trigger = g_strdup_printf(
+      "some %" G_GINT64_FORMAT " %" G_GINT64_FORMAT, threshold_us,
+      kTriggerWindowUs);
+  // The kernel expects the terminating NUL.
+  if (write(fd, trigger, strlen(trigger) + 1) < 0) {
+    g_debug("PSI trigger on %s refused: %s", path, g_strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void trim_work(gpointer user_data) {
+  malloc_trim(0);
+}
+
+// Sends the current level to the listener, if any.
+static void send_level(MemoryMonitor* self) {
+  if (!self->listening) {
+    return;
+  }
+  g_autoptr(FlValue) value = level_to_value(self);
+  g_autoptr(GError) error = nullptr;
+  if (!fl_event_channel_send(self->events, value, nullptr, &error)) {
+    g_warning("Failed to send memory pressure: %s", error->message);
+  }
+}
+
+// Tells the framework to drop what it can, as a mobile OS would.
+static void notify_engine(MemoryMonitor* self) {
+  g_autoptr(GBytes) message = g_bytes_new_static(
+      kMemoryPressureMessage, strlen(kMemoryPressureMessage));
+  fl_binary_messenger_send_on_channel(self->messenger, kSystemChannelName,
+                                      message, nullptr, nullptr, nullptr);
+}
+
+static gboolean sample_cb(gpointer user_data);
+
+// Samples the files, grades the pressure and tells Flutter and Dart when
+// the level changes. @limit_hit is set when memory.events counted a new
+// limit hit.
+static void update_level(MemoryMonitor* self, gboolean limit_hit) {
+  if (self->pressure_path == nullptr ||
+      !read_pressure(self->pressure_path, &self->some_avg10,
+                     &self->full_avg10)) {
+    self->some_avg10 = 0;
+    self->full_avg10 = 0;
+  }
+  self->cgroup_usage =
+      self->cgroup_dir != nullptr ? read_cgroup_usage(self->cgroup_dir) : -1;
+
+  // A raised level holds until its share falls below half the threshold.
+  MemoryPressureLevel level = MEMORY_PRESSURE_NORMAL;
+  gdouble critical = self->level == MEMORY_PRESSURE_CRITICAL
+                         ? self->critical_percent / 2
+                         : self->critical_percent;
+  gdouble moderate = self->level >= MEMORY_PRESSURE_MODERATE
+                         ? self->moderate_percent / 2
+                         : self->moderate_percent;
+  if (limit_hit || self->full_avg10 >= critical) {
+    level = MEMORY_PRESSURE_CRITICAL;
+  } else if (self->some_avg10 >= moderate ||
+             self->cgroup_usage >= kModerateUsage) {
+    level = MEMORY_PRESSURE_MODERATE;
+  }
+
+  MemoryPressureLevel previous = self->level;
+  self->level = level;
+  if (level != previous) {
+    if (level > previous) {
+      notify_engine(self);
+    }
+    if (level == MEMORY_PRESSURE_CRITICAL) {
+      native_tasks_post(BIZSYNC_TASK_BACKGROUND, trim_work, nullptr, nullptr);
+    }
+    send_level(self);
+  }
+
+  // The averages decay on their own, so only a raised level, or the lack
+  // of a trigger, needs sampling.
+  gboolean sample =
+      level != MEMORY_PRESSURE_NORMAL || self->trigger_source == 0;
+  if (sample && self->sample_source == 0) {
+    self->sample_source = g_timeout_add(self->interval_ms, sample_cb, self);
+  } else if (!sample && self->sample_source != 0) {
+    g_source_remove(self->sample_source);
+    self->sample_source = 0;
+  }
+}
+
+static gboolean sample_cb(gpointer user_data) {
+  MemoryMonitor* self = static_cast<MemoryMonitor*>(user_data);
+  gboolean limit_hit = FALSE;
+  if (self->events_fd >= 0) {
+    guint64 limit_events = read_limit_events(self->events_fd);
+    limit_hit = limit_events > self->limit_events;
+    self->limit_events = limit_events;
+  }
+  // update_level() removes the source when sampling is no longer needed.
+  guint source = self->sample_source;
+  update_level(self, limit_hit);
+  return self->sample_source == source ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+static gboolean trigger_cb(gint fd, GIOCondition condition,
+                           gpointer user_data) {
+  MemoryMonitor* self = static_cast<MemoryMonitor*>(user_data);
+  if ((condition & G_IO_ERR) != 0) {
+    // The cgroup was removed; fall back to sampling.
+    g_warning("PSI trigger on %s stopped", self->pressure_path);
+    self->trigger_source = 0;
+    update_level(self, FALSE);
+    return G_SOURCE_REMOVE;
+  }
+  update_level(self, FALSE);
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean events_cb(gint fd, GIOCondition condition,
+                          gpointer user_data) {
+  MemoryMonitor* self = static_cast<MemoryMonitor*>(user_data);
+  guint64 limit_events = read_limit_events(fd);
+  gboolean limit_hit = limit_events > self->limit_events;
+  self->limit_events = limit_events;
+  update_level(self, limit_hit);
+  return G_SOURCE_CONTINUE;
+}
+
+static void method_call_cb(FlMethodChannel* channel, FlMethodCall* method_call,
+                           gpointer user_data) {
+  MemoryMonitor* self = static_cast<MemoryMonitor*>(user_data);
+  const gchar* method = fl_method_call_get_name(method_call);
+
+  g_autoptr(FlMethodResponse) response = nullptr;
+  if (strcmp(method, "getLevel") == 0) {
+    g_autoptr(FlValue) result = level_to_value(self);
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else {
+    response = FL_METHOD_RESPONSE(fl_method_not_implemented_response_new());
+  }
+
+  g_autoptr(GError) error = nullptr;
+  if (!fl_method_call_respond(method_call, response, &error)) {
+    g_warning("Failed to send memory pressure response: %s", error->message);
+  }
+}
+
+static FlMethodErrorResponse* listen_cb(FlEventChannel* channel, FlValue* args,
+                                        gpointer user_data) {
+  MemoryMonitor* self = static_cast<MemoryMonitor*>(user_data);
+  self->listening = TRUE;
+  send_level(self);
+  return nullptr;
+}
+
+static FlMethodErrorResponse* cancel_cb(FlEventChannel* channel, FlValue* args,
+                                        gpointer user_data) {
+  MemoryMonitor* self = static_cast<MemoryMonitor*>(user_data);
+  self->listening = FALSE;
+  return nullptr;
+}
+
+// Reads a percentage in (0, 100) from the [memory-pressure] group.
+static gdouble config_percent(const gchar* key, gdouble fallback) {
+  g_autoptr(GError) error = nullptr;
+  gdouble value = g_key_file_get_double(runner_config_get(),
+                                        "memory-pressure", key, &error);
+  return error != nullptr || value <= 0 || value >= 100 ? fallback : value;
+}
+
+// Opens the pressure sources; without any the level stays normal.
+static void start_monitoring(MemoryMonitor* self) {
+  self->cgroup_dir = find_cgroup_dir();
+  if (self->cgroup_dir != nullptr) {
+    g_autofree gchar* pressure =
+        g_build_filename(self->cgroup_dir, "memory.pressure", nullptr);
+    if (g_file_test(pressure, G_FILE_TEST_EXISTS)) {
+      self->pressure_path = g_steal_pointer(&pressure);
+    }
+
+    // memory.events only exists where the memory controller is enabled.
+    g_autofree gchar* events =
+        g_build_filename(self->cgroup_dir, "memory.events", nullptr);
+    self->events_fd = open(events, O_RDONLY | O_CLOEXEC);
+    if (self->events_fd >= 0) {
+      self->limit_events = read_limit_events(self->events_fd);
+      self->events_source =
+          g_unix_fd_add(self->events_fd, G_IO_PRI, events_cb, self);
+    }
+  }
+  if (self->pressure_path == nullptr &&
+      g_file_test(kSystemPressurePath, G_FILE_TEST_EXISTS)) {
+    self->pressure_path = g_strdup(kSystemPressurePath);
+  }
+
+  if (self->pressure_path != nullptr) {
+    gint64 threshold_us = static_cast<gint64>(
+        kTriggerWindowUs * self->moderate_percent / 100);
+    self->trigger_fd = open_trigger(self->pressure_path, threshold_us);
+    if (self->trigger_fd >= 0) {
+      self->trigger_source = g_unix_fd_add(
+          self->trigger_fd, static_cast<GIOCondition>(G_IO_PRI | G_IO_ERR),
+          trigger_cb, self);
+    }
+  }
+
+  if (self->pressure_path == nullptr && self->events_fd < 0) {
+    g_message("Memory pressure monitoring unavailable: no PSI or cgroup v2");
+    return;
+  }
+  g_print("BizSync: memory pressure from %s%s%s\n",
+          self->pressure_path != nullptr ? self->pressure_path : "",
+          self->events_fd >= 0 ? " and memory.events" : "",
+          self->trigger_fd >= 0 ? "" : " (sampled)");
+  update_level(self, FALSE);
+}
+
+MemoryMonitor* memory_monitor_new(FlPluginRegistry* registry) {
+  MemoryMonitor* self = g_new0(MemoryMonitor, 1);
+  self->trigger_fd = -1;
+  self->events_fd = -1;
+  self->cgroup_usage = -1;
+
+  GKeyFile* config = runner_config_get();
+  self->moderate_percent =
+      config_percent("moderate-percent", kDefaultModeratePercent);
+  self->critical_percent =
+      config_percent("critical-percent", kDefaultCriticalPercent);
+  g_autoptr(GError) error = nullptr;
+  self->interval_ms = g_key_file_get_integer(config, "memory-pressure",
+                                             "interval-ms", &error);
+  if (error != nullptr || self->interval_ms <= 0) {
+    self->interval_ms = kDefaultIntervalMs;
+  }
+
+  g_autoptr(FlPluginRegistrar) registrar =
+      fl_plugin_registry_get_registrar_for_plugin(registry, "MemoryMonitor");
+  self->messenger = FL_BINARY_MESSENGER(
+      g_object_ref(fl_plugin_registrar_get_messenger(registrar)));
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  self->channel = fl_method_channel_new(self->messenger, kChannelName,
+                                        FL_METHOD_CODEC(codec));
+  fl_method_channel_set_method_call_handler(self->channel, method_call_cb,
+                                            self, nullptr);
+  self->events = fl_event_channel_new(self->messenger, kEventChannelName,
+                                      FL_METHOD_CODEC(codec));
+  fl_event_channel_set_stream_handlers(self->events, listen_cb, cancel_cb,
+                                       self, nullptr);
+
+  g_autoptr(GError) enabled_error = nullptr;
+  gboolean enabled = g_key_file_get_boolean(config, "memory-pressure",
+                                            "enabled", &enabled_error);
+  if (enabled_error == nullptr && !enabled) {
+    return self;
+  }
+  start_monitoring(self);
+  return self;
+}
+
+void memory_monitor_free(MemoryMonitor* self) {
+  if (self->sample_source != 0) {
+    g_source_remove(self->sample_source);
+  }
+  if (self->trigger_source != 0) {
+    g_source_remove(self->trigger_source);
+  }
+  if (self->events_source != 0) {
+    g_source_remove(self->events_source);
+  }
+  if (self->trigger_fd >= 0) {
+    close(self->trigger_fd);
+  }
+  if (self->events_fd >= 0) {
+    close(self->events_fd);
+  }
+  g_clear_object(&self->channel);
+  g_clear_object(&self->events);
+  g_clear_object(&self->messenger);
+  g_clear_pointer(&self->cgroup_dir, g_free);
+  g_clear_pointer(&self->pressure_path, g_free);
+  g_free(self);
+}
@@ -0,0 +1,57 @@
+#ifndef FLUTTER_MEMORY_MONITOR_H_
+#define FLUTTER_MEMORY_MONITOR_H_
+
+#include <flutter_linux/flutter_linux.h>
+
+// Grades memory pressure from the kernel's pressure stall information and
+// the process's cgroup, so Dart can shed caches before the kernel starts
+// reclaiming. There are three levels:
+//   normal    nothing stalls on memory.
+//   moderate  some task stalled on memory for moderate-percent of the last
+//             10 s, or the cgroup is within 10% of memory.high.
+//   critical  all tasks stalled for critical-percent of the last 10 s, or
+//             the cgroup hit memory.high or memory.max since the last check.
+//
+// PSI is read from the cgroup's memory.pressure, or /proc/pressure/memory
+// outside a cgroup v2 hierarchy. A PSI trigger wakes the main loop when
+// stalls start, and memory.events wakes it when the cgroup hits a limit.
+// The files are sampled every interval-ms only while the level is above
+// normal. Without trigger support the files are sampled all the time. A
+// level drops once the stall share falls below half its threshold.
+//
+// Each rise in level also sends {"type": "memoryPressure"} on
+// "flutter/system", which the framework answers by clearing its image cache
+// and calling didHaveMemoryPressure on every WidgetsBindingObserver. A rise
+// to critical returns freed malloc memory to the system on a background
+// worker.
+//
+// Methods on "bizsync/memory_pressure":
+//   getLevel -> the last event below.
+// Events on the "bizsync/memory_pressure/events" event channel:
+//   {level: "normal" | "moderate" | "critical", someAvg10: double,
+//    fullAvg10: double, cgroupUsage: double?}
+// where cgroupUsage is memory.current over the cgroup's lowest limit, null
+// without one. The current level is sent when a listener attaches.
+//
+// Settings come from the [memory-pressure] group of bizsync.conf: enabled
+// (true), moderate-percent (10), critical-percent (5) and interval-ms
+// (2000).
+typedef struct _MemoryMonitor MemoryMonitor;
+
+/**
+ * memory_monitor_new:
+ * @registry: the registry of the Flutter view.
+ *
+ * Returns: a new #MemoryMonitor, free with memory_monitor_free().
+ */
+MemoryMonitor* memory_monitor_new(FlPluginRegistry* registry);
+
+/**
+ * memory_monitor_free:
+ * @monitor: a #MemoryMonitor.
+ */
+void memory_monitor_free(MemoryMonitor* monitor);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(MemoryMonitor, memory_monitor_free)
+
+#endif  // FLUTTER_MEMORY_MONITOR_H_
@@ -7,78 +7,97 @@
 #ifdef GDK_WINDOWING_WAYLAND
 #include <gdk/gdkwayland.h>
 #endif
+#include <glib-unix.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include "flutter/generated_plugin_registrant.h"
+#include "engine_tuning.h"
+#include "folder_watcher.h"
+#include "frame_pacer.h"
+#include "frame_stats.h"
+#include "gl_renderer_probe.h"
+#include "instance_channel.h"
+#include "invoice_renderer.h"
+#include "memory_monitor.h"
+#include "native/sync_transport.h"
+#include "native_tasks.h"
+#include "plugin_scheduler.h"
+#include "rendering_profile.h"
+#include "runner_config.h"
+#include "shader_cache.h"
+#include "startup_trace.h"
+#include "wayland_surface.h"
 
 struct _MyApplication {
   GtkApplication parent_instance;
   char** dart_entrypoint_arguments;
+  // Software rendering profile named by --rendering-profile, if any.
+  gchar* rendering_profile;
+  // Engine tuning from --machine-class, --old-gen-heap-size, --dart-flags
+  // and --engine-switch; see engine_tuning.h.
+  gchar* machine_class;
+  gint old_gen_heap_size;
+  gchar* dart_flags;
+  gchar** engine_switches;
+  // Destination of the --frame-stats dump written at shutdown, if any.
+  gchar* frame_stats_path;
+  FrameStats* frame_stats;
+  // Destination of the --trace-startup trace, if any.
+  gchar* startup_trace_path;
+  PluginScheduler* plugin_scheduler;
+  // Set by --single-instance or [application] single-instance=true.
+  gboolean single_instance;
+  // The application window; cleared when it is destroyed.
+  GtkWindow* window;
+  InstanceChannel* instance_channel;
+  InvoiceRenderer* invoice_renderer;
+  FolderWatcher* folder_watcher;
+  // Throttles rendering while the window is idle, unfocused or hidden.
+  FramePacer* frame_pacer;
+  // Grades memory pressure so Dart can shed caches before the kernel
+  // reclaims.
+  MemoryMonitor* memory_monitor;
+  // Uploads CRDT deltas in the background once Dart attaches a database.
+  BizsyncSync* sync_transport;
+  // Worker threads shared by the native engines and the invoice renderer.
+  BizsyncScheduler* scheduler;
+  // The window's exact Wayland scale, when the compositor reports one.
+  WaylandSurface* wayland_surface;
+  // Set by --background: start without mapping the window and hide it,
+  // rather than quit, when it is closed. Dart can toggle it at runtime.
+  gboolean resident;
+  FlMethodChannel* window_channel;
 };
 
 G_DEFINE_TYPE(MyApplication, my_application, GTK_TYPE_APPLICATION)
 
 // Check if Mesa software rendering is being used
 static gboolean is_mesa_software_rendering() {
-  const char* renderer = getenv("LIBGL_ALWAYS_SOFTWARE");
-  if (renderer != nullptr && strcmp(renderer, "1") == 0) {
-    return TRUE;
-  }
-  
-  // Check GL_RENDERER if available
-  const char* gl_renderer = getenv("GL_RENDERER");
-  if (gl_renderer != nullptr) {
-    if (strstr(gl_renderer, "llvmpipe") != nullptr ||
-        strstr(gl_renderer, "softpipe") != nullptr ||
-        strstr(gl_renderer, "swrast") != nullptr) {
-      return TRUE;
-    }
-  }
-  
-  return FALSE;
+  return gl_renderer_probe_get()->is_software;
 }
 
 // Configure environment for Mesa software rendering to avoid flicker
-static void configure_mesa_rendering() {
-  if (is_mesa_software_rendering()) {
-    // Disable vsync for software rendering to avoid flicker
-    setenv("vblank_mode", "0", 1);
-    
-    // Use simpler rendering path
-    setenv("LIBGL_DRI3_DISABLE", "1", 1);
-    
-    // Disable compositor bypass
-    setenv("CLUTTER_PAINT", "disable-clipped-redraws:disable-culling", 1);
-    
-    // Additional Mesa-specific optimizations
-    // Disable GLSL optimizations that can cause issues with software rendering
-    setenv("MESA_GLSL_CACHE_DISABLE", "1", 1);
-    
-    // Use the simplest shader variants
-    setenv("MESA_SHADER_CACHE_DISABLE", "1", 1);
-    
-    // Disable threaded OpenGL to avoid synchronization issues
-    setenv("mesa_glthread", "false", 1);
-    
-    // Disable GPU memory cache which can cause flickering
-    setenv("MESA_NO_MEMOBJ_CACHE", "1", 1);
-    
-    // Force synchronous rendering to avoid frame drops
-    setenv("MESA_DEBUG", "flush", 1);
-    
-    // Disable texture compression for better compatibility
-    setenv("force_s3tc_enable", "false", 1);
-    
-    // Set Mesa extension override to disable problematic extensions
-    setenv("MESA_EXTENSION_OVERRIDE", "-GL_ARB_buffer_storage -GL_EXT_buffer_storage", 1);
-    
-    // Force single-threaded rendering
-    setenv("LP_NUM_THREADS", "1", 1);
-    
-    // Disable FBO cache which can cause rendering issues
-    setenv("MESA_FBO_CACHE", "0", 1);
-    
+static void configure_mesa_rendering(MyApplication* self) {
+  const GlRendererInfo* gl = gl_renderer_probe_get();
+  g_print("BizSync: GL renderer \"%s\" (%s)%s\n", gl->renderer,
+          gl->vendor != nullptr ? gl->vendor : "unknown vendor",
+          gl->from_cache ? " [cached]" : "");
+  shader_cache_configure();
+
+  if (!gl->is_software) {
+    return;
+  }
+
+  const gchar* source = nullptr;
+  RenderingProfile profile =
+      rendering_profile_select(self->rendering_profile, &source);
+  g_print("BizSync: Mesa software rendering detected, using '%s' profile "
+          "(from %s)\n",
+          rendering_profile_to_string(profile), source);
+  rendering_profile_apply(profile);
+
+  if (profile == RENDERING_PROFILE_SAFE) {
     // Force X11 backend if on Wayland with software rendering
     const char* gdk_backend = getenv("GDK_BACKEND");
     if (gdk_backend == nullptr || strcmp(gdk_backend, "wayland") == 0) {
@@ -92,21 +111,126 @@ static void configure_mesa_rendering() {
         #endif
       }
     }
-    
-    g_print("BizSync: Mesa software rendering detected, applying comprehensive workarounds\n");
-    g_print("  - Disabled vsync (vblank_mode=0)\n");
-    g_print("  - Disabled DRI3 (LIBGL_DRI3_DISABLE=1)\n");
-    g_print("  - Disabled GLSL cache\n");
-    g_print("  - Single-threaded rendering (LP_NUM_THREADS=1)\n");
-    g_print("  - Synchronous flushing enabled\n");
+  }
+}
+
+// Marks the engine start: FlView launches the engine when it is realized.
+static void view_realize_cb(GtkWidget* view, gpointer user_data) {
+  startup_trace_instant("engine start");
+}
+
+// Marks the first Flutter frame, writes the startup trace and lets the
+// deferred plugins register.
+static void first_frame_cb(MyApplication* self, FlView* view) {
+  startup_trace_instant("first frame");
+  startup_trace_finish();
+  if (self->plugin_scheduler != nullptr) {
+    plugin_scheduler_start_deferred(self->plugin_scheduler);
+  }
+}
+
+// Closing a resident window only hides it; the engine keeps running.
+static gboolean window_delete_cb(MyApplication* self, GdkEvent* event,
+                                 GtkWidget* window) {
+  if (self->resident) {
+    gtk_widget_hide(window);
+    return TRUE;
+  }
+  return FALSE;
+}
+
+// Returns {preferred: double?, buffer: int}: the scale the compositor wants
+// the window at, null if it has not said, and the one GTK renders at.
+static FlValue* surface_scale_to_value(MyApplication* self) {
+  FlValue* value = fl_value_new_map();
+  gdouble preferred = self->wayland_surface != nullptr
+                          ? wayland_surface_get_preferred_scale(
+                                self->wayland_surface)
+                          : 0;
+  gint buffer = 1;
+  if (self->wayland_surface != nullptr) {
+    buffer = wayland_surface_get_buffer_scale(self->wayland_surface);
+  } else if (self->window != nullptr) {
+    buffer = gtk_widget_get_scale_factor(GTK_WIDGET(self->window));
+  }
+  fl_value_set_string_take(value, "preferred",
+                           preferred > 0 ? fl_value_new_float(preferred)
+                                         : fl_value_new_null());
+  fl_value_set_string_take(value, "buffer", fl_value_new_int(buffer));
+  return value;
+}
+
+// Tells Dart the window moved to an output with another exact scale.
+static void surface_scale_changed_cb(WaylandSurface* surface,
+                                     gpointer user_data) {
+  MyApplication* self = MY_APPLICATION(user_data);
+  if (self->window_channel == nullptr) {
+    return;
+  }
+  g_autoptr(FlValue) scale = surface_scale_to_value(self);
+  fl_method_channel_invoke_method(self->window_channel, "surfaceScaleChanged",
+                                  scale, nullptr, nullptr, nullptr);
+}
+
+// Handles the "bizsync/window" channel: showWindow, hideWindow,
+// isResident, setResident(bool) and getSurfaceScale. Sends
+// surfaceScaleChanged with getSurfaceScale's map when it changes.
+static void window_method_call_cb(FlMethodChannel* channel,
+                                  FlMethodCall* method_call,
+                                  gpointer user_data) {
+  MyApplication* self = MY_APPLICATION(user_data);
+  const gchar* method = fl_method_call_get_name(method_call);
+  FlValue* args = fl_method_call_get_args(method_call);
+
+  g_autoptr(FlMethodResponse) response = nullptr;
+  if (strcmp(method, "showWindow") == 0) {
+    if (self->window != nullptr) {
+      gtk_window_present(self->window);
+    }
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  } else if (strcmp(method, "hideWindow") == 0) {
+    if (self->window != nullptr) {
+      gtk_widget_hide(GTK_WIDGET(self->window));
+    }
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  } else if (strcmp(method, "isResident") == 0) {
+    g_autoptr(FlValue) result = fl_value_new_bool(self->resident);
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else if (strcmp(method, "setResident") == 0 && args != nullptr &&
+             fl_value_get_type(args) == FL_VALUE_TYPE_BOOL) {
+    self->resident = fl_value_get_bool(args);
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  } else if (strcmp(method, "getSurfaceScale") == 0) {
+    g_autoptr(FlValue) result = surface_scale_to_value(self);
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else {
+    response = FL_METHOD_RESPONSE(fl_method_not_implemented_response_new());
+  }
+
+  g_autoptr(GError) error = nullptr;
+  if (!fl_method_call_respond(method_call, response, &error)) {
+    g_warning("Failed to send window response: %s", error->message);
   }
 }
 
 // Implements GApplication::activate.
 static void my_application_activate(GApplication* application) {
   MyApplication* self = MY_APPLICATION(application);
+
+  // Later activations in single-instance mode reuse the existing window.
+  if (self->window != nullptr) {
+    gtk_window_present(self->window);
+    return;
+  }
+
+  startup_trace_begin("window setup");
   GtkWindow* window =
       GTK_WINDOW(gtk_application_window_new(GTK_APPLICATION(application)));
+  self->window = window;
+  g_object_add_weak_pointer(G_OBJECT(window),
+                            reinterpret_cast<gpointer*>(&self->window));
+  g_signal_connect_swapped(window, "delete-event",
+                           G_CALLBACK(window_delete_cb), self);
 
   // Wayland-optimized window configuration
   // Set window properties for better Wayland compatibility
@@ -166,12 +290,53 @@ static void my_application_activate(GApplication* application) {
   }
 #endif
   
-  gtk_widget_show(GTK_WIDGET(window));
+  // In background mode the window is realized, which gives it a frame clock
+  // and lets the view start the engine, but it is not mapped until the user
+  // opens it, so nothing is presented and the compositor has no surface to
+  // draw. The embedder only starts an engine for a realized view, so this
+  // is as headless as it can get.
+  gboolean start_hidden = self->resident;
+  if (start_hidden) {
+    gtk_widget_realize(GTK_WIDGET(window));
+  } else {
+    gtk_widget_show(GTK_WIDGET(window));
+  }
+
+  // Record frame timings for the window's frame clock.
+  GdkFrameClock* frame_clock = gtk_widget_get_frame_clock(GTK_WIDGET(window));
+  if (frame_clock != nullptr && self->frame_stats == nullptr) {
+    self->frame_stats =
+        frame_stats_new(frame_clock, is_wayland ? "wayland" : "x11",
+                        gl_renderer_probe_get()->renderer);
+  }
 
+#ifdef GDK_WINDOWING_WAYLAND
+  if (is_wayland) {
+    self->wayland_surface =
+        wayland_surface_new(window, surface_scale_changed_cb, self);
+  }
+#endif
+
+  startup_trace_end("window setup");
+
+  startup_trace_begin("fl_dart_project_new");
   g_autoptr(FlDartProject) project = fl_dart_project_new();
   fl_dart_project_set_dart_entrypoint_arguments(project, self->dart_entrypoint_arguments);
+  startup_trace_end("fl_dart_project_new");
 
+  startup_trace_begin("fl_view_new");
   FlView* view = fl_view_new(project);
+  startup_trace_end("fl_view_new");
+
+  // The engine, and with it the Dart isolate, starts when the view is
+  // realized; the first frame marks the end of startup.
+  g_signal_connect(view, "realize", G_CALLBACK(view_realize_cb), nullptr);
+  gboolean has_first_frame =
+      g_signal_lookup("first-frame", fl_view_get_type()) != 0;
+  if (has_first_frame) {
+    g_signal_connect_swapped(view, "first-frame", G_CALLBACK(first_frame_cb),
+                             self);
+  }
   
   // Configure Flutter view for Wayland
 #ifdef GDK_WINDOWING_WAYLAND
@@ -199,10 +364,55 @@ static void my_application_activate(GApplication* application) {
     }
   }
   
+  startup_trace_begin("show view");
   gtk_widget_show(GTK_WIDGET(view));
   gtk_container_add(GTK_CONTAINER(window), GTK_WIDGET(view));
+  if (start_hidden) {
+    gtk_widget_realize(GTK_WIDGET(view));
+  }
+  startup_trace_end("show view");
 
-  fl_register_plugins(FL_PLUGIN_REGISTRY(view));
+  // Plugins are registered through the scheduler rather than
+  // fl_register_plugins() so the rarely used ones stay off the startup path.
+  startup_trace_begin("register critical plugins");
+  if (self->plugin_scheduler == nullptr) {
+    self->plugin_scheduler = plugin_scheduler_new(FL_PLUGIN_REGISTRY(view));
+  }
+  startup_trace_end("register critical plugins");
+  // A hidden window never produces a first frame.
+  if (!has_first_frame || start_hidden) {
+    plugin_scheduler_start_deferred(self->plugin_scheduler);
+  }
+  if (self->frame_stats != nullptr) {
+    frame_stats_register_channel(self->frame_stats, FL_PLUGIN_REGISTRY(view));
+  }
+  engine_tuning_register_channel(FL_PLUGIN_REGISTRY(view));
+  if (self->instance_channel == nullptr) {
+    self->instance_channel = instance_channel_new(FL_PLUGIN_REGISTRY(view));
+  }
+  if (self->invoice_renderer == nullptr) {
+    self->invoice_renderer = invoice_renderer_new(FL_PLUGIN_REGISTRY(view));
+  }
+  if (self->folder_watcher == nullptr) {
+    self->folder_watcher = folder_watcher_new(FL_PLUGIN_REGISTRY(view));
+  }
+  if (self->frame_pacer == nullptr) {
+    self->frame_pacer = frame_pacer_new(window, FL_PLUGIN_REGISTRY(view));
+  }
+  if (self->memory_monitor == nullptr) {
+    self->memory_monitor = memory_monitor_new(FL_PLUGIN_REGISTRY(view));
+  }
+  if (self->window_channel == nullptr) {
+    g_autoptr(FlPluginRegistrar) registrar =
+        fl_plugin_registry_get_registrar_for_plugin(FL_PLUGIN_REGISTRY(view),
+                                                    "MyApplication");
+    g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+    self->window_channel = fl_method_channel_new(
+        fl_plugin_registrar_get_messenger(registrar), "bizsync/window",
+        FL_METHOD_CODEC(codec));
+    fl_method_channel_set_method_call_handler(
+        self->window_channel, window_method_call_cb, self, nullptr);
+  }
 
   gtk_widget_grab_focus(GTK_WIDGET(view));
 }
@@ -210,39 +420,200 @@ static void my_application_activate(GApplication* application) {
 // Implements GApplication::local_command_line.
 static gboolean my_application_local_command_line(GApplication* application, gchar*** arguments, int* exit_status) {
   MyApplication* self = MY_APPLICATION(application);
+  startup_trace_begin("parse arguments");
+
+  // Consume the runner's own options; everything else goes to Dart.
+  GOptionEntry entries[] = {
+      {"rendering-profile", 0, 0, G_OPTION_ARG_STRING,
+       &self->rendering_profile,
+       "Software rendering profile: safe, balanced or throughput", "PROFILE"},
+      {"frame-stats", 0, 0, G_OPTION_ARG_FILENAME, &self->frame_stats_path,
+       "Write frame timing statistics to FILE on exit", "FILE"},
+      {"trace-startup", 0, 0, G_OPTION_ARG_FILENAME, &self->startup_trace_path,
+       "Write a Chrome trace of startup phases to FILE", "FILE"},
+      {"single-instance", 0, 0, G_OPTION_ARG_NONE, &self->single_instance,
+       "Forward this launch to an already running BizSync", nullptr},
+      {"background", 0, 0, G_OPTION_ARG_NONE, &self->resident,
+       "Start without a visible window and keep running when it is closed",
+       nullptr},
+      {"machine-class", 0, 0, G_OPTION_ARG_STRING, &self->machine_class,
+       "Engine and memory preset: low-memory, standard or workstation",
+       "CLASS"},
+      {"old-gen-heap-size", 0, 0, G_OPTION_ARG_INT, &self->old_gen_heap_size,
+       "Dart old-generation heap limit in MB (debug and profile builds)",
+       "MB"},
+      {"dart-flags", 0, 0, G_OPTION_ARG_STRING, &self->dart_flags,
+       "Dart VM flags (debug and profile builds)", "FLAGS"},
+      {"engine-switch", 0, 0, G_OPTION_ARG_STRING_ARRAY,
+       &self->engine_switches,
+       "Extra engine switch, may be repeated (debug and profile builds)",
+       "SWITCH"},
+      {nullptr},
+  };
+  g_autoptr(GOptionContext) context = g_option_context_new(nullptr);
+  g_option_context_set_help_enabled(context, FALSE);
+  g_option_context_set_ignore_unknown_options(context, TRUE);
+  g_option_context_add_main_entries(context, entries, nullptr);
+
+  g_autoptr(GError) error = nullptr;
+  if (!g_option_context_parse_strv(context, arguments, &error)) {
+    g_warning("Failed to parse arguments: %s", error->message);
+    *exit_status = 1;
+    return TRUE;
+  }
+  if (self->startup_trace_path != nullptr) {
+    startup_trace_set_output(self->startup_trace_path);
+  }
+
   // Strip out the first argument as it is the binary name.
   self->dart_entrypoint_arguments = g_strdupv(*arguments + 1);
+  startup_trace_end("parse arguments");
 
-  g_autoptr(GError) error = nullptr;
-  if (!g_application_register(application, nullptr, &error)) {
+  EngineTuningOptions tuning = {};
+  tuning.machine_class = self->machine_class;
+  tuning.old_gen_heap_size = self->old_gen_heap_size;
+  tuning.dart_flags = self->dart_flags;
+  tuning.switches = self->engine_switches;
+  engine_tuning_apply(&tuning);
+
+  if (!self->single_instance) {
+    self->single_instance = g_key_file_get_boolean(
+        runner_config_get(), "application", "single-instance", nullptr);
+  }
+  if (self->single_instance) {
+    // Let g_application_run() register the unique name and either forward
+    // the remaining arguments to the primary instance over D-Bus, or, if
+    // this is the primary, hand them to command_line.
+    g_application_set_flags(
+        application, static_cast<GApplicationFlags>(
+                         G_APPLICATION_HANDLES_COMMAND_LINE |
+                         G_APPLICATION_HANDLES_OPEN));
+    return FALSE;
+  }
+
+  startup_trace_begin("g_application_register");
+  gboolean registered = g_application_register(application, nullptr, &error);
+  startup_trace_end("g_application_register");
+  if (!registered) {
      g_warning("Failed to register: %s", error->message);
      *exit_status = 1;
      return TRUE;
   }
 
+  startup_trace_begin("activate");
   g_application_activate(application);
+  startup_trace_end("activate");
   *exit_status = 0;
 
   return TRUE;
 }
 
+// Implements GApplication::command_line. Only reached in single-instance
+// mode, for the primary's own launch and for every forwarded one.
+static int my_application_command_line(GApplication* application,
+                                       GApplicationCommandLine* command_line) {
+  MyApplication* self = MY_APPLICATION(application);
+
+  // The primary's own arguments already went to Dart as entrypoint
+  // arguments.
+  if (self->window == nullptr) {
+    startup_trace_begin("activate");
+    g_application_activate(application);
+    startup_trace_end("activate");
+    return 0;
+  }
+
+  gint argc = 0;
+  g_auto(GStrv) arguments =
+      g_application_command_line_get_arguments(command_line, &argc);
+  if (self->instance_channel != nullptr) {
+    instance_channel_send_command_line(
+        self->instance_channel, argc > 0 ? arguments + 1 : arguments,
+        g_application_command_line_get_cwd(command_line));
+  }
+  gtk_window_present(self->window);
+  return 0;
+}
+
+// Implements GApplication::open, used when files are opened through the
+// primary instance's D-Bus interface.
+static void my_application_open(GApplication* application, GFile** files,
+                                gint n_files, const gchar* hint) {
+  MyApplication* self = MY_APPLICATION(application);
+  g_application_activate(application);
+  if (self->instance_channel != nullptr) {
+    instance_channel_send_open(self->instance_channel, files, n_files, hint);
+  }
+}
+
+// SIGTERM and SIGINT quit through GApplication, so shutdown still writes
+// the frame stats and drains sync batches.
+static gboolean quit_signal_cb(gpointer user_data) {
+  g_application_quit(G_APPLICATION(user_data));
+  return G_SOURCE_CONTINUE;
+}
+
 // Implements GApplication::startup.
 static void my_application_startup(GApplication* application) {
-  //MyApplication* self = MY_APPLICATION(object);
+  MyApplication* self = MY_APPLICATION(application);
 
   // Perform any actions required at application startup.
   
   // Configure Mesa rendering workarounds before Flutter initializes
-  configure_mesa_rendering();
+  startup_trace_begin("configure rendering");
+  configure_mesa_rendering(self);
+  startup_trace_end("configure rendering");
 
+  startup_trace_begin("gtk startup");
   G_APPLICATION_CLASS(my_application_parent_class)->startup(application);
+  startup_trace_end("gtk startup");
+
+  // Started before the engine so every native engine Dart reaches shares
+  // it rather than starting its own threads.
+  self->scheduler = native_tasks_start_scheduler();
+
+  // Started before the engine so Dart finds it with
+  // bizsync_sync_get_default(); it stays idle until configured.
+  self->sync_transport = bizsync_sync_start();
+
+  g_unix_signal_add(SIGTERM, quit_signal_cb, application);
+  g_unix_signal_add(SIGINT, quit_signal_cb, application);
 }
 
 // Implements GApplication::shutdown.
 static void my_application_shutdown(GApplication* application) {
-  //MyApplication* self = MY_APPLICATION(object);
+  MyApplication* self = MY_APPLICATION(application);
 
   // Perform any actions required at application shutdown.
+  // Give in-flight sync batches two seconds to be acknowledged; anything
+  // left is sent again on the next run.
+  if (self->sync_transport != nullptr) {
+    bizsync_sync_stop(self->sync_transport, 2000);
+    self->sync_transport = nullptr;
+  }
+
+  // Cancel running renders. Stopping the scheduler cancels imports, exports
+  // and backups; whatever is still running two seconds later is abandoned
+  // rather than holding up the exit.
+  g_clear_pointer(&self->invoice_renderer, invoice_renderer_free);
+  if (self->scheduler != nullptr) {
+    int32_t left = bizsync_scheduler_stop_within(self->scheduler, 2000);
+    if (left > 0) {
+      g_warning("Exiting with %d native tasks unfinished", left);
+    }
+    self->scheduler = nullptr;
+  }
+
+  // Engines too old to emit "first-frame" get their startup trace here.
+  startup_trace_finish();
+
+  if (self->frame_stats_path != nullptr && self->frame_stats != nullptr) {
+    g_autoptr(GError) error = nullptr;
+    if (!frame_stats_write_json(self->frame_stats, self->frame_stats_path,
+                                &error)) {
+      g_warning("Failed to write frame stats: %s", error->message);
+    }
+  }
 
   G_APPLICATION_CLASS(my_application_parent_class)->shutdown(application);
 }
@@ -251,12 +622,30 @@ static void my_application_shutdown(GApplication* application) {
 static void my_application_dispose(GObject* object) {
   MyApplication* self = MY_APPLICATION(object);
   g_clear_pointer(&self->dart_entrypoint_arguments, g_strfreev);
+  g_clear_pointer(&self->rendering_profile, g_free);
+  g_clear_pointer(&self->machine_class, g_free);
+  g_clear_pointer(&self->dart_flags, g_free);
+  g_clear_pointer(&self->engine_switches, g_strfreev);
+  g_clear_pointer(&self->frame_stats_path, g_free);
+  g_clear_pointer(&self->frame_stats, frame_stats_free);
+  g_clear_pointer(&self->startup_trace_path, g_free);
+  g_clear_pointer(&self->plugin_scheduler, plugin_scheduler_free);
+  g_clear_pointer(&self->instance_channel, instance_channel_free);
+  g_clear_pointer(&self->invoice_renderer, invoice_renderer_free);
+  g_clear_pointer(&self->folder_watcher, folder_watcher_free);
+  g_clear_pointer(&self->frame_pacer, frame_pacer_free);
+  g_clear_pointer(&self->memory_monitor, memory_monitor_free);
+  g_clear_pointer(&self->wayland_surface, wayland_surface_free);
+  g_clear_object(&self->window_channel);
+  g_clear_weak_pointer(reinterpret_cast<gpointer*>(&self->window));
   G_OBJECT_CLASS(my_application_parent_class)->dispose(object);
 }
 
 static void my_application_class_init(MyApplicationClass* klass) {
   G_APPLICATION_CLASS(klass)->activate = my_application_activate;
   G_APPLICATION_CLASS(klass)->local_command_line = my_application_local_command_line;
+  G_APPLICATION_CLASS(klass)->command_line = my_application_command_line;
+  G_APPLICATION_CLASS(klass)->open = my_application_open;
   G_APPLICATION_CLASS(klass)->startup = my_application_startup;
   G_APPLICATION_CLASS(klass)->shutdown = my_application_shutdown;
   G_OBJECT_CLASS(klass)->dispose = my_application_dispose;
@@ -0,0 +1,78 @@
+#include "native_tasks.h"
+
+#include "runner_config.h"
+
+struct NativeTask {
+  NativeTaskFunc work;
+  NativeTaskFunc done;
+  gpointer user_data;
+  GMainContext* context;
+};
+
+static void native_task_free(gpointer data) {
+  NativeTask* task = static_cast<NativeTask*>(data);
+  g_main_context_unref(task->context);
+  g_free(task);
+}
+
+static gboolean native_task_done_cb(gpointer data) {
+  NativeTask* task = static_cast<NativeTask*>(data);
+  task->done(task->user_data);
+  return G_SOURCE_REMOVE;
+}
+
+static void native_task_run(void* data) {
+  NativeTask* task = static_cast<NativeTask*>(data);
+  task->work(task->user_data);
+  if (task->done == nullptr) {
+    native_task_free(task);
+    return;
+  }
+  g_main_context_invoke_full(task->context, G_PRIORITY_DEFAULT,
+                             native_task_done_cb, task, native_task_free);
+}
+
+// Reads a positive integer from the [scheduler] group, or 0 for the
+// default.
+static gint32 config_size(const gchar* key) {
+  g_autoptr(GError) error = nullptr;
+  gint value =
+      g_key_file_get_integer(runner_config_get(), "scheduler", key, &error);
+  return error == nullptr && value > 0 ? value : 0;
+}
+
+BizsyncScheduler* native_tasks_start_scheduler() {
+  BizsyncSchedulerOptions options = {};
+  options.worker_count = config_size("workers");
+  options.background_limit = config_size("background-workers");
+  return bizsync_scheduler_start(&options);
+}
+
+gint native_tasks_get_worker_count() {
+  BizsyncScheduler* scheduler = bizsync_scheduler_get_default();
+  if (scheduler == nullptr) {
+    return 1;
+  }
+  BizsyncSchedulerStats stats;
+  bizsync_scheduler_get_stats(scheduler, &stats);
+  return stats.worker_count;
+}
+
+gboolean native_tasks_post(BizsyncTaskPriority priority, NativeTaskFunc work,
+                           NativeTaskFunc done, gpointer user_data) {
+  BizsyncScheduler* scheduler = bizsync_scheduler_get_default();
+  if (scheduler == nullptr) {
+    return FALSE;
+  }
+  NativeTask* task = g_new0(NativeTask, 1);
+  task->work = work;
+  task->done = done;
+  task->user_data = user_data;
+  task->context = g_main_context_ref_thread_default();
+  if (bizsync_scheduler_post(scheduler, priority, native_task_run, task) !=
+      BIZSYNC_OK) {
+    native_task_free(task);
+    return FALSE;
+  }
+  return TRUE;
+}
@@ -0,0 +1,52 @@
+#ifndef FLUTTER_NATIVE_TASKS_H_
+#define FLUTTER_NATIVE_TASKS_H_
+
+#include <glib.h>
+
+#include "native/task_scheduler.h"
+
+// Runs runner work on the scheduler shared with libbizsync_native (see
+// native/task_scheduler.h) and hands the results back to GLib, so method
+// channel handlers can reply from the main thread.
+//
+// The pool is sized from the `[scheduler]` group of bizsync.conf:
+//   workers             worker threads, one per core by default.
+//   background-workers  how many of them may run background work at once,
+//                       all but one by default.
+
+typedef void (*NativeTaskFunc)(gpointer user_data);
+
+/**
+ * native_tasks_start_scheduler:
+ *
+ * Starts the shared scheduler with the configured sizes. Called once by
+ * #MyApplication at startup.
+ *
+ * Returns: (transfer none): the scheduler, stop with
+ * bizsync_scheduler_stop_within().
+ */
+BizsyncScheduler* native_tasks_start_scheduler();
+
+/**
+ * native_tasks_get_worker_count:
+ *
+ * Returns: how many tasks the scheduler runs at once, the natural number of
+ * pieces to split parallel work into; 1 if it has stopped.
+ */
+gint native_tasks_get_worker_count();
+
+/**
+ * native_tasks_post:
+ * @priority: a #BizsyncTaskPriority.
+ * @work: runs on a scheduler worker.
+ * @done: (allow-none): runs afterwards on the thread-default main context
+ * of the caller.
+ * @user_data: passed to both.
+ *
+ * Returns: %FALSE, and runs neither function, if the scheduler has
+ * stopped.
+ */
+gboolean native_tasks_post(BizsyncTaskPriority priority, NativeTaskFunc work,
+                           NativeTaskFunc done, gpointer user_data);
+
+#endif  // FLUTTER_NATIVE_TASKS_H_
@@ -0,0 +1,117 @@
+#include "packed_channel.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Standard method codec: a success envelope byte, the Uint8List type byte
+// and a size of up to five bytes.
+static const guint8 kEnvelopeSuccess = 0;
+static const guint8 kValueUint8List = 8;
+static const size_t kEnvelopeReserve = 7;
+
+// Buffers kept for reuse, and the largest one worth keeping; a one-off
+// burst should not pin its high-water mark for the rest of the run.
+static const size_t kMaxPooledBuffers = 4;
+static const size_t kMaxPooledCapacity = 4 * 1024 * 1024;
+
+// The engine may release a buffer after the channel is gone, so the pool
+// outlives it while buffers are out.
+struct BufferPool {
+  std::mutex mutex;
+  std::vector<std::string> buffers;
+};
+
+struct SentBuffer {
+  std::string data;
+  std::weak_ptr<BufferPool> pool;
+};
+
+struct _PackedChannel {
+  FlBinaryMessenger* messenger;
+  gchar* name;
+  std::shared_ptr<BufferPool> pool;
+};
+
+static void sent_buffer_free(gpointer user_data) {
+  SentBuffer* sent = static_cast<SentBuffer*>(user_data);
+  std::shared_ptr<BufferPool> pool = sent->pool.lock();
+  if (pool != nullptr && sent->data.capacity() <= kMaxPooledCapacity) {
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    if (pool->buffers.size() < kMaxPooledBuffers) {
+      pool->buffers.push_back(std::move(sent->data));
+    }
+  }
+  delete sent;
+}
+
+// Writes the envelope so that it ends where the rows begin, and returns
+// its first byte's offset.
+static size_t write_envelope(std::string* buffer, size_t length) {
+  guint8 header[kEnvelopeReserve];
+  size_t size = 0;
+  header[size++] = kEnvelopeSuccess;
+  header[size++] = kValueUint8List;
+  if (length < 254) {
+    header[size++] = static_cast<guint8>(length);
+  } else if (length <= 0xffff) {
+    header[size++] = 254;
+    header[size++] = static_cast<guint8>(length);
+    header[size++] = static_cast<guint8>(length >> 8);
+  } else {
+    header[size++] = 255;
+    for (int shift = 0; shift < 32; shift += 8) {
+      header[size++] = static_cast<guint8>(length >> shift);
+    }
+  }
+  size_t offset = kEnvelopeReserve - size;
+  buffer->replace(offset, size, reinterpret_cast<const char*>(header), size);
+  return offset;
+}
+
+PackedChannel* packed_channel_new(FlBinaryMessenger* messenger,
+                                  const gchar* name) {
+  PackedChannel* self = new PackedChannel();
+  self->messenger = FL_BINARY_MESSENGER(g_object_ref(messenger));
+  self->name = g_strdup(name);
+  self->pool = std::make_shared<BufferPool>();
+  return self;
+}
+
+bizsync::PackedRowWriter packed_channel_begin(PackedChannel* self,
+                                              uint32_t column_count) {
+  std::string buffer;
+  {
+    std::lock_guard<std::mutex> lock(self->pool->mutex);
+    if (!self->pool->buffers.empty()) {
+      buffer = std::move(self->pool->buffers.back());
+      self->pool->buffers.pop_back();
+    }
+  }
+  return bizsync::PackedRowWriter(column_count, std::move(buffer),
+                                  kEnvelopeReserve);
+}
+
+void packed_channel_send(PackedChannel* self,
+                         bizsync::PackedRowWriter* rows) {
+  size_t length = rows->size();
+  SentBuffer* sent = new SentBuffer();
+  sent->data = rows->Release();
+  sent->pool = self->pool;
+  size_t offset = write_envelope(&sent->data, length);
+
+  const char* data = sent->data.data() + offset;
+  size_t size = sent->data.size() - offset;
+  g_autoptr(GBytes) message =
+      g_bytes_new_with_free_func(data, size, sent_buffer_free, sent);
+  fl_binary_messenger_send_on_channel(self->messenger, self->name, message,
+                                      nullptr, nullptr, nullptr);
+}
+
+void packed_channel_free(PackedChannel* self) {
+  g_clear_object(&self->messenger);
+  g_clear_pointer(&self->name, g_free);
+  delete self;
+}
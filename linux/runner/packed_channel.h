@@ -0,0 +1,67 @@
+#ifndef FLUTTER_PACKED_CHANNEL_H_
+#define FLUTTER_PACKED_CHANNEL_H_
+
+#include <flutter_linux/flutter_linux.h>
+
+#include "native/packed_rows.h"
+
+// Sends batches of rows to Dart as one packed row buffer (see
+// native/packed_rows.h) rather than a list of FlValue maps. The rows are
+// written straight into a pooled buffer that has room in front for the
+// standard method codec's success envelope. The buffer goes to the
+// messenger as is, and goes back to the pool once the engine has copied
+// it. A message therefore costs a handful of allocations however many
+// fields it holds, and none of them touch FlValue.
+//
+// Dart receives the batch on an EventChannel with the standard codec, as a
+// Uint8List view of the engine's message, and reads it with ByteData
+// without building per-field objects.
+//
+// Call it from the main thread; the engine may release a buffer from any
+// thread.
+typedef struct _PackedChannel PackedChannel;
+
+/**
+ * packed_channel_new:
+ * @messenger: the messenger to send on.
+ * @name: the channel name, usually that of an #FlEventChannel that keeps
+ * handling listen and cancel.
+ *
+ * Returns: a new #PackedChannel, free with packed_channel_free().
+ */
+PackedChannel* packed_channel_new(FlBinaryMessenger* messenger,
+                                  const gchar* name);
+
+/**
+ * packed_channel_begin:
+ * @channel: a #PackedChannel.
+ * @column_count: columns per row.
+ *
+ * Returns: a writer over a pooled buffer; fill it and pass it to
+ * packed_channel_send(), or just drop it.
+ */
+bizsync::PackedRowWriter packed_channel_begin(PackedChannel* channel,
+                                              uint32_t column_count);
+
+/**
+ * packed_channel_send:
+ * @channel: a #PackedChannel.
+ * @rows: a writer from packed_channel_begin(); it cannot be used
+ * afterwards.
+ *
+ * Sends @rows as a successful event, a Uint8List on the Dart side.
+ */
+void packed_channel_send(PackedChannel* channel,
+                         bizsync::PackedRowWriter* rows);
+
+/**
+ * packed_channel_free:
+ * @channel: a #PackedChannel.
+ *
+ * Buffers still held by the engine are freed when it releases them.
+ */
+void packed_channel_free(PackedChannel* channel);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(PackedChannel, packed_channel_free)
+
+#endif  // FLUTTER_PACKED_CHANNEL_H_
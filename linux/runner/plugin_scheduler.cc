@@ -0,0 +1,367 @@
+#include "plugin_scheduler.h"
+
+#include <desktop_lifecycle/desktop_lifecycle_plugin.h>
+#include <dlfcn.h>
+#include <hotkey_manager_linux/hotkey_manager_linux_plugin.h>
+#include <screen_retriever/screen_retriever_plugin.h>
+#include <window_manager/window_manager_plugin.h>
+#include <string.h>
+
+#include "runner_config.h"
+#include "startup_trace.h"
+
+static const gchar* kChannelName = "bizsync/plugins";
+
+typedef void (*RegisterFunc)(FlPluginRegistrar* registrar);
+
+typedef struct {
+  // Package name, as listed in generated_plugins.cmake.
+  const gchar* package;
+  // Registrar name, as used by generated_plugin_registrant.cc.
+  const gchar* name;
+  // Plugins Dart may call before the first frame are linked in.
+  RegisterFunc register_with_registrar;
+  // Deferred plugins are not linked; their library in the bundle's lib/ is
+  // loaded when they register, and |symbol| looked up in it. Keep these in
+  // step with DEFERRED_PLUGINS in linux/CMakeLists.txt.
+  const gchar* library;
+  const gchar* symbol;
+  // Channels whose first message triggers registration of a deferred plugin.
+  const gchar* const* channels;
+} PluginEntry;
+
+static const gchar* const kDesktopDropChannels[] = {"desktop_drop", nullptr};
+static const gchar* const kFileSelectorChannels[] = {
+    "plugins.flutter.dev/file_selector_linux",
+    "dev.flutter.pigeon.file_selector_linux.FileSelectorApi.showFileChooser",
+    nullptr,
+};
+static const gchar* const kPrintingChannels[] = {"net.nfet.printing",
+                                                 nullptr};
+static const gchar* const kUrlLauncherChannels[] = {
+    "dev.flutter.pigeon.url_launcher_linux.UrlLauncherApi.canLaunchUrl",
+    "dev.flutter.pigeon.url_launcher_linux.UrlLauncherApi.launchUrl",
+    nullptr,
+};
+
+// Must list every plugin in generated_plugins.cmake; linux/CMakeLists.txt
+// fails the build when one is missing.
+static const PluginEntry kPlugins[] = {
+    {"window_manager", "WindowManagerPlugin",
+     window_manager_plugin_register_with_registrar, nullptr, nullptr,
+     nullptr},
+    {"desktop_lifecycle", "DesktopLifecyclePlugin",
+     desktop_lifecycle_plugin_register_with_registrar, nullptr, nullptr,
+     nullptr},
+    // window_manager's Dart side queries displays through screen_retriever.
+    {"screen_retriever", "ScreenRetrieverPlugin",
+     screen_retriever_plugin_register_with_registrar, nullptr, nullptr,
+     nullptr},
+    // Global shortcuts are bound in main() before runApp().
+    {"hotkey_manager_linux", "HotkeyManagerLinuxPlugin",
+     hotkey_manager_linux_plugin_register_with_registrar, nullptr, nullptr,
+     nullptr},
+    {"desktop_drop", "DesktopDropPlugin", nullptr,
+     "libdesktop_drop_plugin.so", "desktop_drop_plugin_register_with_registrar",
+     kDesktopDropChannels},
+    {"file_selector_linux", "FileSelectorPlugin", nullptr,
+     "libfile_selector_linux_plugin.so",
+     "file_selector_plugin_register_with_registrar", kFileSelectorChannels},
+    {"url_launcher_linux", "UrlLauncherPlugin", nullptr,
+     "liburl_launcher_linux_plugin.so",
+     "url_launcher_plugin_register_with_registrar", kUrlLauncherChannels},
+    // Loads the PDF and CUPS stack; registered last.
+    {"printing", "PrintingPlugin", nullptr, "libprinting_plugin.so",
+     "printing_plugin_register_with_registrar", kPrintingChannels},
+};
+
+typedef struct {
+  PluginScheduler* scheduler;
+  const PluginEntry* entry;
+  // TRUE while first-use handlers are installed on the entry's channels.
+  gboolean hooked;
+  gboolean registered;
+} PluginState;
+
+struct _PluginScheduler {
+  FlPluginRegistry* registry;
+  FlBinaryMessenger* messenger;
+  FlMethodChannel* channel;
+  PluginState plugins[G_N_ELEMENTS(kPlugins)];
+  guint idle_source;
+};
+
+typedef struct {
+  FlBinaryMessengerMessageHandler handler;
+  gpointer user_data;
+} RecordedHandler;
+
+typedef void (*SetMessageHandlerFunc)(FlBinaryMessenger* messenger,
+                                      const gchar* channel,
+                                      FlBinaryMessengerMessageHandler handler,
+                                      gpointer user_data,
+                                      GDestroyNotify destroy_notify);
+
+// The messenger does not expose its handlers, so while a plugin registers
+// its set_message_handler_on_channel vfunc is interposed to record them.
+// That is what lets the first message of a lazily registered plugin be
+// delivered to the plugin instead of failing with MissingPluginException.
+static SetMessageHandlerFunc chained_set_message_handler = nullptr;
+// Channel name to RecordedHandler; non-null only during a registration.
+static GHashTable* recorded_handlers = nullptr;
+
+static void recording_set_message_handler(
+    FlBinaryMessenger* messenger, const gchar* channel,
+    FlBinaryMessengerMessageHandler handler, gpointer user_data,
+    GDestroyNotify destroy_notify) {
+  if (recorded_handlers != nullptr && handler != nullptr) {
+    RecordedHandler* recorded = g_new0(RecordedHandler, 1);
+    recorded->handler = handler;
+    recorded->user_data = user_data;
+    g_hash_table_replace(recorded_handlers, g_strdup(channel), recorded);
+  }
+  chained_set_message_handler(messenger, channel, handler, user_data,
+                              destroy_notify);
+}
+
+static gboolean interpose_messenger(FlBinaryMessenger* messenger) {
+  if (chained_set_message_handler != nullptr) {
+    return TRUE;
+  }
+
+  FlBinaryMessengerInterface* iface =
+      static_cast<FlBinaryMessengerInterface*>(g_type_interface_peek(
+          G_OBJECT_GET_CLASS(messenger), fl_binary_messenger_get_type()));
+  if (iface == nullptr || iface->set_message_handler_on_channel == nullptr) {
+    return FALSE;
+  }
+  chained_set_message_handler = iface->set_message_handler_on_channel;
+  iface->set_message_handler_on_channel = recording_set_message_handler;
+  return TRUE;
+}
+
+// Returns the registration function of |entry|, loading its library if it
+// is not linked in, or null if that fails. The library stays loaded.
+static RegisterFunc load_plugin(const PluginEntry* entry) {
+  if (entry->library == nullptr) {
+    return entry->register_with_registrar;
+  }
+  // Found through the runner's RUNPATH, $ORIGIN/lib. Lazy binding, so
+  // only the functions the plugin calls are ever resolved.
+  void* library = dlopen(entry->library, RTLD_LAZY | RTLD_LOCAL);
+  if (library == nullptr) {
+    g_warning("Failed to load plugin %s: %s", entry->package, dlerror());
+    return nullptr;
+  }
+  RegisterFunc register_with_registrar =
+      reinterpret_cast<RegisterFunc>(dlsym(library, entry->symbol));
+  if (register_with_registrar == nullptr) {
+    g_warning("Plugin %s has no %s", entry->package, entry->symbol);
+  }
+  return register_with_registrar;
+}
+
+// Registers |plugin| and returns the channel handlers it installed. A
+// plugin that fails to load installs none and is not tried again.
+static GHashTable* register_plugin(PluginState* plugin) {
+  PluginScheduler* self = plugin->scheduler;
+  plugin->registered = TRUE;
+
+  recorded_handlers =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  startup_trace_begin(plugin->entry->name);
+  RegisterFunc register_with_registrar = load_plugin(plugin->entry);
+  if (register_with_registrar != nullptr) {
+    g_autoptr(FlPluginRegistrar) registrar =
+        fl_plugin_registry_get_registrar_for_plugin(self->registry,
+                                                    plugin->entry->name);
+    register_with_registrar(registrar);
+  }
+  startup_trace_end(plugin->entry->name);
+  GHashTable* installed = recorded_handlers;
+  recorded_handlers = nullptr;
+
+  // Drop first-use hooks on channels the plugin did not take over.
+  if (plugin->hooked) {
+    plugin->hooked = FALSE;
+    for (const gchar* const* channel = plugin->entry->channels;
+         *channel != nullptr; channel++) {
+      if (!g_hash_table_contains(installed, *channel)) {
+        fl_binary_messenger_set_message_handler_on_channel(
+            self->messenger, *channel, nullptr, nullptr, nullptr);
+      }
+    }
+  }
+
+  return installed;
+}
+
+static void ensure_registered(PluginState* plugin) {
+  if (!plugin->registered) {
+    g_hash_table_unref(register_plugin(plugin));
+  }
+}
+
+// First message on a deferred plugin's channel: register the plugin and hand
+// it the message.
+static void first_use_cb(FlBinaryMessenger* messenger, const gchar* channel,
+                         GBytes* message,
+                         FlBinaryMessengerResponseHandle* response_handle,
+                         gpointer user_data) {
+  PluginState* plugin = static_cast<PluginState*>(user_data);
+  g_autoptr(GHashTable) installed = register_plugin(plugin);
+
+  RecordedHandler* recorded =
+      static_cast<RecordedHandler*>(g_hash_table_lookup(installed, channel));
+  if (recorded != nullptr) {
+    recorded->handler(messenger, channel, message, response_handle,
+                      recorded->user_data);
+    return;
+  }
+
+  // The plugin does not serve this channel after all.
+  g_autoptr(GError) error = nullptr;
+  if (!fl_binary_messenger_send_response(messenger, response_handle, nullptr,
+                                         &error)) {
+    g_warning("Failed to send response on %s: %s", channel, error->message);
+  }
+}
+
+static gboolean register_next_deferred_cb(gpointer user_data) {
+  PluginScheduler* self = static_cast<PluginScheduler*>(user_data);
+  for (PluginState& plugin : self->plugins) {
+    if (!plugin.registered) {
+      ensure_registered(&plugin);
+      return G_SOURCE_CONTINUE;
+    }
+  }
+
+  self->idle_source = 0;
+  return G_SOURCE_REMOVE;
+}
+
+static PluginState* lookup_package(PluginScheduler* self,
+                                   const gchar* package) {
+  for (PluginState& plugin : self->plugins) {
+    if (g_strcmp0(plugin.entry->package, package) == 0) {
+      return &plugin;
+    }
+  }
+  return nullptr;
+}
+
+static void method_call_cb(FlMethodChannel* channel, FlMethodCall* method_call,
+                           gpointer user_data) {
+  PluginScheduler* self = static_cast<PluginScheduler*>(user_data);
+  const gchar* method = fl_method_call_get_name(method_call);
+  FlValue* args = fl_method_call_get_args(method_call);
+
+  g_autoptr(FlMethodResponse) response = nullptr;
+  if (strcmp(method, "ensureRegistered") == 0) {
+    FlValue* package = args != nullptr &&
+                               fl_value_get_type(args) == FL_VALUE_TYPE_MAP
+                           ? fl_value_lookup_string(args, "plugin")
+                           : nullptr;
+    PluginState* plugin =
+        package != nullptr && fl_value_get_type(package) == FL_VALUE_TYPE_STRING
+            ? lookup_package(self, fl_value_get_string(package))
+            : nullptr;
+    if (plugin != nullptr) {
+      ensure_registered(plugin);
+    }
+    g_autoptr(FlValue) result = fl_value_new_bool(plugin != nullptr);
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else if (strcmp(method, "getRegistered") == 0) {
+    g_autoptr(FlValue) result = fl_value_new_list();
+    for (const PluginState& plugin : self->plugins) {
+      if (plugin.registered) {
+        fl_value_append_take(result,
+                             fl_value_new_string(plugin.entry->package));
+      }
+    }
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else {
+    response = FL_METHOD_RESPONSE(fl_method_not_implemented_response_new());
+  }
+
+  g_autoptr(GError) error = nullptr;
+  if (!fl_method_call_respond(method_call, response, &error)) {
+    g_warning("Failed to send plugin scheduler response: %s", error->message);
+  }
+}
+
+PluginScheduler* plugin_scheduler_new(FlPluginRegistry* registry) {
+  PluginScheduler* self = g_new0(PluginScheduler, 1);
+  self->registry = FL_PLUGIN_REGISTRY(g_object_ref(registry));
+
+  g_autoptr(FlPluginRegistrar) registrar =
+      fl_plugin_registry_get_registrar_for_plugin(registry, "PluginScheduler");
+  self->messenger = FL_BINARY_MESSENGER(
+      g_object_ref(fl_plugin_registrar_get_messenger(registrar)));
+
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  self->channel = fl_method_channel_new(self->messenger, kChannelName,
+                                        FL_METHOD_CODEC(codec));
+  fl_method_channel_set_method_call_handler(self->channel, method_call_cb,
+                                            self, nullptr);
+
+  g_autoptr(GError) error = nullptr;
+  gboolean defer = g_key_file_get_boolean(runner_config_get(), "plugins",
+                                          "deferred", &error);
+  if (error != nullptr) {
+    defer = TRUE;
+  }
+  if (defer && !interpose_messenger(self->messenger)) {
+    g_warning("Cannot hook plugin channels, registering all plugins eagerly");
+    defer = FALSE;
+  }
+
+  for (gsize i = 0; i < G_N_ELEMENTS(kPlugins); i++) {
+    PluginState* plugin = &self->plugins[i];
+    plugin->scheduler = self;
+    plugin->entry = &kPlugins[i];
+    if (!defer || plugin->entry->library == nullptr) {
+      ensure_registered(plugin);
+      continue;
+    }
+
+    for (const gchar* const* channel = plugin->entry->channels;
+         *channel != nullptr; channel++) {
+      fl_binary_messenger_set_message_handler_on_channel(
+          self->messenger, *channel, first_use_cb, plugin, nullptr);
+    }
+    plugin->hooked = TRUE;
+  }
+
+  return self;
+}
+
+void plugin_scheduler_start_deferred(PluginScheduler* self) {
+  if (self->idle_source == 0) {
+    self->idle_source = g_idle_add_full(
+        G_PRIORITY_LOW, register_next_deferred_cb, self, nullptr);
+  }
+}
+
+void plugin_scheduler_free(PluginScheduler* self) {
+  if (self->idle_source != 0) {
+    g_source_remove(self->idle_source);
+  }
+
+  // Unregistered plugins still have first-use hooks pointing at us.
+  for (const PluginState& plugin : self->plugins) {
+    if (!plugin.hooked) {
+      continue;
+    }
+    for (const gchar* const* channel = plugin.entry->channels;
+         *channel != nullptr; channel++) {
+      fl_binary_messenger_set_message_handler_on_channel(
+          self->messenger, *channel, nullptr, nullptr, nullptr);
+    }
+  }
+
+  g_clear_object(&self->channel);
+  g_clear_object(&self->messenger);
+  g_clear_object(&self->registry);
+  g_free(self);
+}
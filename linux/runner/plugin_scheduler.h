@@ -0,0 +1,53 @@
+#ifndef FLUTTER_PLUGIN_SCHEDULER_H_
+#define FLUTTER_PLUGIN_SCHEDULER_H_
+
+#include <flutter_linux/flutter_linux.h>
+
+// Registers the plugins listed in the generated registrant in two tiers. The
+// plugins Dart needs before runApp() (window management, lifecycle, hotkeys)
+// are linked in and register immediately. The rest are not linked, so
+// starting the runner neither maps nor relocates them. Each is loaded with
+// dlopen() and registered on an idle iteration after the first frame, or as
+// soon as Dart sends a message to one of its channels.
+//
+// Dart can also force a registration on the "bizsync/plugins" method
+// channel:
+//   ensureRegistered(plugin: String) -> bool, keyed by package name.
+//   getRegistered -> list of registered package names.
+//
+// Set `deferred=false` in the `[plugins]` group of bizsync.conf to register
+// everything eagerly.
+typedef struct _PluginScheduler PluginScheduler;
+
+/**
+ * plugin_scheduler_new:
+ * @registry: the registry of the Flutter view.
+ *
+ * Registers the critical plugins and installs first-use hooks for the
+ * deferred ones.
+ *
+ * Returns: a new #PluginScheduler, free with plugin_scheduler_free().
+ */
+PluginScheduler* plugin_scheduler_new(FlPluginRegistry* registry);
+
+/**
+ * plugin_scheduler_start_deferred:
+ * @scheduler: a #PluginScheduler.
+ *
+ * Queues the remaining plugins on low-priority idle callbacks. Call once the
+ * first frame is on screen.
+ */
+void plugin_scheduler_start_deferred(PluginScheduler* scheduler);
+
+/**
+ * plugin_scheduler_free:
+ * @scheduler: a #PluginScheduler.
+ *
+ * Cancels pending registrations and releases @scheduler. Registered plugins
+ * stay registered.
+ */
+void plugin_scheduler_free(PluginScheduler* scheduler);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(PluginScheduler, plugin_scheduler_free)
+
+#endif  // FLUTTER_PLUGIN_SCHEDULER_H_
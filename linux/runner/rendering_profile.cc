@@ -0,0 +1,125 @@
+#include "rendering_profile.h"
+
+#include <stdlib.h>
+
+#include "runner_config.h"
+
+typedef struct {
+  const gchar* name;
+  const gchar* value;
+} EnvironmentSetting;
+
+static const gchar* kProfileNames[] = {"safe", "balanced", "throughput"};
+
+// Original all-or-nothing workaround set, kept for hosts that flicker. Every
+// profile also exports LP_NUM_THREADS; here it forces single-threaded
+// rendering.
+static const EnvironmentSetting kSafeSettings[] = {
+    // Disable vsync for software rendering to avoid flicker
+    {"vblank_mode", "0"},
+    // Use simpler rendering path
+    {"LIBGL_DRI3_DISABLE", "1"},
+    // Disable compositor bypass
+    {"CLUTTER_PAINT", "disable-clipped-redraws:disable-culling"},
+    // Disable threaded OpenGL to avoid synchronization issues
+    {"mesa_glthread", "false"},
+    // Disable GPU memory cache which can cause flickering
+    {"MESA_NO_MEMOBJ_CACHE", "1"},
+    // Force synchronous rendering to avoid frame drops
+    {"MESA_DEBUG", "flush"},
+    // Disable texture compression for better compatibility
+    {"force_s3tc_enable", "false"},
+    // Disable problematic extensions
+    {"MESA_EXTENSION_OVERRIDE",
+     "-GL_ARB_buffer_storage -GL_EXT_buffer_storage"},
+    // Disable FBO cache which can cause rendering issues
+    {"MESA_FBO_CACHE", "0"},
+    {nullptr, nullptr},
+};
+
+// Drops the settings that serialize llvmpipe; LP_NUM_THREADS is derived from
+// the core count.
+static const EnvironmentSetting kBalancedSettings[] = {
+    {"vblank_mode", "0"},
+    {"LIBGL_DRI3_DISABLE", "1"},
+    {"CLUTTER_PAINT", "disable-clipped-redraws:disable-culling"},
+    {"mesa_glthread", "false"},
+    {"force_s3tc_enable", "false"},
+    {"MESA_EXTENSION_OVERRIDE",
+     "-GL_ARB_buffer_storage -GL_EXT_buffer_storage"},
+    {nullptr, nullptr},
+};
+
+static const EnvironmentSetting kThroughputSettings[] = {
+    {"vblank_mode", "0"},
+    {nullptr, nullptr},
+};
+
+static gboolean profile_from_string(const gchar* name,
+                                    RenderingProfile* profile) {
+  for (guint i = 0; i < G_N_ELEMENTS(kProfileNames); i++) {
+    if (g_ascii_strcasecmp(name, kProfileNames[i]) == 0) {
+      *profile = static_cast<RenderingProfile>(i);
+      return TRUE;
+    }
+  }
+  g_warning("Unknown rendering profile '%s'", name);
+  return FALSE;
+}
+
+RenderingProfile rendering_profile_select(const gchar* requested,
+                                          const gchar** source) {
+  RenderingProfile profile = RENDERING_PROFILE_SAFE;
+
+  if (requested != nullptr && profile_from_string(requested, &profile)) {
+    *source = "command line";
+    return profile;
+  }
+
+  g_autofree gchar* configured = g_key_file_get_string(
+      runner_config_get(), "rendering", "profile", nullptr);
+  if (configured != nullptr && profile_from_string(configured, &profile)) {
+    *source = "bizsync.conf";
+    return profile;
+  }
+
+  *source = "default";
+  return RENDERING_PROFILE_SAFE;
+}
+
+const gchar* rendering_profile_to_string(RenderingProfile profile) {
+  return kProfileNames[profile];
+}
+
+void rendering_profile_apply(RenderingProfile profile) {
+  const EnvironmentSetting* settings = kSafeSettings;
+  guint threads = 1;
+  switch (profile) {
+    case RENDERING_PROFILE_SAFE:
+      break;
+    case RENDERING_PROFILE_BALANCED:
+      settings = kBalancedSettings;
+      threads = MAX(g_get_num_processors() / 2, 1u);
+      break;
+    case RENDERING_PROFILE_THROUGHPUT:
+      settings = kThroughputSettings;
+      threads = g_get_num_processors();
+      break;
+  }
+
+  for (const EnvironmentSetting* setting = settings; setting->name != nullptr;
+       setting++) {
+    setenv(setting->name, setting->value, 1);
+  }
+
+  g_autofree gchar* thread_count = g_strdup_printf("%u", threads);
+  setenv("LP_NUM_THREADS", thread_count, 1);
+
+  g_print("BizSync: rendering profile '%s' exports:\n",
+          rendering_profile_to_string(profile));
+  for (const EnvironmentSetting* setting = settings; setting->name != nullptr;
+       setting++) {
+    g_print("  - %s=%s\n", setting->name, setting->value);
+  }
+  g_print("  - LP_NUM_THREADS=%s\n", thread_count);
+}
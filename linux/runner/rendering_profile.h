@@ -0,0 +1,51 @@
+#ifndef FLUTTER_RENDERING_PROFILE_H_
+#define FLUTTER_RENDERING_PROFILE_H_
+
+#include <glib.h>
+
+// Sets of Mesa workarounds applied when the renderer is a CPU rasterizer,
+// ordered from most conservative to fastest. None of them touch the disk
+// shader cache, which shader_cache.h manages for every renderer.
+typedef enum {
+  // Every flicker workaround: single-threaded llvmpipe, synchronous flushes.
+  RENDERING_PROFILE_SAFE,
+  // Keeps the vsync and DRI3 workarounds but lets llvmpipe use half the
+  // cores.
+  RENDERING_PROFILE_BALANCED,
+  // Only disables vsync; llvmpipe uses every core.
+  RENDERING_PROFILE_THROUGHPUT,
+} RenderingProfile;
+
+/**
+ * rendering_profile_select:
+ * @requested: (nullable): the profile named on the command line.
+ * @source: (out): a short description of where the choice came from, for
+ * logging.
+ *
+ * Resolves the profile to use: @requested if set, otherwise `profile` in the
+ * `[rendering]` group of the runner config, otherwise
+ * %RENDERING_PROFILE_SAFE. Unknown names are reported and skipped.
+ *
+ * Returns: the selected profile.
+ */
+RenderingProfile rendering_profile_select(const gchar* requested,
+                                          const gchar** source);
+
+/**
+ * rendering_profile_to_string:
+ * @profile: a #RenderingProfile.
+ *
+ * Returns: the name accepted by `--rendering-profile` for @profile.
+ */
+const gchar* rendering_profile_to_string(RenderingProfile profile);
+
+/**
+ * rendering_profile_apply:
+ * @profile: the profile to apply.
+ *
+ * Exports the Mesa environment variables for @profile. Must run before the
+ * GL driver is loaded.
+ */
+void rendering_profile_apply(RenderingProfile profile);
+
+#endif  // FLUTTER_RENDERING_PROFILE_H_
@@ -0,0 +1,32 @@
+#include "runner_config.h"
+
+static const gchar* kConfigFile = "bizsync/bizsync.conf";
+
+GKeyFile* runner_config_get() {
+  static GKeyFile* config = nullptr;
+  if (config != nullptr) {
+    return config;
+  }
+
+  config = g_key_file_new();
+
+  // User directory first, then the system directories in priority order.
+  const gchar* const* system_dirs = g_get_system_config_dirs();
+  g_autoptr(GPtrArray) search_dirs = g_ptr_array_new();
+  g_ptr_array_add(search_dirs, const_cast<gchar*>(g_get_user_config_dir()));
+  for (const gchar* const* dir = system_dirs; *dir != nullptr; dir++) {
+    g_ptr_array_add(search_dirs, const_cast<gchar*>(*dir));
+  }
+  g_ptr_array_add(search_dirs, nullptr);
+
+  g_autoptr(GError) error = nullptr;
+  if (!g_key_file_load_from_dirs(
+          config, kConfigFile,
+          reinterpret_cast<const gchar**>(search_dirs->pdata), nullptr,
+          G_KEY_FILE_NONE, &error) &&
+      !g_error_matches(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_NOT_FOUND)) {
+    g_warning("Failed to load %s: %s", kConfigFile, error->message);
+  }
+
+  return config;
+}
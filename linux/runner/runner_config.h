@@ -0,0 +1,19 @@
+#ifndef FLUTTER_RUNNER_CONFIG_H_
+#define FLUTTER_RUNNER_CONFIG_H_
+
+#include <glib.h>
+
+/**
+ * runner_config_get:
+ *
+ * Returns the runner configuration file, `bizsync/bizsync.conf`, taken from
+ * the first of `$XDG_CONFIG_HOME` and `$XDG_CONFIG_DIRS` that has one, so a
+ * fleet-wide default in `/etc/xdg` can be overridden per user. The file is
+ * read on first use; a missing file yields an empty key file.
+ *
+ * Returns: (transfer none): the configuration, valid for the lifetime of the
+ * process.
+ */
+GKeyFile* runner_config_get();
+
+#endif  // FLUTTER_RUNNER_CONFIG_H_
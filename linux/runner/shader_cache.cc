@@ -0,0 +1,111 @@
+#include "shader_cache.h"
+
+#include <glib/gstdio.h>
+#include <stdlib.h>
+
+#include "gl_renderer_probe.h"
+#include "runner_config.h"
+
+// Hex digits of the key digest used as the directory name.
+static const gsize kKeyLength = 16;
+
+typedef struct {
+  const gchar* name;
+  // Whether the value is the cache directory rather than |value|.
+  gboolean is_directory;
+  const gchar* value;
+} CacheSetting;
+
+static const CacheSetting kEnabledSettings[] = {
+    {"MESA_SHADER_CACHE_DISABLE", FALSE, "false"},
+    {"MESA_SHADER_CACHE_DIR", TRUE, nullptr},
+    // Mesa before 19.3.
+    {"MESA_GLSL_CACHE_DISABLE", FALSE, "false"},
+    {"MESA_GLSL_CACHE_DIR", TRUE, nullptr},
+    {"__GL_SHADER_DISK_CACHE", FALSE, "1"},
+    {"__GL_SHADER_DISK_CACHE_PATH", TRUE, nullptr},
+    // The directory is ours; the driver need not trim it to its own quota.
+    {"__GL_SHADER_DISK_CACHE_SKIP_CLEANUP", FALSE, "1"},
+    {nullptr, FALSE, nullptr},
+};
+
+static const CacheSetting kDisabledSettings[] = {
+    {"MESA_SHADER_CACHE_DISABLE", FALSE, "true"},
+    {"MESA_GLSL_CACHE_DISABLE", FALSE, "true"},
+    {"__GL_SHADER_DISK_CACHE", FALSE, "0"},
+    {nullptr, FALSE, nullptr},
+};
+
+static void apply_settings(const CacheSetting* settings,
+                           const gchar* directory) {
+  for (const CacheSetting* setting = settings; setting->name != nullptr;
+       setting++) {
+    setenv(setting->name, setting->is_directory ? directory : setting->value,
+           1);
+  }
+}
+
+// Deletes |path| and, for a directory, everything below it. Symbolic links
+// are removed, not followed.
+static void remove_tree(const gchar* path) {
+  if (g_file_test(path, G_FILE_TEST_IS_DIR) &&
+      !g_file_test(path, G_FILE_TEST_IS_SYMLINK)) {
+    g_autoptr(GDir) dir = g_dir_open(path, 0, nullptr);
+    const gchar* name;
+    while (dir != nullptr && (name = g_dir_read_name(dir)) != nullptr) {
+      g_autofree gchar* child = g_build_filename(path, name, nullptr);
+      remove_tree(child);
+    }
+    g_rmdir(path);
+    return;
+  }
+  g_unlink(path);
+}
+
+// Removes the cache directories of every key but |key| under |root|.
+static void remove_stale_keys(const gchar* root, const gchar* key) {
+  g_autoptr(GDir) dir = g_dir_open(root, 0, nullptr);
+  if (dir == nullptr) {
+    return;
+  }
+  const gchar* name;
+  while ((name = g_dir_read_name(dir)) != nullptr) {
+    if (g_strcmp0(name, key) != 0) {
+      g_autofree gchar* path = g_build_filename(root, name, nullptr);
+      remove_tree(path);
+    }
+  }
+}
+
+void shader_cache_configure() {
+  g_autoptr(GError) error = nullptr;
+  gboolean enabled = g_key_file_get_boolean(runner_config_get(), "rendering",
+                                            "shader-cache", &error);
+  if (error != nullptr) {
+    enabled = TRUE;
+  }
+  if (!enabled) {
+    apply_settings(kDisabledSettings, nullptr);
+    g_print("BizSync: shader disk cache disabled by bizsync.conf\n");
+    return;
+  }
+
+  const GlRendererInfo* gl = gl_renderer_probe_get();
+  g_autofree gchar* identity = g_strdup_printf(
+      "%s;%s;%s", gl->renderer, gl->driver_key, APP_VERSION);
+  g_autofree gchar* key =
+      g_compute_checksum_for_string(G_CHECKSUM_SHA256, identity, -1);
+  key[kKeyLength] = '\0';
+
+  g_autofree gchar* root = g_build_filename(g_get_user_cache_dir(), "bizsync",
+                                            "shader-cache", nullptr);
+  g_autofree gchar* directory = g_build_filename(root, key, nullptr);
+  if (g_mkdir_with_parents(directory, 0700) != 0) {
+    g_warning("Failed to create %s", directory);
+    return;
+  }
+  remove_stale_keys(root, key);
+
+  apply_settings(kEnabledSettings, directory);
+  g_print("BizSync: shader disk cache %s\n", directory);
+}
@@ -0,0 +1,31 @@
+#ifndef FLUTTER_SHADER_CACHE_H_
+#define FLUTTER_SHADER_CACHE_H_
+
+#include <glib.h>
+
+// Keeps the GL driver's compiled shaders across launches, so each screen
+// pays for shader compilation once per GPU, driver and app version rather
+// than on every launch. Mesa and the NVIDIA driver write their disk caches
+// to `$XDG_CACHE_HOME/bizsync/shader-cache/<key>`. The key is a digest of
+// the GL renderer, the installed driver stack (see gl_renderer_probe.h)
+// and the app version. Directories left by other keys are deleted, since
+// an upgraded driver or app never reads them again.
+//
+// Release AppImages bundle the SkSL recorded by
+// `build-appimage.sh record-shaders`, and the engine compiles it at
+// startup. With the disk cache, those compiles are cache hits from the
+// second launch on, so invoices, inventory and reports open without
+// compiling.
+//
+// `shader-cache=false` in the `[rendering]` group of bizsync.conf turns
+// the driver caches off instead.
+
+/**
+ * shader_cache_configure:
+ *
+ * Exports the driver cache variables. Must run after
+ * gl_renderer_probe_get() and before GTK loads the GL driver.
+ */
+void shader_cache_configure();
+
+#endif  // FLUTTER_SHADER_CACHE_H_
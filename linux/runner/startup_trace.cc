@@ -0,0 +1,146 @@
+#include "startup_trace.h"
+
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+struct TraceEvent {
+  const gchar* name;
+  // Chrome trace phase: 'B'egin, 'E'nd, 'X' complete or 'i'nstant.
+  gchar phase;
+  gint64 timestamp;
+  gint64 duration;
+  pid_t thread;
+};
+
+G_LOCK_DEFINE_STATIC(trace);
+static std::vector<TraceEvent>* events = nullptr;
+static gchar* output_path = nullptr;
+static gboolean finished = FALSE;
+
+static void record(const gchar* name, gchar phase, gint64 timestamp,
+                   gint64 duration) {
+  pid_t thread = static_cast<pid_t>(syscall(SYS_gettid));
+  G_LOCK(trace);
+  if (events != nullptr && !finished) {
+    events->push_back({name, phase, timestamp, duration, thread});
+  }
+  G_UNLOCK(trace);
+}
+
+// Returns the process start time on the monotonic clock, or -1. The kernel
+// reports it in clock ticks since boot, which includes time spent suspended,
+// so it is converted through CLOCK_BOOTTIME.
+static gint64 process_start_time() {
+  g_autofree gchar* stat = nullptr;
+  if (!g_file_get_contents("/proc/self/stat", &stat, nullptr, nullptr)) {
+    return -1;
+  }
+
+  // Field 22 is starttime; the command name in field 2 may contain spaces,
+  // so count from its closing parenthesis.
+  const gchar* field = strrchr(stat, ')');
+  for (int i = 2; field != nullptr && i < 22; i++) {
+    field = strchr(field + 1, ' ');
+  }
+  if (field == nullptr) {
+    return -1;
+  }
+
+  guint64 ticks = g_ascii_strtoull(field + 1, nullptr, 10);
+  long ticks_per_second = sysconf(_SC_CLK_TCK);
+  struct timespec boottime;
+  if (ticks_per_second <= 0 || clock_gettime(CLOCK_BOOTTIME, &boottime) != 0) {
+    return -1;
+  }
+
+  gint64 now_boottime =
+      boottime.tv_sec * G_USEC_PER_SEC + boottime.tv_nsec / 1000;
+  gint64 start_boottime = ticks * G_USEC_PER_SEC / ticks_per_second;
+  return g_get_monotonic_time() - (now_boottime - start_boottime);
+}
+
+void startup_trace_init() {
+  gint64 now = g_get_monotonic_time();
+
+  G_LOCK(trace);
+  if (events == nullptr) {
+    events = new std::vector<TraceEvent>();
+    events->reserve(64);
+  }
+  G_UNLOCK(trace);
+
+  const gchar* path = g_getenv(STARTUP_TRACE_ENVIRONMENT);
+  if (path != nullptr && *path != '\0') {
+    startup_trace_set_output(path);
+  }
+
+  gint64 start = process_start_time();
+  if (start >= 0 && start <= now) {
+    record("exec to main", 'X', start, now - start);
+  }
+}
+
+void startup_trace_set_output(const gchar* path) {
+  G_LOCK(trace);
+  g_free(output_path);
+  output_path = g_strdup(path);
+  G_UNLOCK(trace);
+}
+
+void startup_trace_begin(const gchar* name) {
+  record(name, 'B', g_get_monotonic_time(), 0);
+}
+
+void startup_trace_end(const gchar* name) {
+  record(name, 'E', g_get_monotonic_time(), 0);
+}
+
+void startup_trace_instant(const gchar* name) {
+  record(name, 'i', g_get_monotonic_time(), 0);
+}
+
+void startup_trace_finish() {
+  G_LOCK(trace);
+  if (finished || events == nullptr) {
+    G_UNLOCK(trace);
+    return;
+  }
+  finished = TRUE;
+  if (output_path == nullptr) {
+    G_UNLOCK(trace);
+    return;
+  }
+
+  g_autoptr(GString) json = g_string_new("{\"traceEvents\": [");
+  pid_t pid = getpid();
+  for (gsize i = 0; i < events->size(); i++) {
+    const TraceEvent& event = (*events)[i];
+    g_string_append_printf(json,
+                           "%s\n  {\"name\": \"%s\", \"cat\": \"startup\", "
+                           "\"ph\": \"%c\", \"ts\": %" G_GINT64_FORMAT
+                           ", \"pid\": %d, \"tid\": %d",
+                           i == 0 ? "" : ",", event.name, event.phase,
+                           event.timestamp, pid, event.thread);
+    if (event.phase == 'X') {
+      g_string_append_printf(json, ", \"dur\": %" G_GINT64_FORMAT,
+                             event.duration);
+    } else if (event.phase == 'i') {
+      g_string_append(json, ", \"s\": \"p\"");
+    }
+    g_string_append_c(json, '}');
+  }
+  g_string_append(json, "\n], \"displayTimeUnit\": \"ms\"}\n");
+  g_autofree gchar* path = g_strdup(output_path);
+  G_UNLOCK(trace);
+
+  g_autoptr(GError) error = nullptr;
+  if (g_file_set_contents(path, json->str, json->len, &error)) {
+    g_print("BizSync: startup trace written to %s\n", path);
+  } else {
+    g_warning("Failed to write startup trace: %s", error->message);
+  }
+}
@@ -0,0 +1,62 @@
+#ifndef FLUTTER_STARTUP_TRACE_H_
+#define FLUTTER_STARTUP_TRACE_H_
+
+#include <glib.h>
+
+// Environment variable naming the file the startup trace is written to. The
+// `--trace-startup=FILE` option does the same.
+#define STARTUP_TRACE_ENVIRONMENT "BIZSYNC_TRACE_STARTUP"
+
+// Records startup phases on the monotonic clock and writes them as Chrome
+// trace-event JSON, loadable in chrome://tracing or Perfetto. Recording is
+// always on and costs a few hundred bytes; output only happens when a file
+// was requested.
+
+/**
+ * startup_trace_init:
+ *
+ * Starts the trace. Emits a span from the kernel's process start time to now,
+ * which covers exec and dynamic loading of the Flutter engine. Call first
+ * thing in main().
+ */
+void startup_trace_init();
+
+/**
+ * startup_trace_set_output:
+ * @path: (nullable): trace destination, overriding #STARTUP_TRACE_ENVIRONMENT.
+ */
+void startup_trace_set_output(const gchar* path);
+
+/**
+ * startup_trace_begin:
+ * @name: phase name; must be a string literal.
+ *
+ * Opens a phase on the calling thread.
+ */
+void startup_trace_begin(const gchar* name);
+
+/**
+ * startup_trace_end:
+ * @name: the name passed to startup_trace_begin().
+ *
+ * Closes the innermost open phase on the calling thread.
+ */
+void startup_trace_end(const gchar* name);
+
+/**
+ * startup_trace_instant:
+ * @name: event name; must be a string literal.
+ *
+ * Records a point-in-time event such as the first frame.
+ */
+void startup_trace_instant(const gchar* name);
+
+/**
+ * startup_trace_finish:
+ *
+ * Writes the trace if an output file was requested. Later calls, and events
+ * recorded afterwards, are ignored.
+ */
+void startup_trace_finish();
+
+#endif  // FLUTTER_STARTUP_TRACE_H_
@@ -0,0 +1,173 @@
+#include "wayland_surface.h"
+
+#if defined(WAYLAND_PROTOCOLS_ENABLED) && defined(GDK_WINDOWING_WAYLAND)
+
+#include <gdk/gdkwayland.h>
+#include <string.h>
+
+#include "fractional-scale-v1-client-protocol.h"
+
+// The protocol sends scales in 120ths.
+static const gdouble kScaleDenominator = 120.0;
+
+struct _WaylandSurface {
+  // Cleared when the window is destroyed.
+  GtkWindow* window;
+  gulong unrealize_handler;
+  WaylandSurfaceScaleFunc scale_changed;
+  gpointer user_data;
+  wp_fractional_scale_manager_v1* manager;
+  // Destroyed with the window's wl_surface.
+  wp_fractional_scale_v1* fractional_scale;
+  // In 120ths; 0 until the compositor sends it.
+  guint32 preferred_scale;
+};
+
+static void registry_global_cb(void* data, wl_registry* registry,
+                               uint32_t name, const char* interface,
+                               uint32_t version) {
+  WaylandSurface* self = static_cast<WaylandSurface*>(data);
+  if (self->manager == nullptr &&
+      strcmp(interface, wp_fractional_scale_manager_v1_interface.name) == 0) {
+    self->manager = static_cast<wp_fractional_scale_manager_v1*>(
+        wl_registry_bind(registry, name,
+                         &wp_fractional_scale_manager_v1_interface, 1));
+    // Bound on the private queue; GDK dispatches its events from now on.
+    wl_proxy_set_queue(reinterpret_cast<wl_proxy*>(self->manager), nullptr);
+  }
+}
+
+static void registry_global_remove_cb(void* data, wl_registry* registry,
+                                      uint32_t name) {}
+
+static const wl_registry_listener registry_listener = {
+    registry_global_cb,
+    registry_global_remove_cb,
+};
+
+static void preferred_scale_cb(void* data,
+                               wp_fractional_scale_v1* fractional_scale,
+                               uint32_t scale) {
+  WaylandSurface* self = static_cast<WaylandSurface*>(data);
+  if (scale == self->preferred_scale) {
+    return;
+  }
+  self->preferred_scale = scale;
+  g_debug("Wayland surface scale %.3f, rendered at %d",
+          scale / kScaleDenominator, wayland_surface_get_buffer_scale(self));
+  if (self->scale_changed != nullptr) {
+    self->scale_changed(self, self->user_data);
+  }
+}
+
+static const wp_fractional_scale_v1_listener fractional_scale_listener = {
+    preferred_scale_cb,
+};
+
+static void destroy_fractional_scale(WaylandSurface* self) {
+  if (self->fractional_scale != nullptr) {
+    wp_fractional_scale_v1_destroy(self->fractional_scale);
+    self->fractional_scale = nullptr;
+  }
+}
+
+// GDK destroys the wl_surface when the window is unrealized, and the
+// fractional scale object must not outlive it.
+static void window_unrealize_cb(GtkWidget* widget, gpointer user_data) {
+  destroy_fractional_scale(static_cast<WaylandSurface*>(user_data));
+}
+
+WaylandSurface* wayland_surface_new(GtkWindow* window,
+                                    WaylandSurfaceScaleFunc scale_changed,
+                                    gpointer user_data) {
+  GdkWindow* gdk_window = gtk_widget_get_window(GTK_WIDGET(window));
+  if (gdk_window == nullptr || !GDK_IS_WAYLAND_WINDOW(gdk_window)) {
+    return nullptr;
+  }
+  wl_surface* surface = gdk_wayland_window_get_wl_surface(gdk_window);
+  if (surface == nullptr) {
+    return nullptr;
+  }
+  wl_display* display = gdk_wayland_display_get_wl_display(
+      gdk_window_get_display(gdk_window));
+
+  WaylandSurface* self = g_new0(WaylandSurface, 1);
+
+  // List the globals on a private queue so the roundtrip dispatches none of
+  // GDK's events.
+  wl_event_queue* queue = wl_display_create_queue(display);
+  wl_display* wrapper =
+      static_cast<wl_display*>(wl_proxy_create_wrapper(display));
+  wl_proxy_set_queue(reinterpret_cast<wl_proxy*>(wrapper), queue);
+  wl_registry* registry = wl_display_get_registry(wrapper);
+  wl_proxy_wrapper_destroy(wrapper);
+  wl_registry_add_listener(registry, &registry_listener, self);
+  wl_display_roundtrip_queue(display, queue);
+  wl_registry_destroy(registry);
+  wl_event_queue_destroy(queue);
+
+  if (self->manager == nullptr) {
+    g_debug("Compositor has no wp_fractional_scale_manager_v1");
+    g_free(self);
+    return nullptr;
+  }
+
+  self->window = window;
+  g_object_add_weak_pointer(G_OBJECT(window),
+                            reinterpret_cast<gpointer*>(&self->window));
+  self->unrealize_handler = g_signal_connect(
+      window, "unrealize", G_CALLBACK(window_unrealize_cb), self);
+  self->scale_changed = scale_changed;
+  self->user_data = user_data;
+  self->fractional_scale =
+      wp_fractional_scale_manager_v1_get_fractional_scale(self->manager,
+                                                          surface);
+  wp_fractional_scale_v1_add_listener(self->fractional_scale,
+                                      &fractional_scale_listener, self);
+  return self;
+}
+
+gdouble wayland_surface_get_preferred_scale(WaylandSurface* self) {
+  return self->preferred_scale / kScaleDenominator;
+}
+
+gint wayland_surface_get_buffer_scale(WaylandSurface* self) {
+  if (self->window == nullptr) {
+    return 1;
+  }
+  return gtk_widget_get_scale_factor(GTK_WIDGET(self->window));
+}
+
+void wayland_surface_free(WaylandSurface* self) {
+  if (self == nullptr) {
+    return;
+  }
+  if (self->window != nullptr) {
+    g_signal_handler_disconnect(self->window, self->unrealize_handler);
+    g_object_remove_weak_pointer(G_OBJECT(self->window),
+                                 reinterpret_cast<gpointer*>(&self->window));
+  }
+  destroy_fractional_scale(self);
+  wp_fractional_scale_manager_v1_destroy(self->manager);
+  g_free(self);
+}
+
+#else
+
+WaylandSurface* wayland_surface_new(GtkWindow* window,
+                                    WaylandSurfaceScaleFunc scale_changed,
+                                    gpointer user_data) {
+  return nullptr;
+}
+
+gdouble wayland_surface_get_preferred_scale(WaylandSurface* self) {
+  return 0;
+}
+
+gint wayland_surface_get_buffer_scale(WaylandSurface* self) {
+  return 1;
+}
+
+void wayland_surface_free(WaylandSurface* self) {}
+
+#endif
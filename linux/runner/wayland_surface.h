@@ -0,0 +1,66 @@
+#ifndef FLUTTER_WAYLAND_SURFACE_H_
+#define FLUTTER_WAYLAND_SURFACE_H_
+
+#include <gtk/gtk.h>
+
+// Asks the compositor for the exact scale of the window through
+// wp_fractional_scale_v1, which GTK 3 does not bind. GTK only knows integer
+// scales, so on a 1.5x output it renders at 2x and the compositor scales
+// every frame down; the exact scale lets Dart see how far the buffer is
+// from what is shown, and size its raster work to match.
+//
+// Only built when wayland-scanner and wayland-protocols 1.31 or later are
+// found; elsewhere, and on X11 or compositors without the protocol,
+// wayland_surface_new() returns %NULL.
+typedef struct _WaylandSurface WaylandSurface;
+
+/**
+ * WaylandSurfaceScaleFunc:
+ * @surface: the #WaylandSurface.
+ * @user_data: the data passed to wayland_surface_new().
+ *
+ * Called on the main thread when the compositor changes the preferred
+ * scale, for example when the window moves to another output.
+ */
+typedef void (*WaylandSurfaceScaleFunc)(WaylandSurface* surface,
+                                        gpointer user_data);
+
+/**
+ * wayland_surface_new:
+ * @window: a realized #GtkWindow.
+ * @scale_changed: (allow-none): called when the preferred scale changes.
+ * @user_data: passed to @scale_changed.
+ *
+ * Returns: (nullable): a new #WaylandSurface, free with
+ * wayland_surface_free(), or %NULL if the protocol is not available.
+ */
+WaylandSurface* wayland_surface_new(GtkWindow* window,
+                                    WaylandSurfaceScaleFunc scale_changed,
+                                    gpointer user_data);
+
+/**
+ * wayland_surface_get_preferred_scale:
+ * @surface: a #WaylandSurface.
+ *
+ * Returns: the scale the compositor would like the window rendered at, or
+ * 0 until it has said.
+ */
+gdouble wayland_surface_get_preferred_scale(WaylandSurface* surface);
+
+/**
+ * wayland_surface_get_buffer_scale:
+ * @surface: a #WaylandSurface.
+ *
+ * Returns: the integer scale GTK renders the window at.
+ */
+gint wayland_surface_get_buffer_scale(WaylandSurface* surface);
+
+/**
+ * wayland_surface_free:
+ * @surface: (allow-none): a #WaylandSurface.
+ */
+void wayland_surface_free(WaylandSurface* surface);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(WaylandSurface, wayland_surface_free)
+
+#endif  // FLUTTER_WAYLAND_SURFACE_H_